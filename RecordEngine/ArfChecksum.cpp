@@ -0,0 +1,176 @@
+/*
+ ------------------------------------------------------------------
+
+ Michal Badura, 2016
+ based on code by Florian Franzen, 2014
+
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+#include "ArfChecksum.h"
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define ARF_CHECKSUM_SSE42 1
+#include <nmmintrin.h>
+#endif
+
+//CRC32C polynomial, bit-reversed
+#define CASTAGNOLI 0x82F63B78
+
+namespace
+{
+
+//Tables for 8 bytes at a time without the instruction ("slicing by 8"): entry b of table k is the
+//CRC of byte b followed by k zero bytes
+struct CrcTables
+{
+    uint32 t[8][256];
+
+    CrcTables()
+    {
+        for (uint32 b = 0; b < 256; b++)
+        {
+            uint32 c = b;
+            for (int k = 0; k < 8; k++)
+                c = (c >> 1) ^ ((c & 1) ? CASTAGNOLI : 0);
+            t[0][b] = c;
+        }
+        for (int k = 1; k < 8; k++)
+        {
+            for (uint32 b = 0; b < 256; b++)
+                t[k][b] = (t[k - 1][b] >> 8) ^ t[0][t[k - 1][b] & 0xff];
+        }
+    }
+};
+
+const CrcTables& getTables()
+{
+    static const CrcTables tables;
+    return tables;
+}
+
+uint32 softwareCrc(uint32 c, const uint8* p, size_t n)
+{
+    const CrcTables& tables = getTables();
+    const uint32 (*t)[256] = tables.t;
+    for (; n >= 8; n -= 8, p += 8)
+    {
+        uint32 lo = c ^ ((uint32)p[0] | ((uint32)p[1] << 8) | ((uint32)p[2] << 16) | ((uint32)p[3] << 24));
+        c = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24]
+            ^ t[3][p[4]] ^ t[2][p[5]] ^ t[1][p[6]] ^ t[0][p[7]];
+    }
+    for (; n > 0; n--)
+        c = (c >> 8) ^ t[0][(c ^ *p++) & 0xff];
+    return c;
+}
+
+#if defined(ARF_CHECKSUM_SSE42)
+//Built for SSE4.2 whatever the rest of the file is built for, and only called if the CPU has it
+__attribute__((target("sse4.2"))) uint32 hardwareCrc(uint32 c, const uint8* p, size_t n)
+{
+    for (; n > 0 && ((pointer_sized_int)p & 7) != 0; n--)
+        c = _mm_crc32_u8(c, *p++);
+    uint64 c64 = c;
+    for (; n >= 8; n -= 8, p += 8)
+        c64 = _mm_crc32_u64(c64, *(const uint64*)p);
+    c = (uint32)c64;
+    for (; n > 0; n--)
+        c = _mm_crc32_u8(c, *p++);
+    return c;
+}
+
+bool detectHardware()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.2");
+}
+#endif
+
+}
+
+bool ArfChecksum::hasHardwareSupport()
+{
+#if defined(ARF_CHECKSUM_SSE42)
+    static const bool hardware = detectHardware();
+    return hardware;
+#else
+    return false;
+#endif
+}
+
+uint32 ArfChecksum::crc32c(uint32 crc, const void* data, size_t size)
+{
+    const uint8* p = (const uint8*)data;
+#if defined(ARF_CHECKSUM_SSE42)
+    if (hasHardwareSupport())
+        return ~hardwareCrc(~crc, p, size);
+#endif
+    return ~softwareCrc(~crc, p, size);
+}
+
+ArfChecksum::ArfChecksum(int chunkSize) : chunkSize(jmax(1, chunkSize)), position(0), crc(0)
+{
+}
+
+int ArfChecksum::getChunkSize() const
+{
+    return chunkSize;
+}
+
+void ArfChecksum::addSamples(const int16* data, int nSamples)
+{
+    //the samples are still in the cache from the conversion and the overview
+    while (nSamples > 0)
+    {
+        int n = jmin(nSamples, chunkSize - (int)(position % chunkSize));
+        crc = crc32c(crc, data, n * sizeof(int16));
+        position += n;
+        data += n;
+        nSamples -= n;
+        if (position % chunkSize == 0)
+        {
+            checksums.add(crc);
+            crc = 0;
+        }
+    }
+}
+
+void ArfChecksum::finish()
+{
+    if (position % chunkSize != 0)
+        checksums.add(crc);
+    crc = 0;
+}
+
+void ArfChecksum::skipTo(int64 newPosition, uint32 newCrc)
+{
+    position = newPosition;
+    crc = newCrc;
+}
+
+int ArfChecksum::getNumChecksums() const
+{
+    return checksums.size();
+}
+
+uint32* ArfChecksum::getChecksums()
+{
+    return checksums.getRawDataPointer();
+}
+
+void ArfChecksum::clearChecksums()
+{
+    checksums.clearQuick();
+}
@@ -0,0 +1,74 @@
+/*
+ ------------------------------------------------------------------
+
+ Michal Badura, 2016
+ based on code by Florian Franzen, 2014
+
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+#ifndef ARFCHECKSUM_H_INCLUDED
+#define ARFCHECKSUM_H_INCLUDED
+
+#include "../../../../JuceLibraryCode/JuceHeader.h"
+
+//group of a recording with a checksum table per channel, e.g. /rec_0/checksums/channel3
+#define ARF_CHECKSUM_GROUP "checksums"
+//entries in a chunk of a checksum table
+#define ARF_CHECKSUM_CHUNK_SIZE 1024
+
+//CRC32C (Castagnoli, as in iSCSI and ext4) of every chunk of a channel dataset, taken from the
+//samples as they are written. Entry k of a table covers the little-endian bytes of samples
+//k * chunk size up to the next chunk, or up to the end of the dataset for the last one, so it
+//does not depend on how the chunk is stored (compressed, coded or not).
+//
+//Where the CPU has SSE4.2 the CRC32 instruction does 8 bytes at a time; other machines get the
+//same values from a table.
+class ArfChecksum
+{
+public:
+    //CRC32C of SIZE bytes at DATA, continuing from CRC, the CRC32C of the bytes before (0 for none)
+    static uint32 crc32c(uint32 crc, const void* data, size_t size);
+    //whether crc32c uses the SSE4.2 instruction
+    static bool hasHardwareSupport();
+
+    //Checksums of the chunks of CHUNKSIZE samples of one channel
+    ArfChecksum(int chunkSize);
+
+    void addSamples(const int16* data, int nSamples);
+    //ends the chunk that is still open, at the end of a part
+    void finish();
+    //Continues after POSITION samples that are already written, e.g. in a restarted writer.
+    //CRC is the checksum of the samples of the open chunk up to there
+    void skipTo(int64 position, uint32 crc);
+
+    int getChunkSize() const;
+
+    //finished chunks
+    int getNumChecksums() const;
+    uint32* getChecksums();
+    void clearChecksums();
+
+private:
+    int chunkSize;
+    int64 position;
+    uint32 crc;
+    Array<uint32> checksums;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ArfChecksum);
+};
+
+#endif  // ARFCHECKSUM_H_INCLUDED
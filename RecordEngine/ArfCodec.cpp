@@ -0,0 +1,405 @@
+/*
+ ------------------------------------------------------------------
+
+ Michal Badura, 2016
+ based on code by Florian Franzen, 2014
+
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "ArfCodec.h"
+#include <hdf5.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define HEADER_SIZE 8
+#define LANES 8
+#define ROWS (ARF_CODEC_BLOCK / LANES)
+
+namespace
+{
+
+//Chunks handed back to HDF5 must come from its allocator, which isn't malloc in every build
+void* allocate(size_t size)
+{
+#if H5_VERSION_GE(1,8,15)
+    return H5allocate_memory(size, false);
+#else
+    return malloc(size);
+#endif
+}
+
+void release(void* ptr)
+{
+#if H5_VERSION_GE(1,8,15)
+    H5free_memory(ptr);
+#else
+    free(ptr);
+#endif
+}
+
+int bitWidth(unsigned int bits)
+{
+    int width = 0;
+    while (bits != 0)
+    {
+        width++;
+        bits >>= 1;
+    }
+    return width;
+}
+
+//Residuals of the block at X (with the two samples before it at X[-1] and X[-2]) for both
+//predictors, zigzag encoded; returns the OR of each set, for their bit width
+void predict(const int16_t* x, uint16_t* first, uint16_t* second, unsigned int& orFirst, unsigned int& orSecond)
+{
+#if defined(__SSE2__)
+    __m128i or1 = _mm_setzero_si128();
+    __m128i or2 = _mm_setzero_si128();
+    for (int i = 0; i < ARF_CODEC_BLOCK; i += LANES)
+    {
+        __m128i x0 = _mm_loadu_si128((const __m128i*)(x + i));
+        __m128i x1 = _mm_loadu_si128((const __m128i*)(x + i - 1));
+        __m128i x2 = _mm_loadu_si128((const __m128i*)(x + i - 2));
+        __m128i d1 = _mm_sub_epi16(x0, x1);
+        __m128i d2 = _mm_sub_epi16(d1, _mm_sub_epi16(x1, x2));
+        __m128i z1 = _mm_xor_si128(_mm_slli_epi16(d1, 1), _mm_srai_epi16(d1, 15));
+        __m128i z2 = _mm_xor_si128(_mm_slli_epi16(d2, 1), _mm_srai_epi16(d2, 15));
+        _mm_storeu_si128((__m128i*)(first + i), z1);
+        _mm_storeu_si128((__m128i*)(second + i), z2);
+        or1 = _mm_or_si128(or1, z1);
+        or2 = _mm_or_si128(or2, z2);
+    }
+    uint16_t lanes1[LANES], lanes2[LANES];
+    _mm_storeu_si128((__m128i*)lanes1, or1);
+    _mm_storeu_si128((__m128i*)lanes2, or2);
+    orFirst = orSecond = 0;
+    for (int j = 0; j < LANES; j++)
+    {
+        orFirst |= lanes1[j];
+        orSecond |= lanes2[j];
+    }
+#else
+    orFirst = orSecond = 0;
+    for (int i = 0; i < ARF_CODEC_BLOCK; i++)
+    {
+        int16_t d1 = (int16_t)(x[i] - x[i - 1]);
+        int16_t d2 = (int16_t)(d1 - (int16_t)(x[i - 1] - x[i - 2]));
+        first[i] = (uint16_t)((uint16_t)d1 << 1) ^ (uint16_t)(d1 >> 15);
+        second[i] = (uint16_t)((uint16_t)d2 << 1) ^ (uint16_t)(d2 >> 15);
+        orFirst |= first[i];
+        orSecond |= second[i];
+    }
+#endif
+}
+
+//Packs a block at WIDTH bits: row r is values r * LANES to r * LANES + 7, and lane j of every
+//16-bit word of the output takes the bits of lane j of the rows, lowest bits first
+void pack(const uint16_t* values, int width, uint8_t* dst)
+{
+    if (width == 0)
+        return;
+#if defined(__SSE2__)
+    __m128i acc = _mm_setzero_si128();
+    int filled = 0;
+    for (int r = 0; r < ROWS; r++)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(values + r * LANES));
+        acc = _mm_or_si128(acc, _mm_sll_epi16(v, _mm_cvtsi32_si128(filled)));
+        filled += width;
+        if (filled >= 16)
+        {
+            _mm_storeu_si128((__m128i*)dst, acc);
+            dst += 16;
+            filled -= 16;
+            acc = _mm_srl_epi16(v, _mm_cvtsi32_si128(width - filled));
+        }
+    }
+#else
+    for (int j = 0; j < LANES; j++)
+    {
+        uint32_t acc = 0;
+        int filled = 0;
+        uint8_t* out = dst + 2 * j;
+        for (int r = 0; r < ROWS; r++)
+        {
+            acc |= (uint32_t)values[r * LANES + j] << filled;
+            filled += width;
+            if (filled >= 16)
+            {
+                out[0] = (uint8_t)acc;
+                out[1] = (uint8_t)(acc >> 8);
+                out += 16;
+                acc >>= 16;
+                filled -= 16;
+            }
+        }
+    }
+#endif
+}
+
+void unpack(const uint8_t* src, int width, uint16_t* values)
+{
+    if (width == 0)
+    {
+        memset(values, 0, ARF_CODEC_BLOCK * sizeof(uint16_t));
+        return;
+    }
+#if defined(__SSE2__)
+    const __m128i mask = _mm_set1_epi16((short)((1 << width) - 1));
+    const uint8_t* end = src + 32 * width;
+    __m128i word = _mm_loadu_si128((const __m128i*)src);
+    int used = 0;
+    for (int r = 0; r < ROWS; r++)
+    {
+        __m128i v = _mm_srl_epi16(word, _mm_cvtsi32_si128(used));
+        used += width;
+        if (used >= 16)
+        {
+            src += 16;
+            used -= 16;
+            word = (src < end) ? _mm_loadu_si128((const __m128i*)src) : _mm_setzero_si128();
+            if (used > 0)
+                v = _mm_or_si128(v, _mm_sll_epi16(word, _mm_cvtsi32_si128(width - used)));
+        }
+        _mm_storeu_si128((__m128i*)(values + r * LANES), _mm_and_si128(v, mask));
+    }
+#else
+    const uint32_t mask = (1u << width) - 1;
+    for (int j = 0; j < LANES; j++)
+    {
+        const uint8_t* in = src + 2 * j;
+        uint32_t acc = 0;
+        int available = 0;
+        for (int r = 0; r < ROWS; r++)
+        {
+            if (available < width)
+            {
+                acc |= (uint32_t)(in[0] | (in[1] << 8)) << available;
+                in += 16;
+                available += 16;
+            }
+            values[r * LANES + j] = (uint16_t)(acc & mask);
+            acc >>= width;
+            available -= width;
+        }
+    }
+#endif
+}
+
+//Undoes the zigzag encoding and the prediction of a block, given the last two samples before it
+void reconstruct(const uint16_t* residuals, int predictor, int16_t* x, int16_t before1, int16_t before2)
+{
+#if defined(__SSE2__)
+    //running sums over the 8 lanes, carried from row to row in every lane
+    __m128i sample = _mm_set1_epi16(before1);
+    __m128i diff = _mm_set1_epi16((short)(before1 - before2));
+    for (int r = 0; r < ROWS; r++)
+    {
+        __m128i z = _mm_loadu_si128((const __m128i*)(residuals + r * LANES));
+        __m128i d = _mm_xor_si128(_mm_srli_epi16(z, 1), _mm_sub_epi16(_mm_setzero_si128(), _mm_and_si128(z, _mm_set1_epi16(1))));
+        d = _mm_add_epi16(d, _mm_slli_si128(d, 2));
+        d = _mm_add_epi16(d, _mm_slli_si128(d, 4));
+        d = _mm_add_epi16(d, _mm_slli_si128(d, 8));
+        if (predictor == 2)
+        {
+            d = _mm_add_epi16(d, diff);
+            diff = _mm_shufflehi_epi16(d, 0xff);
+            diff = _mm_unpackhi_epi64(diff, diff);
+            d = _mm_add_epi16(d, _mm_slli_si128(d, 2));
+            d = _mm_add_epi16(d, _mm_slli_si128(d, 4));
+            d = _mm_add_epi16(d, _mm_slli_si128(d, 8));
+        }
+        d = _mm_add_epi16(d, sample);
+        sample = _mm_shufflehi_epi16(d, 0xff);
+        sample = _mm_unpackhi_epi64(sample, sample);
+        _mm_storeu_si128((__m128i*)(x + r * LANES), d);
+    }
+#else
+    int16_t sample = before1;
+    int16_t diff = (int16_t)(before1 - before2);
+    for (int i = 0; i < ARF_CODEC_BLOCK; i++)
+    {
+        int16_t d = (int16_t)((residuals[i] >> 1) ^ (uint16_t)-(int)(residuals[i] & 1));
+        if (predictor == 2)
+        {
+            diff = (int16_t)(diff + d);
+            d = diff;
+        }
+        sample = (int16_t)(sample + d);
+        x[i] = sample;
+    }
+#endif
+}
+
+size_t filter(unsigned int flags, size_t nValues, const unsigned int values[], size_t nBytes, size_t* bufSize, void** buf)
+{
+    if (flags & H5Z_FLAG_REVERSE)
+    {
+        int64_t nSamples = ArfCodec::getDecodedSamples((const uint8_t*)*buf, nBytes);
+        if (nSamples < 0)
+            return 0;
+        //at least one byte, which HDF5 expects of a buffer
+        void* out = allocate(nSamples * sizeof(int16_t) + 1);
+        if (out == nullptr || !ArfCodec::decode((const uint8_t*)*buf, nBytes, (int16_t*)out))
+        {
+            release(out);
+            return 0;
+        }
+        release(*buf);
+        *buf = out;
+        *bufSize = nSamples * sizeof(int16_t) + 1;
+        return nSamples * sizeof(int16_t);
+    }
+    //only for 16-bit samples; the optional filter is then left out of the chunk
+    if (nValues < 1 || values[0] != sizeof(int16_t) || nBytes % sizeof(int16_t) != 0)
+        return 0;
+    size_t nSamples = nBytes / sizeof(int16_t);
+    void* out = allocate(ArfCodec::getMaxEncodedSize(nSamples));
+    if (out == nullptr)
+        return 0;
+    size_t size = ArfCodec::encode((const int16_t*)*buf, nSamples, (uint8_t*)out);
+    release(*buf);
+    *buf = out;
+    *bufSize = ArfCodec::getMaxEncodedSize(nSamples);
+    return size;
+}
+
+//Keeps the size of the dataset's type with the filter
+herr_t setLocal(hid_t dcpl, hid_t type, hid_t)
+{
+    unsigned int flags;
+    size_t nValues = 0;
+    if (H5Pget_filter_by_id2(dcpl, ARF_CODEC_FILTER, &flags, &nValues, nullptr, 0, nullptr, nullptr) < 0)
+        return -1;
+    unsigned int values[1] = { (unsigned int)H5Tget_size(type) };
+    return H5Pmodify_filter(dcpl, ARF_CODEC_FILTER, flags, 1, values);
+}
+
+const H5Z_class2_t filterClass =
+{
+    H5Z_CLASS_T_VERS,
+    (H5Z_filter_t)ARF_CODEC_FILTER,
+    1, 1,
+    "arf int16 codec",
+    nullptr,
+    setLocal,
+    filter
+};
+
+}
+
+bool ArfCodec::registerFilter()
+{
+    static const bool registered = H5Zregister(&filterClass) >= 0;
+    return registered;
+}
+
+const void* ArfCodec::getFilterClass()
+{
+    return &filterClass;
+}
+
+size_t ArfCodec::getMaxEncodedSize(size_t nSamples)
+{
+    size_t nBlocks = (nSamples + ARF_CODEC_BLOCK - 1) / ARF_CODEC_BLOCK;
+    return HEADER_SIZE + nBlocks * (1 + ARF_CODEC_BLOCK * sizeof(int16_t));
+}
+
+size_t ArfCodec::encode(const int16_t* samples, size_t nSamples, uint8_t* dst)
+{
+    uint8_t* out = dst;
+    out[0] = ARF_CODEC_VERSION;
+    out[1] = out[2] = out[3] = 0;
+    for (int i = 0; i < 4; i++)
+        out[4 + i] = (uint8_t)(nSamples >> (8 * i));
+    out += HEADER_SIZE;
+
+    //each block with the two samples before it, which are 0 before the first block
+    int16_t block[ARF_CODEC_BLOCK + LANES];
+    int16_t* x = block + LANES;
+    x[-2] = x[-1] = 0;
+    uint16_t first[ARF_CODEC_BLOCK], second[ARF_CODEC_BLOCK];
+    for (size_t start = 0; start < nSamples; start += ARF_CODEC_BLOCK)
+    {
+        size_t n = nSamples - start;
+        if (n > ARF_CODEC_BLOCK)
+            n = ARF_CODEC_BLOCK;
+        memcpy(x, samples + start, n * sizeof(int16_t));
+        memset(x + n, 0, (ARF_CODEC_BLOCK - n) * sizeof(int16_t));
+        unsigned int orFirst, orSecond;
+        predict(x, first, second, orFirst, orSecond);
+        int widthFirst = bitWidth(orFirst);
+        int widthSecond = bitWidth(orSecond);
+        bool useSecond = widthSecond < widthFirst;
+        int width = useSecond ? widthSecond : widthFirst;
+        *out++ = (uint8_t)(((useSecond ? 2 : 1) << 5) | width);
+        pack(useSecond ? second : first, width, out);
+        out += 32 * width;
+        x[-2] = x[n - 2];
+        x[-1] = x[n - 1];
+    }
+    return out - dst;
+}
+
+int64_t ArfCodec::getDecodedSamples(const uint8_t* src, size_t size)
+{
+    if (size < HEADER_SIZE || src[0] != ARF_CODEC_VERSION)
+        return -1;
+    int64_t nSamples = 0;
+    for (int i = 0; i < 4; i++)
+        nSamples |= (int64_t)src[4 + i] << (8 * i);
+    return nSamples;
+}
+
+bool ArfCodec::decode(const uint8_t* src, size_t size, int16_t* dst)
+{
+    int64_t nSamples = getDecodedSamples(src, size);
+    if (nSamples < 0)
+        return false;
+    const uint8_t* end = src + size;
+    src += HEADER_SIZE;
+    uint16_t residuals[ARF_CODEC_BLOCK];
+    int16_t block[ARF_CODEC_BLOCK];
+    int16_t before1 = 0, before2 = 0;
+    for (int64_t start = 0; start < nSamples; start += ARF_CODEC_BLOCK)
+    {
+        if (src >= end)
+            return false;
+        int predictor = *src >> 5;
+        int width = *src & 0x1f;
+        src++;
+        if (width > 16 || (predictor != 1 && predictor != 2) || end - src < 32 * width)
+            return false;
+        unpack(src, width, residuals);
+        src += 32 * width;
+        int64_t n = nSamples - start;
+        if (n > ARF_CODEC_BLOCK)
+            n = ARF_CODEC_BLOCK;
+        //a whole block can go straight to DST, the last one only up to the end of the chunk
+        int16_t* x = (n == ARF_CODEC_BLOCK) ? dst + start : block;
+        reconstruct(residuals, predictor, x, before1, before2);
+        if (x == block)
+            memcpy(dst + start, block, n * sizeof(int16_t));
+        before2 = (n > 1) ? x[n - 2] : before1;
+        before1 = x[n - 1];
+    }
+    return true;
+}
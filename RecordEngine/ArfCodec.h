@@ -0,0 +1,66 @@
+/*
+ ------------------------------------------------------------------
+
+ Michal Badura, 2016
+ based on code by Florian Franzen, 2014
+
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+#ifndef ARFCODEC_H_INCLUDED
+#define ARFCODEC_H_INCLUDED
+
+//Plain C++ and the HDF5 C library only, so that it can also be built into the filter plugin
+//(Tools/arf-codec) that lets any HDF5 program read the datasets.
+
+#include <stdint.h>
+#include <stddef.h>
+
+//HDF5 filter id, one of those HDF5 leaves for testing new filters (256-511). It is stored in
+//every file that uses the codec, so it must not change
+#define ARF_CODEC_FILTER 305
+#define ARF_CODEC_VERSION 1
+//samples in a block; every block has its own predictor and bit width
+#define ARF_CODEC_BLOCK 256
+
+//Lossless codec for the int16 samples of the channel datasets, applied to every chunk as an HDF5
+//filter. Each block of ARF_CODEC_BLOCK samples is predicted from the samples before it, with the
+//first or the second difference, whichever leaves the smaller residuals. The residuals are zigzag
+//encoded (so that small negative numbers become small positive ones) and bit-packed at the width
+//of the largest one. The packing interleaves 8 lanes of 16 bits, so that SSE2 encodes and decodes
+//8 samples at once; other machines get the same format from plain loops.
+//
+//A chunk is a byte with the version, 3 reserved bytes and the number of samples (32 bits, little
+//endian), then the blocks: a byte with the predictor (1 or 2) in bits 5-6 and the bit width (0-16)
+//in bits 0-4, and 32 bytes for every bit of width. The last block is padded with zeros.
+class ArfCodec
+{
+public:
+    //Registers the filter with the HDF5 library, once; false if that failed
+    static bool registerFilter();
+    //The filter's H5Z_class2_t, for H5Zregister and the plugin
+    static const void* getFilterClass();
+
+    static size_t getMaxEncodedSize(size_t nSamples);
+    //Encodes NSAMPLES samples into DST, which must have room for getMaxEncodedSize; returns the bytes used
+    static size_t encode(const int16_t* samples, size_t nSamples, uint8_t* dst);
+    //Samples in the encoded chunk SRC of SIZE bytes, or -1 if it is not one
+    static int64_t getDecodedSamples(const uint8_t* src, size_t size);
+    //Decodes SRC into DST, which must have room for getDecodedSamples; false if SRC is damaged
+    static bool decode(const uint8_t* src, size_t size, int16_t* dst);
+};
+
+#endif  // ARFCODEC_H_INCLUDED
@@ -0,0 +1,140 @@
+/*
+ ------------------------------------------------------------------
+
+ Michal Badura, 2016
+ based on code by Florian Franzen, 2014
+
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "ArfDecimator.h"
+
+ArfDecimator::ArfDecimator(int factor) : factor(factor), tapsPerPhase(ARF_DECIMATION_TAPS_PER_PHASE),
+    inputStart(0), inputCount(0), outputCount(0), scratchSize(0)
+{
+    const int length = factor * tapsPerPhase;
+    delay = length / 2;
+    const double cutoff = ARF_DECIMATION_CUTOFF * 0.5 / factor;
+
+    HeapBlock<double> taps(length);
+    double sum = 0;
+    for (int i = 0; i < length; i++)
+    {
+        double t = i - delay;
+        double sinc = (i == delay) ? 2 * cutoff : std::sin(2 * double_Pi * cutoff * t) / (double_Pi * t);
+        double window = 0.42 - 0.5 * std::cos(2 * double_Pi * i / length) + 0.08 * std::cos(4 * double_Pi * i / length);
+        taps[i] = sinc * window;
+        sum += taps[i];
+    }
+    //unity gain at DC
+    phases.malloc(length);
+    for (int p = 0; p < factor; p++)
+    {
+        for (int k = 0; k < tapsPerPhase; k++)
+            phases[p * tapsPerPhase + k] = (float)(taps[k * factor + p] / sum);
+    }
+}
+
+int ArfDecimator::getFactor() const
+{
+    return factor;
+}
+
+int64 ArfDecimator::getOutputOffset() const
+{
+    return outputCount * factor - inputCount;
+}
+
+int ArfDecimator::process(float* data, int nSamples)
+{
+    if (nSamples <= 0)
+        return 0;
+    //Before the first sample the signal is taken to stay at its first value, rather than to step from 0
+    if (inputCount == 0 && input.size() == 0)
+    {
+        inputStart = -delay;
+        input.insertMultiple(0, data[0], delay);
+    }
+    input.addArray(data, nSamples);
+    inputCount += nSamples;
+
+    //Output n is the filter centered on input n * factor, so it needs the input up to n * factor + delay
+    int64 end = (inputCount - 1 - delay >= 0) ? (inputCount - 1 - delay) / factor + 1 : 0;
+    int nOut = (int)(end - outputCount);
+    if (nOut <= 0)
+        return 0;
+    const int K = tapsPerPhase;
+    if (scratchSize < nOut + K)
+    {
+        scratchSize = nOut + K;
+        branch.malloc(scratchSize);
+        output.malloc(scratchSize);
+    }
+
+    //With tap i = k * factor + p, output n is the sum over the phases p of branch p, i.e. every
+    //factor-th input sample from offset -p, convolved with the taps of phase p
+    FloatVectorOperations::clear(output, nOut);
+    const int64 first = outputCount - K / 2 + 1;
+    const float* in = input.getRawDataPointer();
+    for (int p = 0; p < factor; p++)
+    {
+        const float* src = in + (first * factor - p - inputStart);
+        for (int j = 0; j < nOut + K - 1; j++)
+            branch[j] = src[(int64)j * factor];
+        const float* taps = phases + p * K;
+        for (int k = 0; k < K; k++)
+            FloatVectorOperations::addWithMultiply(output, branch + (K - 1 - k), taps[k], nOut);
+    }
+    FloatVectorOperations::copy(data, output, nOut);
+    outputCount = end;
+
+    //keep only what the next output reaches back to
+    int64 keepFrom = (outputCount - K / 2 + 1) * factor - (factor - 1);
+    if (keepFrom > inputStart)
+    {
+        input.removeRange(0, (int)(keepFrom - inputStart));
+        inputStart = keepFrom;
+    }
+    return nOut;
+}
+
+Array<int> ArfDecimator::parseFactors(const String& spec, int nChannels)
+{
+    Array<int> factors;
+    factors.insertMultiple(0, 1, nChannels);
+    StringArray entries;
+    entries.addTokens(spec, ",;", "");
+    for (int i = 0; i < entries.size(); i++)
+    {
+        String entry = entries[i].trim();
+        if (entry.isEmpty())
+            continue;
+        String channels = entry.upToFirstOccurrenceOf(":", false, false).trim();
+        int factor = entry.fromFirstOccurrenceOf(":", false, false).trim().getIntValue();
+        int firstChannel = channels.upToFirstOccurrenceOf("-", false, false).trim().getIntValue();
+        int lastChannel = channels.contains("-") ? channels.fromFirstOccurrenceOf("-", false, false).trim().getIntValue() : firstChannel;
+        if (!entry.contains(":") || factor < 1 || factor > ARF_DECIMATION_MAX_FACTOR || firstChannel < 0 || lastChannel < firstChannel)
+        {
+            std::cerr << "Ignoring decimation \"" << entry << "\", expected <channel>[-<channel>]:<factor up to "
+                << ARF_DECIMATION_MAX_FACTOR << ">" << std::endl;
+            continue;
+        }
+        for (int c = firstChannel; c <= lastChannel && c < nChannels; c++)
+            factors.set(c, factor);
+    }
+    return factors;
+}
@@ -0,0 +1,77 @@
+/*
+ ------------------------------------------------------------------
+
+ Michal Badura, 2016
+ based on code by Florian Franzen, 2014
+
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+#ifndef ARFDECIMATOR_H_INCLUDED
+#define ARFDECIMATOR_H_INCLUDED
+
+#include "../../../../JuceLibraryCode/JuceHeader.h"
+
+//taps of the anti-alias filter for every output sample, i.e. per phase; even
+#define ARF_DECIMATION_TAPS_PER_PHASE 32
+//cutoff (-6 dB) of the filter as a fraction of the new Nyquist frequency; with 32 taps per phase
+//the stopband starts about at the new Nyquist frequency
+#define ARF_DECIMATION_CUTOFF 0.82
+#define ARF_DECIMATION_MAX_FACTOR 64
+
+//Lowers the sample rate of one channel by an integer factor on the way to the file, with a
+//windowed-sinc (Blackman) low-pass against aliasing. The filter is zero-phase: output n is the
+//filtered signal at input sample n * factor, so it lines up with the timestamps of the full rate,
+//at the cost of holding back half the filter length. The filter runs as factor polyphase branches
+//over contiguous copies of the input, so all the arithmetic is done with FloatVectorOperations.
+class ArfDecimator
+{
+public:
+    ArfDecimator(int factor);
+
+    int getFactor() const;
+    //Filters NSAMPLES of DATA and puts the output in place, at the start of DATA; returns how many
+    //output samples there are. State carries over between calls (and parts) of the same recording.
+    int process(float* data, int nSamples);
+    //Input samples from the first sample of the next process call to the first output it gives,
+    //which is negative when that output belongs to an earlier call's samples
+    int64 getOutputOffset() const;
+
+    //The factor of every recorded channel from SPEC, a list like "0-31:10, 40:4" of recorded
+    //channels (or ranges) and their factors; 1 for the channels not in it
+    static Array<int> parseFactors(const String& spec, int nChannels);
+
+private:
+    int factor;
+    int tapsPerPhase;
+    //the filter's center, in input samples
+    int delay;
+    //coefficient k of phase p at p * tapsPerPhase + k
+    HeapBlock<float> phases;
+    //input from absolute sample inputStart on, as far back as the next output needs
+    Array<float> input;
+    int64 inputStart;
+    int64 inputCount;
+    int64 outputCount;
+    //one phase of the input, and the output being summed up
+    HeapBlock<float> branch;
+    HeapBlock<float> output;
+    int scratchSize;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ArfDecimator);
+};
+
+#endif  // ARFDECIMATOR_H_INCLUDED
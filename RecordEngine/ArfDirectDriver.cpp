@@ -0,0 +1,794 @@
+/*
+ ------------------------------------------------------------------
+
+ Michal Badura, 2016
+ based on code by Florian Franzen, 2014
+
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include <H5Cpp.h>
+#include "ArfDirectDriver.h"
+
+#if defined(__linux__)
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+
+//HDF5 numbers drivers since 1.13.2; 256 to 511 are left for drivers that aren't registered with The HDF Group
+#define ARF_DIRECT_DRIVER_VALUE 511
+
+static haddr_t alignDown(haddr_t addr)
+{
+    return addr & ~(haddr_t)(ARF_DIRECT_BLOCK_SIZE - 1);
+}
+
+static haddr_t alignUp(haddr_t addr)
+{
+    return alignDown(addr + ARF_DIRECT_BLOCK_SIZE - 1);
+}
+
+static bool writeAll(int fd, const char* data, size_t size, haddr_t addr)
+{
+    while (size > 0)
+    {
+        ssize_t n = pwrite(fd, data, size, (off_t)addr);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        data += n;
+        size -= n;
+        addr += n;
+    }
+    return true;
+}
+
+//Writes [FIRST, LAST) from DATA, which is at the same offset in a block as FIRST. Only whole
+//blocks go through DIRECTFD; the partial blocks at either end are shared with whatever lies next
+//to the data in the file, so they go through the page cache. If the file system doesn't take a
+//direct write after all, DIRECTFD is closed and set to -1.
+static bool writeBlocks(int fd, int& directFd, const char* data, haddr_t first, haddr_t last)
+{
+    haddr_t directFirst = alignUp(first);
+    haddr_t directLast = alignDown(last);
+    if (directFd < 0 || directFirst >= directLast)
+        directFirst = directLast = last;
+
+    bool ok = writeAll(fd, data, (size_t)(directFirst - first), first);
+    if (ok && directLast > directFirst && !writeAll(directFd, data + (directFirst - first), (size_t)(directLast - directFirst), directFirst))
+    {
+        std::cerr << "Direct I/O failed (" << strerror(errno) << "), writing through the page cache" << std::endl;
+        ::close(directFd);
+        directFd = -1;
+        ok = writeAll(fd, data + (directFirst - first), (size_t)(directLast - directFirst), directFirst);
+    }
+    if (ok)
+        ok = writeAll(fd, data + (directLast - first), (size_t)(last - directLast), directLast);
+    if (!ok)
+        std::cerr << "Could not write to disk: " << strerror(errno) << std::endl;
+    return ok;
+}
+
+//Collects the raw data writes of one file into block aligned buffers and writes them from its
+//thread. Consecutive writes (HDF5 mostly appends chunks) end up in the same buffer.
+class ArfDirectWriter : public Thread
+{
+public:
+    //takes DIRECTFD over, -1 for none
+    ArfDirectWriter(int fd, int directFd);
+    ~ArfDirectWriter();
+
+    //takes SIZE bytes for ADDR, waiting for a free buffer if the disk is behind
+    bool write(haddr_t addr, size_t size, const char* data);
+    //waits until everything taken so far is written; false if anything could not be
+    bool drain();
+    //whether some of [ADDR, ADDR + SIZE) is not written yet
+    bool isPending(haddr_t addr, size_t size);
+
+    void run() override;
+
+private:
+    struct Buffer
+    {
+        HeapBlock<char> memory;
+        //block aligned start within memory, for the file address start
+        char* data;
+        haddr_t start;
+        //the data is from data + begin to data + end
+        size_t begin;
+        size_t end;
+    };
+
+    void submit();
+    Buffer* takeFreeBuffer();
+    void writeBuffer(Buffer* buffer);
+
+    int fd;
+    int directFd;
+    Buffer* current;
+
+    OwnedArray<Buffer> buffers;
+    Array<Buffer*> freeBuffers;
+    Array<Buffer*> queue;
+    //the buffer the thread is writing
+    Buffer* writing;
+    CriticalSection queueLock;
+    WaitableEvent queued;
+    WaitableEvent written;
+    bool writeFailed;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ArfDirectWriter);
+};
+
+ArfDirectWriter::ArfDirectWriter(int fd, int directFd) : Thread("Arf direct I/O"), fd(fd), directFd(directFd),
+    current(nullptr), writing(nullptr), writeFailed(false)
+{
+    for (int i = 0; i < ARF_DIRECT_BUFFERS; i++)
+    {
+        Buffer* buffer = buffers.add(new Buffer());
+        buffer->memory.malloc(ARF_DIRECT_BUFFER_SIZE + ARF_DIRECT_BLOCK_SIZE);
+        buffer->data = (char*)alignUp((haddr_t)(pointer_sized_int)buffer->memory.getData());
+        freeBuffers.add(buffer);
+    }
+    startThread(8);
+}
+
+ArfDirectWriter::~ArfDirectWriter()
+{
+    drain();
+    signalThreadShouldExit();
+    queued.signal();
+    waitForThreadToExit(-1);
+    if (directFd >= 0)
+        ::close(directFd);
+}
+
+bool ArfDirectWriter::write(haddr_t addr, size_t size, const char* data)
+{
+    while (size > 0)
+    {
+        if (current != nullptr && (addr != current->start + current->end || current->end == ARF_DIRECT_BUFFER_SIZE))
+            submit();
+        if (current == nullptr)
+        {
+            current = takeFreeBuffer();
+            current->start = alignDown(addr);
+            current->begin = current->end = (size_t)(addr - current->start);
+        }
+        size_t n = jmin(size, ARF_DIRECT_BUFFER_SIZE - current->end);
+        memcpy(current->data + current->end, data, n);
+        current->end += n;
+        addr += n;
+        data += n;
+        size -= n;
+    }
+    return !writeFailed;
+}
+
+void ArfDirectWriter::submit()
+{
+    if (current == nullptr)
+        return;
+    const ScopedLock sl(queueLock);
+    queue.add(current);
+    current = nullptr;
+    queued.signal();
+}
+
+ArfDirectWriter::Buffer* ArfDirectWriter::takeFreeBuffer()
+{
+    while (true)
+    {
+        {
+            const ScopedLock sl(queueLock);
+            if (freeBuffers.size() > 0)
+                return freeBuffers.removeAndReturn(freeBuffers.size() - 1);
+        }
+        written.wait(100);
+    }
+}
+
+bool ArfDirectWriter::drain()
+{
+    submit();
+    while (true)
+    {
+        {
+            const ScopedLock sl(queueLock);
+            if (queue.size() == 0 && writing == nullptr)
+                return !writeFailed;
+        }
+        written.wait(100);
+    }
+}
+
+bool ArfDirectWriter::isPending(haddr_t addr, size_t size)
+{
+    if (current != nullptr && addr < current->start + current->end && addr + size > current->start + current->begin)
+        return true;
+    const ScopedLock sl(queueLock);
+    for (int i = -1; i < queue.size(); i++)
+    {
+        const Buffer* b = (i < 0) ? writing : queue[i];
+        if (b != nullptr && addr < b->start + b->end && addr + size > b->start + b->begin)
+            return true;
+    }
+    return false;
+}
+
+void ArfDirectWriter::run()
+{
+    while (true)
+    {
+        {
+            const ScopedLock sl(queueLock);
+            if (queue.size() > 0)
+                writing = queue.removeAndReturn(0);
+        }
+        if (writing == nullptr)
+        {
+            if (threadShouldExit())
+                return;
+            queued.wait(100);
+            continue;
+        }
+        writeBuffer(writing);
+        {
+            const ScopedLock sl(queueLock);
+            freeBuffers.add(writing);
+            writing = nullptr;
+        }
+        written.signal();
+    }
+}
+
+void ArfDirectWriter::writeBuffer(Buffer* buffer)
+{
+    if (!writeBlocks(fd, directFd, buffer->data + buffer->begin, buffer->start + buffer->begin, buffer->start + buffer->end))
+        writeFailed = true;
+}
+
+//Keeps the whole file in memory, in pages of ARF_STAGING_PAGE_SIZE, and writes the pages that
+//have changed to disk from its thread, once they have not been written to for ARF_STAGING_SETTLE_MS.
+//A page that is not in memory (e.g. of a file that was already on disk) is read when it is needed.
+class ArfStagedImage : public Thread
+{
+public:
+    //takes DIRECTFD over, -1 for none. SIZE is the size of the file on disk, RATE the most it
+    //writes in MB/s when it is not catching up, 0 for no limit
+    ArfStagedImage(int fd, int directFd, haddr_t size, int rate);
+    ~ArfStagedImage();
+
+    bool read(haddr_t addr, size_t size, char* dst);
+    bool write(haddr_t addr, size_t size, const char* data);
+    void truncate(haddr_t newSize);
+    //writes every changed page now and gives the file on disk its size; false if anything could not be written
+    bool persist();
+
+    void run() override;
+
+private:
+    struct Page
+    {
+        HeapBlock<char> memory;
+        //block aligned start within memory
+        char* data;
+        bool dirty;
+        uint32 lastWrite;
+    };
+
+    //the page at INDEX, read from disk or allocated if it is not in memory. pageLock must be held
+    Page* getPage(int index);
+    //writes page INDEX if it has changed (and has settled, if SETTLED), returns the bytes written.
+    //persistLock must be held
+    int64 persistPage(int index, bool settled);
+    //frees pages that are on disk until the image fits in ARF_STAGING_MEMORY again
+    void evict();
+    bool isOverLimit();
+
+    int fd;
+    int directFd;
+    int rate;
+    OwnedArray<Page> pages;
+    //size of the file, and how much of it is on disk
+    haddr_t size;
+    haddr_t diskSize;
+    int64 resident;
+    bool writeFailed;
+    //pageLock guards the pages, persistLock keeps a page from being written by both threads at once
+    CriticalSection pageLock;
+    CriticalSection persistLock;
+    HeapBlock<char> scratchMemory;
+    char* scratch;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ArfStagedImage);
+};
+
+ArfStagedImage::ArfStagedImage(int fd, int directFd, haddr_t size, int rate) : Thread("Arf staging"), fd(fd), directFd(directFd),
+    rate(rate), size(size), diskSize(size), resident(0), writeFailed(false)
+{
+    scratchMemory.malloc(ARF_STAGING_PAGE_SIZE + ARF_DIRECT_BLOCK_SIZE);
+    scratch = (char*)alignUp((haddr_t)(pointer_sized_int)scratchMemory.getData());
+    startThread(4);
+}
+
+ArfStagedImage::~ArfStagedImage()
+{
+    stopThread(-1);
+    if (directFd >= 0)
+        ::close(directFd);
+}
+
+ArfStagedImage::Page* ArfStagedImage::getPage(int index)
+{
+    while (pages.size() <= index)
+        pages.add(nullptr);
+    Page* page = pages[index];
+    if (page != nullptr)
+        return page;
+
+    page = new Page();
+    page->memory.malloc(ARF_STAGING_PAGE_SIZE + ARF_DIRECT_BLOCK_SIZE);
+    page->data = (char*)alignUp((haddr_t)(pointer_sized_int)page->memory.getData());
+    page->dirty = false;
+    page->lastWrite = Time::getMillisecondCounter();
+    haddr_t start = (haddr_t)index * ARF_STAGING_PAGE_SIZE;
+    size_t onDisk = (diskSize > start) ? (size_t)jmin((haddr_t)ARF_STAGING_PAGE_SIZE, diskSize - start) : 0;
+    ssize_t n = (onDisk > 0) ? pread(fd, page->data, onDisk, (off_t)start) : 0;
+    memset(page->data + jmax((ssize_t)0, n), 0, ARF_STAGING_PAGE_SIZE - jmax((ssize_t)0, n));
+    if (n < (ssize_t)onDisk)
+    {
+        delete page;
+        return nullptr;
+    }
+    pages.set(index, page);
+    resident += ARF_STAGING_PAGE_SIZE;
+    return page;
+}
+
+bool ArfStagedImage::read(haddr_t addr, size_t count, char* dst)
+{
+    const ScopedLock sl(pageLock);
+    while (count > 0)
+    {
+        int index = (int)(addr / ARF_STAGING_PAGE_SIZE);
+        size_t offset = (size_t)(addr % ARF_STAGING_PAGE_SIZE);
+        size_t n = jmin(count, (size_t)ARF_STAGING_PAGE_SIZE - offset);
+        //reading doesn't bring a page into memory, HDF5 has its own caches
+        Page* page = (index < pages.size()) ? pages[index] : nullptr;
+        if (page != nullptr)
+            memcpy(dst, page->data + offset, n);
+        else
+        {
+            size_t onDisk = (diskSize > addr) ? (size_t)jmin((haddr_t)n, diskSize - addr) : 0;
+            if (onDisk > 0 && pread(fd, dst, onDisk, (off_t)addr) != (ssize_t)onDisk)
+                return false;
+            memset(dst + onDisk, 0, n - onDisk);
+        }
+        addr += n;
+        dst += n;
+        count -= n;
+    }
+    return true;
+}
+
+bool ArfStagedImage::write(haddr_t addr, size_t count, const char* data)
+{
+    {
+        const ScopedLock sl(pageLock);
+        uint32 now = Time::getMillisecondCounter();
+        while (count > 0)
+        {
+            int index = (int)(addr / ARF_STAGING_PAGE_SIZE);
+            size_t offset = (size_t)(addr % ARF_STAGING_PAGE_SIZE);
+            size_t n = jmin(count, (size_t)ARF_STAGING_PAGE_SIZE - offset);
+            Page* page = getPage(index);
+            if (page == nullptr)
+                return false;
+            memcpy(page->data + offset, data, n);
+            page->dirty = true;
+            page->lastWrite = now;
+            addr += n;
+            data += n;
+            count -= n;
+        }
+        size = jmax(size, addr);
+    }
+    if (isOverLimit())
+        notify();
+    return !writeFailed;
+}
+
+void ArfStagedImage::truncate(haddr_t newSize)
+{
+    const ScopedLock sl(pageLock);
+    //what is cut off reads as zeros if the file grows again
+    int first = (int)((newSize + ARF_STAGING_PAGE_SIZE - 1) / ARF_STAGING_PAGE_SIZE);
+    for (int i = pages.size() - 1; i >= first; i--)
+    {
+        if (pages[i] != nullptr)
+            resident -= ARF_STAGING_PAGE_SIZE;
+        pages.remove(i);
+    }
+    if (newSize % ARF_STAGING_PAGE_SIZE != 0 && first - 1 < pages.size() && pages[first - 1] != nullptr)
+    {
+        size_t offset = (size_t)(newSize % ARF_STAGING_PAGE_SIZE);
+        memset(pages[first - 1]->data + offset, 0, ARF_STAGING_PAGE_SIZE - offset);
+    }
+    size = newSize;
+}
+
+int64 ArfStagedImage::persistPage(int index, bool settled)
+{
+    haddr_t start = (haddr_t)index * ARF_STAGING_PAGE_SIZE;
+    size_t n;
+    {
+        //the copy lets the recording go on writing to the page while it goes to disk
+        const ScopedLock sl(pageLock);
+        Page* page = (index < pages.size()) ? pages[index] : nullptr;
+        if (page == nullptr || !page->dirty || start >= size)
+            return 0;
+        if (settled && Time::getMillisecondCounter() - page->lastWrite < ARF_STAGING_SETTLE_MS)
+            return 0;
+        n = (size_t)jmin((haddr_t)ARF_STAGING_PAGE_SIZE, size - start);
+        memcpy(scratch, page->data, n);
+        page->dirty = false;
+    }
+    bool ok = writeBlocks(fd, directFd, scratch, start, start + n);
+    const ScopedLock sl(pageLock);
+    if (!ok)
+    {
+        writeFailed = true;
+        if (index < pages.size() && pages[index] != nullptr)
+            pages[index]->dirty = true;
+        return 0;
+    }
+    diskSize = jmax(diskSize, start + n);
+    return (int64)n;
+}
+
+bool ArfStagedImage::persist()
+{
+    const ScopedLock pl(persistLock);
+    int nPages;
+    {
+        const ScopedLock sl(pageLock);
+        nPages = pages.size();
+    }
+    for (int i = 0; i < nPages; i++)
+        persistPage(i, false);
+
+    const ScopedLock sl(pageLock);
+    if (diskSize != size)
+    {
+        if (ftruncate(fd, (off_t)size) != 0)
+            writeFailed = true;
+        diskSize = size;
+    }
+    return !writeFailed;
+}
+
+bool ArfStagedImage::isOverLimit()
+{
+    const ScopedLock sl(pageLock);
+    return resident > ((int64)ARF_STAGING_MEMORY << 20);
+}
+
+void ArfStagedImage::evict()
+{
+    const ScopedLock sl(pageLock);
+    for (int i = 0; i < pages.size() && resident > ((int64)ARF_STAGING_MEMORY << 20); i++)
+    {
+        //only pages that are on disk, and not the ones still being written to
+        Page* page = pages[i];
+        if (page != nullptr && !page->dirty && Time::getMillisecondCounter() - page->lastWrite >= ARF_STAGING_SETTLE_MS)
+        {
+            pages.set(i, nullptr);
+            resident -= ARF_STAGING_PAGE_SIZE;
+        }
+    }
+}
+
+void ArfStagedImage::run()
+{
+    //One pass over the pages every ARF_STAGING_SETTLE_MS, in file order so that the disk sees
+    //long sequential writes. The rate limit is lifted while the image is too large.
+    while (!threadShouldExit())
+    {
+        int nPages;
+        {
+            const ScopedLock sl(pageLock);
+            nPages = pages.size();
+        }
+        for (int i = 0; i < nPages && !threadShouldExit(); i++)
+        {
+            bool catchingUp = isOverLimit();
+            int64 written;
+            {
+                const ScopedLock pl(persistLock);
+                written = persistPage(i, !catchingUp);
+            }
+            if (written > 0 && rate > 0 && !catchingUp)
+                wait((int)jmax((int64)1, written * 1000 / ((int64)rate << 20)));
+        }
+        evict();
+        wait(isOverLimit() ? 10 : ARF_STAGING_SETTLE_MS);
+    }
+}
+//The HDF5 side: a file of the driver. pub has to come first. A writable file has either a
+//writer, for the raw data, or a staged image, for everything
+struct ArfDirectFile
+{
+    H5FD_t pub;
+    int fd;
+    dev_t device;
+    ino_t inode;
+    haddr_t eoa;
+    haddr_t eof;
+    ArfDirectWriter* writer;
+    ArfStagedImage* staged;
+};
+
+//What H5Pset_driver keeps in the access property list, see ArfDirectDriver::setFileAccess
+struct ArfDirectSettings
+{
+    int direct;
+    int staged;
+    int stagingRate;
+};
+
+static H5FD_t* directOpen(const char* name, unsigned flags, hid_t fapl, haddr_t maxaddr)
+{
+    int oflags = (flags & H5F_ACC_RDWR) ? O_RDWR : O_RDONLY;
+    if (flags & H5F_ACC_TRUNC) oflags |= O_TRUNC;
+    if (flags & H5F_ACC_CREAT) oflags |= O_CREAT;
+    if (flags & H5F_ACC_EXCL) oflags |= O_EXCL;
+    int fd = open(name, oflags, 0666);
+    struct stat st;
+    if (fd < 0)
+        return nullptr;
+    if (fstat(fd, &st) != 0)
+    {
+        ::close(fd);
+        return nullptr;
+    }
+
+    ArfDirectSettings settings = { 1, 0, 0 };
+    const ArfDirectSettings* info = (const ArfDirectSettings*)H5Pget_driver_info(fapl);
+    if (info != nullptr)
+        settings = *info;
+
+    ArfDirectFile* file = new ArfDirectFile();
+    memset(&file->pub, 0, sizeof(H5FD_t));
+    file->fd = fd;
+    file->device = st.st_dev;
+    file->inode = st.st_ino;
+    file->eoa = 0;
+    file->eof = (haddr_t)st.st_size;
+    file->writer = nullptr;
+    file->staged = nullptr;
+    if (flags & H5F_ACC_RDWR)
+    {
+        int directFd = -1;
+        if (settings.direct)
+        {
+            directFd = open(name, O_RDWR | O_DIRECT);
+            if (directFd < 0)
+                std::cerr << "No direct I/O for " << name << ", writing through the page cache" << std::endl;
+        }
+        if (settings.staged)
+            file->staged = new ArfStagedImage(fd, directFd, file->eof, settings.stagingRate);
+        else
+            file->writer = new ArfDirectWriter(fd, directFd);
+    }
+    return &file->pub;
+}
+
+static herr_t directClose(H5FD_t* f)
+{
+    ArfDirectFile* file = (ArfDirectFile*)f;
+    bool ok = (file->writer == nullptr || file->writer->drain()) && (file->staged == nullptr || file->staged->persist());
+    delete file->writer;
+    delete file->staged;
+    if (::close(file->fd) != 0)
+        ok = false;
+    delete file;
+    return ok ? 0 : -1;
+}
+
+static int directCompare(const H5FD_t* f1, const H5FD_t* f2)
+{
+    const ArfDirectFile* a = (const ArfDirectFile*)f1;
+    const ArfDirectFile* b = (const ArfDirectFile*)f2;
+    if (a->device != b->device)
+        return (a->device < b->device) ? -1 : 1;
+    if (a->inode != b->inode)
+        return (a->inode < b->inode) ? -1 : 1;
+    return 0;
+}
+
+static herr_t directQuery(const H5FD_t* f, unsigned long* flags)
+{
+    //as sec2
+    *flags = H5FD_FEAT_AGGREGATE_METADATA | H5FD_FEAT_ACCUMULATE_METADATA | H5FD_FEAT_DATA_SIEVE | H5FD_FEAT_AGGREGATE_SMALLDATA;
+    return 0;
+}
+
+static haddr_t directGetEoa(const H5FD_t* f, H5FD_mem_t type)
+{
+    return ((const ArfDirectFile*)f)->eoa;
+}
+
+static herr_t directSetEoa(H5FD_t* f, H5FD_mem_t type, haddr_t addr)
+{
+    ((ArfDirectFile*)f)->eoa = addr;
+    return 0;
+}
+
+#if H5_VERSION_GE(1, 10, 0)
+static haddr_t directGetEof(const H5FD_t* f, H5FD_mem_t type)
+#else
+static haddr_t directGetEof(const H5FD_t* f)
+#endif
+{
+    return ((const ArfDirectFile*)f)->eof;
+}
+
+static herr_t directGetHandle(H5FD_t* f, hid_t fapl, void** handle)
+{
+    *handle = &((ArfDirectFile*)f)->fd;
+    return 0;
+}
+
+static herr_t directRead(H5FD_t* f, H5FD_mem_t type, hid_t dxpl, haddr_t addr, size_t size, void* buffer)
+{
+    ArfDirectFile* file = (ArfDirectFile*)f;
+    if (file->staged != nullptr)
+        return file->staged->read(addr, size, (char*)buffer) ? 0 : -1;
+    if (file->writer != nullptr && file->writer->isPending(addr, size) && !file->writer->drain())
+        return -1;
+    char* dst = (char*)buffer;
+    while (size > 0)
+    {
+        ssize_t n = pread(file->fd, dst, size, (off_t)addr);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return -1;
+        //past the end of the file reads as zeros, as with sec2
+        if (n == 0)
+        {
+            memset(dst, 0, size);
+            break;
+        }
+        dst += n;
+        size -= n;
+        addr += n;
+    }
+    return 0;
+}
+
+static herr_t directWrite(H5FD_t* f, H5FD_mem_t type, hid_t dxpl, haddr_t addr, size_t size, const void* buffer)
+{
+    ArfDirectFile* file = (ArfDirectFile*)f;
+    bool ok;
+    if (file->staged != nullptr)
+        ok = file->staged->write(addr, size, (const char*)buffer);
+    else if (file->writer == nullptr)
+        return -1;
+    else if (type == H5FD_MEM_DRAW)
+        ok = file->writer->write(addr, size, (const char*)buffer);
+    else
+        ok = (!file->writer->isPending(addr, size) || file->writer->drain()) && writeAll(file->fd, (const char*)buffer, size, addr);
+    file->eof = jmax(file->eof, addr + size);
+    return ok ? 0 : -1;
+}
+
+static herr_t directFlush(H5FD_t* f, hid_t dxpl, hbool_t closing)
+{
+    //A staged file is written out too, as with the core driver: arf-writer relies on a flushed
+    //file being complete on disk
+    ArfDirectFile* file = (ArfDirectFile*)f;
+    if (file->staged != nullptr)
+        return file->staged->persist() ? 0 : -1;
+    return (file->writer == nullptr || file->writer->drain()) ? 0 : -1;
+}
+
+static herr_t directTruncate(H5FD_t* f, hid_t dxpl, hbool_t closing)
+{
+    ArfDirectFile* file = (ArfDirectFile*)f;
+    if (file->staged != nullptr)
+    {
+        //the file on disk gets its size when the image is persisted
+        file->staged->truncate(file->eoa);
+        file->eof = file->eoa;
+        return 0;
+    }
+    if (file->writer != nullptr && !file->writer->drain())
+        return -1;
+    if (file->eoa != file->eof)
+    {
+        if (ftruncate(file->fd, (off_t)file->eoa) != 0)
+            return -1;
+        file->eof = file->eoa;
+    }
+    return 0;
+}
+
+static hid_t getDriverId()
+{
+    static hid_t driverId = -1;
+    if (driverId >= 0 && H5Iis_valid(driverId) > 0)
+        return driverId;
+
+    //Set field by field, the struct differs between HDF5 versions. Since 1.13.2 it carries its
+    //version and a driver number, and H5FDregister rejects a class without them
+    static H5FD_class_t directClass;
+    memset(&directClass, 0, sizeof(directClass));
+#if H5_VERSION_GE(1,13,2)
+    directClass.version = H5FD_CLASS_VERSION;
+    directClass.value = (H5FD_class_value_t)ARF_DIRECT_DRIVER_VALUE;
+#endif
+    directClass.name = "arf_direct";
+    directClass.maxaddr = (haddr_t)std::numeric_limits<off_t>::max();
+    directClass.fc_degree = H5F_CLOSE_WEAK;
+    //the settings are plain data, so HDF5 can copy and free them itself
+    directClass.fapl_size = sizeof(ArfDirectSettings);
+    directClass.open = directOpen;
+    directClass.close = directClose;
+    directClass.cmp = directCompare;
+    directClass.query = directQuery;
+    directClass.get_eoa = directGetEoa;
+    directClass.set_eoa = directSetEoa;
+    directClass.get_eof = directGetEof;
+    directClass.get_handle = directGetHandle;
+    directClass.read = directRead;
+    directClass.write = directWrite;
+    directClass.flush = directFlush;
+    directClass.truncate = directTruncate;
+    for (int i = 0; i < H5FD_MEM_NTYPES; i++)
+        directClass.fl_map[i] = (i == H5FD_MEM_DEFAULT) ? H5FD_MEM_SUPER : (H5FD_mem_t)i;
+    driverId = H5FDregister(&directClass);
+    if (driverId < 0)
+        std::cerr << "Could not register the direct I/O driver with HDF5 " << H5_VERS_MAJOR << "." << H5_VERS_MINOR << "." << H5_VERS_RELEASE << std::endl;
+    return driverId;
+}
+
+bool ArfDirectDriver::setFileAccess(H5::FileAccPropList& props, bool direct, bool staged, int stagingRate)
+{
+    ArfDirectSettings settings = { direct ? 1 : 0, staged ? 1 : 0, jmax(0, stagingRate) };
+    hid_t id = getDriverId();
+    if (id < 0 || H5Pset_driver(props.getId(), id, &settings) < 0)
+        return false;
+    //chunks of a block or more start on a block, so that all of them but the last partial block goes directly
+    if (direct)
+        H5Pset_alignment(props.getId(), ARF_DIRECT_BLOCK_SIZE, ARF_DIRECT_BLOCK_SIZE);
+    return true;
+}
+
+#else
+
+bool ArfDirectDriver::setFileAccess(H5::FileAccPropList& props, bool direct, bool staged, int stagingRate)
+{
+    return false;
+}
+
+#endif
@@ -0,0 +1,69 @@
+/*
+ ------------------------------------------------------------------
+
+ Michal Badura, 2016
+ based on code by Florian Franzen, 2014
+
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+#ifndef ARFDIRECTDRIVER_H_INCLUDED
+#define ARFDIRECTDRIVER_H_INCLUDED
+
+#include "../../../../JuceLibraryCode/JuceHeader.h"
+
+//raw data is collected in buffers of this size, and up to ARF_DIRECT_BUFFERS of them are
+//waiting for the disk before a write has to wait
+#define ARF_DIRECT_BUFFER_SIZE (4 << 20)
+#define ARF_DIRECT_BUFFERS 4
+//alignment of direct writes, a multiple of the logical block size of any disk
+#define ARF_DIRECT_BLOCK_SIZE 4096
+
+//A staged file is kept in memory in pages of this size
+#define ARF_STAGING_PAGE_SIZE (1 << 20)
+//a changed page is written once it has not been written to for this long, in ms
+#define ARF_STAGING_SETTLE_MS 250
+//Above this many MB in memory, pages that are on disk are freed and the rate limit is lifted
+#ifndef ARF_STAGING_MEMORY
+#define ARF_STAGING_MEMORY 4096
+#endif
+
+namespace H5
+{
+class FileAccPropList;
+}
+
+//HDF5 file driver for Linux with two ways of keeping the disk out of the recording path:
+//
+//Direct I/O writes the raw data, i.e. the chunks of the datasets, with O_DIRECT from a thread of
+//its own, so that a long recording neither fills the page cache nor stalls when the kernel writes
+//it back. The metadata and the parts of the raw data that don't fill whole disk blocks go through
+//the page cache, as with the default sec2 driver. Where the file system doesn't take O_DIRECT
+//(e.g. tmpfs), everything goes through the page cache.
+//
+//Staging builds the whole file in memory, like the core driver with a backing store, and a thread
+//writes the pages that have changed to disk in file order, at a limited rate if one is set. A flush
+//or close writes whatever is left. With direct I/O as well, the pages are written with O_DIRECT.
+class ArfDirectDriver
+{
+public:
+    //Makes the files opened with PROPS use the driver, with direct I/O and/or staging. STAGINGRATE
+    //is the most the staging thread writes in MB/s, 0 for as fast as the disk takes it. Returns
+    //false where the driver is not available; the files then use the default driver
+    static bool setFileAccess(H5::FileAccPropList& props, bool direct, bool staged, int stagingRate);
+};
+
+#endif  // ARFDIRECTDRIVER_H_INCLUDED
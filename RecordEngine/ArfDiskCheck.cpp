@@ -0,0 +1,263 @@
+/*
+ ------------------------------------------------------------------
+
+ Michal Badura, 2016
+ based on code by Florian Franzen, 2014
+
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+#include "ArfDiskCheck.h"
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+//Waits until FILE is on the disk, rather than in the page cache
+static bool syncFile(const File& file)
+{
+#if defined(__linux__)
+    int fd = ::open(file.getFullPathName().toRawUTF8(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    bool synced = (fsync(fd) == 0);
+    ::close(fd);
+    return synced;
+#else
+    //elsewhere the rate includes what the OS still holds in its cache
+    return file.existsAsFile();
+#endif
+}
+
+ArfDiskCheck::ArfDiskCheck() : writeRate(0), start(0)
+{
+}
+
+void ArfDiskCheck::reset()
+{
+    folder = File();
+    writeRate = 0;
+}
+
+File ArfDiskCheck::getFolder() const
+{
+    return folder;
+}
+
+double ArfDiskCheck::getWriteRate() const
+{
+    return writeRate;
+}
+
+//how full the buffer of a writer may get before the test waits for it, so that nothing is dropped
+#define MAX_BACKLOG 0.5
+//how long to wait for a writer that doesn't get anything written, in ms
+#define WRITER_TIMEOUT 10000
+
+static double getBacklog(ArfFile&)
+{
+    return 0;
+}
+
+static double getBacklog(ArfRemoteWriter& writer)
+{
+    return writer.getBacklog();
+}
+
+static double getBacklog(ArfRawCapture& capture)
+{
+    return capture.getBacklog();
+}
+
+//Waits until the buffer of WRITER is at most LIMIT full; false if it stops getting anything written
+template <class Writer>
+static bool waitForWriter(Writer& writer, double limit)
+{
+    double backlog = getBacklog(writer);
+    uint32 lastProgress = Time::getMillisecondCounter();
+    while (backlog > limit)
+    {
+        Thread::sleep(1);
+        double now = getBacklog(writer);
+        if (now < backlog)
+            lastProgress = Time::getMillisecondCounter();
+        else if (Time::getMillisecondCounter() - lastProgress > WRITER_TIMEOUT)
+            return false;
+        backlog = now;
+    }
+    return true;
+}
+
+//Writes BLOCK to every channel until TOTAL bytes are written. Channel i goes to WRITERS[CHANNELSHARD[i]]
+//as its channel CHANNELINDEX[i]. Returns the bytes written, or -1 if a writer got stuck.
+template <class Writer>
+static int64 writeNoise(const Array<Writer*>& writers, const Array<int>& channelShard, const Array<int>& channelIndex,
+    const ArfRecordingInfo& info, int16* block, int blockSamples, int64 total)
+{
+    int64 written = 0;
+    while (written < total)
+    {
+        for (int i = 0; i < channelShard.size(); i++)
+        {
+            //slower channels get fewer samples, as in the recording
+            int n = jlimit(1, blockSamples, roundToInt(blockSamples * info.channelSampleRates[i] / info.sample_rate));
+            writers[channelShard[i]]->writeChannel(block, n, channelIndex[i]);
+            written += n * sizeof(int16);
+        }
+        for (int k = 0; k < writers.size(); k++)
+        {
+            if (!waitForWriter(*writers[k], MAX_BACKLOG))
+                return -1;
+        }
+    }
+    return written;
+}
+
+void ArfDiskCheck::begin(const File& target, int blockSamples)
+{
+    folder = target.getParentDirectory();
+    writeRate = 0;
+    files.clear();
+
+    //noise, so that neither the codec nor compression make it easier than the recording
+    block.malloc(jmax(1, blockSamples));
+    Random random(1);
+    for (int i = 0; i < blockSamples; i++)
+        block[i] = (int16)(random.nextInt(2001) - 1000);
+    start = Time::getMillisecondCounterHiRes();
+}
+
+bool ArfDiskCheck::finish(int64 written)
+{
+    //the rate is of data on the disk, not in the page cache
+    bool synced = (written > 0);
+    for (int i = 0; i < files.size() && synced; i++)
+        synced = syncFile(files[i]);
+    double seconds = (Time::getMillisecondCounterHiRes() - start) / 1000.0;
+    for (int i = 0; i < files.size(); i++)
+        files[i].deleteFile();
+    if (!synced)
+        return false;
+    writeRate = written / jmax(seconds, 0.001);
+    return true;
+}
+
+bool ArfDiskCheck::run(ArfFile& file, ArfRecordingInfo* info, int blockSamples, int megabytes)
+{
+    File target(file.getFileName());
+    int nChannels = info->channelSampleRates.size();
+    begin(target, blockSamples);
+    if (nChannels == 0 || blockSamples <= 0 || megabytes <= 0)
+        return false;
+
+    Array<int> channelNumbers;
+    for (int i = 0; i < nChannels; i++)
+        channelNumbers.add(i);
+    Array<int> channelShard;
+    channelShard.insertMultiple(0, 0, nChannels);
+    Array<ArfFile*> writers;
+    writers.add(&file);
+
+    target.deleteFile();
+    files.add(target);
+    if (file.open(nChannels))
+        return false;
+    file.startNewRecording(0, nChannels, info, channelNumbers, channelNumbers);
+    int64 written = writeNoise(writers, channelShard, channelNumbers, *info, block, blockSamples, (int64)megabytes << 20);
+    file.stopRecording();
+    file.close();
+    return finish(written);
+}
+
+bool ArfDiskCheck::run(const OwnedArray<ArfRemoteWriter>& writers, const Array<ArfPartDescription>& parts,
+    const Array<int>& channelShard, int blockSamples, int megabytes)
+{
+    if (parts.size() == 0 || writers.size() < parts.size() || channelShard.size() == 0 || blockSamples <= 0 || megabytes <= 0)
+        return false;
+    const ArfPartDescription& first = parts.getReference(0);
+    begin(File(first.basePath + ".arf"), blockSamples);
+
+    //the rates of all channels, in the order of CHANNELSHARD
+    ArfRecordingInfo info = first.info;
+    info.channelSampleRates.clear();
+    Array<int> channelIndex;
+    Array<int> nextChannel;
+    nextChannel.insertMultiple(0, 0, parts.size());
+    for (int i = 0; i < channelShard.size(); i++)
+    {
+        int shard = channelShard[i];
+        info.channelSampleRates.add(parts.getReference(shard).info.channelSampleRates[nextChannel[shard]]);
+        channelIndex.add(nextChannel[shard]);
+        nextChannel.set(shard, nextChannel[shard] + 1);
+    }
+
+    Array<ArfRemoteWriter*> shardWriters;
+    for (int k = 0; k < parts.size(); k++)
+    {
+        File target(parts.getReference(k).basePath + ".arf");
+        target.deleteFile();
+        files.add(target);
+        shardWriters.add(writers[k]);
+        writers[k]->openPart(parts.getReference(k));
+    }
+    int64 written = writeNoise(shardWriters, channelShard, channelIndex, info, block, blockSamples, (int64)megabytes << 20);
+    //the writers close the files before they let go of the close records
+    for (int k = 0; k < shardWriters.size(); k++)
+        shardWriters[k]->closePart();
+    for (int k = 0; k < shardWriters.size(); k++)
+    {
+        if (!waitForWriter(*shardWriters[k], 0))
+            written = -1;
+    }
+    return finish(written);
+}
+
+bool ArfDiskCheck::run(ArfRawCapture& capture, const ArfPartDescription& part, int blockSamples, int megabytes)
+{
+    if (part.nChannels == 0 || blockSamples <= 0 || megabytes <= 0)
+        return false;
+    String name = ArfRawCapture::getCaptureName(part.basePath, part.recordingNumber);
+    begin(File(name + ".dat"), blockSamples);
+    files.add(File(name + ".dat"));
+    files.add(File(name + ".evt"));
+
+    Array<int> channelNumbers;
+    for (int i = 0; i < part.nChannels; i++)
+        channelNumbers.add(i);
+    Array<int> channelShard;
+    channelShard.insertMultiple(0, 0, part.nChannels);
+    Array<ArfRawCapture*> writers;
+    writers.add(&capture);
+
+    if (!capture.openPart(part))
+        return false;
+    int64 written = writeNoise(writers, channelShard, channelNumbers, part.info, block, blockSamples, (int64)megabytes << 20);
+    capture.closePart();
+    if (!waitForWriter(capture, 0))
+        written = -1;
+    return finish(written);
+}
+
+double ArfDiskCheck::getRequiredRate(const ArfRecordingInfo& info, const ArfSchemaRegistry& schema)
+{
+    double rate = 0;
+    for (int i = 0; i < info.channelSampleRates.size(); i++)
+        rate += info.channelSampleRates[i] * sizeof(int16);
+    rate += ARF_DISK_EVENT_RATE * ARF_DISK_EVENT_BYTES;
+    for (int i = 0; i < schema.getNumChannelGroups(); i++)
+        rate += ARF_DISK_SPIKE_RATE * (schema.getChannelGroupSize(i) * ARF_DISK_SPIKE_SAMPLES * sizeof(int16) + 16);
+    return rate;
+}
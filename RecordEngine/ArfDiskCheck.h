@@ -0,0 +1,87 @@
+/*
+ ------------------------------------------------------------------
+
+ Michal Badura, 2016
+ based on code by Florian Franzen, 2014
+
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+#ifndef ARFDISKCHECK_H_INCLUDED
+#define ARFDISKCHECK_H_INCLUDED
+
+#include "ArfRemoteWriter.h"
+#include "ArfRawCapture.h"
+
+//the disk should take this many times the data rate of the recording: the test is short, and
+//disks slow down as they fill up or when something else is using them
+#define ARF_DISK_HEADROOM 2.0
+//warn if the disk has room for less recording than this, in seconds
+#define ARF_DISK_MIN_FREE_SECONDS 3600
+//What the events and spikes can add to the samples, on top of the channels: events per second
+//(and bytes per event with its text), and spikes per second on every electrode
+#define ARF_DISK_EVENT_RATE 1000
+#define ARF_DISK_EVENT_BYTES 64
+#define ARF_DISK_SPIKE_RATE 100
+//samples per channel of a spike waveform
+#define ARF_DISK_SPIKE_SAMPLES 40
+
+//Preflight of the folder a recording goes to. Writes a short recording of noise through the writer
+//the parts will use (an ArfFile set up like them, the writer processes or the raw capture), syncs it
+//to disk and deletes it again, so that a disk that can't keep up shows before the session rather
+//than as lost data minutes into it.
+class ArfDiskCheck
+{
+public:
+    ArfDiskCheck();
+
+    //Records MEGABYTES of samples into FILE, which has been given its name and settings but is not
+    //open, with the channels of INFO in blocks of BLOCKSAMPLES samples at the main rate.
+    //Returns false if the file could not be written.
+    bool run(ArfFile& file, ArfRecordingInfo* info, int blockSamples, int megabytes);
+    //The same through writer processes: WRITERS[k] records PARTS[k], and CHANNELSHARD gives the
+    //part of every channel, as for a recording
+    bool run(const OwnedArray<ArfRemoteWriter>& writers, const Array<ArfPartDescription>& parts,
+        const Array<int>& channelShard, int blockSamples, int megabytes);
+    //The same through a raw capture of PART
+    bool run(ArfRawCapture& capture, const ArfPartDescription& part, int blockSamples, int megabytes);
+    //forgets the last test, so that the next one runs again
+    void reset();
+
+    //folder of the last test, and the bytes per second its file was written and synced at
+    File getFolder() const;
+    double getWriteRate() const;
+
+    //bytes per second a recording of INFO needs at most: the samples, and the budget of events
+    //and of spikes on the electrodes of SCHEMA
+    static double getRequiredRate(const ArfRecordingInfo& info, const ArfSchemaRegistry& schema);
+
+private:
+    //sets up the noise block and starts the clock for a test in the folder of TARGET
+    void begin(const File& target, int blockSamples);
+    //syncs and deletes the files of the test, WRITTEN is what was written or -1
+    bool finish(int64 written);
+
+    File folder;
+    double writeRate;
+    Array<File> files;
+    HeapBlock<int16> block;
+    double start;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ArfDiskCheck);
+};
+
+#endif  // ARFDISKCHECK_H_INCLUDED
@@ -21,22 +21,54 @@
  */
 
 #include <H5Cpp.h>
+#include <H5DOpublic.h>
 #include "ArfFileFormat.h"
+#include "ArfTypedDataset.h"
+#include "ArfOverview.h"
+#include "ArfChecksum.h"
+#include "ArfDirectDriver.h"
+#include "ArfCodec.h"
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#endif
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
-#ifndef CHUNK_XSIZE
-#define CHUNK_XSIZE 2048
+#ifndef SPIKE_CHUNK_YSIZE
+#define SPIKE_CHUNK_YSIZE 40
 #endif
 
-#ifndef EVENT_CHUNK_SIZE
-#define EVENT_CHUNK_SIZE 8
+#ifndef OVERVIEW_CHUNK_SIZE
+#define OVERVIEW_CHUNK_SIZE 256
+#endif
+#ifndef CHUNK_STATS_CHUNK_SIZE
+#define CHUNK_STATS_CHUNK_SIZE 1024
 #endif
 
-#ifndef SPIKE_CHUNK_XSIZE
-#define SPIKE_CHUNK_XSIZE 8
+#ifndef PACKED_SPIKE_CHUNK_SIZE
+#define PACKED_SPIKE_CHUNK_SIZE 64
+#endif
+#ifndef PACKED_SPIKE_INDEX_CHUNK_SIZE
+#define PACKED_SPIKE_INDEX_CHUNK_SIZE 4096
 #endif
 
-#ifndef SPIKE_CHUNK_YSIZE
-#define SPIKE_CHUNK_YSIZE 40
+//event rows of a type kept in memory before they are written together
+#ifndef EVENT_BATCH_ROWS
+#define EVENT_BATCH_ROWS 256
+#endif
+//where the payload of an event row starts, right after the node id
+#define EVENT_PAYLOAD_OFFSET (HOFFSET(ArfFile::EventHeader, nodeID) + sizeof(uint8))
+
+#ifndef MESSAGE_TEXT_CHUNK_SIZE
+#define MESSAGE_TEXT_CHUNK_SIZE 4096
+#endif
+#ifndef MESSAGE_TEXT_ENTRIES
+#define MESSAGE_TEXT_ENTRIES 4096
 #endif
 
 #ifndef TIMESTAMP_CHUNK_SIZE
@@ -47,18 +79,54 @@
 
 //#define MAX_STR_SIZE 256 //defined in .h file
 
+#ifndef GROUP_LINK_SIZE_HINT
+#define GROUP_LINK_SIZE_HINT 16
+#endif
+
+//Object headers keep up to this many attributes in compact form
+#ifndef ATTR_MAX_COMPACT
+#define ATTR_MAX_COMPACT 16
+#endif
+
 #define ARF_VERSION "2.1"
 
+//Placeholder name of the recording skeleton in a part template
+#define TEMPLATE_RECORDING "/rec_template"
+
+//Growth step of in-memory files
+#define MEMORY_FILE_INCREMENT (1 << 20)
+
+//File space page of the paged layout. Big enough for the object headers and index nodes of
+//dozens of channels, small enough that the partly used pages at the end of a part don't matter
+#define LAYOUT_PAGE_SIZE (256 << 10)
+//Metadata and small raw data are allocated in blocks of this size; with paged file space
+//(HDF5 1.10.1 and later) the pages do this instead
+#define LAYOUT_BLOCK_SIZE (1 << 20)
+
 #define PROCESS_ERROR std::cerr << error.getCDetailMsg() << std::endl; return -1
 #define CHECK_ERROR(x) if (x) std::cerr << "Error at HDFRecording " << __LINE__ << std::endl;
 
 using namespace H5;
 
+struct ArfMetadataBuilder::Entry
+{
+    String name;
+    ArfFileBase::DataTypes type;
+    int size;
+    bool asArray;
+    String str;
+    HeapBlock<char> data;
+};
+
 //HDF5FileBase
 
-ArfFileBase::ArfFileBase() : readyToOpen(false), opened(false)
+ArfFileBase::ArfFileBase() : readyToOpen(false), opened(false), inMemory(false), backingStore(false), readOnly(false), compressionLevel(0), codec(false),
+    cacheBytes(0), cacheSlots(1667), cacheChunkSize(CHUNK_XSIZE), directIO(false), staging(false), stagingRate(0),
+    pagedLayout(false), preallocateBytes(0)
 {
     Exception::dontPrint();
+    //before anything is opened, so that files with coded datasets can be read as well
+    ArfCodec::registerFilter();
 };
 
 ArfFileBase::~ArfFileBase()
@@ -91,6 +159,30 @@ int ArfFileBase::open(int nChans)
 
 }
 
+int ArfFileBase::openReadOnly()
+{
+    if (!readyToOpen || opened) return -1;
+    try
+    {
+        file = new H5File(getFileName().toUTF8(), H5F_ACC_RDONLY);
+        opened = true;
+        readOnly = true;
+        return 0;
+    }
+    catch (FileIException error)
+    {
+        PROCESS_ERROR;
+    }
+}
+
+int ArfFileBase::openInMemory(int nChans, bool backingStore)
+{
+    if (!readyToOpen) return -1;
+    inMemory = true;
+    this->backingStore = backingStore;
+    return open(true, nChans);
+}
+
 int ArfFileBase::open(bool newfile, int nChans)
 {
     int accFlags,ret=0;
@@ -99,16 +191,45 @@ int ArfFileBase::open(bool newfile, int nChans)
 
     try
     {
-		FileAccPropList props = FileAccPropList::DEFAULT;
+		//A fresh list: a copy of DEFAULT shares its id, and the settings would leak into every later open
+		FileAccPropList props;
 		if (nChans > 0)
 		{
-			props.setCache(0, 1667, 2 * 8 * 2 * CHUNK_XSIZE * nChans, 1);
+			props.setCache(0, cacheSlots, (cacheBytes > 0) ? cacheBytes : 2 * 8 * 2 * (int64)cacheChunkSize * nChans, 1);
+		}
+		if (inMemory)
+		{
+			props.setCore(MEMORY_FILE_INCREMENT, backingStore);
+		}
+		else if ((directIO || staging) && !ArfDirectDriver::setFileAccess(props, directIO, staging, stagingRate))
+		{
+			std::cerr << "Direct I/O and staging are not available, writing through the page cache" << std::endl;
+		}
+
+		FileCreatPropList fcpl;
+		if (pagedLayout)
+		{
+			//Objects in the latest format, but a superblock that 1.10 doesn't mark as open for
+			//writing, so that a restarted arf-writer and readers can still open a part in progress
+#if H5_VERSION_GE(1, 10, 2)
+			props.setLibverBounds(H5F_LIBVER_V18, H5F_LIBVER_LATEST);
+#else
+			props.setLibverBounds(H5F_LIBVER_LATEST, H5F_LIBVER_LATEST);
+#endif
+			H5Pset_meta_block_size(props.getId(), LAYOUT_BLOCK_SIZE);
+			H5Pset_small_data_block_size(props.getId(), LAYOUT_BLOCK_SIZE);
+#if H5_VERSION_GE(1, 10, 1)
+			//an existing file keeps the strategy it was created with
+			H5Pset_file_space_strategy(fcpl.getId(), H5F_FSPACE_STRATEGY_PAGE, false, 1);
+			H5Pset_file_space_page_size(fcpl.getId(), LAYOUT_PAGE_SIZE);
+#endif
 		}
 
         if (newfile) accFlags = H5F_ACC_TRUNC;
         else accFlags = H5F_ACC_RDWR;
-        file = new H5File(getFileName().toUTF8(),accFlags,FileCreatPropList::DEFAULT,props);
+        file = new H5File(getFileName().toUTF8(),accFlags,fcpl,props);
         opened = true;
+        preallocate();
         if (newfile)
         {
             ret = createFileStructure();
@@ -130,131 +251,208 @@ int ArfFileBase::open(bool newfile, int nChans)
     }
 }
 
+int ArfFileBase::flush()
+{
+    if (!opened) return -1;
+    try
+    {
+        file->flush(H5F_SCOPE_GLOBAL);
+    }
+    catch (FileIException error)
+    {
+        PROCESS_ERROR;
+    }
+    return 0;
+}
+
 void ArfFileBase::close()
 {
     file = nullptr;
     opened = false;
+    inMemory = false;
+    backingStore = false;
+    readOnly = false;
+#if defined(__linux__)
+    //Cutting a file to the size it has frees the blocks reserved past its end
+    if (preallocatedPath.isNotEmpty())
+    {
+        int fd = ::open(preallocatedPath.toUTF8(), O_RDWR);
+        struct stat st;
+        if (fd >= 0 && fstat(fd, &st) == 0)
+            ftruncate(fd, st.st_size);
+        if (fd >= 0)
+            ::close(fd);
+    }
+#endif
+    preallocatedPath = String();
 }
 
-int ArfFileBase::setAttribute(DataTypes type, void* data, String path, String name)
+void ArfFileBase::setCompression(int level)
 {
-    return setAttributeArray(type, data, 1, path, name);
+    compressionLevel = jlimit(0, 9, level);
+}
+
+void ArfFileBase::setCache(int64 bytes, int slots, int chunkSize)
+{
+    cacheBytes = bytes;
+    cacheSlots = slots;
+    cacheChunkSize = chunkSize;
 }
 
+void ArfFileBase::setDirectIO(bool direct)
+{
+    directIO = direct;
+}
 
-//Create array of type TYPE, versus setAttributeArray that creates a scalar of type array
-int ArfFileBase::setAttributeAsArray(DataTypes type, void* data, int size, String path, String name)
+void ArfFileBase::setStaging(bool staged, int rate)
 {
-    H5Location* loc;
-    Group gloc;
-    DataSet dloc;
-    Attribute attr;
-    DataType H5type;
-    DataType origType;
+    staging = staged;
+    stagingRate = rate;
+}
 
-    if (!opened) return -1;
-    try
-    {
-        try
-        {
-            gloc = file->openGroup(path.toUTF8());
-            loc = &gloc;
-        }
-        catch (FileIException error) //If there is no group with that path, try a dataset
-        {
-            dloc = file->openDataSet(path.toUTF8());
-            loc = &dloc;
-        }
+void ArfFileBase::setPagedLayout(bool paged, int64 bytes)
+{
+    pagedLayout = paged;
+    preallocateBytes = bytes;
+}
 
-        H5type = getH5Type(type);
-        origType = getNativeType(type);
+void ArfFileBase::preallocate()
+{
+#if defined(__linux__)
+    //Reserved without changing the size of the file, so HDF5 doesn't see it. Both the default
+    //driver and ArfDirectDriver hand out their file descriptor
+    void* handle = nullptr;
+    if (inMemory || preallocateBytes <= 0 || H5Fget_vfd_handle(file->getId(), H5P_DEFAULT, &handle) < 0 || handle == nullptr)
+        return;
+    if (fallocate(*(int*)handle, FALLOC_FL_KEEP_SIZE, 0, (off_t)preallocateBytes) == 0)
+        preallocatedPath = getFileName();
+    else
+        std::cerr << "Could not reserve " << (preallocateBytes >> 20) << " MB for " << getFileName() << ": " << strerror(errno) << std::endl;
+#endif
+}
 
-        hsize_t dims = size;
+int ArfFileBase::getCompression() const
+{
+    return compressionLevel;
+}
 
-        if (loc->attrExists(name.toUTF8()))
-        {
-            attr = loc->openAttribute(name.toUTF8());
-        }
-        else
-        {
-            DataSpace attr_dataspace(1, &dims); //create a 1d simple dataspace of len SIZE
-            attr = loc->createAttribute(name.toUTF8(),H5type,attr_dataspace);
-        }
+void ArfFileBase::setCodec(bool useCodec)
+{
+    codec = useCodec;
+}
 
-        attr.write(origType,data);
+bool ArfFileBase::getCodec() const
+{
+    return codec;
+}
 
-    }
-    catch (GroupIException error)
+void ArfFileBase::setFilters(DSetCreatPropList& prop, bool samples)
+{
+    //Optional, so that a chunk the filter can't take is stored as it is
+    if (codec && samples)
     {
-        PROCESS_ERROR;
+        H5Pset_filter(prop.getId(), ARF_CODEC_FILTER, H5Z_FLAG_OPTIONAL, 0, nullptr);
+        return;
     }
-    catch (AttributeIException error)
+    //shuffling the bytes of the int16 samples first roughly doubles what deflate gets out of them
+    if (compressionLevel > 0)
     {
-        PROCESS_ERROR;
+        prop.setShuffle();
+        prop.setDeflate(compressionLevel);
     }
-    catch (DataSetIException error)
+}
+
+bool ArfFileBase::getFileImage(MemoryBlock& image)
+{
+    if (!opened) return false;
+    try
     {
-        PROCESS_ERROR;
+        file->flush(H5F_SCOPE_GLOBAL);
+        ssize_t size = H5Fget_file_image(file->getId(), nullptr, 0);
+        if (size <= 0) return false;
+        image.setSize(size);
+        return H5Fget_file_image(file->getId(), image.getData(), size) == size;
     }
     catch (FileIException error)
     {
-        PROCESS_ERROR;
+        std::cerr << error.getCDetailMsg() << std::endl;
+        return false;
     }
+}
 
+int ArfFileBase::moveObject(String src, String dst)
+{
+    if (!opened) return -1;
+    if (H5Lexists(file->getId(), src.toUTF8(), H5P_DEFAULT) <= 0) return -1;
+    if (H5Lmove(file->getId(), src.toUTF8(), file->getId(), dst.toUTF8(), H5P_DEFAULT, H5P_DEFAULT) < 0) return -1;
     return 0;
 }
 
-int ArfFileBase::setAttributeArray(DataTypes type, void* data, int size, String path, String name)
+int ArfFileBase::deleteObject(String path)
 {
-    H5Location* loc;
-    Group gloc;
-    DataSet dloc;
-    Attribute attr;
-    DataType H5type;
-    DataType origType;
+    if (!opened) return -1;
+    if (H5Lexists(file->getId(), path.toUTF8(), H5P_DEFAULT) <= 0) return 0;
+    if (H5Ldelete(file->getId(), path.toUTF8(), H5P_DEFAULT) < 0) return -1;
+    return 0;
+}
+
+int ArfFileBase::setAttribute(DataTypes type, void* data, String path, String name)
+{
+    return setAttributeArray(type, data, 1, path, name);
+}
+
+
+//Create array of type TYPE, versus setAttributeArray that creates a scalar of type array
+int ArfFileBase::setAttributeAsArray(DataTypes type, void* data, int size, String path, String name)
+{
+    ArfMetadataBuilder md;
 
     if (!opened) return -1;
-    try
-    {
-        try
-        {
-            gloc = file->openGroup(path.toUTF8());
-            loc = &gloc;
-        }
-        catch (FileIException error) //If there is no group with that path, try a dataset
-        {
-            dloc = file->openDataSet(path.toUTF8());
-            loc = &dloc;
-        }
+    md.addAsArray(type, data, size, name);
+    return writeMetadata(path, md);
+}
 
-        H5type = getH5Type(type);
-        origType = getNativeType(type);
+int ArfFileBase::setAttributeArray(DataTypes type, void* data, int size, String path, String name)
+{
+    ArfMetadataBuilder md;
 
-        if (size > 1)
-        {
-            hsize_t dims = size;
-            H5type = ArrayType(H5type,1,&dims);
-            origType = ArrayType(origType,1,&dims);
-        }
+    if (!opened) return -1;
+    md.add(type, data, name, size);
+    return writeMetadata(path, md);
+}
 
-        if (loc->attrExists(name.toUTF8()))
-        {
-            attr = loc->openAttribute(name.toUTF8());
-        }
-        else
-        {
-            DataSpace attr_dataspace(H5S_SCALAR);
-            attr = loc->createAttribute(name.toUTF8(),H5type,attr_dataspace);
-        }
+int ArfFileBase::setAttributeStr(String value, String path, String name)
+{
+    ArfMetadataBuilder md;
 
-        attr.write(origType,data);
+    if (!opened) return -1;
+    md.addStr(value, name);
+    return writeMetadata(path, md);
+}
 
+H5Object* ArfFileBase::openObject(String path, Group& gloc, DataSet& dloc)
+{
+    //Checking the type first is much cheaper than letting openGroup fail on every dataset
+    if (file->childObjType(path.toUTF8()) == H5O_TYPE_GROUP)
+    {
+        gloc = file->openGroup(path.toUTF8());
+        return &gloc;
     }
-    catch (GroupIException error)
+    dloc = file->openDataSet(path.toUTF8());
+    return &dloc;
+}
+
+int ArfFileBase::writeMetadata(String path, const ArfMetadataBuilder& md)
+{
+    Group gloc;
+    DataSet dloc;
+
+    if (!opened) return -1;
+    try
     {
-        PROCESS_ERROR;
+        return writeMetadata(openObject(path, gloc, dloc), md);
     }
-    catch (AttributeIException error)
+    catch (GroupIException error)
     {
         PROCESS_ERROR;
     }
@@ -266,45 +464,66 @@ int ArfFileBase::setAttributeArray(DataTypes type, void* data, int size, String
     {
         PROCESS_ERROR;
     }
-
-    return 0;
 }
 
-int ArfFileBase::setAttributeStr(String value, String path, String name)
+int ArfFileBase::writeMetadata(ArfRecordingData* dSet, const ArfMetadataBuilder& md)
 {
-    H5Location* loc;
-    Group gloc;
-    DataSet dloc;
-    Attribute attr;
+    if (!opened || dSet == nullptr) return -1;
+    return writeMetadata(dSet->dSet.get(), md);
+}
 
-    if (!opened) return -1;
+int ArfFileBase::writeMetadata(H5Object* loc, const ArfMetadataBuilder& md)
+{
+    DataSpace scalarSpace(H5S_SCALAR);
+    int ret = 0;
 
-    StrType type(PredType::C_S1, value.length());
     try
     {
-        try
-        {
-            gloc = file->openGroup(path.toUTF8());
-            loc = &gloc;
-        }
-        catch (FileIException error) //If there is no group with that path, try a dataset
+        for (int i = 0; i < md.entries.size(); i++)
         {
-            dloc = file->openDataSet(path.toUTF8());
-            loc = &dloc;
+            const ArfMetadataBuilder::Entry* entry = md.entries[i];
+            Attribute attr;
+
+            if (entry->type == STR)
+            {
+                if (loc->attrExists(entry->name.toUTF8()))
+                {
+                    //string attributes cannot change size easily, better not allow overwritting.
+                    ret = -1;
+                    continue;
+                }
+                StrType type(PredType::C_S1, jmax<size_t>(1, entry->str.getNumBytesAsUTF8()));
+                attr = loc->createAttribute(entry->name.toUTF8(), type, scalarSpace);
+                attr.write(type, entry->str.toUTF8());
+                continue;
+            }
+
+            DataType H5type = getH5Type(entry->type);
+            DataType origType = getNativeType(entry->type);
+            hsize_t dims = entry->size;
+
+            if (!entry->asArray && entry->size > 1)
+            {
+                H5type = ArrayType(H5type, 1, &dims);
+                origType = ArrayType(origType, 1, &dims);
+            }
+
+            if (loc->attrExists(entry->name.toUTF8()))
+            {
+                attr = loc->openAttribute(entry->name.toUTF8());
+            }
+            else if (entry->asArray)
+            {
+                DataSpace attr_dataspace(1, &dims); //create a 1d simple dataspace of len SIZE
+                attr = loc->createAttribute(entry->name.toUTF8(), H5type, attr_dataspace);
+            }
+            else
+            {
+                attr = loc->createAttribute(entry->name.toUTF8(), H5type, scalarSpace);
+            }
+
+            attr.write(origType, entry->data);
         }
-
-        if (loc->attrExists(name.toUTF8()))
-        {
-            //attr = loc.openAttribute(name.toUTF8());
-            return -1; //string attributes cannot change size easily, better not allow overwritting.
-        }
-        else
-        {
-            DataSpace attr_dataspace(H5S_SCALAR);
-            attr = loc->createAttribute(name.toUTF8(), type, attr_dataspace);
-        }
-        attr.write(type,value.toUTF8());
-
     }
     catch (GroupIException error)
     {
@@ -314,17 +533,16 @@ int ArfFileBase::setAttributeStr(String value, String path, String name)
     {
         PROCESS_ERROR;
     }
-    catch (FileIException error)
+    catch (DataSetIException error)
     {
         PROCESS_ERROR;
     }
-    catch (DataSetIException error)
+    catch (FileIException error)
     {
         PROCESS_ERROR;
     }
 
-
-    return 0;
+    return ret;
 }
 
 int ArfFileBase::createGroup(String path)
@@ -345,6 +563,27 @@ int ArfFileBase::createGroup(String path)
     return 0;
 }
 
+int ArfFileBase::createGroup(String path, const ArfMetadataBuilder& md, int nLinks)
+{
+    Group group;
+
+    if (!opened) return -1;
+    try
+    {
+        //size the local heap for the link names up front, so that it doesn't grow channel by channel
+        group = file->createGroup(path.toUTF8(), nLinks * GROUP_LINK_SIZE_HINT);
+    }
+    catch (FileIException error)
+    {
+        PROCESS_ERROR;
+    }
+    catch (GroupIException error)
+    {
+        PROCESS_ERROR;
+    }
+    return writeMetadata(&group, md);
+}
+
 ArfRecordingData* ArfFileBase::getDataSet(String path)
 {
     ScopedPointer<DataSet> data;
@@ -441,6 +680,8 @@ ArfRecordingData* ArfFileBase::createDataSet(DataTypes type, int dimension, int*
     {
         DataSpace dSpace(dimension,dims,max_dims);
         prop.setChunk(dimension,chunk_dims);
+        setFilters(prop, type == I16);
+        H5Pset_attr_phase_change(prop.getId(), ATTR_MAX_COMPACT, ATTR_MAX_COMPACT/2);
 
         data = new DataSet(file->createDataSet(path.toUTF8(),H5type,dSpace,prop));
         return new ArfRecordingData(data.release());
@@ -464,43 +705,171 @@ ArfRecordingData* ArfFileBase::createDataSet(DataTypes type, int dimension, int*
 
 }
 
-//Creates a dataset: an array of HDF5 CompoundType 
-//If you want a dimension i to be unlimited, pass chunk_dims[i]=NCHUNK and max_dims[i]=0. If limited, pass max_dims[i]=N and chunk_dims[i]=N.
-ArfRecordingData* ArfFileBase::createCompoundDataSet(CompType type, String path, int dimension, int* max_dims, int* chunk_dims)
+CompType ArfFileBase::getCommittedType(const CompType& type, String path)
 {
-    ScopedPointer<DataSet> data;
-    DSetCreatPropList prop;
-    
-    hsize_t Hdims[3];
-    hsize_t Hmax_dims [3];
-    hsize_t Hchunk_dims[3];
+    CompType committed;
 
-    for (int i=0; i < dimension; i++)
+    try
     {
-        Hchunk_dims[i] = chunk_dims[i];
-        if (chunk_dims[i] > 0 && chunk_dims[i] != max_dims[i])
-        {
-            Hmax_dims[i] = H5S_UNLIMITED;
-            Hdims[i] = 0;
-        }
-        else
+        String group = path.upToLastOccurrenceOf("/", false, false);
+        if (H5Lexists(file->getId(), group.toUTF8(), H5P_DEFAULT) <= 0)
+            file->createGroup(group.toUTF8());
+        if (H5Lexists(file->getId(), path.toUTF8(), H5P_DEFAULT) > 0)
+            return file->openCompType(path.toUTF8());
+
+        committed.copy(type);
+        committed.commit(*file, path.toUTF8());
+        return committed;
+    }
+    catch (Exception error)
+    {
+        //Datasets will still be written, only with their own copy of the type
+        std::cerr << "Could not commit datatype " << path << ": " << error.getCDetailMsg() << std::endl;
+        return type;
+    }
+}
+
+StringArray ArfFileBase::getChildNames(String path)
+{
+    StringArray names;
+    if (!opened) return names;
+    try
+    {
+        Group group = file->openGroup(path.toUTF8());
+        for (hsize_t i = 0; i < group.getNumObjs(); i++)
+            names.add(String(group.getObjnameByIdx(i).c_str()));
+    }
+    catch (Exception error)
+    {
+        std::cerr << error.getCDetailMsg() << std::endl;
+    }
+    return names;
+}
+
+int ArfFileBase::copyAttributes(ArfFileBase& source, String srcPath, String dstPath)
+{
+    Group sgloc, dgloc;
+    DataSet sdloc, ddloc;
+
+    if (!opened || !source.opened) return -1;
+    try
+    {
+        H5Object* src = source.openObject(srcPath, sgloc, sdloc);
+        H5Object* dst = openObject(dstPath, dgloc, ddloc);
+        for (int i = 0; i < src->getNumAttrs(); i++)
         {
-            Hmax_dims[i] = max_dims[i];
-            Hdims[i] = max_dims[i];
+            Attribute attr = src->openAttribute((unsigned int)i);
+            DataType type = attr.getDataType();
+            DataSpace space = attr.getSpace();
+            HeapBlock<char> data;
+            data.calloc(jmax<size_t>(1, type.getSize() * space.getSimpleExtentNpoints()));
+            attr.read(type, data);
+            String name(attr.getName().c_str());
+            if (dst->attrExists(name.toUTF8()))
+                dst->removeAttr(name.toUTF8());
+            dst->createAttribute(name.toUTF8(), type, space).write(type, data);
         }
-    }   
-    
-    DataSpace dSpace(dimension, Hdims, Hmax_dims);
-    prop.setChunk(dimension, Hchunk_dims);
-    data = new DataSet(file->createDataSet(path.toUTF8(),type,dSpace,prop));
-    return new ArfRecordingData(data.release());  
+    }
+    catch (Exception error)
+    {
+        PROCESS_ERROR;
+    }
+    return 0;
 }
 
-H5::DataType ArfFileBase::getNativeType(DataTypes type)
+int ArfFileBase::copyNamedTypes(ArfFileBase& source, String recordPath)
 {
-    switch (type)
+    if (!opened || !source.opened) return -1;
+    String group = recordPath + "/" + ARF_TYPES_GROUP;
+    //files from before the types were kept per recording have them in /types
+    String sourceGroup = group;
+    if (H5Lexists(source.file->getId(), recordPath.toUTF8(), H5P_DEFAULT) <= 0
+        || H5Lexists(source.file->getId(), group.toUTF8(), H5P_DEFAULT) <= 0)
+        sourceGroup = "/types";
+    if (H5Lexists(source.file->getId(), sourceGroup.toUTF8(), H5P_DEFAULT) <= 0) return 0;
+    StringArray names = source.getChildNames(sourceGroup);
+    try
     {
-        case I8:
+        if (H5Lexists(file->getId(), group.toUTF8(), H5P_DEFAULT) <= 0)
+            file->createGroup(group.toUTF8());
+        for (int i = 0; i < names.size(); i++)
+        {
+            String path = group + "/" + names[i];
+            if (H5Lexists(file->getId(), path.toUTF8(), H5P_DEFAULT) > 0)
+                continue;
+            String sourcePath = sourceGroup + "/" + names[i];
+            if (H5Ocopy(source.file->getId(), sourcePath.toUTF8(), file->getId(), path.toUTF8(), H5P_DEFAULT, H5P_DEFAULT) < 0)
+                return -1;
+        }
+    }
+    catch (Exception error)
+    {
+        PROCESS_ERROR;
+    }
+    return 0;
+}
+
+DataType ArfFileBase::findNamedType(const DataType& type, String recordPath)
+{
+    String group = recordPath + "/" + ARF_TYPES_GROUP;
+    if (!opened || H5Lexists(file->getId(), group.toUTF8(), H5P_DEFAULT) <= 0)
+        return type;
+    StringArray names = getChildNames(group);
+    try
+    {
+        for (int i = 0; i < names.size(); i++)
+        {
+            DataType named = file->openDataType((group + "/" + names[i]).toUTF8());
+            if (named == type)
+                return named;
+        }
+    }
+    catch (Exception error)
+    {
+        std::cerr << error.getCDetailMsg() << std::endl;
+    }
+    return type;
+}
+
+//Creates a dataset: an array of HDF5 CompoundType 
+//If you want a dimension i to be unlimited, pass chunk_dims[i]=NCHUNK and max_dims[i]=0. If limited, pass max_dims[i]=N and chunk_dims[i]=N.
+ArfRecordingData* ArfFileBase::createCompoundDataSet(DataType type, String path, int dimension, int* max_dims, int* chunk_dims)
+{
+    ScopedPointer<DataSet> data;
+    DSetCreatPropList prop;
+    
+    hsize_t Hdims[3];
+    hsize_t Hmax_dims [3];
+    hsize_t Hchunk_dims[3];
+
+    for (int i=0; i < dimension; i++)
+    {
+        Hchunk_dims[i] = chunk_dims[i];
+        if (chunk_dims[i] > 0 && chunk_dims[i] != max_dims[i])
+        {
+            Hmax_dims[i] = H5S_UNLIMITED;
+            Hdims[i] = 0;
+        }
+        else
+        {
+            Hmax_dims[i] = max_dims[i];
+            Hdims[i] = max_dims[i];
+        }
+    }   
+    
+    DataSpace dSpace(dimension, Hdims, Hmax_dims);
+    prop.setChunk(dimension, Hchunk_dims);
+    setFilters(prop, false);
+    H5Pset_attr_phase_change(prop.getId(), ATTR_MAX_COMPACT, ATTR_MAX_COMPACT/2);
+    data = new DataSet(file->createDataSet(path.toUTF8(),type,dSpace,prop));
+    return new ArfRecordingData(data.release());  
+}
+
+H5::DataType ArfFileBase::getNativeType(DataTypes type)
+{
+    switch (type)
+    {
+        case I8:
             return PredType::NATIVE_INT8;
             break;
         case I16:
@@ -572,17 +941,97 @@ H5::DataType ArfFileBase::getH5Type(DataTypes type)
     return PredType::STD_I32LE;
 }
 
+//ArfMetadataBuilder
+
+ArfMetadataBuilder::ArfMetadataBuilder() {}
+
+ArfMetadataBuilder::~ArfMetadataBuilder() {}
+
+void ArfMetadataBuilder::add(ArfFileBase::DataTypes type, const void* data, String name, int size)
+{
+    Entry* entry = entries.add(new Entry());
+    size_t nBytes = ArfFileBase::getNativeType(type).getSize() * size;
+    entry->name = name;
+    entry->type = type;
+    entry->size = size;
+    entry->asArray = false;
+    entry->data.malloc(nBytes);
+    memcpy(entry->data, data, nBytes);
+}
+
+void ArfMetadataBuilder::addAsArray(ArfFileBase::DataTypes type, const void* data, int size, String name)
+{
+    add(type, data, name, size);
+    entries.getLast()->asArray = true;
+}
+
+void ArfMetadataBuilder::addStr(String value, String name)
+{
+    Entry* entry = entries.add(new Entry());
+    entry->name = name;
+    entry->type = ArfFileBase::STR;
+    entry->size = 1;
+    entry->asArray = false;
+    entry->str = value;
+}
+
+void ArfMetadataBuilder::clear()
+{
+    entries.clear();
+}
+
+int ArfMetadataBuilder::size() const
+{
+    return entries.size();
+}
+
+//ArfNativeType, see ArfTypedDataset.h
+
+const DataType& ArfNativeType<int8>::get() { return PredType::NATIVE_INT8; }
+const DataType& ArfNativeType<uint8>::get() { return PredType::NATIVE_UINT8; }
+const DataType& ArfNativeType<int16>::get() { return PredType::NATIVE_INT16; }
+const DataType& ArfNativeType<uint16>::get() { return PredType::NATIVE_UINT16; }
+const DataType& ArfNativeType<int32>::get() { return PredType::NATIVE_INT32; }
+const DataType& ArfNativeType<uint32>::get() { return PredType::NATIVE_UINT32; }
+const DataType& ArfNativeType<int64>::get() { return PredType::NATIVE_INT64; }
+const DataType& ArfNativeType<uint64>::get() { return PredType::NATIVE_UINT64; }
+const DataType& ArfNativeType<float>::get() { return PredType::NATIVE_FLOAT; }
+
+//The native type for the writes that still name it with ArfFileBase::DataTypes, without building
+//a new DataType every time like ArfFileBase::getNativeType
+static const DataType& getStoredNativeType(ArfFileBase::DataTypes type)
+{
+    switch (type)
+    {
+        case ArfFileBase::I8: return ArfNativeType<int8>::get();
+        case ArfFileBase::I16: return ArfNativeType<int16>::get();
+        case ArfFileBase::I32: return ArfNativeType<int32>::get();
+        case ArfFileBase::I64: return ArfNativeType<int64>::get();
+        case ArfFileBase::U8: return ArfNativeType<uint8>::get();
+        case ArfFileBase::U16: return ArfNativeType<uint16>::get();
+        case ArfFileBase::U32: return ArfNativeType<uint32>::get();
+        case ArfFileBase::U64: return ArfNativeType<uint64>::get();
+        case ArfFileBase::F32: return ArfNativeType<float>::get();
+        case ArfFileBase::STR:
+        {
+            //never released, HDF5 may already be shut down when static objects are destroyed
+            static const StrType* strType = new StrType(PredType::C_S1, MAX_STR_SIZE);
+            return *strType;
+        }
+    }
+    return ArfNativeType<int32>::get();
+}
+
 ArfRecordingData::ArfRecordingData(DataSet* data)
 {
-    DataSpace dSpace;
     DSetCreatPropList prop;
     ScopedPointer<DataSet> dataSet = data;
     hsize_t dims[3], chunk[3];
 
-    dSpace = dataSet->getSpace();
+    fileSpace = new DataSpace(dataSet->getSpace());
     prop = dataSet->getCreatePlist();
 
-    dimension = dSpace.getSimpleExtentDims(dims);
+    dimension = fileSpace->getSimpleExtentDims(dims);
     prop.getChunk(dimension,chunk);
 
     this->size[0] = dims[0];
@@ -590,7 +1039,7 @@ ArfRecordingData::ArfRecordingData(DataSet* data)
         this->size[1] = dims[1];
     else
         this->size[1] = 1;
-    if (dimension > 1)
+    if (dimension > 2)
         this->size[2] = dims[2];
     else
         this->size[2] = 1;
@@ -600,59 +1049,63 @@ ArfRecordingData::ArfRecordingData(DataSet* data)
     this->dSet = dataSet;
     this->rowXPos.clear();
     this->rowXPos.insertMultiple(0,0,this->size[1]);
+    memSize[0] = memSize[1] = memSize[2] = -1;
 }
 
 ArfRecordingData::~ArfRecordingData()
 {
-	
-	dSet->flush(H5F_SCOPE_GLOBAL);
-}
-int ArfRecordingData::writeDataBlock(int xDataSize, ArfFileBase::DataTypes type, void* data)
-{
-    return writeDataBlock(xDataSize,size[1],type,data);
+    //Flushing is left to the owning file, which does it once for all its datasets
+    //instead of writing out the whole metadata cache for every single one
 }
 
-int ArfRecordingData::writeDataBlock(int xDataSize, int yDataSize, ArfFileBase::DataTypes type, void* data)
+int ArfRecordingData::writeHyperslab(int64 xStart, int yStart, int xDataSize, int yDataSize, const DataType& type, const void* data)
 {
-    hsize_t dim[3],offset[3];
-    DataSpace fSpace;
-    DataType nativeType;
+    hsize_t dim[3], maxDim[3], offset[3];
 
-    dim[2] = size[2];
-    //only modify y size if new required size is larger than what we had.
-    if (yDataSize > size[1])
-        dim[1] = yDataSize;
-    else
-        dim[1] = size[1];
-    dim[0] = xPos + xDataSize;
+    if (dimension == 1)
+        yDataSize = 1;
     try
     {
-        //First be sure that we have enough space
-        dSet->extend(dim);
-
-        fSpace = dSet->getSpace();
-        fSpace.getSimpleExtentDims(dim);
-        size[0]=dim[0];
-        if (dimension > 1)
-            size[1]=dim[1];
+        //First be sure that we have enough space. Only the y size of 2-D datasets grows here,
+        //the z size is always written whole
+        if (xStart + xDataSize > size[0] || (dimension > 1 && yStart + yDataSize > size[1]))
+        {
+            dim[0] = jmax(size[0], xStart + (int64)xDataSize);
+            dim[1] = jmax(size[1], (int64)(yStart + yDataSize));
+            dim[2] = size[2];
+            dSet->extend(dim);
+            fileSpace->getSimpleExtentDims(nullptr, maxDim);
+            fileSpace->setExtentSimple(dimension, dim, maxDim);
+            size[0] = dim[0];
+            if (dimension > 1)
+            {
+                size[1] = dim[1];
+                while (rowXPos.size() < size[1])
+                    rowXPos.add(0);
+            }
+        }
 
-        //Create memory space
-        dim[0]=xDataSize;
-        dim[1]=yDataSize;
+        dim[0] = xDataSize;
+        dim[1] = yDataSize;
         dim[2] = size[2];
+        if (memSize[0] != (int)dim[0] || memSize[1] != (int)dim[1] || memSize[2] != (int)dim[2])
+        {
+            if (memSpace == nullptr)
+                memSpace = new DataSpace(dimension, dim);
+            else
+                memSpace->setExtentSimple(dimension, dim);
+            memSize[0] = dim[0];
+            memSize[1] = dim[1];
+            memSize[2] = dim[2];
+        }
 
-        DataSpace mSpace(dimension,dim);
         //select where to write
-        offset[0]=xPos;
-        offset[1]=0;
-        offset[2]=0;
-
-        fSpace.selectHyperslab(H5S_SELECT_SET, dim, offset);
+        offset[0] = xStart;
+        offset[1] = yStart;
+        offset[2] = 0;
+        fileSpace->selectHyperslab(H5S_SELECT_SET, dim, offset);
 
-        nativeType = ArfFileBase::getNativeType(type);
-
-        dSet->write(data,nativeType,mSpace,fSpace);
-        xPos += xDataSize;
+        dSet->write(data, type, *memSpace, *fileSpace);
     }
     catch (DataSetIException error)
     {
@@ -665,129 +1118,136 @@ int ArfRecordingData::writeDataBlock(int xDataSize, int yDataSize, ArfFileBase::
     return 0;
 }
 
+int ArfRecordingData::appendBlock(int xDataSize, int yDataSize, const DataType& type, const void* data)
+{
+    if (writeHyperslab(xPos, 0, xDataSize, yDataSize, type, data))
+        return -1;
+    xPos += xDataSize;
+    return 0;
+}
+
+int ArfRecordingData::appendToRow(int yPos, int xDataSize, const DataType& type, const void* data)
+{
+    if (dimension > 2) return -4; //We're not going to write rows in datasets bigger than 2d.
+    if ((yPos < 0) || (yPos >= size[1])) return -2;
+
+    if (writeHyperslab(rowXPos[yPos], yPos, xDataSize, 1, type, data))
+        return -1;
+    rowXPos.set(yPos, rowXPos[yPos] + xDataSize);
+    if (rowXPos[yPos] > (uint32)xPos)
+        xPos = rowXPos[yPos];
+    return 0;
+}
+
+int ArfRecordingData::writeDataBlock(int xDataSize, ArfFileBase::DataTypes type, void* data)
+{
+    return appendBlock(xDataSize, size[1], getStoredNativeType(type), data);
+}
+
+int ArfRecordingData::writeDataBlock(int xDataSize, int yDataSize, ArfFileBase::DataTypes type, void* data)
+{
+    return appendBlock(xDataSize, yDataSize, getStoredNativeType(type), data);
+}
+
 //write data into a 1-d array, with type wrapped by ArfFileBase::DataTypes, instead of raw HDF5 type
 int ArfRecordingData::writeDataChannel(int dataSize, ArfFileBase::DataTypes type, void* data)
 {
-    //Data is 1-dimensional
-    hsize_t dim[3],offset[3];
-    DataSpace fSpace;
-    
-    DataType nativeType = ArfFileBase::getNativeType(type);
-    if (xPos+dataSize > size[0])
-    {
-        dim[0] = xPos + dataSize;
-        dim[1] = 0;
-        dim[2] = 0;
-        dSet->extend(dim);
-    }
-    
-    fSpace = dSet->getSpace();
-    fSpace.getSimpleExtentDims(dim);
-    size[0]=dim[0];
-    if (dimension > 1)
-        size[1]=dim[1];
+    return appendBlock(dataSize, 1, getStoredNativeType(type), data);
+}
+
+//Writes data into an array of HDF5 datatype TYPE
+void ArfRecordingData::writeCompoundData(int xDataSize, int yDataSize, const DataType& type, void* data)
+{
+    appendBlock(xDataSize, yDataSize, type, data);
+}
 
-    //Create memory space
-    dim[0]= dataSize;
-    dim[1]= 0;
-    dim[2]= 0;
+int ArfRecordingData::writeDataRow(int yPos, int xDataSize, ArfFileBase::DataTypes type, void* data)
+{
+    return appendToRow(yPos, xDataSize, getStoredNativeType(type), data);
+}
 
-    DataSpace mSpace(dimension,dim);
-    //select where to write
-    offset[0]=xPos;
-    offset[1]=0;
-    offset[2]=0;
+void ArfRecordingData::getRowXPositions(Array<uint32>& rows)
+{
+    rows.clear();
+    rows.addArray(rowXPos);
+}
 
-    fSpace.selectHyperslab(H5S_SELECT_SET, dim, offset);
-    
-    
-    dSet->write(data,nativeType,mSpace,fSpace);
-    xPos = xPos + dataSize;
+int64 ArfRecordingData::getPosition() const
+{
+    return xPos;
 }
 
-//Writes data into an array of HDF5 datatype TYPE
-void ArfRecordingData::writeCompoundData(int xDataSize, int yDataSize, DataType type, void* data)
+//Continues writing at POS, dropping whatever the dataset holds after it
+int ArfRecordingData::setPosition(int64 pos)
 {
-    hsize_t dim[3],offset[3];
-    DataSpace fSpace;
-    DataType nativeType;
+    hsize_t dim[3];
 
+    dim[0] = pos;
+    dim[1] = size[1];
     dim[2] = size[2];
-    //only modify y size if new required size is larger than what we had.
-    if (yDataSize > size[1])
-        dim[1] = yDataSize;
-    else
-        dim[1] = size[1];
-    dim[0] = xPos + xDataSize;
-
-        //First be sure that we have enough space
+    try
+    {
+        hsize_t maxDim[3];
         dSet->extend(dim);
+        fileSpace->getSimpleExtentDims(nullptr, maxDim);
+        fileSpace->setExtentSimple(dimension, dim, maxDim);
+    }
+    catch (DataSetIException error)
+    {
+        PROCESS_ERROR;
+    }
+    catch (DataSpaceIException error)
+    {
+        PROCESS_ERROR;
+    }
+    size[0] = pos;
+    xPos = pos;
+    return 0;
+}
 
-        fSpace = dSet->getSpace();
-        fSpace.getSimpleExtentDims(dim);
-        size[0]=dim[0];
-        if (dimension > 1)
-            size[1]=dim[1];
+int64 ArfRecordingData::getSize() const
+{
+    return size[0];
+}
 
-        //Create memory space
-        dim[0]=xDataSize;
-        dim[1]=yDataSize;
-        dim[2] = size[2];
+int ArfRecordingData::getWidth() const
+{
+    return size[1];
+}
 
-        DataSpace mSpace(dimension,dim);
-        //select where to write
-        offset[0]=xPos;
-        offset[1]=0;
-        offset[2]=0;
+int ArfRecordingData::getChunkSize() const
+{
+    return xChunkSize;
+}
 
-        fSpace.selectHyperslab(H5S_SELECT_SET, dim, offset);
+int ArfRecordingData::getRank() const
+{
+    return dimension;
+}
 
-        dSet->write(data,type,mSpace,fSpace);
-        xPos += xDataSize;
+DataType ArfRecordingData::getType() const
+{
+    return dSet->getDataType();
 }
 
+int ArfRecordingData::readDataBlock(int64 xStart, int xDataSize, ArfFileBase::DataTypes type, void* data)
+{
+    return readCompoundData(xStart, xDataSize, getStoredNativeType(type), data);
+}
 
-int ArfRecordingData::writeDataRow(int yPos, int xDataSize, ArfFileBase::DataTypes type, void* data)
+int ArfRecordingData::readCompoundData(int64 xStart, int xDataSize, const DataType& type, void* data)
 {
-    hsize_t dim[2],offset[2];
-    DataSpace fSpace;
-    DataType nativeType;
-    if (dimension > 2) return -4; //We're not going to write rows in datasets bigger than 2d.
-    //    if (xDataSize != rowDataSize) return -2;
-    if ((yPos < 0) || (yPos >= size[1])) return -2;
+    hsize_t dim[1], offset[1];
 
+    if (dimension != 1 || xStart < 0 || xStart + xDataSize > size[0]) return -2;
     try
     {
-        if (rowXPos[yPos]+xDataSize > size[0])
-        {
-            dim[1] = size[1];
-            dim[0] = rowXPos[yPos] + xDataSize;
-            dSet->extend(dim);
-
-            fSpace = dSet->getSpace();
-            fSpace.getSimpleExtentDims(dim);
-            size[0]=dim[0];
-        }
-        if (rowXPos[yPos]+xDataSize > xPos)
-        {
-            xPos = rowXPos[yPos]+xDataSize;
-        }
-
         dim[0] = xDataSize;
-        dim[1] = 1;
-        DataSpace mSpace(dimension,dim);
-
-        fSpace = dSet->getSpace();
-        offset[0] = rowXPos[yPos];
-        offset[1] = yPos;
+        offset[0] = xStart;
+        DataSpace mSpace(1, dim);
+        DataSpace fSpace = dSet->getSpace();
         fSpace.selectHyperslab(H5S_SELECT_SET, dim, offset);
-
-        nativeType = ArfFileBase::getNativeType(type);
-
-
-        dSet->write(data,nativeType,mSpace,fSpace);
-
-        rowXPos.set(yPos,rowXPos[yPos] + xDataSize);
+        dSet->read(data, type, mSpace, fSpace);
     }
     catch (DataSetIException error)
     {
@@ -797,27 +1257,67 @@ int ArfRecordingData::writeDataRow(int yPos, int xDataSize, ArfFileBase::DataTyp
     {
         PROCESS_ERROR;
     }
-    catch (FileIException error)
+    return 0;
+}
+
+int ArfRecordingData::writeRawChunk(int chunkIndex, const void* data, size_t nBytes)
+{
+    hsize_t offset[3] = { (hsize_t)chunkIndex * xChunkSize, 0, 0 };
+
+    //all filters applied, i.e. a filter mask of 0
+    if (H5DOwrite_chunk(dSet->getId(), H5P_DEFAULT, 0, offset, nBytes, data) < 0)
     {
-        PROCESS_ERROR;
+        std::cerr << "Could not write chunk " << chunkIndex << std::endl;
+        return -1;
     }
     return 0;
 }
 
-void ArfRecordingData::getRowXPositions(Array<uint32>& rows)
+int ArfRecordingData::readRawChunk(int chunkIndex, MemoryBlock& data, uint32& filterMask)
 {
-    rows.clear();
-    rows.addArray(rowXPos);
+    hsize_t offset[3] = { (hsize_t)chunkIndex * xChunkSize, 0, 0 };
+    hsize_t nBytes = 0;
+
+    filterMask = 0;
+    if (H5Dget_chunk_storage_size(dSet->getId(), offset, &nBytes) < 0)
+    {
+        //not allocated, i.e. never written
+        data.setSize(0);
+        return 0;
+    }
+    data.setSize((size_t)nBytes);
+    if (nBytes > 0 && H5DOread_chunk(dSet->getId(), H5P_DEFAULT, offset, &filterMask, data.getData()) < 0)
+    {
+        std::cerr << "Could not read chunk " << chunkIndex << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+Array<int> ArfRecordingData::getFilters() const
+{
+    Array<int> filters;
+    hid_t prop = H5Dget_create_plist(dSet->getId());
+    int nFilters = (prop >= 0) ? H5Pget_nfilters(prop) : 0;
+    for (int i = 0; i < nFilters; i++)
+    {
+        unsigned int flags;
+        size_t nValues = 0;
+        filters.add((int)H5Pget_filter2(prop, (unsigned)i, &flags, &nValues, nullptr, 0, nullptr, nullptr));
+    }
+    if (prop >= 0)
+        H5Pclose(prop);
+    return filters;
 }
 
 //Continuous File
 
-ArfFile::ArfFile(int processorNumber, String basename) : ArfFileBase()
+ArfFile::ArfFile(int processorNumber, String basename) : ArfFileBase(), schema(nullptr), overviewColumns(0), chunkStats(false), checksums(false), packedSpikes(false)
 {
     initFile(processorNumber, basename);
 }
 
-ArfFile::ArfFile() : ArfFileBase()
+ArfFile::ArfFile() : ArfFileBase(), schema(nullptr), overviewColumns(0), chunkStats(false), checksums(false), packedSpikes(false)
 {
 }
 
@@ -833,101 +1333,485 @@ void ArfFile::initFile(int processorNumber, String basename) //TODO don't need p
     if (isOpen()) return;
     filename = basename + ".arf";
     readyToOpen=true;
-    
-    //For spikes
-    numElectrodes=0;
 }
 
-void ArfFile::startNewRecording(int recordingNumber, int nChannels, ArfRecordingInfo* info, Array<int> recordedChanToKWDChan, Array<int> procMap)
+void ArfFile::setSchema(const ArfSchemaRegistry* schema)
 {
-    this->recordingNumber = recordingNumber;
-    this->nChannels = nChannels;
-    this->multiSample = info->multiSample;
-    uint8 mSample = info->multiSample ? 1 : 0;
+    this->schema = schema;
+}
 
-	ScopedPointer<ArfRecordingData> bitVoltsSet;
-	ScopedPointer<ArfRecordingData> sampleRateSet;
+void ArfFile::setOverview(int columns)
+{
+    overviewColumns = (columns > 0) ? jlimit(2, 3, columns) : 0;
+}
 
-    String recordPath = String("/rec_")+String(recordingNumber);
-    CHECK_ERROR(createGroup(recordPath));
-    CHECK_ERROR(setAttributeStr(info->name,recordPath,String("name")));
-    CHECK_ERROR(setAttribute(U32,&(info->bit_depth),recordPath,String("bit_depth")));
+void ArfFile::setChunkStats(bool enable)
+{
+    chunkStats = enable;
+}
 
-    CHECK_ERROR(setAttribute(U8,&mSample,recordPath,String("is_multiSampleRate_data")));
+void ArfFile::setChecksums(bool enable)
+{
+    checksums = enable;
+}
 
-    int64 timeMilli = Time::currentTimeMillis();
-    int64 times[2] = {timeMilli/1000, (timeMilli%1000)*1000};
-    setAttributeAsArray(I64, times, 2, recordPath, "timestamp");
-    
-    String uuid = Uuid().toDashedString();
-    CHECK_ERROR(setAttributeStr(uuid, recordPath, String("uuid")));
-        
-    for (int i = 0; i<nChannels; i++) {        
-        //separate Dataset for each channel
-        String channelPath = recordPath+"/channel"+String(i);
-        
-        recarr.add(createDataSet(I16, 0, CHUNK_XSIZE, channelPath));
-        CHECK_ERROR(setAttribute(F32, info->channelSampleRates.getRawDataPointer()+i, channelPath, String("sampling_rate")));
-        CHECK_ERROR(setAttribute(F32, info->bitVolts.getRawDataPointer()+i, channelPath, String("bit_volts")));
-        CHECK_ERROR(setAttributeStr(String("V"), channelPath, String("units")));
-        int64 datatype = 0;
-        CHECK_ERROR(setAttribute(I64,&datatype,channelPath, String("datatype")));
-        CHECK_ERROR(setAttribute(I32, procMap.getRawDataPointer()+i, channelPath, String("nodeID")));
-        CHECK_ERROR(setAttribute(I32, recordedChanToKWDChan.getRawDataPointer()+i, channelPath, String("node_channel_no")));
-    }
-    
-    //Creating hierarchy for events
-    for (int i=0; i < eventNames.size(); i++)
-    {
-        ScopedPointer<ArfRecordingData> dSet;
-        // e.g /rec_0/Messages
-        String path = recordPath + "/";
+CompType ArfFile::getChunkStatsType()
+{
+    CompType ctype(sizeof(ArfChunkStats));
+    ctype.insertMember(H5std_string("channel"), HOFFSET(ArfChunkStats, channel), PredType::NATIVE_INT32);
+    ctype.insertMember(H5std_string("chunk"), HOFFSET(ArfChunkStats, chunk), PredType::NATIVE_INT32);
+    ctype.insertMember(H5std_string("count"), HOFFSET(ArfChunkStats, count), PredType::NATIVE_INT32);
+    ctype.insertMember(H5std_string("min"), HOFFSET(ArfChunkStats, min), PredType::NATIVE_INT16);
+    ctype.insertMember(H5std_string("max"), HOFFSET(ArfChunkStats, max), PredType::NATIVE_INT16);
+    ctype.insertMember(H5std_string("sum"), HOFFSET(ArfChunkStats, sum), PredType::NATIVE_INT64);
+    ctype.insertMember(H5std_string("sum_squares"), HOFFSET(ArfChunkStats, sumSquares), PredType::NATIVE_UINT64);
+    ctype.insertMember(H5std_string("clipped"), HOFFSET(ArfChunkStats, clipped), PredType::NATIVE_INT32);
+    return ctype;
+}
 
-        int max_dims[3] = {0, 0, 0};
-        int chunk_dims[3] = {EVENT_CHUNK_SIZE, 0, 0};
-        dSet = createCompoundDataSet(eventCompTypes[i],path + eventNames[i], 1, max_dims, chunk_dims);
-        CHECK_ERROR(setAttributeStr(String("samples"), path + eventNames[i], String("units")));
-        
-    }
-    this->sample_rate = info->sample_rate;
-    kwdIndex=0;
-    for (int i = 0; i < eventNames.size(); i++)
-    {
-        ArfRecordingData* dSet;
-        
-        String path = recordPath + "/" + eventNames[i];
-        
-        dSet = getDataSet(path);
-        eventFullData.add(dSet);
-    }    
-    
-    //For spikes
-    transformVector.malloc(MAX_TRANSFORM_SIZE);
-    
-    for (int i=0; i < channelArray.size(); i++)
-    {
-        createChannelGroup(i);
-    }
-    for (int i=0; i < channelArray.size(); i++)
-    {
-        ArfRecordingData* dSet;
-        String path = recordPath + "/spike_group"+String(i);
-        
-        dSet = getDataSet(path);
-        spikeFullDataArray.add(dSet);
-    }
-    
-    
-    curChan = nChannels;
+void ArfFile::setProfile(const ArfProfile& profile)
+{
+    this->profile = profile;
+    setCache((int64)profile.cacheMegabytes << 20, profile.cacheSlots, profile.chunkSize);
 }
 
-void ArfFile::stopRecording()
+void ArfFile::setPackedSpikes(bool enable)
 {
-    //ScopedPointer does the deletion and destructors the closings
+    packedSpikes = enable;
+}
+
+String ArfFile::getPackedSpikePath(String recordPath, int typeIndex)
+{
+    return recordPath + "/spikes_" + String(schema->spikeTypeChannels[typeIndex]) + "ch";
+}
+
+void ArfFile::buildSpikeIndex(const Array<int>& electrodes, Array<int>& order, Array<int>& index)
+{
+    order.clearQuick();
+    index.clearQuick();
+    int nElectrodes = 0;
+    for (int i = 0; i < electrodes.size(); i++)
+        nElectrodes = jmax(nElectrodes, electrodes[i] + 1);
+
+    //counting sort, so the rows of every electrode stay in the order they were recorded
+    Array<int> first;
+    first.insertMultiple(0, 0, nElectrodes + 1);
+    for (int i = 0; i < electrodes.size(); i++)
+        first.getReference(electrodes[i] + 1)++;
+    for (int e = 0; e < nElectrodes; e++)
+    {
+        if (first[e + 1] > 0)
+        {
+            index.add(e);
+            index.add(first[e]);
+            index.add(first[e + 1]);
+        }
+        first.set(e + 1, first[e] + first[e + 1]);
+    }
+    order.insertMultiple(0, 0, electrodes.size());
+    for (int i = 0; i < electrodes.size(); i++)
+        order.set(first.getReference(electrodes[i])++, i);
+}
+
+String ArfFile::getOverviewPath(String recordPath, int channel, int level)
+{
+    return recordPath + "/" + ARF_OVERVIEW_GROUP + "/channel" + String(channel) + "_" + String(ArfOverview::getDecimation(level));
+}
+
+String ArfFile::getChecksumPath(String recordPath, int channel)
+{
+    return recordPath + "/" + ARF_CHECKSUM_GROUP + "/channel" + String(channel);
+}
+
+void ArfFile::commitSchemaTypes(String recordPath)
+{
+    typesPath = recordPath + "/" + ARF_TYPES_GROUP;
+    eventCompTypes.clear();
+    spikeCompTypes.clear();
+    packedSpikeCompTypes.clear();
+    packedTypes.clear();
+    if (schema == nullptr) return;
+
+    for (int i = 0; i < schema->eventCompTypes.size(); i++)
+    {
+        String path = typesPath + "/" + schema->eventNames[i];
+        eventCompTypes.add(getCommittedType(schema->eventCompTypes.getReference(i), path));
+    }
+    for (int i = 0; i < schema->spikeCompTypes.size(); i++)
+    {
+        String path = typesPath + "/spike_" + String(schema->spikeTypeChannels[i]) + "ch";
+        spikeCompTypes.add(getCommittedType(schema->spikeCompTypes.getReference(i), path));
+        if (packedSpikes)
+            packedSpikeCompTypes.add(getCommittedType(schema->packedSpikeCompTypes.getReference(i), path + "_packed"));
+    }
+
+    //the packed tables of this recording, in the order the spike types first come up
+    packedTypes.clear();
+    for (int i = 0; i < schema->getNumChannelGroups() && packedSpikes; i++)
+        packedTypes.addIfNotAlreadyThere(schema->spikeTypeIndex[i]);
+}
+
+void ArfFile::addOverviews(int nChannels, ArfRecordingInfo* info)
+{
+    if (chunkStats)
+        chunkStatsType = new CompType(getCommittedType(getChunkStatsType(), typesPath + "/" + ARF_CHUNK_STATS));
+    if (overviewColumns == 0 && !chunkStats)
+        return;
+    for (int i = 0; i < nChannels; i++)
+    {
+        int chunkSize = chunkStats ? getChannelChunkSize(info->channelSampleRates[i], info->sample_rate, profile.chunkSize) : 0;
+        overviews.add(new ArfOverview(overviewColumns, chunkSize, i));
+    }
+}
+
+void ArfFile::addChecksums(int nChannels, ArfRecordingInfo* info)
+{
+    //the chunks of the checksums are the chunks of the channel datasets
+    for (int i = 0; i < nChannels && checksums; i++)
+        channelChecksums.add(new ArfChecksum(getChannelChunkSize(info->channelSampleRates[i], info->sample_rate, profile.chunkSize)));
+}
+
+void ArfFile::startNewRecording(int recordingNumber, int nChannels, ArfRecordingInfo* info, Array<int> recordedChanToKWDChan, Array<int> procMap)
+{
+    String recordPath = String("/rec_")+String(recordingNumber);
+
+    this->recordingNumber = recordingNumber;
+    createRecordingSkeleton(recordPath, nChannels, info, recordedChanToKWDChan, procMap);
+    CHECK_ERROR(writeRecordingAttributes(recordPath, info));
+}
+
+void ArfFile::createTemplate(int nChannels, ArfRecordingInfo* info, Array<int> recordedChanToKWDChan, Array<int> procMap)
+{
+    this->recordingNumber = -1;
+    createRecordingSkeleton(TEMPLATE_RECORDING, nChannels, info, recordedChanToKWDChan, procMap);
+}
+
+bool ArfFile::resumeRecording(int recordingNumber, int nChannels, ArfRecordingInfo* info)
+{
+    String recordPath = String("/rec_")+String(recordingNumber);
+
+    //the caller starts the recording from scratch then, which must not leave the template behind
+    if (moveObject(TEMPLATE_RECORDING, recordPath))
+    {
+        deleteObject(TEMPLATE_RECORDING);
+        return false;
+    }
+    if (!attachRecording(recordingNumber, nChannels, info)) return false;
+
+    CHECK_ERROR(writeRecordingAttributes(recordPath, info));
+    return true;
+}
+
+bool ArfFile::attachRecording(int recordingNumber, int nChannels, ArfRecordingInfo* info, const Array<int64>* positions)
+{
+    String recordPath = String("/rec_")+String(recordingNumber);
+
+    this->recordingNumber = recordingNumber;
+    this->nChannels = nChannels;
+    this->multiSample = info->multiSample;
+    this->sample_rate = info->sample_rate;
+    commitSchemaTypes(recordPath);
+
+    //Channel datasets are attached on their first write, so opening a part does not depend on the channel count.
+    //When continuing at given positions they are needed right away.
+    for (int i = 0; i < nChannels; i++)
+    {
+        recarr.add((positions != nullptr) ? getDataSet(recordPath + "/channel" + String(i)) : nullptr);
+        for (int j = 0; j < ARF_OVERVIEW_LEVELS && overviewColumns > 0; j++)
+            overviewData.add((positions != nullptr) ? getDataSet(getOverviewPath(recordPath, i, j)) : nullptr);
+        if (checksums)
+            checksumData.add((positions != nullptr) ? getDataSet(getChecksumPath(recordPath, i)) : nullptr);
+    }
+    addOverviews(nChannels, info);
+    addChecksums(nChannels, info);
+    if (chunkStats && positions != nullptr)
+        chunkStatsData = getDataSet(recordPath + "/" + ARF_CHUNK_STATS);
+    for (int i = 0; i < eventCompTypes.size(); i++)
+    {
+        eventFullData.add(getDataSet(recordPath + "/" + schema->getEventName(i)));
+        if (schema->isTextEvent(i))
+            messageText = getDataSet(recordPath + "/" + MESSAGE_TEXT);
+    }
+    int nElectrodes = (schema != nullptr) ? schema->getNumChannelGroups() : 0;
+    for (int i = 0; i < nElectrodes && !packedSpikes; i++)
+    {
+        spikeFullDataArray.add(getDataSet(recordPath + "/spike_group" + String(i)));
+    }
+    for (int i = 0; i < packedTypes.size(); i++)
+    {
+        spikeFullDataArray.add(getDataSet(getPackedSpikePath(recordPath, packedTypes[i])));
+        packedElectrodes.add(new Array<int>());
+    }
+    kwdIndex=0;
+    curChan = nChannels;
+
+    if (positions == nullptr)
+        return true;
+
+    //Same order as getWritePositions
+    if (positions->size() != recarr.size() + eventFullData.size() + spikeFullDataArray.size() + (messageText != nullptr ? 1 : 0) + (chunkStats ? 1 : 0))
+        return false;
+    int n = 0;
+    for (int i = 0; i < recarr.size(); i++, n++)
+    {
+        if (recarr[i] == nullptr || recarr[i]->setPosition((*positions)[n])) return false;
+        if (checksums && !resumeChecksums(i, (*positions)[n])) return false;
+        if (overviews.size() == 0)
+            continue;
+        //the overview rows and chunk statistics that were complete at that point are already written
+        overviews[i]->skipTo((*positions)[n]);
+        for (int j = 0; j < ARF_OVERVIEW_LEVELS && overviewColumns > 0; j++)
+        {
+            ArfRecordingData* dSet = overviewData[i * ARF_OVERVIEW_LEVELS + j];
+            if (dSet == nullptr || dSet->setPosition((*positions)[n] / ArfOverview::getDecimation(j))) return false;
+        }
+    }
+    for (int i = 0; i < eventFullData.size(); i++, n++)
+    {
+        if (eventFullData[i] == nullptr || eventFullData[i]->setPosition((*positions)[n])) return false;
+    }
+    for (int i = 0; i < spikeFullDataArray.size(); i++, n++)
+    {
+        if (spikeFullDataArray[i] == nullptr || spikeFullDataArray[i]->setPosition((*positions)[n])) return false;
+    }
+    //The electrodes of the packed rows that are already there, for the index written at the end
+    for (int i = 0; i < packedTypes.size(); i++)
+    {
+        int nRows = (int)spikeFullDataArray[i]->getPosition();
+        CompType electrodeType(sizeof(int32));
+        electrodeType.insertMember(H5std_string("electrode"), 0, PredType::NATIVE_INT32);
+        packedElectrodes[i]->insertMultiple(0, 0, nRows);
+        if (nRows > 0 && spikeFullDataArray[i]->readCompoundData(0, nRows, electrodeType, packedElectrodes[i]->getRawDataPointer()))
+            return false;
+    }
+    if (messageText != nullptr && messageText->setPosition((*positions)[n++])) return false;
+    if (chunkStats && (chunkStatsData == nullptr || chunkStatsData->setPosition((*positions)[n]))) return false;
+    return true;
+}
+
+bool ArfFile::resumeChecksums(int channel, int64 position)
+{
+    //The finished chunks are in the table. The samples of the open one are read back, so that its
+    //checksum still covers the whole chunk
+    ArfChecksum* checksum = channelChecksums[channel];
+    ArfRecordingData* dSet = checksumData[channel];
+    int chunkSize = checksum->getChunkSize();
+    int64 start = position - position % chunkSize;
+    int nOpen = (int)(position - start);
+    if (dSet == nullptr || dSet->setPosition(position / chunkSize)) return false;
+    HeapBlock<int16> samples(jmax(1, nOpen));
+    if (nOpen > 0 && TypedDataset<int16, 1>(recarr[channel]).read(start, arfSpan(samples.getData(), nOpen))) return false;
+    checksum->skipTo(position, ArfChecksum::crc32c(0, samples, nOpen * sizeof(int16)));
+    return true;
+}
+
+void ArfFile::getWritePositions(Array<int64>& positions)
+{
+    positions.clearQuick();
+    for (int i = 0; i < recarr.size(); i++)
+    {
+        positions.add((recarr[i] != nullptr) ? recarr[i]->getPosition() : 0);
+    }
+    for (int i = 0; i < eventFullData.size(); i++)
+    {
+        positions.add((eventFullData[i] != nullptr) ? eventFullData[i]->getPosition() : 0);
+    }
+    for (int i = 0; i < spikeFullDataArray.size(); i++)
+    {
+        positions.add((spikeFullDataArray[i] != nullptr) ? spikeFullDataArray[i]->getPosition() : 0);
+    }
+    if (messageText != nullptr)
+        positions.add(messageText->getPosition());
+    if (chunkStats)
+        positions.add((chunkStatsData != nullptr) ? chunkStatsData->getPosition() : 0);
+}
+
+//Attributes that are different for every recording and part, so they can't be part of a template
+int ArfFile::writeRecordingAttributes(String recordPath, ArfRecordingInfo* info)
+{
+    int64 timeMilli = Time::currentTimeMillis();
+    int64 times[2] = {timeMilli/1000, (timeMilli%1000)*1000};
+    String uuid = Uuid().toDashedString();
+
+    ArfMetadataBuilder recordMeta;
+    recordMeta.addStr(info->name, "name");
+    recordMeta.addAsArray(I64, times, 2, "timestamp");
+    recordMeta.addStr(uuid, "uuid");
+    if (info->diskRate > 0)
+    {
+        float headroom = info->diskRate / jmax(info->requiredRate, 1e-6f);
+        recordMeta.add(F32, &info->diskRate, "disk_write_rate");
+        recordMeta.add(F32, &info->requiredRate, "required_write_rate");
+        recordMeta.add(F32, &headroom, "disk_headroom");
+        recordMeta.add(I64, &info->diskFree, "disk_free_bytes");
+    }
+    return writeMetadata(recordPath, recordMeta);
+}
+
+int ArfFile::getChannelChunkSize(float sampleRate, float mainRate, int chunkSize)
+{
+    if (sampleRate <= 0 || mainRate <= 0 || sampleRate == mainRate)
+        return chunkSize;
+    return jlimit(MIN_CHUNK_XSIZE, MAX_CHUNK_XSIZE, nextPowerOfTwo((int)std::ceil(chunkSize * sampleRate / mainRate)));
+}
+
+void ArfFile::createRecordingSkeleton(String recordPath, int nChannels, ArfRecordingInfo* info, Array<int> recordedChanToKWDChan, Array<int> procMap)
+{
+    this->nChannels = nChannels;
+    this->multiSample = info->multiSample;
+    uint8 mSample = info->multiSample ? 1 : 0;
+
+    ArfMetadataBuilder recordMeta;
+    recordMeta.add(U32, &(info->bit_depth), "bit_depth");
+    recordMeta.add(U8, &mSample, "is_multiSampleRate_data");
+    recordMeta.addStr(profile.name, "profile");
+    recordMeta.addStr(profile.toString(), "profile_settings");
+    int nElectrodes = (schema != nullptr) ? schema->getNumChannelGroups() : 0;
+    int nEventTypes = (schema != nullptr) ? schema->getNumEventTypes() : 0;
+    //every spike type has an electrode, so there is a packed table for each
+    int nSpikeSets = packedSpikes ? ((schema != nullptr) ? schema->spikeCompTypes.size() : 0) * 3 : nElectrodes;
+    CHECK_ERROR(createGroup(recordPath, recordMeta, 1 + nChannels + nEventTypes + nSpikeSets + ((overviewColumns > 0) ? 1 : 0) + (chunkStats ? 1 : 0) + (checksums ? 1 : 0)));
+    commitSchemaTypes(recordPath);
+
+    //The dataset handles are kept open, so attributes are written straight through them
+    ArfMetadataBuilder channelMeta;
+    int64 datatype = 0;
+    for (int i = 0; i<nChannels; i++) {
+        //separate Dataset for each channel
+        String channelPath = recordPath+"/channel"+String(i);
+
+        ArfRecordingData* dSet = createDataSet(I16, 0, getChannelChunkSize(info->channelSampleRates[i], info->sample_rate, profile.chunkSize), channelPath);
+        recarr.add(dSet);
+
+        channelMeta.clear();
+        channelMeta.add(F32, info->channelSampleRates.getRawDataPointer()+i, "sampling_rate");
+        channelMeta.add(F32, info->bitVolts.getRawDataPointer()+i, "bit_volts");
+        channelMeta.addStr("V", "units");
+        channelMeta.add(I64, &datatype, "datatype");
+        channelMeta.add(I32, procMap.getRawDataPointer()+i, "nodeID");
+        channelMeta.add(I32, recordedChanToKWDChan.getRawDataPointer()+i, "node_channel_no");
+        CHECK_ERROR(writeMetadata(dSet, channelMeta));
+    }
+
+    //Overview levels, as 2-D datasets of rows (min, max[, rms]) for every ARF_OVERVIEW_FACTOR^(level+1) samples
+    if (overviewColumns > 0)
+    {
+        ArfMetadataBuilder overviewMeta;
+        overviewMeta.addStr((overviewColumns > 2) ? "min,max,rms" : "min,max", "columns");
+        CHECK_ERROR(createGroup(recordPath + "/" + ARF_OVERVIEW_GROUP, overviewMeta, nChannels * ARF_OVERVIEW_LEVELS));
+        for (int i = 0; i < nChannels; i++)
+        {
+            for (int j = 0; j < ARF_OVERVIEW_LEVELS; j++)
+            {
+                ArfRecordingData* dSet = createDataSet(I16, 0, overviewColumns, OVERVIEW_CHUNK_SIZE, getOverviewPath(recordPath, i, j));
+                int decimation = ArfOverview::getDecimation(j);
+                channelMeta.clear();
+                channelMeta.add(I32, &decimation, "decimation");
+                CHECK_ERROR(writeMetadata(dSet, channelMeta));
+                overviewData.add(dSet);
+            }
+        }
+    }
+    addOverviews(nChannels, info);
+
+    //One row per finished chunk of every channel, in the order they are finished
+    if (chunkStats)
+    {
+        int max_dims[3] = {0, 0, 0};
+        int chunk_dims[3] = {CHUNK_STATS_CHUNK_SIZE, 0, 0};
+        chunkStatsData = createCompoundDataSet(*chunkStatsType, recordPath + "/" + ARF_CHUNK_STATS, 1, max_dims, chunk_dims);
+    }
+
+    //The CRC32C of every chunk of every channel, in a U32 table per channel
+    if (checksums)
+    {
+        ArfMetadataBuilder checksumMeta;
+        checksumMeta.addStr("crc32c", "algorithm");
+        CHECK_ERROR(createGroup(recordPath + "/" + ARF_CHECKSUM_GROUP, checksumMeta, nChannels));
+        for (int i = 0; i < nChannels; i++)
+        {
+            ArfRecordingData* dSet = createDataSet(U32, 0, ARF_CHECKSUM_CHUNK_SIZE, getChecksumPath(recordPath, i));
+            int chunkSize = getChannelChunkSize(info->channelSampleRates[i], info->sample_rate, profile.chunkSize);
+            channelMeta.clear();
+            channelMeta.add(I32, &chunkSize, "chunk_size");
+            CHECK_ERROR(writeMetadata(dSet, channelMeta));
+            checksumData.add(dSet);
+        }
+    }
+    addChecksums(nChannels, info);
+
+    //Creating hierarchy for events
+    ArfMetadataBuilder unitsMeta;
+    unitsMeta.addStr("samples", "units");
+    for (int i=0; i < eventCompTypes.size(); i++)
+    {
+        // e.g /rec_0/Messages
+        String path = recordPath + "/" + schema->getEventName(i);
+
+        int max_dims[3] = {0, 0, 0};
+        int chunk_dims[3] = {profile.eventChunkSize, 0, 0};
+        ArfRecordingData* dSet = createCompoundDataSet(eventCompTypes[i], path, 1, max_dims, chunk_dims);
+        CHECK_ERROR(writeMetadata(dSet, unitsMeta));
+        eventFullData.add(dSet);
+        if (schema->isTextEvent(i))
+            messageText = createDataSet(U8, 0, MESSAGE_TEXT_CHUNK_SIZE, recordPath + "/" + MESSAGE_TEXT);
+    }
+    this->sample_rate = info->sample_rate;
+    kwdIndex=0;
+
+    //For spikes
+    for (int i=0; i < nElectrodes && !packedSpikes; i++)
+    {
+        spikeFullDataArray.add(createChannelGroup(recordPath, i));
+    }
+    for (int i = 0; i < packedTypes.size(); i++)
+    {
+        int max_dims[3] = {0, 0, 0};
+        int chunk_dims[3] = {jmax(PACKED_SPIKE_CHUNK_SIZE, profile.spikeChunkSize), 0, 0};
+        ArfRecordingData* dSet = createCompoundDataSet(packedSpikeCompTypes[packedTypes[i]], getPackedSpikePath(recordPath, packedTypes[i]), 1, max_dims, chunk_dims);
+        CHECK_ERROR(writeMetadata(dSet, unitsMeta));
+        spikeFullDataArray.add(dSet);
+        packedElectrodes.add(new Array<int>());
+    }
+
+    curChan = nChannels;
+}
+
+void ArfFile::stopRecording()
+{
+    //the last blocks of the overview only cover the samples up to here
+    for (int i = 0; i < overviews.size(); i++)
+    {
+        overviews[i]->finish();
+        writeOverview(i);
+    }
+    overviews.clear();
+    overviewData.clear();
+    chunkStatsData = nullptr;
+    for (int i = 0; i < channelChecksums.size(); i++)
+    {
+        channelChecksums[i]->finish();
+        writeChecksums(i);
+    }
+    channelChecksums.clear();
+    checksumData.clear();
+    //a template is not recorded into, its index is only written in the parts made from it
+    if (isOpen() && recordingNumber >= 0)
+        writeSpikeIndex();
+    packedElectrodes.clear();
+
+    //ScopedPointer does the deletion and destructors the closings. flush writes the events that
+    //are still waiting
+    if (isOpen())
+        CHECK_ERROR(flush());
+    pendingEvents.fill(0);
     recdata = nullptr;
     recarr.clear();
 	tsData = nullptr;
     eventFullData.clear();
+    messageText = nullptr;
+    messageTexts.clear();
+    messageCache.reset();
     spikeFullDataArray.clear();
 }
 
@@ -941,12 +1825,97 @@ int ArfFile::createFileStructure()
 
 void ArfFile::writeBlockData(int16* data, int nSamples)
 {
-    CHECK_ERROR(recdata->writeDataBlock(nSamples,I16,data));
+    int nColumns = recdata->getWidth();
+    TypedDataset<int16, 2> block(recdata);
+    CHECK_ERROR(block.append(arfSpan(data, nSamples * nColumns), nColumns));
 }
 
 void ArfFile::writeChannel(int16* data, int nSamples, int noChannel)
 {
-    CHECK_ERROR(recarr[noChannel]->writeDataChannel(nSamples,I16,data));
+    if (recarr[noChannel] == nullptr)
+    {
+        recarr.set(noChannel, getDataSet(String("/rec_") + String(recordingNumber) + "/channel" + String(noChannel)));
+        if (recarr[noChannel] == nullptr)
+        {
+            std::cerr << "Error attaching channel " << noChannel << std::endl;
+            return;
+        }
+    }
+    TypedDataset<int16, 1> channelData(recarr[noChannel]);
+    CHECK_ERROR(channelData.append(arfSpan(data, nSamples)));
+    if (noChannel < overviews.size())
+    {
+        overviews[noChannel]->addSamples(data, nSamples);
+        writeOverview(noChannel);
+    }
+    if (noChannel < channelChecksums.size())
+    {
+        channelChecksums[noChannel]->addSamples(data, nSamples);
+        writeChecksums(noChannel);
+    }
+}
+
+void ArfFile::writeChecksums(int channel)
+{
+    ArfChecksum* checksum = channelChecksums[channel];
+    int n = checksum->getNumChecksums();
+    if (n == 0)
+        return;
+    if (checksumData[channel] == nullptr)
+    {
+        checksumData.set(channel, getDataSet(getChecksumPath(String("/rec_") + String(recordingNumber), channel)));
+        if (checksumData[channel] == nullptr)
+        {
+            std::cerr << "Error attaching the checksums of channel " << channel << std::endl;
+            checksum->clearChecksums();
+            return;
+        }
+    }
+    TypedDataset<uint32, 1> table(checksumData[channel]);
+    CHECK_ERROR(table.append(arfSpan(checksum->getChecksums(), n)));
+    checksum->clearChecksums();
+}
+
+void ArfFile::writeOverview(int channel)
+{
+    ArfOverview* overview = overviews[channel];
+    for (int j = 0; j < ARF_OVERVIEW_LEVELS; j++)
+    {
+        int nRows = overview->getNumRows(j);
+        if (nRows == 0)
+            continue;
+        int index = channel * ARF_OVERVIEW_LEVELS + j;
+        if (overviewData[index] == nullptr)
+        {
+            overviewData.set(index, getDataSet(getOverviewPath(String("/rec_") + String(recordingNumber), channel, j)));
+            if (overviewData[index] == nullptr)
+            {
+                std::cerr << "Error attaching the overview of channel " << channel << std::endl;
+                overview->clearRows(j);
+                continue;
+            }
+        }
+        int nColumns = overview->getNumColumns();
+        TypedDataset<int16, 2> level(overviewData[index]);
+        CHECK_ERROR(level.append(arfSpan(overview->getRows(j), nRows * nColumns), nColumns));
+        overview->clearRows(j);
+    }
+
+    int nStats = overview->getNumChunkStats();
+    if (nStats == 0)
+        return;
+    if (chunkStatsData == nullptr)
+    {
+        chunkStatsData = getDataSet(String("/rec_") + String(recordingNumber) + "/" + ARF_CHUNK_STATS);
+        if (chunkStatsData == nullptr)
+        {
+            std::cerr << "Error attaching the chunk statistics" << std::endl;
+            overview->clearChunkStats();
+            return;
+        }
+    }
+    chunkStatsData->writeCompoundData(nStats, 0, *chunkStatsType, overview->getChunkStats());
+    overview->clearChunkStats();
 }
 
 void ArfFile::writeRowData(int16* data, int nSamples)
@@ -955,7 +1924,8 @@ void ArfFile::writeRowData(int16* data, int nSamples)
     {
         curChan=0;
     }
-    CHECK_ERROR(recdata->writeDataRow(curChan,nSamples,I16,data));
+    TypedDataset<int16, 2> rows(recdata);
+    CHECK_ERROR(rows.appendToRow(curChan, arfSpan(data, nSamples)));
     curChan++;
 }
 
@@ -963,7 +1933,8 @@ void ArfFile::writeRowData(int16* data, int nSamples, int channel)
 {
 	if (channel >= 0 && channel < nChannels)
 	{
-		CHECK_ERROR(recdata->writeDataRow(channel, nSamples, I16, data));
+		TypedDataset<int16, 2> rows(recdata);
+		CHECK_ERROR(rows.appendToRow(channel, arfSpan(data, nSamples)));
 		curChan = channel;
 	}
 }
@@ -972,152 +1943,507 @@ void ArfFile::writeTimestamps(int64* ts, int nTs, int channel)
 {
 	if (channel >= 0 && channel < nChannels)
 	{
-		CHECK_ERROR(tsData->writeDataRow(channel, nTs, I64, ts));
+		TypedDataset<int64, 2> timestamps(tsData);
+		CHECK_ERROR(timestamps.appendToRow(channel, arfSpan(ts, nTs)));
 	}
 }
 
-void ArfFile::writeEvent(int type, uint8 id, uint8 processor, void* data, int64 timestamp)
+void ArfFile::writeEvent(int type, uint8 id, uint8 processor, const void* data, int dataSize, int64 timestamp)
 {
-    if (type > eventNames.size() || type < 0)
+    if (type >= eventCompTypes.size() || type < 0 || eventFullData[type] == nullptr)
     {
         std::cerr << "writeEvent Invalid event type " << type << std::endl;
         return;
     }
-    
-    //Declare here, so that they are still in scope when we call write.
-    //This is unfortunately silly. If you add event types, you need to add pointers here.
-    MessageEvent evm;
-    TTLEvent evt;
-    void* evptr;
-
-    float time = (float)timestamp / sample_rate;
 
-    if (eventNames[type] == "Messages")
+    int rowSize = schema->eventSizes[type];
+    while (eventRows.size() <= type)
+    {
+        eventRows.add(new MemoryBlock());
+        pendingEvents.add(0);
+    }
+    if (eventRows[type]->getSize() == 0)
+        eventRows[type]->setSize((size_t)rowSize * EVENT_BATCH_ROWS);
+    char* row = (char*)eventRows[type]->getData() + (size_t)rowSize * pendingEvents[type];
+
+    //The row is built in place; the padding is zeroed so that the files don't depend on what was in memory
+    EventHeader header;
+    header.time = (float)timestamp / sample_rate;
+    header.recording = recordingNumber;
+    header.eventID = id;
+    header.nodeID = processor;
+    memset(row, 0, rowSize);
+    memcpy(row, &header, EVENT_PAYLOAD_OFFSET);
+    if (schema->eventText[type])
     {
-        evm.time = time;
-        evm.recording = recordingNumber;
-        evm.eventID = id;
-        evm.nodeID = processor;
-        String str = String((char*)data);
-        str.copyToUTF8(evm.text, MAX_STR_SIZE);
-        evptr = (void*)&evm;     
+        MessageEvent evm;
+        const char* text = (const char*)data;
+        int length = 0;
+        while (length < dataSize && text[length] != 0)
+            length++;
+        evm.textLength = length;
+        evm.textOffset = addMessageText(text, length);
+        memcpy(row + HOFFSET(MessageEvent, textLength), &evm.textLength, sizeof(evm.textLength));
+        memcpy(row + HOFFSET(MessageEvent, textOffset), &evm.textOffset, sizeof(evm.textOffset));
     }
-    else if (eventNames[type] == "TTL")
+    else if (dataSize > 0)
     {
-        evt.time = time;
-        evt.recording = recordingNumber;
-        evt.eventID = id;
-        evt.nodeID = processor;
-        evt.event_channel = *((uint8*)data);
-        evptr = (void*)&evt;
-    }    
+        memcpy(row + EVENT_PAYLOAD_OFFSET, data, jmin(dataSize, schema->eventPayloadSizes[type]));
+    }
 
-    eventFullData[type]->writeCompoundData(1, 0, eventCompTypes[type], evptr); 
+    pendingEvents.set(type, pendingEvents[type] + 1);
+    if (pendingEvents[type] == EVENT_BATCH_ROWS)
+        writeEventRows(type);
 }
 
-void ArfFile::addEventType(String name, DataTypes type, String dataName)
-{    
-    eventNames.add(name);
-    eventTypes.add(type);
-    eventDataNames.add(dataName);  
-    
-    size_t typesize = (type == STR) ? MAX_STR_SIZE : getNativeType(type).getSize();
-    size_t size = 2*sizeof(uint8)+sizeof(int) + sizeof(float) + typesize;
-    eventSizes.add(size);
-    CompType ctype(size);
-    if (name == "Messages")
-    {         
-        ctype.insertMember(H5std_string("start"), HOFFSET(MessageEvent, time), PredType::NATIVE_FLOAT);
-        ctype.insertMember(H5std_string("recording"), HOFFSET(MessageEvent, recording), PredType::NATIVE_INT32);
-        ctype.insertMember(H5std_string("eventID"), HOFFSET(MessageEvent, eventID), PredType::NATIVE_UINT8);
-        ctype.insertMember(H5std_string("nodeID"), HOFFSET(MessageEvent, nodeID), PredType::NATIVE_UINT8);
-        ctype.insertMember(H5std_string("Text"), HOFFSET(MessageEvent, text), getNativeType(type));        
-        eventCompTypes.add(ctype);
+void ArfFile::writeEventRows(int type)
+{
+    int n = pendingEvents[type];
+    if (n == 0)
+        return;
+    //the rows are laid out as the committed type, so HDF5 takes them without converting
+    CHECK_ERROR(eventFullData[type]->appendBlock(n, 0, eventCompTypes.getReference(type), eventRows[type]->getData()));
+    pendingEvents.set(type, 0);
+}
+
+void ArfFile::writePendingEvents()
+{
+    for (int i = 0; i < pendingEvents.size() && i < eventFullData.size(); i++)
+        writeEventRows(i);
+}
+
+int ArfFile::flush()
+{
+    writePendingEvents();
+    return ArfFileBase::flush();
+}
+
+int64 ArfFile::addMessageText(const char* text, int length)
+{
+    if (messageText == nullptr)
+        return -1;
+    //no String is made for the key, a text with the same checksum is compared byte by byte
+    int key = (int)ArfChecksum::crc32c(0, text, length);
+    if (messageTexts.contains(key))
+    {
+        MessageText known = messageTexts[key];
+        if (known.length == length && (length == 0 || memcmp((const char*)messageCache.getData() + known.cached, text, length) == 0))
+            return known.offset;
     }
-    else if (name == "TTL")
+
+    int64 offset = messageText->getPosition();
+    if (length > 0)
     {
-        ctype.insertMember(H5std_string("start"), HOFFSET(TTLEvent, time), PredType::NATIVE_FLOAT);
-        ctype.insertMember(H5std_string("recording"), HOFFSET(TTLEvent, recording), PredType::NATIVE_INT32);
-        ctype.insertMember(H5std_string("eventID"), HOFFSET(TTLEvent, eventID), PredType::NATIVE_UINT8);
-        ctype.insertMember(H5std_string("nodeID"), HOFFSET(TTLEvent, nodeID), PredType::NATIVE_UINT8);
-        ctype.insertMember(H5std_string("event_channel"), HOFFSET(TTLEvent, event_channel), getNativeType(type));
-        eventCompTypes.add(ctype);      
+        TypedDataset<uint8, 1> textData(messageText);
+        CHECK_ERROR(textData.append(arfSpan((const uint8*)text, length)));
     }
-    else
+    //a long recording of ever new messages should not fill the memory
+    if (messageTexts.size() >= MESSAGE_TEXT_ENTRIES)
     {
-        std::cerr << "Event type" << name << "not implemented; look at ArfFileFormat.cpp";
+        messageTexts.clear();
+        messageCache.reset();
     }
+    MessageText entry = { offset, messageCache.getDataSize(), length };
+    messageCache.write(text, (size_t)length);
+    messageTexts.set(key, entry);
+    return offset;
 }
 
-void ArfFile::addChannelGroup(int nChannels)
+ArfRecordingData* ArfFile::createChannelGroup(String recordPath, int index)
 {
-    channelArray.add(nChannels);
-    numElectrodes++;
-    
-    //Create the compound datatype for that group
-    CompType spiketype(sizeof(SpikeInfo));
-    hsize_t dims[2] = {MAX_TRANSFORM_SIZE/(uint64)nChannels, (uint64)nChannels};
-    spiketype.insertMember(H5std_string("waveform"), HOFFSET(SpikeInfo, waveform), ArrayType(getNativeType(I16), 2, dims));
-    spiketype.insertMember(H5std_string("recording"), HOFFSET(SpikeInfo, recording), getNativeType(U16));
-    spiketype.insertMember(H5std_string("start"), HOFFSET(SpikeInfo, time), PredType::NATIVE_FLOAT);
-    spiketype.insertMember(H5std_string("valid_samples"), HOFFSET(SpikeInfo, samples), getNativeType(I32));
-    spikeCompTypes.add(spiketype);
+    ArfRecordingData* dSet;
+    ArfMetadataBuilder md;
+    String path(recordPath + "/spike_group" + String(index));
+
+    int max_dims[3] = {0, 0, 0}; //first dimension set to 0, because we want it unlimited (look at createCompoundDataSet)
+    int chunk_dims[3] = {profile.spikeChunkSize, 0, 0};
+    dSet = createCompoundDataSet(spikeCompTypes[schema->spikeTypeIndex[index]], path, 1, max_dims, chunk_dims);
+    md.addStr("samples", "units");
+    CHECK_ERROR(writeMetadata(dSet, md));
+    return dSet;
 }
 
-int ArfFile::createChannelGroup(int index)
+void ArfFile::writeSpikeIndex()
 {
-    ScopedPointer<ArfRecordingData> dSet;
-    int nChannels = channelArray[index];
-    String path("/rec_" + String(recordingNumber) + "/spike_group" + String(index));
-    
-    int max_dims[3] = {0, 0, 0}; //first dimension set to 0, because we want it unlimited (look at createCompoundDataSet)
-    int chunk_dims[3] = {SPIKE_CHUNK_XSIZE, 0, 0};
-    dSet = createCompoundDataSet(spikeCompTypes[index], path, 1, max_dims, chunk_dims);
-    CHECK_ERROR(setAttributeStr(String("samples"), path, String("units")));
-    return 0;
+    String recordPath = String("/rec_") + String(recordingNumber);
+    for (int i = 0; i < packedElectrodes.size(); i++)
+    {
+        Array<int> order, index;
+        buildSpikeIndex(*packedElectrodes[i], order, index);
+        String path = getPackedSpikePath(recordPath, packedTypes[i]);
+
+        ScopedPointer<ArfRecordingData> orderSet = createDataSet(I32, 0, PACKED_SPIKE_INDEX_CHUNK_SIZE, path + "_order");
+        ScopedPointer<ArfRecordingData> indexSet = createDataSet(I32, 0, 3, PACKED_SPIKE_INDEX_CHUNK_SIZE, path + "_index");
+        if (orderSet == nullptr || indexSet == nullptr)
+        {
+            std::cerr << "Error creating the electrode index of " << path << std::endl;
+            continue;
+        }
+        ArfMetadataBuilder indexMeta;
+        indexMeta.addStr("electrode,first,count", "columns");
+        CHECK_ERROR(writeMetadata(indexSet, indexMeta));
+        if (order.size() > 0)
+        {
+            TypedDataset<int32, 1> orderData(orderSet);
+            CHECK_ERROR(orderData.append(arfSpan(order)));
+        }
+        if (index.size() > 0)
+        {
+            TypedDataset<int32, 2> indexData(indexSet);
+            CHECK_ERROR(indexData.append(arfSpan(index), 3));
+        }
+    }
 }
 
 void ArfFile::resetChannels()
 {
     stopRecording(); //Just in case
-    channelArray.clear();
+}
+
+//Spike waveforms come channel by channel as offset binary. They are stored sample by sample as
+//int16, and subtracting 32768 is the same as flipping the top bit. The usual electrode sizes
+//(1, 2, 4 and 8 channels) get an SSE2 transpose, 8 samples per channel at a time.
+#if defined(__SSE2__)
+template <int N>
+static int transposeSpikeBlocks(const uint16* src, int stride, int nSamples, int16* dst)
+{
+    const __m128i bias = _mm_set1_epi16((short)0x8000);
+    int i = 0;
+    for (; i + 8 <= nSamples; i += 8)
+    {
+        __m128i r[N];
+        for (int j = 0; j < N; j++)
+            r[j] = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(src + j * stride + i)), bias);
+        __m128i* out = (__m128i*)(dst + i * N);
+        if (N == 1)
+        {
+            _mm_storeu_si128(out, r[0]);
+        }
+        else if (N == 2)
+        {
+            _mm_storeu_si128(out, _mm_unpacklo_epi16(r[0], r[1]));
+            _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(r[0], r[1]));
+        }
+        else if (N == 4)
+        {
+            __m128i ab0 = _mm_unpacklo_epi16(r[0], r[1]);
+            __m128i ab1 = _mm_unpackhi_epi16(r[0], r[1]);
+            __m128i cd0 = _mm_unpacklo_epi16(r[2], r[3]);
+            __m128i cd1 = _mm_unpackhi_epi16(r[2], r[3]);
+            _mm_storeu_si128(out, _mm_unpacklo_epi32(ab0, cd0));
+            _mm_storeu_si128(out + 1, _mm_unpackhi_epi32(ab0, cd0));
+            _mm_storeu_si128(out + 2, _mm_unpacklo_epi32(ab1, cd1));
+            _mm_storeu_si128(out + 3, _mm_unpackhi_epi32(ab1, cd1));
+        }
+        else
+        {
+            //8x8: pairs of channels, then quads, then all eight for every sample
+            __m128i p[8], q[8];
+            for (int j = 0; j < 4; j++)
+            {
+                p[2 * j] = _mm_unpacklo_epi16(r[2 * j], r[2 * j + 1]);
+                p[2 * j + 1] = _mm_unpackhi_epi16(r[2 * j], r[2 * j + 1]);
+            }
+            for (int j = 0; j < 2; j++)
+            {
+                q[4 * j] = _mm_unpacklo_epi32(p[4 * j], p[4 * j + 2]);
+                q[4 * j + 1] = _mm_unpackhi_epi32(p[4 * j], p[4 * j + 2]);
+                q[4 * j + 2] = _mm_unpacklo_epi32(p[4 * j + 1], p[4 * j + 3]);
+                q[4 * j + 3] = _mm_unpackhi_epi32(p[4 * j + 1], p[4 * j + 3]);
+            }
+            for (int j = 0; j < 4; j++)
+            {
+                _mm_storeu_si128(out + 2 * j, _mm_unpacklo_epi64(q[j], q[j + 4]));
+                _mm_storeu_si128(out + 2 * j + 1, _mm_unpackhi_epi64(q[j], q[j + 4]));
+            }
+        }
+    }
+    return i;
+}
+#endif
+
+//STRIDE is the number of samples per channel in SRC, of which the first NSAMPLES are stored
+static void transposeSpike(const uint16* src, int stride, int nSamples, int nChans, int16* dst)
+{
+    int done = 0;
+#if defined(__SSE2__)
+    switch (nChans)
+    {
+    case 1: done = transposeSpikeBlocks<1>(src, stride, nSamples, dst); break;
+    case 2: done = transposeSpikeBlocks<2>(src, stride, nSamples, dst); break;
+    case 4: done = transposeSpikeBlocks<4>(src, stride, nSamples, dst); break;
+    case 8: done = transposeSpikeBlocks<8>(src, stride, nSamples, dst); break;
+    default: break;
+    }
+#endif
+    int16* out = dst + done * nChans;
+    for (int i = done; i < nSamples; i++)
+    {
+        for (int j = 0; j < nChans; j++)
+            *(out++) = (int16)(src[j * stride + i] ^ 0x8000);
+    }
 }
 
 void ArfFile::writeSpike(int groupIndex, int nSamples, const uint16* data, float time)
 {
-    if ((groupIndex < 0) || (groupIndex >= numElectrodes))
+    int nElectrodes = (schema != nullptr) ? schema->getNumChannelGroups() : 0;
+    int set = (packedSpikes && groupIndex >= 0 && groupIndex < nElectrodes) ? packedTypes.indexOf(schema->spikeTypeIndex[groupIndex]) : groupIndex;
+    if ((groupIndex < 0) || (groupIndex >= nElectrodes) || (set < 0) || (set >= spikeFullDataArray.size()))
     {
         std::cerr << "HDF5::writeSpike Electrode index out of bounds " << groupIndex << std::endl;
         return;
     }
-    int nChans= channelArray[groupIndex];
+    int nChans= schema->getChannelGroupSize(groupIndex);
     
-    if (nSamples > MAX_TRANSFORM_SIZE)
+    //only what fits in the waveform is stored
+    int stored = nSamples;
+    if (nSamples * nChans > MAX_TRANSFORM_SIZE)
     {
         std::cerr << "Spike nSamples is bigger than MAX_TRANSFORM_SIZE/nChannels in group" << groupIndex << std::endl;
+        stored = MAX_TRANSFORM_SIZE / nChans;
     }
     
     spikeinfo.recording = recordingNumber;
     spikeinfo.time = time;
-    spikeinfo.samples = nSamples;
+    spikeinfo.samples = stored;
     
-    int16* dst=transformVector;
-    int16* waveBuf = spikeinfo.waveform;
-
     //Given the way we store spike data, we need to transpose it to store in
     //NSAMPLES x NCHANNELS as well as convert from u16 to i16
-    for (int i = 0; i < nSamples; i++)
+    transposeSpike(data, nSamples, stored, nChans, spikeinfo.waveform);
+    //Fill the rest of buffer with 0s, so that we don't write any junk. 
+    //This is annoying, but it seems there are problems trying to do Variable Length types in Compound Types
+    memset(spikeinfo.waveform + stored * nChans, 0, (MAX_TRANSFORM_SIZE - stored * nChans) * sizeof(int16));
+    
+    if (packedSpikes)
     {
-        for (int j = 0; j < nChans; j++)
+        spikeinfo.electrode = groupIndex;
+        spikeFullDataArray[set]->writeCompoundData(1, 0, packedSpikeCompTypes[schema->spikeTypeIndex[groupIndex]], (void*)&spikeinfo);
+        packedElectrodes[set]->add(groupIndex);
+    }
+    else
+        spikeFullDataArray[set]->writeCompoundData(1, 0, spikeCompTypes[schema->spikeTypeIndex[groupIndex]], (void*)&spikeinfo);
+}
+
+//Schema registry
+
+ArfSchemaRegistry::ArfSchemaRegistry() {}
+
+ArfSchemaRegistry::~ArfSchemaRegistry() {}
+
+int ArfSchemaRegistry::addEventType(String name, ArfFileBase::DataTypes type, String dataName)
+{
+    Array<ArfEventField> fields;
+    if (type != ArfFileBase::STR)
+    {
+        ArfEventField field = { dataName, type, 0, 1 };
+        fields.add(field);
+        return addEventSchema(name, fields, (int)ArfFileBase::getNativeType(type).getSize());
+    }
+
+    //message text is not in the rows, they have its length and offset in the MESSAGE_TEXT table
+    ArfEventField length = { "text_length", ArfFileBase::U32, (int)(HOFFSET(ArfFile::MessageEvent, textLength) - EVENT_PAYLOAD_OFFSET), 1 };
+    ArfEventField offset = { "text_offset", ArfFileBase::I64, (int)(HOFFSET(ArfFile::MessageEvent, textOffset) - EVENT_PAYLOAD_OFFSET), 1 };
+    fields.add(length);
+    fields.add(offset);
+    int index = addEventSchema(name, fields, (int)(sizeof(ArfFile::MessageEvent) - EVENT_PAYLOAD_OFFSET));
+    if (index >= 0)
+        eventText.set(index, true);
+    return index;
+}
+
+int ArfSchemaRegistry::addEventSchema(String name, const Array<ArfEventField>& fields, int payloadSize)
+{
+    //rows are not padded, so the TTL rows stay the 11 bytes they always were
+    int size = (int)EVENT_PAYLOAD_OFFSET + payloadSize;
+    if (eventNames.contains(name) || payloadSize < 0)
+    {
+        std::cerr << "Event type " << name << " already exists or has no payload" << std::endl;
+        return -1;
+    }
+    try
+    {
+        CompType ctype((size_t)size);
+        ctype.insertMember(H5std_string("start"), HOFFSET(ArfFile::EventHeader, time), PredType::NATIVE_FLOAT);
+        ctype.insertMember(H5std_string("recording"), HOFFSET(ArfFile::EventHeader, recording), PredType::NATIVE_INT32);
+        ctype.insertMember(H5std_string("eventID"), HOFFSET(ArfFile::EventHeader, eventID), PredType::NATIVE_UINT8);
+        ctype.insertMember(H5std_string("nodeID"), HOFFSET(ArfFile::EventHeader, nodeID), PredType::NATIVE_UINT8);
+        for (int i = 0; i < fields.size(); i++)
         {
-            *(dst++) = *(data+j*nSamples+i)-32768;
-            *(waveBuf++) = *(data+j*nSamples+i)-32768;
+            const ArfEventField& field = fields.getReference(i);
+            if (field.type == ArfFileBase::STR || field.count < 1 || field.offset < 0
+                || field.offset + field.count * (int)ArfFileBase::getNativeType(field.type).getSize() > payloadSize)
+            {
+                std::cerr << "Field " << field.name << " of event type " << name << " does not fit its payload" << std::endl;
+                return -1;
+            }
+            hsize_t dims[1] = { (hsize_t)field.count };
+            size_t offset = EVENT_PAYLOAD_OFFSET + field.offset;
+            if (field.count == 1)
+                ctype.insertMember(field.name.toStdString(), offset, ArfFileBase::getNativeType(field.type));
+            else
+                ctype.insertMember(field.name.toStdString(), offset, ArrayType(ArfFileBase::getNativeType(field.type), 1, dims));
         }
+        eventCompTypes.add(ctype);
     }
-    //Fill the rest of buffer with 0s, so that we don't write any junk. 
-    //This is annoying, but it seems there are problems trying to do Variable Length types in Compound Types
-    while(waveBuf < spikeinfo.waveform+MAX_TRANSFORM_SIZE)
-        {*(waveBuf++) = 0;}
-    
-    spikeFullDataArray[groupIndex]->writeCompoundData(1, 0, spikeCompTypes[groupIndex], (void*)&spikeinfo);
+    catch (Exception error)
+    {
+        //e.g. fields that overlap or have the same name
+        std::cerr << "Event type " << name << ": " << error.getCDetailMsg() << std::endl;
+        return -1;
+    }
+    eventNames.add(name);
+    eventFields.add(new Array<ArfEventField>(fields));
+    eventPayloadSizes.add(payloadSize);
+    eventText.add(false);
+    eventSizes.add(size);
+    return eventNames.size() - 1;
+}
+
+int ArfSchemaRegistry::addEventSchemas(const String& spec)
+{
+    int added = 0;
+    StringArray types;
+    types.addTokens(spec, ";", "");
+    for (int i = 0; i < types.size(); i++)
+    {
+        String entry = types[i].trim();
+        if (entry.isEmpty())
+            continue;
+        String name = entry.upToFirstOccurrenceOf(":", false, false).trim();
+        StringArray fieldSpecs;
+        fieldSpecs.addTokens(entry.fromFirstOccurrenceOf(":", false, false), ",", "");
+        Array<ArfEventField> fields;
+        int payloadSize = 0;
+        bool valid = entry.contains(":") && name.isNotEmpty() && !name.containsAnyOf("/ ");
+        for (int j = 0; j < fieldSpecs.size() && valid; j++)
+        {
+            //<field> <type>[[<count>]][@<offset>]
+            String fieldSpec = fieldSpecs[j].trim();
+            String typeSpec = fieldSpec.fromFirstOccurrenceOf(" ", false, false).trim();
+            String typeName = typeSpec.upToFirstOccurrenceOf("[", false, false).upToFirstOccurrenceOf("@", false, false).trim();
+            ArfEventField field;
+            field.name = fieldSpec.upToFirstOccurrenceOf(" ", false, false);
+            field.count = typeSpec.contains("[") ? typeSpec.fromFirstOccurrenceOf("[", false, false).getIntValue() : 1;
+            field.offset = typeSpec.contains("@") ? typeSpec.fromFirstOccurrenceOf("@", false, false).getIntValue() : payloadSize;
+            const char* typeNames[] = { "U8", "U16", "U32", "U64", "I8", "I16", "I32", "I64", "F32" };
+            int type = -1;
+            for (int t = 0; t < 9; t++)
+                if (typeName.equalsIgnoreCase(typeNames[t]))
+                    type = t;
+            field.type = (ArfFileBase::DataTypes)jmax(0, type);
+            valid = field.name.isNotEmpty() && type >= 0 && field.count >= 1 && field.offset >= 0;
+            if (valid)
+            {
+                fields.add(field);
+                payloadSize = jmax(payloadSize, field.offset + field.count * (int)ArfFileBase::getNativeType(field.type).getSize());
+            }
+        }
+        if (!valid || fields.size() == 0)
+        {
+            std::cerr << "Ignoring event type \"" << entry << "\", expected <name>: <field> <type>[[<count>]][@<offset>], ..."
+                << " with types U8, U16, U32, U64, I8, I16, I32, I64 or F32" << std::endl;
+            continue;
+        }
+        if (addEventSchema(name, fields, payloadSize) >= 0)
+            added++;
+    }
+    return added;
+}
+
+void ArfSchemaRegistry::removeEventTypes(int first)
+{
+    int n = eventNames.size() - first;
+    if (n <= 0)
+        return;
+    eventNames.removeRange(first, n);
+    eventFields.removeRange(first, n);
+    eventPayloadSizes.removeRange(first, n);
+    eventText.removeRange(first, n);
+    eventSizes.removeRange(first, n);
+    eventCompTypes.removeRange(first, n);
+}
+
+int ArfSchemaRegistry::getNumEventTypes() const
+{
+    return eventNames.size();
+}
+
+String ArfSchemaRegistry::getEventName(int index) const
+{
+    return eventNames[index];
+}
+
+ArfFileBase::DataTypes ArfSchemaRegistry::getEventType(int index) const
+{
+    if (eventText[index])
+        return ArfFileBase::STR;
+    return eventFields[index]->getFirst().type;
+}
+
+String ArfSchemaRegistry::getEventDataName(int index) const
+{
+    if (eventText[index])
+        return "Text";
+    return eventFields[index]->getFirst().name;
+}
+
+bool ArfSchemaRegistry::isTextEvent(int index) const
+{
+    return eventText[index];
+}
+
+int ArfSchemaRegistry::getPayloadSize(int index) const
+{
+    return eventPayloadSizes[index];
+}
+
+const Array<ArfEventField>& ArfSchemaRegistry::getEventFields(int index) const
+{
+    return *eventFields[index];
+}
+
+void ArfSchemaRegistry::addChannelGroup(int nChannels)
+{
+    int typeIndex = spikeTypeChannels.indexOf(nChannels);
+
+    //Create the compound datatype only for the first group of that size
+    if (typeIndex < 0)
+    {
+        CompType spiketype(HOFFSET(ArfFile::SpikeInfo, electrode));
+        hsize_t dims[2] = {MAX_TRANSFORM_SIZE/(uint64)nChannels, (uint64)nChannels};
+        spiketype.insertMember(H5std_string("waveform"), HOFFSET(ArfFile::SpikeInfo, waveform), ArrayType(ArfFileBase::getNativeType(ArfFileBase::I16), 2, dims));
+        spiketype.insertMember(H5std_string("recording"), HOFFSET(ArfFile::SpikeInfo, recording), ArfFileBase::getNativeType(ArfFileBase::U16));
+        spiketype.insertMember(H5std_string("start"), HOFFSET(ArfFile::SpikeInfo, time), PredType::NATIVE_FLOAT);
+        spiketype.insertMember(H5std_string("valid_samples"), HOFFSET(ArfFile::SpikeInfo, samples), ArfFileBase::getNativeType(ArfFileBase::I32));
+        typeIndex = spikeCompTypes.size();
+        spikeCompTypes.add(spiketype);
+
+        CompType packedtype(sizeof(ArfFile::SpikeInfo));
+        packedtype.insertMember(H5std_string("waveform"), HOFFSET(ArfFile::SpikeInfo, waveform), ArrayType(ArfFileBase::getNativeType(ArfFileBase::I16), 2, dims));
+        packedtype.insertMember(H5std_string("recording"), HOFFSET(ArfFile::SpikeInfo, recording), ArfFileBase::getNativeType(ArfFileBase::U16));
+        packedtype.insertMember(H5std_string("start"), HOFFSET(ArfFile::SpikeInfo, time), PredType::NATIVE_FLOAT);
+        packedtype.insertMember(H5std_string("valid_samples"), HOFFSET(ArfFile::SpikeInfo, samples), ArfFileBase::getNativeType(ArfFileBase::I32));
+        packedtype.insertMember(H5std_string("electrode"), HOFFSET(ArfFile::SpikeInfo, electrode), PredType::NATIVE_INT32);
+        packedSpikeCompTypes.add(packedtype);
+        spikeTypeChannels.add(nChannels);
+    }
+    channelArray.add(nChannels);
+    spikeTypeIndex.add(typeIndex);
+}
+
+void ArfSchemaRegistry::resetChannels()
+{
+    //The datatypes themselves are kept, they will be reused if the same group sizes come back
+    channelArray.clear();
+    spikeTypeIndex.clear();
+}
+
+int ArfSchemaRegistry::getNumChannelGroups() const
+{
+    return channelArray.size();
+}
+
+int ArfSchemaRegistry::getChannelGroupSize(int index) const
+{
+    return channelArray[index];
 }
@@ -26,14 +26,33 @@
 #define ARFFILEFORMAT_H_INCLUDED
 
 #include "../../../../JuceLibraryCode/JuceHeader.h"
+#include "ArfProfile.h"
+
+//samples per chunk of the channel datasets; parts are cut on multiples of it
+#ifndef CHUNK_XSIZE
+#define CHUNK_XSIZE 2048
+#endif
+//limits for the chunks of channels that don't run at the main sample rate
+#define MIN_CHUNK_XSIZE 256
+#define MAX_CHUNK_XSIZE 16384
+//the text of the messages of a recording, e.g. /rec_0/Messages_text
+#define MESSAGE_TEXT "Messages_text"
+//group of a recording with its named event, spike and chunk statistics datatypes, e.g. /rec_0/types/spike_4ch
+#define ARF_TYPES_GROUP "types"
 
 class ArfRecordingData;
+class ArfOverview;
+class ArfChecksum;
 namespace H5
 {
 class DataSet;
 class H5File;
+class H5Object;
+class Group;
 class DataType;
+class DataSpace;
 class CompType;
+class DSetCreatPropList;
 class ArrayType;
 
 }
@@ -48,8 +67,15 @@ struct ArfRecordingInfo
     Array<float> bitVolts;
     Array<float> channelSampleRates;
     bool multiSample;
+    //Disk preflight of the folder the recording goes to, in MB/s, 0 if none was run (see ArfDiskCheck),
+    //and the space that was left there
+    float diskRate;
+    float requiredRate;
+    int64 diskFree;
 };
 
+class ArfMetadataBuilder;
+
 class ArfFileBase
 {
 public:
@@ -58,7 +84,14 @@ public:
 
     int open();
 	int open(int nChans);
+    //opens an existing file without write access, e.g. a finished part
+    int openReadOnly();
+    //creates the file in memory only (core driver without a backing store), e.g. to build a template.
+    //With BACKINGSTORE it is written to its name when it is closed
+    int openInMemory(int nChans, bool backingStore = false);
     void close();
+    //copies the whole file, as it would be on disk, into IMAGE
+    bool getFileImage(MemoryBlock& image);
     virtual String getFileName() = 0;
     bool isOpen() const;
 	bool isReadyToOpen() const;
@@ -69,6 +102,39 @@ public:
     
     //moved from protected to be able to set attributes through messages
     int setAttributeStr(String value, String path, String name);
+    virtual int flush();
+
+    //Datasets created from now on get a byte shuffle and deflate at LEVEL (1-9); 0 turns it off
+    void setCompression(int level);
+    int getCompression() const;
+    //Int16 datasets created from now on, i.e. the samples and the overview, go through ArfCodec
+    //instead of shuffle and deflate
+    void setCodec(bool codec);
+    bool getCodec() const;
+    //Raw data chunk cache of every dataset of the files opened from now on: BYTES in SLOTS hash
+    //slots, or with BYTES 0, room for 32 chunks of CHUNKSIZE samples of every channel
+    void setCache(int64 bytes, int slots, int chunkSize);
+    //Files opened from now on write their raw data with O_DIRECT where possible, see ArfDirectDriver
+    void setDirectIO(bool direct);
+    //Files opened from now on are built in memory and written to disk by a thread at up to
+    //RATE MB/s (0 for no limit), and completely on flush and close, see ArfDirectDriver
+    void setStaging(bool staged, int rate);
+    //For many channels: files created from now on store their objects in the latest format, with
+    //metadata and raw data kept in separate pages of file space, and every file opened from now on gets
+    //PREALLOCATEBYTES of disk space reserved (0 for none), which close gives back if it wasn't used
+    void setPagedLayout(bool paged, int64 preallocateBytes);
+
+    //For tools that read finished files
+    ArfRecordingData* getDataSet(String path);
+    //names of the objects in the group at PATH
+    StringArray getChildNames(String path);
+    //copies every attribute of the object at SRCPATH in SOURCE to DSTPATH in this file
+    int copyAttributes(ArfFileBase& source, String srcPath, String dstPath);
+    //copies the named datatypes of the recording at RECORDPATH in SOURCE that this file doesn't have
+    //there yet. The recording must exist in this file.
+    int copyNamedTypes(ArfFileBase& source, String recordPath);
+    //the named datatype of the recording at RECORDPATH that equals TYPE, or TYPE itself if there is none
+    H5::DataType findNamedType(const H5::DataType& type, String recordPath);
     
     
 protected:
@@ -80,15 +146,24 @@ protected:
     int setAttributeAsArray(DataTypes type, void* data, int size, String path, String name);
     int setAttributeArray(DataTypes type, void* data, int size, String path, String name);
     int createGroup(String path);
-
-    ArfRecordingData* getDataSet(String path);
+    //creates the group and writes all the attributes in MD through the new handle.
+    //nLinks is a hint of how many objects will be created inside the group
+    int createGroup(String path, const ArfMetadataBuilder& md, int nLinks = 0);
+    //writes all the attributes in MD through the already open dataset handle
+    int writeMetadata(ArfRecordingData* dSet, const ArfMetadataBuilder& md);
+    int writeMetadata(String path, const ArfMetadataBuilder& md);
+    int moveObject(String src, String dst);
+    int deleteObject(String path);
+    //returns the named datatype at PATH, committing a copy of TYPE there if the file doesn't have it yet.
+    //The group of PATH is created if needed, the one above it must exist
+    H5::CompType getCommittedType(const H5::CompType& type, String path);
 
     //aliases for createDataSet
     ArfRecordingData* createDataSet(DataTypes type, int sizeX, int chunkX, String path);
     ArfRecordingData* createDataSet(DataTypes type, int sizeX, int sizeY, int chunkX, String path);
     ArfRecordingData* createDataSet(DataTypes type, int sizeX, int sizeY, int sizeZ, int chunkX, String path);
     ArfRecordingData* createDataSet(DataTypes type, int sizeX, int sizeY, int sizeZ, int chunkX, int chunkY, String path);
-    ArfRecordingData* createCompoundDataSet(H5::CompType type, String path, int dimension, int* max_dims, int* chunk_dims);
+    ArfRecordingData* createCompoundDataSet(H5::DataType type, String path, int dimension, int* max_dims, int* chunk_dims);
 
     bool readyToOpen;
 
@@ -96,12 +171,59 @@ private:
     //create an extendable dataset
     ArfRecordingData* createDataSet(DataTypes type, int dimension, int* size, int* chunking, String path);
     int open(bool newfile, int nChans);
+    void preallocate();
+    int writeMetadata(H5::H5Object* loc, const ArfMetadataBuilder& md);
+    //shuffle and deflate, if compression is on, or ArfCodec for SAMPLES if the codec is on
+    void setFilters(H5::DSetCreatPropList& prop, bool samples);
+    //opens the group or dataset at PATH without relying on a thrown exception to tell them apart
+    H5::H5Object* openObject(String path, H5::Group& gloc, H5::DataSet& dloc);
     ScopedPointer<H5::H5File> file;
     bool opened;
+    bool inMemory;
+    bool backingStore;
+    bool readOnly;
+    int compressionLevel;
+    bool codec;
+    int64 cacheBytes;
+    int cacheSlots;
+    int cacheChunkSize;
+    bool directIO;
+    bool staging;
+    int stagingRate;
+    bool pagedLayout;
+    int64 preallocateBytes;
+    //the open file, if it has disk space reserved past its end
+    String preallocatedPath;
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ArfFileBase);
 };
 
+//Collects the attributes of one group or dataset, so that they can all be written
+//in one pass through a handle that is already open, instead of looking up the object
+//by its path for every single attribute.
+class ArfMetadataBuilder
+{
+public:
+    ArfMetadataBuilder();
+    ~ArfMetadataBuilder();
+
+    //scalar attribute (or a scalar of array type, if size > 1), as setAttributeArray
+    void add(ArfFileBase::DataTypes type, const void* data, String name, int size = 1);
+    //one-dimensional attribute of length SIZE, as setAttributeAsArray
+    void addAsArray(ArfFileBase::DataTypes type, const void* data, int size, String name);
+    void addStr(String value, String name);
+
+    void clear();
+    int size() const;
+
+private:
+    friend class ArfFileBase;
+    struct Entry;
+    OwnedArray<Entry> entries;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ArfMetadataBuilder);
+};
+
 class ArfRecordingData
 {
 public:
@@ -115,21 +237,129 @@ public:
     
     int writeDataChannel(int dataSize, ArfFileBase::DataTypes type, void* data);
     
-    void writeCompoundData(int xDataSize, int yDataSize, H5::DataType type, void* data);
+    void writeCompoundData(int xDataSize, int yDataSize, const H5::DataType& type, void* data);
+
+    //What the writes above come down to, also used by TypedDataset. TYPE is the HDF5 type of DATA in
+    //memory. appendBlock writes XDATASIZE rows of YDATASIZE values (ignored for 1-D datasets) at the
+    //write position and moves it on; appendToRow writes XDATASIZE values along row YPOS, at the
+    //position of that row
+    int appendBlock(int xDataSize, int yDataSize, const H5::DataType& type, const void* data);
+    int appendToRow(int yPos, int xDataSize, const H5::DataType& type, const void* data);
 
     void getRowXPositions(Array<uint32>& rows);
 
+    //rows are counted in 64 bits, a merged channel can have more than 2^31 samples
+    int64 getPosition() const;
+    int setPosition(int64 pos);
+
+    //For tools that read finished files. Datasets are one-dimensional, XSTART is the first row
+    int64 getSize() const;
+    //columns of a 2-D dataset
+    int getWidth() const;
+    int getChunkSize() const;
+    int getRank() const;
+    H5::DataType getType() const;
+    int readDataBlock(int64 xStart, int xDataSize, ArfFileBase::DataTypes type, void* data);
+    int readCompoundData(int64 xStart, int xDataSize, const H5::DataType& type, void* data);
+    //Stores a whole chunk that has already been run through the filters of the dataset
+    //(see ArfFileBase::setCompression); the dataset must already be extended over it
+    int writeRawChunk(int chunkIndex, const void* data, size_t nBytes);
+    //The bytes of a chunk as they are stored, before the filters are undone. FILTERMASK gets the
+    //filters that were skipped for it (bit i for the i-th of getFilters); DATA is left empty if
+    //the chunk was never written
+    int readRawChunk(int chunkIndex, MemoryBlock& data, uint32& filterMask);
+    //ids of the filters of the dataset, in the order they are applied
+    Array<int> getFilters() const;
+
 private:
-    int xPos;
+    //Writes a block of XDATASIZE by YDATASIZE values at XSTART, YSTART, extending the dataset
+    //if it doesn't reach that far yet
+    int writeHyperslab(int64 xStart, int yStart, int xDataSize, int yDataSize, const H5::DataType& type, const void* data);
+
+    int64 xPos;
     int xChunkSize;
-    int size[3];
+    int64 size[3];
     int dimension;
     Array<uint32> rowXPos;
     ScopedPointer<H5::DataSet> dSet;
+    //The dataspaces of the last write, kept for the next ones: the one of the file is resized
+    //along with the dataset, the one of memory when the block size changes
+    ScopedPointer<H5::DataSpace> fileSpace;
+    ScopedPointer<H5::DataSpace> memSpace;
+    int memSize[3];
+
+    friend class ArfFileBase;
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ArfRecordingData);
 };
 
+//A field of the payload of an event: COUNT values of TYPE (not STR), OFFSET bytes into it
+struct ArfEventField
+{
+    String name;
+    ArfFileBase::DataTypes type;
+    int offset;
+    int count;
+};
+
+//Builds the compound datatypes for events and spikes once per engine, instead of
+//once per part. Each recording commits them in its types group, so that all datasets of
+//the same kind share one named datatype.
+class ArfSchemaRegistry
+{
+public:
+    ArfSchemaRegistry();
+    ~ArfSchemaRegistry();
+
+    //For events. A row of every event type has the time, recording, event id and node id, followed
+    //by the payload of the event. addEventType stores a payload of one value of TYPE named DATANAME,
+    //or with STR the text of messages (see ArfFile::writeEvent); addEventSchema stores a payload of
+    //PAYLOADSIZE bytes laid out as FIELDS just as it is. Both return the index that events of the
+    //type are written with, or -1 if the type can't be built.
+    int addEventType(String name, ArfFileBase::DataTypes type, String dataName);
+    int addEventSchema(String name, const Array<ArfEventField>& fields, int payloadSize);
+    //Adds the event types of SPEC, "<name>: <field> <type>[[<count>]][@<offset>], ...; <name>: ...",
+    //e.g. "Position: x F32, y F32, frame U32@8". Fields without an offset follow the one before.
+    //Returns the number of types added; entries that can't be used are reported and skipped
+    int addEventSchemas(const String& spec);
+    //drops the event types from FIRST on
+    void removeEventTypes(int first);
+    int getNumEventTypes() const;
+    String getEventName(int index) const;
+    //type and name of the first field, STR for messages
+    ArfFileBase::DataTypes getEventType(int index) const;
+    String getEventDataName(int index) const;
+    bool isTextEvent(int index) const;
+    int getPayloadSize(int index) const;
+    const Array<ArfEventField>& getEventFields(int index) const;
+
+    //For spikes; electrodes with the same number of channels share a datatype
+    void addChannelGroup(int nChannels);
+    void resetChannels();
+    int getNumChannelGroups() const;
+    int getChannelGroupSize(int index) const;
+
+private:
+    friend class ArfFile;
+
+    Array<String> eventNames;
+    OwnedArray<Array<ArfEventField>> eventFields;
+    Array<int> eventPayloadSizes;
+    Array<bool> eventText;
+    //bytes of a row
+    Array<int> eventSizes;
+    Array<H5::CompType> eventCompTypes;
+
+    Array<int> channelArray;
+    Array<int> spikeTypeIndex;
+    Array<int> spikeTypeChannels;
+    Array<H5::CompType> spikeCompTypes;
+    //the same with an electrode column, for the packed spike tables
+    Array<H5::CompType> packedSpikeCompTypes;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ArfSchemaRegistry);
+};
+
 class ArfFile : public ArfFileBase
 {
 public:
@@ -137,7 +367,43 @@ public:
     ArfFile();
     virtual ~ArfFile();
     void initFile(int processorNumber, String basename);
+    void setSchema(const ArfSchemaRegistry* schema);
+    //Chunk size of a channel at SAMPLERATE: the time span of CHUNKSIZE samples at MAINRATE,
+    //as a power of two between MIN_CHUNK_XSIZE and MAX_CHUNK_XSIZE
+    static int getChannelChunkSize(float sampleRate, float mainRate, int chunkSize = CHUNK_XSIZE);
+    //Chunk and cache sizes of the recordings started from now on, stored with them as the
+    //profile and profile_settings attributes. The cache applies from the next open.
+    void setProfile(const ArfProfile& profile);
+    //With COLUMNS of 2 (min, max) or 3 (and RMS), recordings started from now on get an ArfOverview
+    //of every channel under /rec_N/overview; 0 turns it off
+    void setOverview(int columns);
+    //Recordings started from now on get a /rec_N/chunk_stats table with the ArfChunkStats of every
+    //chunk of every channel
+    void setChunkStats(bool enable);
+    //compound type of the chunk_stats table, committed as types/chunk_stats of the recording
+    static H5::CompType getChunkStatsType();
+    //Recordings started from now on get a /rec_N/checksums group with the CRC32C of every chunk of
+    //every channel, see ArfChecksum
+    void setChecksums(bool enable);
+    //Recordings started from now on put the spikes of all electrodes with the same number of channels
+    //in one table (e.g. /rec_N/spikes_4ch for tetrodes) instead of a spike_groupK dataset per electrode
+    void setPackedSpikes(bool enable);
+    //Sorts the rows of a packed spike table by electrode: ORDER gets the row numbers of every
+    //electrode in turn, and INDEX a row of (electrode, first entry in ORDER, count) per electrode
+    static void buildSpikeIndex(const Array<int>& electrodes, Array<int>& order, Array<int>& index);
     void startNewRecording(int recordingNumber, int nChannels, ArfRecordingInfo* info, Array<int> recordedChanToKWDChan, Array<int> procMap);
+    //Creates the group, dataset and attribute skeleton of a recording under a placeholder name,
+    //so that an image of this file can be used for the parts that follow
+    void createTemplate(int nChannels, ArfRecordingInfo* info, Array<int> recordedChanToKWDChan, Array<int> procMap);
+    //Starts recording into a file made from a template: renames the skeleton and opens its datasets.
+    //On false the template has been removed, and startNewRecording can be used instead
+    bool resumeRecording(int recordingNumber, int nChannels, ArfRecordingInfo* info);
+    //Opens the datasets of a recording that is already in the file. With POSITIONS (as returned by
+    //getWritePositions) writing continues there, e.g. after the file was last flushed
+    bool attachRecording(int recordingNumber, int nChannels, ArfRecordingInfo* info, const Array<int64>* positions = nullptr);
+    //where the next sample of every channel, event and spike dataset goes, as far as it has been
+    //written: events that flush has not written yet are not counted
+    void getWritePositions(Array<int64>& positions);
     void stopRecording();
     void writeBlockData(int16* data, int nSamples);
     void writeRowData(int16* data, int nSamples);
@@ -147,11 +413,16 @@ public:
     String getFileName();
     
     //For events
-    void writeEvent(int type, uint8 id, uint8 processor, void* data, int64 timestamp);
-    void addEventType(String name, DataTypes type, String dataName);
+    //Events are dispatched by their index in the schema and kept until there are EVENT_BATCH_ROWS of
+    //a type, which are then written at once; writePendingEvents, flush and stopRecording write the rest.
+    //DATASIZE is the length of a message, which does not have to end in a 0, or of the payload of a
+    //binary event, which is cut or filled up with zeros to the size of the schema
+    void writeEvent(int type, uint8 id, uint8 processor, const void* data, int dataSize, int64 timestamp);
+    //writes the rows of every type that are still waiting for their batch to fill
+    void writePendingEvents();
+    int flush() override;
     
     //For spikes
-    void addChannelGroup(int nChannels);
     void resetChannels();
     void writeSpike(int groupIndex, int nSamples, const uint16* data, float time);
     
@@ -160,6 +431,13 @@ protected:
     int createFileStructure();
 
 private:
+    friend class ArfSchemaRegistry;
+
+    //commits the registry types into the recording at RECORDPATH, or opens them if it already has them
+    void commitSchemaTypes(String recordPath);
+    void createRecordingSkeleton(String recordPath, int nChannels, ArfRecordingInfo* info, Array<int> recordedChanToKWDChan, Array<int> procMap);
+    int writeRecordingAttributes(String recordPath, ArfRecordingInfo* info);
+
     int recordingNumber;
     int nChannels;
     int curChan;
@@ -172,52 +450,108 @@ private:
     
     
     //For events
-    typedef struct MessageEvent {
+    //The columns every event row starts with, see ArfSchemaRegistry; the payload follows nodeID
+    typedef struct EventHeader {
         float time;
         int32 recording;
         uint8 eventID;
         uint8 nodeID;
-        char text[MAX_STR_SIZE];        
-    } MessageEvent;
-    typedef struct TTLEvent {
+    } EventHeader;
+    //The text of a message is in the MESSAGE_TEXT table of the recording, from textOffset on
+    typedef struct MessageEvent {
         float time;
         int32 recording;
         uint8 eventID;
         uint8 nodeID;
-        uint8 event_channel;        
-    } TTLEvent;
+        uint32 textLength;
+        int64 textOffset;
+    } MessageEvent;
+    //writes the rows of event type TYPE that are waiting in eventRows
+    void writeEventRows(int type);
    
     float sample_rate;
     
+    const ArfSchemaRegistry* schema;
     OwnedArray<ArfRecordingData> eventFullData;
-    Array<String> eventNames;
-    Array<DataTypes> eventTypes;
-    Array<String> eventDataNames;
-    
-    Array<int> eventSizes;
+    //named types committed in this file
     Array<H5::CompType> eventCompTypes;
+    //rows of every event type that have not been written yet, pendingEvents of them
+    OwnedArray<MemoryBlock> eventRows;
+    Array<int> pendingEvents;
+    //Message text, every distinct text once. messageTexts finds the ones already in the table by
+    //the CRC32C of their bytes (up to MESSAGE_TEXT_ENTRIES of them), and messageCache holds the
+    //bytes to compare with
+    struct MessageText
+    {
+        int64 offset;
+        size_t cached;
+        int length;
+    };
+    int64 addMessageText(const char* text, int length);
+    ScopedPointer<ArfRecordingData> messageText;
+    HashMap<int, MessageText> messageTexts;
+    MemoryOutputStream messageCache;
     
     int kwdIndex;
     
     //For spikes
-    int createChannelGroup(int index);
+    ArfRecordingData* createChannelGroup(String recordPath, int index);
     OwnedArray<ArfRecordingData> spikeArray;
     OwnedArray<ArfRecordingData> recordingArray;
     OwnedArray<ArfRecordingData> timeStamps;
     OwnedArray<ArfRecordingData> spikeFullDataArray;
     
-    Array<int> channelArray;
-    int numElectrodes;
-	HeapBlock<int16> transformVector;
+    ArfProfile profile;
+
+    //For the min/max overview
+    String getOverviewPath(String recordPath, int channel, int level);
+    //one ArfOverview per channel if the overview or the chunk statistics are on
+    void addOverviews(int nChannels, ArfRecordingInfo* info);
+    //writes the rows the overview of CHANNEL has finished, and its finished chunk statistics
+    void writeOverview(int channel);
+    int overviewColumns;
+    bool chunkStats;
+    ScopedPointer<H5::CompType> chunkStatsType;
+    //types group of the recording being written
+    String typesPath;
+    ScopedPointer<ArfRecordingData> chunkStatsData;
+    OwnedArray<ArfOverview> overviews;
+    //ARF_OVERVIEW_LEVELS datasets per channel, attached on their first write like recarr
+    OwnedArray<ArfRecordingData> overviewData;
+
+    //For the chunk checksums
+    String getChecksumPath(String recordPath, int channel);
+    //one ArfChecksum per channel if the checksums are on
+    void addChecksums(int nChannels, ArfRecordingInfo* info);
+    //writes the checksums of the chunks of CHANNEL that are finished
+    void writeChecksums(int channel);
+    //continues the checksums of CHANNEL after POSITION samples, see attachRecording
+    bool resumeChecksums(int channel, int64 position);
+    bool checksums;
+    OwnedArray<ArfChecksum> channelChecksums;
+    //one table per channel, attached on its first write like recarr
+    OwnedArray<ArfRecordingData> checksumData;
     
+    //The spike_groupK rows end before electrode, which only the packed tables have
     typedef struct SpikeInfo {
         float time;
         int recording;
         int16 waveform[MAX_TRANSFORM_SIZE];
         int samples;
+        int32 electrode;
     } SpikeInfo;
-    Array<H5::CompType> spikeCompTypes;
+    Array<H5::CompType> spikeCompTypes; //one per distinct electrode size, see ArfSchemaRegistry
     SpikeInfo spikeinfo;
+
+    //For the packed spike tables
+    String getPackedSpikePath(String recordPath, int typeIndex);
+    //writes the _order and _index datasets of every packed table
+    void writeSpikeIndex();
+    bool packedSpikes;
+    Array<H5::CompType> packedSpikeCompTypes;
+    //spike type of every packed table in spikeFullDataArray, and the electrode of each of its rows
+    Array<int> packedTypes;
+    OwnedArray<Array<int>> packedElectrodes;
     
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ArfFile);
@@ -0,0 +1,257 @@
+/*
+ ------------------------------------------------------------------
+
+ Michal Badura, 2016
+ based on code by Florian Franzen, 2014
+
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "ArfLiveTap.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <new>
+
+ArfLiveTap::ArfLiveTap() : header(nullptr), data(nullptr), mappedSize(0), pendingHead(0), sequence(0),
+    recordingNumber(0), partNumber(0)
+{
+}
+
+ArfLiveTap::~ArfLiveTap()
+{
+    close();
+}
+
+bool ArfLiveTap::open(String name, int megabytes)
+{
+    const ScopedLock sl(lock);
+    close();
+    uint64 capacity = ((uint64)jmax(1, megabytes) << 20);
+    //a tap left behind by a crashed recording would keep the name taken
+    shm_unlink(name.toUTF8());
+    int fd = shm_open(name.toUTF8(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0)
+    {
+        std::cerr << "Could not create the live tap " << name << std::endl;
+        return false;
+    }
+    size_t size = sizeof(ArfTapHeader) + capacity;
+    //Pre-faulting the pages keeps page faults out of the recording thread
+    void* ptr = (ftruncate(fd, size) == 0) ? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0) : MAP_FAILED;
+    ::close(fd);
+    if (ptr == MAP_FAILED)
+    {
+        std::cerr << "Could not map " << (int)(size >> 20) << " MB of shared memory for the live tap" << std::endl;
+        shm_unlink(name.toUTF8());
+        return false;
+    }
+    this->name = name;
+    header = (ArfTapHeader*)ptr;
+    data = (char*)ptr + sizeof(ArfTapHeader);
+    mappedSize = size;
+
+    new (header) ArfTapHeader();
+    header->capacity = capacity;
+    header->producerPid = getpid();
+    header->head = 0;
+    header->oldest = 0;
+    header->dropped = 0;
+    header->infoVersion = 0;
+    header->recordingNumber = 0;
+    header->partNumber = 0;
+    header->nChannels = 0;
+    header->mainSampleRate = 0;
+    header->version = ARF_TAP_VERSION;
+    std::atomic_thread_fence(std::memory_order_release);
+    header->magic = ARF_TAP_MAGIC;
+    pendingHead = 0;
+    sequence = 0;
+    return true;
+}
+
+void ArfLiveTap::close()
+{
+    const ScopedLock sl(lock);
+    if (header == nullptr)
+        return;
+    munmap(header, mappedSize);
+    shm_unlink(name.toUTF8());
+    header = nullptr;
+    data = nullptr;
+    mappedSize = 0;
+    name = String();
+}
+
+bool ArfLiveTap::isOpen() const
+{
+    return header != nullptr;
+}
+
+String ArfLiveTap::getName() const
+{
+    return name;
+}
+
+char* ArfLiveTap::beginRecord(ArfTapRecordType type, uint32 size)
+{
+    const uint64 capacity = header->capacity;
+    uint64 head = header->head.load(std::memory_order_relaxed);
+    uint64 space = arfTapSpace(size);
+    uint64 offset = head % capacity;
+    uint64 contiguous = capacity - offset;
+    if (space > capacity / 2)
+    {
+        header->dropped.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    //Everything the record (and the pad before it) overwrites is given up first, so that a
+    //consumer checking oldest after reading knows whether what it read was still intact
+    uint64 end = head + space + ((contiguous < space) ? contiguous : 0);
+    uint64 oldest = header->oldest.load(std::memory_order_relaxed);
+    while (end - oldest > capacity)
+        oldest += arfTapSpace(((const ArfTapRecordHeader*)(data + oldest % capacity))->size);
+    header->oldest.store(oldest, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    //A record never wraps around, the rest of the ring is skipped with a pad record instead
+    if (contiguous < space)
+    {
+        ArfTapRecordHeader* pad = (ArfTapRecordHeader*)(data + offset);
+        pad->type = TapPad;
+        pad->size = (uint32)(contiguous - sizeof(ArfTapRecordHeader));
+        pad->sequence = 0;
+        head += contiguous;
+        offset = 0;
+    }
+    ArfTapRecordHeader* rec = (ArfTapRecordHeader*)(data + offset);
+    rec->type = type;
+    rec->size = size;
+    rec->sequence = sequence++;
+    pendingHead = head + space;
+    return data + offset + sizeof(ArfTapRecordHeader);
+}
+
+void ArfLiveTap::commitRecord()
+{
+    header->head.store(pendingHead, std::memory_order_release);
+}
+
+void ArfLiveTap::openPart(int recordingNumber, int partNumber, float mainSampleRate, const Array<float>& sampleRates,
+                          const Array<float>& bitVolts, const Array<int>& processors)
+{
+    const ScopedLock sl(lock);
+    if (header == nullptr)
+        return;
+    this->recordingNumber = recordingNumber;
+    this->partNumber = partNumber;
+
+    //The table is only ever changed here. Consumers retry while infoVersion is odd or has moved
+    uint32 version = header->infoVersion.load(std::memory_order_relaxed);
+    header->infoVersion.store(version + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    int nChannels = jmin(sampleRates.size(), ARF_TAP_MAX_CHANNELS);
+    if (nChannels < sampleRates.size())
+        std::cerr << "The live tap only describes the first " << nChannels << " channels" << std::endl;
+    header->recordingNumber = recordingNumber;
+    header->partNumber = partNumber;
+    header->nChannels = nChannels;
+    header->mainSampleRate = mainSampleRate;
+    for (int i = 0; i < nChannels; i++)
+    {
+        header->channels[i].sampleRate = sampleRates[i];
+        header->channels[i].bitVolts = bitVolts[i];
+        header->channels[i].processor = processors[i];
+    }
+    header->infoVersion.store(version + 2, std::memory_order_release);
+
+    ArfTapPart* part = (ArfTapPart*)beginRecord(TapOpen, sizeof(ArfTapPart));
+    if (part == nullptr)
+        return;
+    part->recordingNumber = recordingNumber;
+    part->partNumber = partNumber;
+    commitRecord();
+}
+
+void ArfLiveTap::closePart()
+{
+    const ScopedLock sl(lock);
+    if (header == nullptr)
+        return;
+    ArfTapPart* part = (ArfTapPart*)beginRecord(TapClose, sizeof(ArfTapPart));
+    if (part == nullptr)
+        return;
+    part->recordingNumber = recordingNumber;
+    part->partNumber = partNumber;
+    commitRecord();
+}
+
+void ArfLiveTap::writeData(int channel, const int16* samples, int nSamples, int64 timestamp)
+{
+    const ScopedLock sl(lock);
+    if (header == nullptr)
+        return;
+    char* dst = beginRecord(TapData, (uint32)(sizeof(ArfTapData) + nSamples * sizeof(int16)));
+    if (dst == nullptr)
+        return;
+    ArfTapData* rec = (ArfTapData*)dst;
+    rec->channel = channel;
+    rec->nSamples = nSamples;
+    rec->timestamp = timestamp;
+    memcpy(dst + sizeof(ArfTapData), samples, nSamples * sizeof(int16));
+    commitRecord();
+}
+
+void ArfLiveTap::writeEvent(int type, uint8 id, uint8 processor, const void* eventData, int dataSize, int64 timestamp)
+{
+    const ScopedLock sl(lock);
+    if (header == nullptr)
+        return;
+    dataSize = jlimit(0, 0xffff, dataSize);
+    char* dst = beginRecord(TapEvent, (uint32)(sizeof(ArfTapEvent) + dataSize));
+    if (dst == nullptr)
+        return;
+    ArfTapEvent* rec = (ArfTapEvent*)dst;
+    rec->type = type;
+    rec->eventID = id;
+    rec->nodeID = processor;
+    rec->dataSize = (uint16)dataSize;
+    rec->timestamp = timestamp;
+    if (dataSize > 0)
+        memcpy(dst + sizeof(ArfTapEvent), eventData, dataSize);
+    commitRecord();
+}
+
+void ArfLiveTap::writeSpike(int electrode, int nSamples, int nValues, const uint16* values, float time, int64 timestamp)
+{
+    const ScopedLock sl(lock);
+    if (header == nullptr)
+        return;
+    char* dst = beginRecord(TapSpike, (uint32)(sizeof(ArfTapSpike) + nValues * sizeof(uint16)));
+    if (dst == nullptr)
+        return;
+    ArfTapSpike* rec = (ArfTapSpike*)dst;
+    rec->electrode = electrode;
+    rec->nSamples = nSamples;
+    rec->nValues = nValues;
+    rec->time = time;
+    rec->timestamp = timestamp;
+    memcpy(dst + sizeof(ArfTapSpike), values, nValues * sizeof(uint16));
+    commitRecord();
+}
@@ -0,0 +1,75 @@
+/*
+ ------------------------------------------------------------------
+
+ Michal Badura, 2016
+ based on code by Florian Franzen, 2014
+
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef ARFLIVETAP_H_INCLUDED
+#define ARFLIVETAP_H_INCLUDED
+
+#include "../../../../JuceLibraryCode/JuceHeader.h"
+#include "ArfTapFormat.h"
+
+//The live tap: every converted block, event and spike the recording writes, published in POSIX
+//shared memory (layout in ArfTapFormat.h) for processes that need them while the part is still
+//open. The recording never waits for the consumers. When the ring is full the oldest records are
+//overwritten, and a consumer that falls behind sees a gap in the sequence numbers.
+//Tools/arf-tap/ArfTapReader.h is the consumer side.
+class ArfLiveTap
+{
+public:
+    ArfLiveTap();
+    ~ArfLiveTap();
+
+    //makes the shared memory NAME with MEGABYTES for records, replacing a stale one of the same name
+    bool open(String name, int megabytes);
+    //unmaps and removes the name; consumers keep what they mapped
+    void close();
+    bool isOpen() const;
+    String getName() const;
+
+    //Publishes the channel table of a new part and its TapOpen record
+    void openPart(int recordingNumber, int partNumber, float mainSampleRate, const Array<float>& sampleRates,
+                  const Array<float>& bitVolts, const Array<int>& processors);
+    void closePart();
+    void writeData(int channel, const int16* data, int nSamples, int64 timestamp);
+    void writeEvent(int type, uint8 id, uint8 processor, const void* data, int dataSize, int64 timestamp);
+    void writeSpike(int electrode, int nSamples, int nValues, const uint16* data, float time, int64 timestamp);
+
+private:
+    //Returns where SIZE bytes of the record go after making room for it, or nullptr if it can never fit
+    char* beginRecord(ArfTapRecordType type, uint32 size);
+    void commitRecord();
+
+    String name;
+    ArfTapHeader* header;
+    char* data;
+    size_t mappedSize;
+    uint64 pendingHead;
+    uint64 sequence;
+    int recordingNumber;
+    int partNumber;
+    //the recording thread and the event and spike calls may come from different threads
+    CriticalSection lock;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ArfLiveTap);
+};
+
+#endif  // ARFLIVETAP_H_INCLUDED
@@ -0,0 +1,266 @@
+/*
+ ------------------------------------------------------------------
+
+ Michal Badura, 2016
+ based on code by Florian Franzen, 2014
+
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+#include "ArfOverview.h"
+#include <cmath>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+//samples per pass of the SSE2 loop, so that its 16 and 32 bit lane totals can't overflow
+#define SCAN_BLOCK 32768
+
+//Adds N samples to STATS. This runs over every recorded sample, so it works on 8 samples
+//at a time where SSE2 is available.
+static void scanSamples(const int16* data, int n, ArfSampleStats& stats)
+{
+    int16 mn = stats.min;
+    int16 mx = stats.max;
+    int64 sum = 0;
+    uint64 sumSquares = 0;
+    int64 clipped = 0;
+    int i = 0;
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi16(1);
+    const __m128i high = _mm_set1_epi16(32766);
+    const __m128i low = _mm_set1_epi16(-32766);
+    __m128i vmin = _mm_set1_epi16(mn);
+    __m128i vmax = _mm_set1_epi16(mx);
+    while (i + 8 <= n)
+    {
+        __m128i vsum = zero;
+        __m128i vsquares = zero;
+        __m128i vclipped = zero;
+        int end = i + jmin(SCAN_BLOCK, (n - i) & ~7);
+        for (; i < end; i += 8)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+            vmin = _mm_min_epi16(vmin, v);
+            vmax = _mm_max_epi16(vmax, v);
+            vsum = _mm_add_epi32(vsum, _mm_madd_epi16(v, ones));
+            //pairs of squares, at most 2^31 each, so they fit in unsigned 32 bits
+            __m128i sq = _mm_madd_epi16(v, v);
+            vsquares = _mm_add_epi64(vsquares, _mm_unpacklo_epi32(sq, zero));
+            vsquares = _mm_add_epi64(vsquares, _mm_unpackhi_epi32(sq, zero));
+            //the compare masks are -1 where a sample is at full scale
+            __m128i full = _mm_or_si128(_mm_cmpgt_epi16(v, high), _mm_cmplt_epi16(v, low));
+            vclipped = _mm_sub_epi16(vclipped, full);
+        }
+        int32 sums[4];
+        _mm_storeu_si128((__m128i*)sums, vsum);
+        sum += (int64)sums[0] + sums[1] + sums[2] + sums[3];
+        uint64 squares[2];
+        _mm_storeu_si128((__m128i*)squares, vsquares);
+        sumSquares += squares[0] + squares[1];
+        int16 counts[8];
+        _mm_storeu_si128((__m128i*)counts, vclipped);
+        for (int k = 0; k < 8; k++)
+            clipped += (uint16)counts[k];
+    }
+    int16 lanes[8];
+    _mm_storeu_si128((__m128i*)lanes, vmin);
+    for (int k = 0; k < 8; k++)
+        mn = jmin(mn, lanes[k]);
+    _mm_storeu_si128((__m128i*)lanes, vmax);
+    for (int k = 0; k < 8; k++)
+        mx = jmax(mx, lanes[k]);
+#endif
+    for (; i < n; i++)
+    {
+        mn = jmin(mn, data[i]);
+        mx = jmax(mx, data[i]);
+        sum += data[i];
+        sumSquares += (uint64)((int32)data[i] * data[i]);
+        if (data[i] >= 32767 || data[i] <= -32767)
+            clipped++;
+    }
+    stats.count += n;
+    stats.min = mn;
+    stats.max = mx;
+    stats.sum += sum;
+    stats.sumSquares += sumSquares;
+    stats.clipped += clipped;
+}
+
+void ArfSampleStats::reset()
+{
+    count = 0;
+    min = std::numeric_limits<int16>::max();
+    max = std::numeric_limits<int16>::min();
+    sum = 0;
+    sumSquares = 0;
+    clipped = 0;
+}
+
+void ArfSampleStats::add(const ArfSampleStats& other)
+{
+    count += other.count;
+    min = jmin(min, other.min);
+    max = jmax(max, other.max);
+    sum += other.sum;
+    sumSquares += other.sumSquares;
+    clipped += other.clipped;
+}
+
+ArfOverview::ArfOverview(int columns, int chunkSize, int channel)
+    : columns((columns > 0) ? jlimit(2, 3, columns) : 0), chunkSize(jmax(0, chunkSize)), channel(channel), position(0)
+{
+    for (int i = 0; i < ARF_OVERVIEW_LEVELS; i++)
+        levels[i].block.reset();
+    chunk.reset();
+}
+
+int ArfOverview::getNumColumns() const
+{
+    return columns;
+}
+
+int ArfOverview::getDecimation(int level)
+{
+    int decimation = ARF_OVERVIEW_FACTOR;
+    for (int i = 0; i < level; i++)
+        decimation *= ARF_OVERVIEW_FACTOR;
+    return decimation;
+}
+
+void ArfOverview::addSamples(const int16* data, int nSamples)
+{
+    if (columns == 0 && chunkSize == 0)
+        return;
+    //Every stretch up to the next block or chunk end is scanned once, for both
+    ArfSampleStats segment;
+    while (nSamples > 0)
+    {
+        int n = nSamples;
+        if (columns > 0)
+            n = jmin(n, ARF_OVERVIEW_FACTOR - (int)(position % ARF_OVERVIEW_FACTOR));
+        if (chunkSize > 0)
+            n = jmin(n, chunkSize - (int)(position % chunkSize));
+        segment.reset();
+        scanSamples(data, n, segment);
+        position += n;
+        data += n;
+        nSamples -= n;
+
+        if (columns > 0)
+        {
+            levels[0].block.add(segment);
+            if (position % ARF_OVERVIEW_FACTOR == 0)
+                endBlock(0);
+        }
+        if (chunkSize > 0)
+        {
+            chunk.add(segment);
+            if (position % chunkSize == 0)
+                endChunk();
+        }
+    }
+}
+
+void ArfOverview::closeBlock(int level)
+{
+    ArfSampleStats& block = levels[level].block;
+    if (block.count > 0)
+    {
+        Array<int16>& rows = levels[level].rows;
+        rows.add(block.min);
+        rows.add(block.max);
+        if (columns > 2)
+            rows.add((int16)jmin(32767.0, std::sqrt((double)block.sumSquares / block.count)));
+        if (level + 1 < ARF_OVERVIEW_LEVELS)
+            levels[level + 1].block.add(block);
+    }
+    block.reset();
+}
+
+void ArfOverview::endBlock(int level)
+{
+    closeBlock(level);
+    if (level + 1 < ARF_OVERVIEW_LEVELS && position % getDecimation(level + 1) == 0)
+        endBlock(level + 1);
+}
+
+void ArfOverview::endChunk()
+{
+    if (chunk.count > 0)
+    {
+        ArfChunkStats row;
+        row.channel = channel;
+        row.chunk = (int32)((position - 1) / chunkSize);
+        row.count = (int32)chunk.count;
+        row.min = chunk.min;
+        row.max = chunk.max;
+        row.sum = chunk.sum;
+        row.sumSquares = chunk.sumSquares;
+        row.clipped = (int32)chunk.clipped;
+        chunkStats.add(row);
+    }
+    chunk.reset();
+}
+
+void ArfOverview::finish()
+{
+    //each level passes its open block up before the level above is closed
+    for (int i = 0; i < ARF_OVERVIEW_LEVELS && columns > 0; i++)
+        closeBlock(i);
+    if (chunkSize > 0)
+        endChunk();
+}
+
+void ArfOverview::skipTo(int64 newPosition)
+{
+    position = newPosition;
+    for (int i = 0; i < ARF_OVERVIEW_LEVELS; i++)
+        levels[i].block.reset();
+    chunk.reset();
+}
+
+int ArfOverview::getNumRows(int level) const
+{
+    return (columns > 0) ? levels[level].rows.size() / columns : 0;
+}
+
+int16* ArfOverview::getRows(int level)
+{
+    return levels[level].rows.getRawDataPointer();
+}
+
+void ArfOverview::clearRows(int level)
+{
+    levels[level].rows.clearQuick();
+}
+
+int ArfOverview::getNumChunkStats() const
+{
+    return chunkStats.size();
+}
+
+ArfChunkStats* ArfOverview::getChunkStats()
+{
+    return chunkStats.getRawDataPointer();
+}
+
+void ArfOverview::clearChunkStats()
+{
+    chunkStats.clearQuick();
+}
@@ -0,0 +1,119 @@
+/*
+ ------------------------------------------------------------------
+
+ Michal Badura, 2016
+ based on code by Florian Franzen, 2014
+
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+#ifndef ARFOVERVIEW_H_INCLUDED
+#define ARFOVERVIEW_H_INCLUDED
+
+#include "../../../../JuceLibraryCode/JuceHeader.h"
+
+//group of a recording that holds the overview datasets, e.g. /rec_0/overview/channel3_4096
+#define ARF_OVERVIEW_GROUP "overview"
+//levels of 1:64, 1:4096 and 1:262144 samples
+#define ARF_OVERVIEW_LEVELS 3
+#define ARF_OVERVIEW_FACTOR 64
+//table of a recording with a row of ArfChunkStats for every chunk of every channel
+#define ARF_CHUNK_STATS "chunk_stats"
+
+//Summary of a stretch of samples of one channel
+struct ArfSampleStats
+{
+    int64 count;
+    int16 min;
+    int16 max;
+    int64 sum;
+    uint64 sumSquares;
+    //samples at full scale (+-32767 or -32768), i.e. most likely clipped
+    int64 clipped;
+
+    void reset();
+    void add(const ArfSampleStats& other);
+};
+
+//A row of the chunk statistics table; the layout of the table's compound type
+struct ArfChunkStats
+{
+    int32 channel;
+    //chunk of the channel dataset, i.e. samples from chunk * chunk size on
+    int32 chunk;
+    int32 count;
+    int16 min;
+    int16 max;
+    int64 sum;
+    uint64 sumSquares;
+    int32 clipped;
+};
+
+//Summaries of one channel, taken from the samples as they are written in a single pass:
+//min and max (and optionally RMS) over blocks of 64, 4096 and 262144 samples, so that a viewer
+//can draw hours of data without reading every sample, and ArfChunkStats for every chunk of
+//the channel dataset. Finished rows are kept until they are taken.
+class ArfOverview
+{
+public:
+    //COLUMNS is 2 for min and max, 3 to add the RMS, or 0 for no overview levels.
+    //With CHUNKSIZE > 0 the chunk statistics of CHANNEL are collected as well.
+    ArfOverview(int columns, int chunkSize = 0, int channel = 0);
+
+    void addSamples(const int16* data, int nSamples);
+    //ends the blocks and the chunk that are still open, at the end of a part
+    void finish();
+    //Continues after POSITION samples that are already written, e.g. in a restarted writer.
+    //The blocks and the chunk open at that point then only cover the samples from here on.
+    void skipTo(int64 position);
+
+    int getNumColumns() const;
+    static int getDecimation(int level);
+
+    //finished rows of LEVEL, getNumColumns() values each
+    int getNumRows(int level) const;
+    int16* getRows(int level);
+    void clearRows(int level);
+
+    //finished chunks
+    int getNumChunkStats() const;
+    ArfChunkStats* getChunkStats();
+    void clearChunkStats();
+
+private:
+    struct Level
+    {
+        ArfSampleStats block;
+        Array<int16> rows;
+    };
+    //adds the open block of LEVEL as a row, and to the open block of the level above
+    void closeBlock(int level);
+    //closes the block of LEVEL and of every level above that ends at the same sample
+    void endBlock(int level);
+    void endChunk();
+
+    int columns;
+    int chunkSize;
+    int channel;
+    int64 position;
+    Level levels[ARF_OVERVIEW_LEVELS];
+    ArfSampleStats chunk;
+    Array<ArfChunkStats> chunkStats;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ArfOverview);
+};
+
+#endif  // ARFOVERVIEW_H_INCLUDED
@@ -0,0 +1,221 @@
+/*
+ ------------------------------------------------------------------
+
+ Michal Badura, 2016
+ based on code by Florian Franzen, 2014
+
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "ArfProfile.h"
+#include "ArfFileFormat.h"
+
+//The default preset. They can still be set at compile time, as before
+
+#ifndef SAVING_NUM
+#define SAVING_NUM 20000
+#endif
+
+#ifndef MAX_BUFFER_SIZE
+#define MAX_BUFFER_SIZE 40960
+#endif
+
+// how many savingNum samples need to pass until we open a new file,
+// unless a part length or size is set in the engine parameters
+// if set to 0, then no parts
+#ifndef CNT_PER_PART
+#define CNT_PER_PART 1000
+#endif
+
+#ifndef EVENT_CHUNK_SIZE
+#define EVENT_CHUNK_SIZE 8
+#endif
+
+#ifndef SPIKE_CHUNK_XSIZE
+#define SPIKE_CHUNK_XSIZE 8
+#endif
+
+#ifndef CACHE_SLOTS
+#define CACHE_SLOTS 1667
+#endif
+
+#ifndef FLUSH_INTERVAL
+#define FLUSH_INTERVAL 500
+#endif
+
+//Every setting, with the key it has in profile files and the values it may take
+static const struct ProfileField
+{
+    const char* key;
+    int ArfProfile::* value;
+    int minValue;
+    int maxValue;
+} profileFields[] =
+{
+    { "saving_num", &ArfProfile::savingNum, 256, 1 << 20 },
+    { "buffer_size", &ArfProfile::bufferSize, 1024, 1 << 24 },
+    { "blocks_per_part", &ArfProfile::blocksPerPart, 0, 1 << 24 },
+    { "chunk_size", &ArfProfile::chunkSize, MIN_CHUNK_XSIZE, MAX_CHUNK_XSIZE },
+    { "event_chunk_size", &ArfProfile::eventChunkSize, 1, 1 << 20 },
+    { "spike_chunk_size", &ArfProfile::spikeChunkSize, 1, 1 << 16 },
+    { "cache_mb", &ArfProfile::cacheMegabytes, 0, 1 << 16 },
+    { "cache_slots", &ArfProfile::cacheSlots, 1, 1 << 24 },
+    { "flush_interval", &ArfProfile::flushInterval, 10, 60000 }
+};
+#define NUM_PROFILE_FIELDS (int)numElementsInArray(profileFields)
+
+//Values in the order of profileFields. "auto" takes the first one with room for the channels.
+//Fewer channels can afford bigger chunks and more frequent flushes. With thousands of channels
+//the blocks get shorter to keep the buffers in bounds, the event and spike chunks grow, and every
+//dataset gets a small chunk cache: the hash slots are allocated for each open dataset, and a
+//channel that is only appended to doesn't need more than a few chunks.
+static const struct ProfilePreset
+{
+    const char* name;
+    int maxChannels;
+    int values[9];
+} profilePresets[] =
+{
+    { "default", -1, { SAVING_NUM, MAX_BUFFER_SIZE, CNT_PER_PART, CHUNK_XSIZE, EVENT_CHUNK_SIZE, SPIKE_CHUNK_XSIZE, 0, CACHE_SLOTS, FLUSH_INTERVAL } },
+    { "low", 64, { 20000, 40960, 1000, 4096, 64, 32, 0, 1667, 250 } },
+    { "medium", 512, { 20000, 40960, 1000, 2048, 256, 64, 0, 1667, 500 } },
+    { "high", std::numeric_limits<int>::max(), { 8192, 40960, 2500, 1024, 1024, 256, 1, 521, 1000 } }
+};
+
+ArfProfile::ArfProfile()
+{
+    getPreset("default", 0, *this);
+}
+
+StringArray ArfProfile::getPresetNames()
+{
+    StringArray names;
+    for (int i = 0; i < numElementsInArray(profilePresets); i++)
+        names.add(profilePresets[i].name);
+    names.add("auto");
+    return names;
+}
+
+bool ArfProfile::getPreset(String preset, int nChannels, ArfProfile& profile)
+{
+    for (int i = 0; i < numElementsInArray(profilePresets); i++)
+    {
+        const ProfilePreset& p = profilePresets[i];
+        if (preset.equalsIgnoreCase(p.name) || (preset.equalsIgnoreCase("auto") && nChannels <= p.maxChannels))
+        {
+            profile.name = p.name;
+            for (int j = 0; j < NUM_PROFILE_FIELDS; j++)
+                profile.*profileFields[j].value = p.values[j];
+            return true;
+        }
+    }
+    return false;
+}
+
+ArfProfile ArfProfile::load(String profile, int nChannels)
+{
+    ArfProfile p;
+    if (profile.isEmpty() || getPreset(profile.trim(), nChannels, p))
+        return p;
+
+    String error = "there is no preset or file " + profile;
+    File file = File::getCurrentWorkingDirectory().getChildFile(profile.trim());
+    if (file.existsAsFile() && p.loadFile(file, nChannels, error))
+        return p;
+    std::cerr << "ARF profile: " << error << ", using the default one" << std::endl;
+    return ArfProfile();
+}
+
+bool ArfProfile::loadFile(const File& file, int nChannels, String& error)
+{
+    StringArray lines;
+    file.readLines(lines);
+    for (int i = 0; i < lines.size(); i++)
+    {
+        String line = lines[i].upToFirstOccurrenceOf("#", false, false).trim();
+        if (line.isEmpty())
+            continue;
+        String where = file.getFileName() + ":" + String(i + 1) + ": ";
+        String key = line.upToFirstOccurrenceOf("=", false, false).trim();
+        String value = line.fromFirstOccurrenceOf("=", false, false).trim();
+        if (!line.containsChar('=') || value.isEmpty())
+        {
+            error = where + "expected key = value";
+            return false;
+        }
+        if (key == "preset")
+        {
+            if (!getPreset(value, nChannels, *this))
+            {
+                error = where + "unknown preset " + value;
+                return false;
+            }
+            continue;
+        }
+
+        int field = 0;
+        while (field < NUM_PROFILE_FIELDS && key != profileFields[field].key)
+            field++;
+        if (field == NUM_PROFILE_FIELDS)
+        {
+            error = where + "unknown setting " + key;
+            return false;
+        }
+        const ProfileField& f = profileFields[field];
+        int v = value.getIntValue();
+        if (!value.containsOnly("0123456789") || v < f.minValue || v > f.maxValue)
+        {
+            error = where + key + " must be a number from " + String(f.minValue) + " to " + String(f.maxValue);
+            return false;
+        }
+        this->*f.value = v;
+    }
+    name = file.getFullPathName();
+    return true;
+}
+
+String ArfProfile::toString() const
+{
+    String s;
+    for (int i = 0; i < NUM_PROFILE_FIELDS; i++)
+        s += String(profileFields[i].key) + "=" + String(this->*profileFields[i].value) + ";";
+    return s;
+}
+
+void ArfProfile::writeTo(MemoryOutputStream& out) const
+{
+    out.writeString(name);
+    out.writeInt(NUM_PROFILE_FIELDS);
+    for (int i = 0; i < NUM_PROFILE_FIELDS; i++)
+        out.writeInt(this->*profileFields[i].value);
+}
+
+bool ArfProfile::readFrom(MemoryInputStream& in)
+{
+    name = in.readString();
+    int n = in.readInt();
+    if (n < 0 || n > in.getNumBytesRemaining() / 4)
+        return false;
+    //settings added later keep their default
+    for (int i = 0; i < n; i++)
+    {
+        int v = in.readInt();
+        if (i < NUM_PROFILE_FIELDS)
+            this->*profileFields[i].value = jlimit(profileFields[i].minValue, profileFields[i].maxValue, v);
+    }
+    return true;
+}
@@ -0,0 +1,71 @@
+/*
+ ------------------------------------------------------------------
+
+ Michal Badura, 2016
+ based on code by Florian Franzen, 2014
+
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+#ifndef ARFPROFILE_H_INCLUDED
+#define ARFPROFILE_H_INCLUDED
+
+#include "../../../../JuceLibraryCode/JuceHeader.h"
+
+//Buffer, chunk, cache, flush and rollover sizes of a recording, so that a rig can be tuned
+//without recompiling. ArfRecording picks one in openFiles, from a preset or a profile file.
+struct ArfProfile
+{
+    //the "default" preset, i.e. the sizes the engine always had
+    ArfProfile();
+
+    //preset name or profile file it came from
+    String name;
+    //samples per channel written at once, at the main sample rate
+    int savingNum;
+    //samples of the buffers that convert a block of a channel to int16
+    int bufferSize;
+    //blocks of savingNum samples per part, if no part length or size is set; 0 for a single file
+    int blocksPerPart;
+    //samples per chunk of the channel datasets at the main sample rate
+    int chunkSize;
+    //rows per chunk of the event and spike tables
+    int eventChunkSize;
+    int spikeChunkSize;
+    //raw data chunk cache of every dataset in MB, 0 for 32 chunks per channel of the file, and its hash slots
+    int cacheMegabytes;
+    int cacheSlots;
+    //how often arf-writer flushes the file and frees the ring, in ms
+    int flushInterval;
+
+    //"default", "low", "medium", "high" and "auto", which picks one of them for NCHANNELS
+    static StringArray getPresetNames();
+    static bool getPreset(String preset, int nChannels, ArfProfile& profile);
+    //PROFILE is the name of a preset or the path of a profile file. Falls back to the default
+    //preset, with a message, if it is neither
+    static ArfProfile load(String profile, int nChannels);
+
+    //Reads "key = value" lines over the current settings, # starts a comment.
+    //A "preset = <name>" line starts over from that preset.
+    bool loadFile(const File& file, int nChannels, String& error);
+    //every setting as "key=value;", e.g. for the attributes of a recording
+    String toString() const;
+
+    void writeTo(MemoryOutputStream& out) const;
+    bool readFrom(MemoryInputStream& in);
+};
+
+#endif  // ARFPROFILE_H_INCLUDED
@@ -0,0 +1,334 @@
+/*
+ ------------------------------------------------------------------
+
+ Michal Badura, 2016
+ based on code by Florian Franzen, 2014
+
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "ArfRawCapture.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+ArfRawCapture::ArfRawCapture() : Thread("Arf raw capture"), lastLogWrite(0), dropped(0), reportedDropped(0), writeFailed(false)
+{
+    fds[DataStream] = fds[LogStream] = -1;
+    current[DataStream] = current[LogStream] = nullptr;
+    //the first blocks are allocated now rather than when recording starts
+    Array<Block*> ready;
+    for (int i = 0; i < ARF_RAW_BLOCKS; i++)
+        ready.add(takeFreeBlock(DataStream));
+    ready.add(takeFreeBlock(LogStream));
+    ready.add(takeFreeBlock(LogStream));
+    freeBlocks.addArray(ready);
+    startThread(8);
+}
+
+ArfRawCapture::~ArfRawCapture()
+{
+    closePart();
+    //whatever is still queued is written before the thread exits
+    signalThreadShouldExit();
+    queued.signal();
+    waitForThreadToExit(-1);
+}
+
+String ArfRawCapture::getCaptureName(const String& basePath, int recordingNumber)
+{
+    return basePath + "_rec" + String(recordingNumber);
+}
+
+bool ArfRawCapture::openPart(const ArfPartDescription& part)
+{
+    closePart();
+    const ScopedLock sl(writeLock);
+    String name = getCaptureName(part.basePath, part.recordingNumber);
+    String fileNames[2] = { name + ".dat", name + ".evt" };
+    for (int s = 0; s < 2; s++)
+    {
+        fds[s] = open(fileNames[s].toUTF8(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fds[s] < 0)
+        {
+            std::cerr << "Could not create " << fileNames[s] << std::endl;
+            if (s > 0)
+                ::close(fds[0]);
+            fds[0] = fds[1] = -1;
+            return false;
+        }
+    }
+    MemoryOutputStream out;
+    part.writeTo(out);
+    for (int s = 0; s < 2; s++)
+    {
+        current[s] = takeFreeBlock((Stream)s, true);
+        char* dst = beginRecord((Stream)s, ArfRecord::RecordOpen, (uint32)out.getDataSize());
+        if (dst != nullptr)
+            memcpy(dst, out.getData(), out.getDataSize());
+    }
+    lastLogWrite = Time::getMillisecondCounter();
+    return true;
+}
+
+void ArfRawCapture::closePart()
+{
+    const ScopedLock sl(writeLock);
+    if (fds[DataStream] < 0)
+        return;
+    beginRecord(LogStream, ArfRecord::RecordClose, 0);
+    for (int s = 0; s < 2; s++)
+    {
+        //the files get closed by the thread, so there must be a block to pass them on
+        if (current[s] == nullptr)
+            current[s] = takeFreeBlock((Stream)s, true);
+        submit((Stream)s, true);
+        fds[s] = -1;
+    }
+    checkProgress(true);
+}
+
+bool ArfRawCapture::isOpen() const
+{
+    return fds[DataStream] >= 0;
+}
+
+double ArfRawCapture::getBacklog() const
+{
+    const ScopedLock sl(queueLock);
+    //the blocks that are neither free nor being filled are queued or being written
+    int inUse = blocks.size() - freeBlocks.size();
+    for (int s = 0; s < 2; s++)
+    {
+        if (current[s] != nullptr)
+            inUse--;
+    }
+    return (double)inUse / ARF_RAW_BLOCKS;
+}
+
+char* ArfRawCapture::beginRecord(Stream stream, ArfRecord::RecordType type, uint32 size)
+{
+    if (fds[stream] < 0)
+        return nullptr;
+    uint64 space = ArfRecord::space(size);
+    size_t blockSize = (stream == DataStream) ? ARF_RAW_BLOCK_SIZE : ARF_RAW_LOG_BLOCK_SIZE;
+    if (space > blockSize)
+    {
+        dropped++;
+        return nullptr;
+    }
+    //A record never spans two blocks, the rest of a block is padded instead
+    if (current[stream] != nullptr && current[stream]->used + space > current[stream]->size)
+        submit(stream, false);
+    if (current[stream] == nullptr)
+        current[stream] = takeFreeBlock(stream);
+    Block* block = current[stream];
+    if (block == nullptr)
+    {
+        dropped++;
+        return nullptr;
+    }
+    ArfRecord::RecordHeader* rec = (ArfRecord::RecordHeader*)(block->data + block->used);
+    rec->type = type;
+    rec->size = size;
+    char* dst = block->data + block->used + sizeof(ArfRecord::RecordHeader);
+    //the alignment bytes would otherwise hold whatever the block had before
+    memset(dst + size, 0, space - sizeof(ArfRecord::RecordHeader) - size);
+    block->used += space;
+    return dst;
+}
+
+void ArfRawCapture::pad(Block* block, size_t end)
+{
+    if (end <= block->used)
+        return;
+    ArfRecord::RecordHeader* rec = (ArfRecord::RecordHeader*)(block->data + block->used);
+    rec->type = ArfRecord::RecordPad;
+    rec->size = (uint32)(end - block->used - sizeof(ArfRecord::RecordHeader));
+    memset(block->data + block->used + sizeof(ArfRecord::RecordHeader), 0, rec->size);
+    block->used = end;
+}
+
+void ArfRawCapture::submit(Stream stream, bool last)
+{
+    Block* block = current[stream];
+    current[stream] = nullptr;
+    if (block == nullptr)
+        return;
+    pad(block, (block->used + ARF_RAW_PAGE_SIZE - 1) & ~(size_t)(ARF_RAW_PAGE_SIZE - 1));
+    block->fd = fds[stream];
+    block->last = last;
+    if (stream == LogStream)
+        lastLogWrite = Time::getMillisecondCounter();
+
+    const ScopedLock sl(queueLock);
+    queue.add(block);
+    queued.signal();
+}
+
+ArfRawCapture::Block* ArfRawCapture::takeFreeBlock(Stream stream, bool force)
+{
+    size_t size = (stream == DataStream) ? ARF_RAW_BLOCK_SIZE : ARF_RAW_LOG_BLOCK_SIZE;
+    const ScopedLock sl(queueLock);
+    Block* block = nullptr;
+    for (int i = 0; i < freeBlocks.size() && block == nullptr; i++)
+    {
+        if (freeBlocks[i]->size == size)
+            block = freeBlocks.removeAndReturn(i);
+    }
+    //The disk is behind: buffer more, until that gets out of hand too
+    if (block == nullptr && (force || blocks.size() < ARF_RAW_MAX_BLOCKS + 2))
+    {
+        block = new Block();
+        block->memory.calloc(size + ARF_RAW_PAGE_SIZE);
+        block->data = (char*)(((pointer_sized_int)block->memory.getData() + ARF_RAW_PAGE_SIZE - 1) & ~(pointer_sized_int)(ARF_RAW_PAGE_SIZE - 1));
+        block->size = size;
+        blocks.add(block);
+    }
+    if (block != nullptr)
+    {
+        block->used = 0;
+        block->fd = -1;
+        block->last = false;
+    }
+    return block;
+}
+
+void ArfRawCapture::writeChannel(const int16* data, int nSamples, int channel)
+{
+    const ScopedLock sl(writeLock);
+    uint32 dataSize = nSamples * sizeof(int16);
+    char* dst = beginRecord(DataStream, ArfRecord::RecordData, sizeof(ArfRecord::DataRecord) + dataSize);
+    if (dst != nullptr)
+    {
+        ArfRecord::DataRecord* rec = (ArfRecord::DataRecord*)dst;
+        rec->channel = channel;
+        rec->nSamples = nSamples;
+        memcpy(dst + sizeof(ArfRecord::DataRecord), data, dataSize);
+    }
+    checkProgress(false);
+}
+
+void ArfRawCapture::writeEvent(int type, uint8 id, uint8 processor, const void* data, int dataSize, int64 timestamp)
+{
+    const ScopedLock sl(writeLock);
+    dataSize = jlimit(0, ARF_MAX_EVENT_DATA, dataSize);
+    char* dst = beginRecord(LogStream, ArfRecord::RecordEvent, sizeof(ArfRecord::EventRecord) + dataSize);
+    if (dst != nullptr)
+    {
+        ArfRecord::EventRecord* rec = (ArfRecord::EventRecord*)dst;
+        rec->type = type;
+        rec->eventID = id;
+        rec->nodeID = processor;
+        rec->dataSize = (uint16)dataSize;
+        rec->timestamp = timestamp;
+        memcpy(dst + sizeof(ArfRecord::EventRecord), data, dataSize);
+    }
+}
+
+void ArfRawCapture::writeSpike(int groupIndex, int nSamples, int nValues, const uint16* data, float time)
+{
+    const ScopedLock sl(writeLock);
+    uint32 dataSize = nValues * sizeof(uint16);
+    char* dst = beginRecord(LogStream, ArfRecord::RecordSpike, sizeof(ArfRecord::SpikeRecord) + dataSize);
+    if (dst != nullptr)
+    {
+        ArfRecord::SpikeRecord* rec = (ArfRecord::SpikeRecord*)dst;
+        rec->electrode = groupIndex;
+        rec->nSamples = nSamples;
+        rec->nValues = nValues;
+        rec->time = time;
+        memcpy(dst + sizeof(ArfRecord::SpikeRecord), data, dataSize);
+    }
+}
+
+void ArfRawCapture::setAttributeStr(String value, String path, String name)
+{
+    MemoryOutputStream out;
+    out.writeString(value);
+    out.writeString(path);
+    out.writeString(name);
+
+    const ScopedLock sl(writeLock);
+    char* dst = beginRecord(LogStream, ArfRecord::RecordAttribute, (uint32)out.getDataSize());
+    if (dst != nullptr)
+        memcpy(dst, out.getData(), out.getDataSize());
+}
+
+//Writes out the sidecar log now and then, so that a crash loses little of it, and reports drops
+void ArfRawCapture::checkProgress(bool force)
+{
+    uint32 now = Time::getMillisecondCounter();
+    if (!force && now - lastLogWrite < ARF_RAW_LOG_INTERVAL)
+        return;
+    if (current[LogStream] != nullptr && current[LogStream]->used > 0)
+        submit(LogStream, false);
+    lastLogWrite = now;
+    if (dropped != reportedDropped)
+    {
+        std::cerr << "Raw capture buffer full, " << (int64)(dropped - reportedDropped) << " blocks were not recorded" << std::endl;
+        reportedDropped = dropped;
+    }
+}
+
+void ArfRawCapture::run()
+{
+    while (true)
+    {
+        Block* block = nullptr;
+        {
+            const ScopedLock sl(queueLock);
+            if (queue.size() > 0)
+                block = queue.removeAndReturn(0);
+        }
+        if (block == nullptr)
+        {
+            if (threadShouldExit())
+                return;
+            queued.wait(100);
+            continue;
+        }
+        writeBlock(block);
+        const ScopedLock sl(queueLock);
+        freeBlocks.add(block);
+    }
+}
+
+void ArfRawCapture::writeBlock(Block* block)
+{
+    size_t done = 0;
+    while (done < block->used && !writeFailed)
+    {
+        ssize_t n = write(block->fd, block->data + done, block->used - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            //reported once per part, the rest of it is lost anyway
+            std::cerr << "Raw capture could not write to disk: " << strerror(errno) << std::endl;
+            writeFailed = true;
+            break;
+        }
+        done += n;
+    }
+    if (block->last)
+    {
+        ::close(block->fd);
+        writeFailed = false;
+    }
+}
@@ -0,0 +1,108 @@
+/*
+ ------------------------------------------------------------------
+
+ Michal Badura, 2016
+ based on code by Florian Franzen, 2014
+
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+#ifndef ARFRAWCAPTURE_H_INCLUDED
+#define ARFRAWCAPTURE_H_INCLUDED
+
+#include "ArfRecordStream.h"
+
+//the sample file is written in blocks of this size, the sidecar log in smaller ones
+#define ARF_RAW_BLOCK_SIZE (4 << 20)
+#define ARF_RAW_LOG_BLOCK_SIZE (1 << 20)
+//every write starts and ends on a page boundary
+#define ARF_RAW_PAGE_SIZE 4096
+//sample blocks kept ready; more are allocated while the disk falls behind, up to ARF_RAW_MAX_BLOCKS
+#define ARF_RAW_BLOCKS 8
+#define ARF_RAW_MAX_BLOCKS 64
+//how often the sidecar log is written out even if its block is not full, in ms
+#define ARF_RAW_LOG_INTERVAL 1000
+
+//Raw capture: writes everything for a part as ArfRecord records to flat files with plain
+//sequential writes from a thread of its own, and leaves the ARF file to Tools/arf-convert.
+//Samples go to <base>_rec<N>.dat, events, spikes and attributes to the <base>_rec<N>.evt log.
+//Both start with the RecordOpen of the part; the log ends with a RecordClose.
+//Same calls as ArfRemoteWriter.
+class ArfRawCapture : public Thread
+{
+public:
+    enum Stream { DataStream, LogStream };
+
+    ArfRawCapture();
+    ~ArfRawCapture();
+
+    bool openPart(const ArfPartDescription& part);
+    void closePart();
+    bool isOpen() const;
+    //blocks handed to the thread and not written yet, relative to ARF_RAW_BLOCKS
+    double getBacklog() const;
+    void writeChannel(const int16* data, int nSamples, int channel);
+    void writeEvent(int type, uint8 id, uint8 processor, const void* data, int dataSize, int64 timestamp);
+    void writeSpike(int groupIndex, int nSamples, int nValues, const uint16* data, float time);
+    void setAttributeStr(String value, String path, String name);
+
+    //path of the raw files of a part, without the .dat or .evt
+    static String getCaptureName(const String& basePath, int recordingNumber);
+
+    void run() override;
+
+private:
+    struct Block
+    {
+        HeapBlock<char> memory;
+        //page aligned start within memory
+        char* data;
+        size_t size;
+        size_t used;
+        int fd;
+        //the file is closed once this block is written
+        bool last;
+    };
+
+    //Returns where SIZE bytes of the record go, or nullptr if there is no room for it
+    char* beginRecord(Stream stream, ArfRecord::RecordType type, uint32 size);
+    //fills the block up to END with a pad record
+    void pad(Block* block, size_t end);
+    //hands the current block of STREAM to the thread
+    void submit(Stream stream, bool last);
+    Block* takeFreeBlock(Stream stream, bool force = false);
+    void writeBlock(Block* block);
+    void checkProgress(bool force);
+
+    int fds[2];
+    Block* current[2];
+    CriticalSection writeLock;
+
+    OwnedArray<Block> blocks;
+    Array<Block*> freeBlocks;
+    Array<Block*> queue;
+    CriticalSection queueLock;
+    WaitableEvent queued;
+
+    uint32 lastLogWrite;
+    uint64 dropped;
+    uint64 reportedDropped;
+    bool writeFailed;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ArfRawCapture);
+};
+
+#endif  // ARFRAWCAPTURE_H_INCLUDED
@@ -0,0 +1,226 @@
+/*
+ ------------------------------------------------------------------
+
+ Michal Badura, 2016
+ based on code by Florian Franzen, 2014
+
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "ArfRecordStream.h"
+
+//ArfPartDescription
+
+void ArfPartDescription::setSchema(const ArfSchemaRegistry& schema)
+{
+    eventNames.clear();
+    eventTypes.clear();
+    eventDataNames.clear();
+    eventPayloadSizes.clear();
+    eventFields.clear();
+    channelGroups.clear();
+    for (int i = 0; i < schema.getNumEventTypes(); i++)
+    {
+        eventNames.add(schema.getEventName(i));
+        eventTypes.add(schema.getEventType(i));
+        eventDataNames.add(schema.getEventDataName(i));
+        eventPayloadSizes.add(schema.getPayloadSize(i));
+        eventFields.add(schema.getEventFields(i));
+    }
+    for (int i = 0; i < schema.getNumChannelGroups(); i++)
+    {
+        channelGroups.add(schema.getChannelGroupSize(i));
+    }
+}
+
+void ArfPartDescription::applySchema(ArfSchemaRegistry& schema) const
+{
+    for (int i = 0; i < eventNames.size(); i++)
+    {
+        if (eventTypes[i] != ArfFileBase::STR && i < eventFields.size())
+            schema.addEventSchema(eventNames[i], eventFields.getReference(i), eventPayloadSizes[i]);
+        else
+            schema.addEventType(eventNames[i], (ArfFileBase::DataTypes)eventTypes[i], eventDataNames[i]);
+    }
+    for (int i = 0; i < channelGroups.size(); i++)
+    {
+        schema.addChannelGroup(channelGroups[i]);
+    }
+}
+
+static void writeIntArray(MemoryOutputStream& out, const Array<int>& values)
+{
+    out.writeInt(values.size());
+    for (int i = 0; i < values.size(); i++)
+        out.writeInt(values[i]);
+}
+
+static void writeFloatArray(MemoryOutputStream& out, const Array<float>& values)
+{
+    out.writeInt(values.size());
+    for (int i = 0; i < values.size(); i++)
+        out.writeFloat(values[i]);
+}
+
+static bool readIntArray(MemoryInputStream& in, Array<int>& values)
+{
+    int n = in.readInt();
+    if (n < 0 || n > in.getNumBytesRemaining() / 4) return false;
+    values.clearQuick();
+    values.ensureStorageAllocated(n);
+    for (int i = 0; i < n; i++)
+        values.add(in.readInt());
+    return true;
+}
+
+static bool readFloatArray(MemoryInputStream& in, Array<float>& values)
+{
+    int n = in.readInt();
+    if (n < 0 || n > in.getNumBytesRemaining() / 4) return false;
+    values.clearQuick();
+    values.ensureStorageAllocated(n);
+    for (int i = 0; i < n; i++)
+        values.add(in.readFloat());
+    return true;
+}
+
+void ArfPartDescription::writeTo(MemoryOutputStream& out) const
+{
+    out.writeString(basePath);
+    out.writeInt(recordingNumber);
+    out.writeInt(nChannels);
+
+    out.writeString(info.name);
+    out.writeInt64(info.start_time);
+    out.writeInt((int)info.start_sample);
+    out.writeFloat(info.sample_rate);
+    out.writeInt((int)info.bit_depth);
+    out.writeBool(info.multiSample);
+    writeFloatArray(out, info.bitVolts);
+    writeFloatArray(out, info.channelSampleRates);
+
+    writeIntArray(out, recordedChanToKWDChan);
+    writeIntArray(out, procMap);
+
+    out.writeInt(eventNames.size());
+    for (int i = 0; i < eventNames.size(); i++)
+    {
+        out.writeString(eventNames[i]);
+        out.writeInt(eventTypes[i]);
+        out.writeString(eventDataNames[i]);
+    }
+    writeIntArray(out, channelGroups);
+    out.writeInt(overviewColumns);
+    out.writeBool(chunkStats);
+    out.writeBool(packedSpikes);
+    profile.writeTo(out);
+    out.writeBool(directIO);
+    out.writeBool(staging);
+    out.writeInt(stagingRate);
+    out.writeBool(pagedLayout);
+    out.writeInt64(preallocateBytes);
+    out.writeBool(codec);
+    out.writeBool(checksums);
+    out.writeFloat(info.diskRate);
+    out.writeFloat(info.requiredRate);
+    out.writeInt64(info.diskFree);
+    for (int i = 0; i < eventFields.size(); i++)
+    {
+        const Array<ArfEventField>& fields = eventFields.getReference(i);
+        out.writeInt(eventPayloadSizes[i]);
+        out.writeInt(fields.size());
+        for (int j = 0; j < fields.size(); j++)
+        {
+            const ArfEventField& field = fields.getReference(j);
+            out.writeString(field.name);
+            out.writeInt(field.type);
+            out.writeInt(field.offset);
+            out.writeInt(field.count);
+        }
+    }
+}
+
+bool ArfPartDescription::readFrom(MemoryInputStream& in)
+{
+    basePath = in.readString();
+    recordingNumber = in.readInt();
+    nChannels = in.readInt();
+
+    info.name = in.readString();
+    info.start_time = in.readInt64();
+    info.start_sample = (uint32)in.readInt();
+    info.sample_rate = in.readFloat();
+    info.bit_depth = (uint32)in.readInt();
+    info.multiSample = in.readBool();
+    if (!readFloatArray(in, info.bitVolts) || !readFloatArray(in, info.channelSampleRates))
+        return false;
+
+    if (!readIntArray(in, recordedChanToKWDChan) || !readIntArray(in, procMap))
+        return false;
+
+    int nEvents = in.readInt();
+    if (nEvents < 0 || nEvents > in.getNumBytesRemaining()) return false;
+    eventNames.clear();
+    eventTypes.clear();
+    eventDataNames.clear();
+    for (int i = 0; i < nEvents; i++)
+    {
+        eventNames.add(in.readString());
+        eventTypes.add(in.readInt());
+        eventDataNames.add(in.readString());
+    }
+    if (!readIntArray(in, channelGroups))
+        return false;
+    //raw captures from before the overview end here
+    overviewColumns = (in.getNumBytesRemaining() >= 4) ? in.readInt() : 0;
+    chunkStats = (in.getNumBytesRemaining() >= 1) ? in.readBool() : false;
+    packedSpikes = (in.getNumBytesRemaining() >= 1) ? in.readBool() : false;
+    profile = ArfProfile();
+    if (in.getNumBytesRemaining() > 0 && !profile.readFrom(in))
+        return false;
+    directIO = (in.getNumBytesRemaining() >= 1) ? in.readBool() : false;
+    staging = (in.getNumBytesRemaining() >= 1) ? in.readBool() : false;
+    stagingRate = (in.getNumBytesRemaining() >= 4) ? in.readInt() : 0;
+    pagedLayout = (in.getNumBytesRemaining() >= 1) ? in.readBool() : false;
+    preallocateBytes = (in.getNumBytesRemaining() >= 8) ? in.readInt64() : 0;
+    codec = (in.getNumBytesRemaining() >= 1) ? in.readBool() : false;
+    checksums = (in.getNumBytesRemaining() >= 1) ? in.readBool() : false;
+    info.diskRate = (in.getNumBytesRemaining() >= 4) ? in.readFloat() : 0;
+    info.requiredRate = (in.getNumBytesRemaining() >= 4) ? in.readFloat() : 0;
+    info.diskFree = (in.getNumBytesRemaining() >= 8) ? in.readInt64() : 0;
+    eventPayloadSizes.clear();
+    eventFields.clear();
+    for (int i = 0; i < nEvents && in.getNumBytesRemaining() >= 8; i++)
+    {
+        eventPayloadSizes.add(in.readInt());
+        int nFields = in.readInt();
+        if (nFields < 0 || nFields > in.getNumBytesRemaining()) return false;
+        Array<ArfEventField> fields;
+        for (int j = 0; j < nFields; j++)
+        {
+            ArfEventField field;
+            field.name = in.readString();
+            field.type = (ArfFileBase::DataTypes)in.readInt();
+            field.offset = in.readInt();
+            field.count = in.readInt();
+            fields.add(field);
+        }
+        eventFields.add(fields);
+    }
+
+    return nChannels >= 0 && nChannels == procMap.size() && nChannels == recordedChanToKWDChan.size();
+}
@@ -0,0 +1,121 @@
+/*
+ ------------------------------------------------------------------
+
+ Michal Badura, 2016
+ based on code by Florian Franzen, 2014
+
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef ARFRECORDSTREAM_H_INCLUDED
+#define ARFRECORDSTREAM_H_INCLUDED
+
+#include "ArfFileFormat.h"
+
+//longest event data, i.e. message text, an EventRecord can carry
+#define ARF_MAX_EVENT_DATA 65535
+
+//Everything needed to create a part file, sent with every ArfRecord::RecordOpen
+struct ArfPartDescription
+{
+    String basePath;
+    int recordingNumber;
+    int nChannels;
+    ArfRecordingInfo info;
+    Array<int> recordedChanToKWDChan;
+    Array<int> procMap;
+
+    //the schema, as registered in ArfRecording
+    StringArray eventNames;
+    Array<int> eventTypes;
+    StringArray eventDataNames;
+    Array<int> channelGroups;
+    //payload layout of every event type (see ArfSchemaRegistry::addEventSchema), empty from
+    //writers that only knew TTL and messages
+    Array<int> eventPayloadSizes;
+    Array<Array<ArfEventField>> eventFields;
+
+    //columns of the min/max overview, 0 for none (see ArfFile::setOverview)
+    int overviewColumns;
+    //per-chunk statistics table (see ArfFile::setChunkStats)
+    bool chunkStats;
+    //one spike table per electrode size (see ArfFile::setPackedSpikes)
+    bool packedSpikes;
+    //chunk, cache and flush settings of the part
+    ArfProfile profile;
+    //raw data written with O_DIRECT (see ArfDirectDriver)
+    bool directIO;
+    //part built in memory and written out at up to stagingRate MB/s (see ArfDirectDriver)
+    bool staging;
+    int stagingRate;
+    //paged file space, and the disk space to reserve for the part (see ArfFileBase::setPagedLayout)
+    bool pagedLayout;
+    int64 preallocateBytes;
+    //samples stored with ArfCodec (see ArfFileBase::setCodec)
+    bool codec;
+    //CRC32C of every chunk (see ArfFile::setChecksums)
+    bool checksums;
+
+    void setSchema(const ArfSchemaRegistry& schema);
+    void applySchema(ArfSchemaRegistry& schema) const;
+
+    void writeTo(MemoryOutputStream& out) const;
+    bool readFrom(MemoryInputStream& in);
+};
+
+//Everything ArfRecording writes to a part, as records in the order it happens. They go to the
+//arf-writer process through ArfShmRing, or to the raw capture files that arf-convert reads.
+struct ArfRecord
+{
+    enum RecordType { RecordPad, RecordOpen, RecordClose, RecordData, RecordEvent, RecordSpike, RecordAttribute, RecordQuit };
+
+    struct RecordHeader
+    {
+        uint32 type;
+        uint32 size;
+    };
+
+    //Fixed part of the records, the samples or event data follow right after
+    struct DataRecord
+    {
+        int32 channel;
+        int32 nSamples;
+    };
+    struct EventRecord
+    {
+        int32 type;
+        uint8 eventID;
+        uint8 nodeID;
+        uint16 dataSize;
+        int64 timestamp;
+    };
+    struct SpikeRecord
+    {
+        int32 electrode;
+        int32 nSamples;
+        int32 nValues;
+        float time;
+    };
+
+    //bytes taken by a record with SIZE bytes of data, header included. Records are 8 byte aligned
+    static uint64 space(uint32 size)
+    {
+        return (sizeof(RecordHeader) + (uint64)size + 7) & ~(uint64)7;
+    }
+};
+
+#endif  // ARFRECORDSTREAM_H_INCLUDED
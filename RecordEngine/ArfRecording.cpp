@@ -24,30 +24,35 @@
 #include "ArfRecording.h"
 #include "../../../Processors/GenericProcessor/GenericProcessor.h"
 
-#define MAX_BUFFER_SIZE 40960
 #define CHANNEL_TIMESTAMP_PREALLOC_SIZE 128
 #define CHANNEL_TIMESTAMP_MIN_WRITE	32
 #define TIMESTAMP_EACH_NSAMPLES 1024
+//most disk space reserved for a part with the paged layout, in MB
+#define MAX_PREALLOCATION 65536
+//schema index of the first binary event type, after TTL and Messages
+#define FIRST_BINARY_EVENT 2
 
-
-#define CNT_PER_PART 1000
-// how many savingNum samples need to pass until we open a new file
-// savingNum is currently 20000 and you probably shouldn't change it
-// if set to 0, then no parts
-
-ArfRecording::ArfRecording() : processorIndex(-1), bufferSize(MAX_BUFFER_SIZE), hasAcquired(false)
+ArfRecording::ArfRecording() : processorIndex(-1), hasAcquired(false),
+    useWriterProcess(false), writerBufferSize(256), writerExecutable("arf-writer"),
+    numShards(1), shardByProcessor(false), activeShards(0), partSeconds(0), partMegabytes(0), messageCut(-1),
+    writeOverview(false), overviewRms(false), chunkStats(false), checksums(false), packedSpikes(false), profileName("default"), directIO(false), staging(false), stagingRate(0), pagedLayout(false), codec(false), preflightMB(0), rawCapture(false), tapSize(64)
 {
     //timestamp = 0;
-    scaledBuffer.malloc(MAX_BUFFER_SIZE);
-    intBuffer.malloc(MAX_BUFFER_SIZE);
-    savingNum = SAVING_NUM; //declared as a const in ArfRecording.h
-    cntPerPart = CNT_PER_PART;
+    bufferSize = profile.bufferSize;
+    scaledBuffer.malloc(bufferSize);
+    intBuffer.malloc(bufferSize);
+    savingNum = profile.savingNum;
+    cntPerPart = profile.blocksPerPart;
     partNo = 0;
-    partCnt = 0;
+
+    schema.addEventType("TTL",ArfFileBase::U8,"event_channel");
+    schema.addEventType("Messages",ArfFileBase::STR,"Text");
 }
 
 ArfRecording::~ArfRecording()
 {	
+    //waits for the writer processes to save everything that is still in their buffers
+    remoteWriters.clear();
 }
 
 String ArfRecording::getEngineID() const
@@ -74,9 +79,9 @@ void ArfRecording::registerProcessor(const GenericProcessor* proc)
 
 void ArfRecording::resetChannels()
 {
-	scaledBuffer.malloc(MAX_BUFFER_SIZE);
-	intBuffer.malloc(MAX_BUFFER_SIZE);
-	bufferSize = MAX_BUFFER_SIZE;
+	scaledBuffer.malloc(profile.bufferSize);
+	intBuffer.malloc(profile.bufferSize);
+	bufferSize = profile.bufferSize;
     processorIndex = -1;
     fileArray.clear();
 	channelsPerProcessor.clear();
@@ -87,13 +92,16 @@ void ArfRecording::resetChannels()
 	recordedChanToKWDChan.clear();
 	channelLeftOverSamples.clear();
 	channelTimestampArray.clear();
+    schema.resetChannels();
 
     for (int i=0; i<partBuffer.size(); i++) 
     {
         partBuffer[i]->clear();
     }
     partNo = 0;
-    partCnt = 0;
+    messageCut = -1;
+    rateGroups.clear();
+    channelGroup.clear();
 }
 
 void ArfRecording::addChannel(int index,const Channel* chan)
@@ -102,94 +110,412 @@ void ArfRecording::addChannel(int index,const Channel* chan)
 }
 
 
-void ArfRecording::openFiles(File rootFolder, int experimentNumber, int recordingNumber)
+String ArfRecording::getBasePath(int part)
 {
-    this->rootFolder = rootFolder;
-    this->experimentNumber = experimentNumber;
-    this->recordingNumber = recordingNumber;
     String partName = "";
-    if (cntPerPart > 0) {
-        partName = "_prt"+String(partNo);
-        std::cout << "Opening part" << partNo << std::endl;
+    if (savesInParts()) {
+        partName = "_prt"+String(part);
     }
-    String basepath = rootFolder.getFullPathName() + rootFolder.separatorString + "experiment" + String(experimentNumber) + partName;
-
-
-    //Let's just put the first processor (usually the source node) on the KWIK for now
-    infoArray[0]->name = String("Open Ephys Recording #") + String(recordingNumber);
-
-	infoArray[0]->start_time = getTimestamp(0);
-
-    infoArray[0]->start_sample = 0;
+    return rootFolder.getFullPathName() + rootFolder.separatorString + "experiment" + String(experimentNumber) + partName;
+}
 
+void ArfRecording::updateChannelInfo()
+{
+    bitVolts.clear();
+    sampleRates.clear();
+    procMap.clear();
 	recordedChanToKWDChan.clear();
 	Array<int> processorRecPos;
 	processorRecPos.insertMultiple(0, 0, fileArray.size());
-	
-    mainInfo = new ArfRecordingInfo();
-    mainFile = new ArfFile();
-    
-    
-    mainFile->initFile(0, basepath);
-    mainInfo->start_time = getTimestamp(0);    
+    decimation = ArfDecimator::parseFactors(decimationSpec, getNumRecordedChannels());
+
     for (int i = 0; i < getNumRecordedChannels(); i++)
 	{
         bitVolts.add(getChannel(getRealChannel(i))->bitVolts);
-        sampleRates.add(getChannel(getRealChannel(i))->sampleRate);
+        sampleRates.add(getChannel(getRealChannel(i))->sampleRate / decimation[i]);
         procMap.add(getChannel(getRealChannel(i))->nodeId);
 
 		int procPos = processorRecPos[processorMap[getRealChannel(i)]];
 
 		recordedChanToKWDChan.add(procPos);
 		processorRecPos.set(processorMap[getRealChannel(i)], procPos+1);
-		channelTimestampArray.add(new Array<int64>);
-		channelTimestampArray.getLast()->ensureStorageAllocated(CHANNEL_TIMESTAMP_PREALLOC_SIZE);
-		channelLeftOverSamples.add(0);
 	}
-    
-    mainFile->open(getNumRecordedChannels());
-    
+
+    mainInfo = new ArfRecordingInfo();
     mainInfo->name = String("Open Ephys Recording #") + String(recordingNumber);
+    mainInfo->start_time = getTimestamp(0);
     mainInfo->start_sample = 0;
     mainInfo->sample_rate = infoArray[0]->sample_rate;
-    mainInfo->bitVolts.clear();
+    mainInfo->bit_depth = infoArray[0]->bit_depth;
+    mainInfo->multiSample = infoArray[0]->multiSample;
     mainInfo->bitVolts.addArray(bitVolts);
-    mainInfo->channelSampleRates.clear();
     mainInfo->channelSampleRates.addArray(sampleRates);
-        
-    mainFile->addEventType("TTL",ArfFileBase::U8,"event_channels");
-    mainFile->addEventType("Messages",ArfFileBase::STR,"Text");
-    
-    for (int i=0; i<spikeInfoArray.size(); i++)
+    for (int i = 1; i < sampleRates.size(); i++)
     {
-        mainFile->addChannelGroup(spikeInfoArray[i]);        
+        if (sampleRates[i] != sampleRates[0])
+            mainInfo->multiSample = true;
     }
-    
-    mainFile->startNewRecording(recordingNumber,getNumRecordedChannels(), mainInfo, recordedChanToKWDChan, procMap);   
-    
-    for (int i=0; i<getNumRecordedChannels(); i++)
-    {        
-        partBuffer.add(new Array<int16, CriticalSection, 3*SAVING_NUM>);
+}
+
+void ArfRecording::applyProfile()
+{
+    profile = ArfProfile::load(profileName, getNumRecordedChannels());
+    savingNum = profile.savingNum;
+    cntPerPart = profile.blocksPerPart;
+    if (bufferSize < profile.bufferSize)
+    {
+        bufferSize = profile.bufferSize;
+        scaledBuffer.malloc(bufferSize);
+        intBuffer.malloc(bufferSize);
+    }
+}
+
+void ArfRecording::buildRateGroups()
+{
+    rateGroups.clear();
+    channelGroup.clearQuick();
+    for (int i = 0; i < getNumRecordedChannels(); i++)
+    {
+        int g = 0;
+        while (g < rateGroups.size() && rateGroups[g]->sampleRate != sampleRates[i])
+            g++;
+        if (g == rateGroups.size())
+        {
+            ArfRateGroup* group = rateGroups.add(new ArfRateGroup());
+            group->sampleRate = sampleRates[i];
+            group->savingNum = jmax(1, roundToInt(savingNum * sampleRates[i] / mainInfo->sample_rate));
+            group->chunkSize = ArfFile::getChannelChunkSize(sampleRates[i], mainInfo->sample_rate, profile.chunkSize);
+            group->partSamples = 0;
+            group->droppedSamples = 0;
+            group->dropStart = 0;
+        }
+        rateGroups[g]->channels.add(i);
+        channelGroup.add(g);
+    }
+}
+
+//Everything a part skeleton depends on, other than the recording number
+String ArfRecording::getTemplateKey()
+{
+    String key = String(mainInfo->sample_rate) + ";" + String(mainInfo->bit_depth) + ";" + String((int)mainInfo->multiSample) + ";";
+    for (int i = 0; i < bitVolts.size(); i++)
+    {
+        key += String(sampleRates[i]) + "," + String(bitVolts[i]) + "," + String(procMap[i]) + "," + String(recordedChanToKWDChan[i]) + ";";
+    }
+    key += String(schema.getNumEventTypes()) + ";" + eventSchemaSpec + ";" + String(getOverviewColumns()) + ";" + String((int)chunkStats) + ";" + String((int)checksums) + ";" + String((int)packedSpikes) + ";" + String((int)pagedLayout) + ";" + String((int)codec) + ";" + profile.toString();
+    for (int i = 0; i < schema.getNumChannelGroups(); i++)
+    {
+        key += String(schema.getChannelGroupSize(i)) + ",";
+    }
+    return key;
+}
+
+bool ArfRecording::buildPartTemplate()
+{
+    ScopedPointer<ArfFile> tmpl = new ArfFile();
+
+    partPreparer.discard();
+    partTemplate.reset();
+    partTemplateKey = String();
+
+    tmpl->initFile(0, File::getSpecialLocation(File::tempDirectory).getChildFile("arf_template").getFullPathName());
+    tmpl->setSchema(&schema);
+    tmpl->setOverview(getOverviewColumns());
+    tmpl->setChunkStats(chunkStats);
+    tmpl->setChecksums(checksums);
+    tmpl->setPackedSpikes(packedSpikes);
+    tmpl->setProfile(profile);
+    tmpl->setPagedLayout(pagedLayout, 0);
+    tmpl->setCodec(codec);
+    //HDF5 1.10 leaves a stale superblock checksum in the image of an open file with a newer
+    //superblock, so with the paged layout the image is the file written when the template is closed
+    File tmplFile(tmpl->getFileName());
+    if (tmpl->openInMemory(getNumRecordedChannels(), pagedLayout))
+        return false;
+    tmpl->createTemplate(getNumRecordedChannels(), mainInfo, recordedChanToKWDChan, procMap);
+    tmpl->stopRecording();
+    bool ok = pagedLayout || tmpl->getFileImage(partTemplate);
+    tmpl->close();
+    //the file is only closed once the last dataset of it is
+    tmpl = nullptr;
+    if (pagedLayout)
+    {
+        ok = tmplFile.loadFileAsData(partTemplate);
+        tmplFile.deleteFile();
+    }
+
+    if (ok)
+        partTemplateKey = getTemplateKey();
+    return ok;
+}
+
+void ArfRecording::checkDisk(const File& folder)
+{
+    if (preflightMB <= 0 || diskCheck.getFolder() == folder)
+        return;
+    String scratchPath = folder.getChildFile("arf_disk_check").getFullPathName();
+    bool tested;
+
+    //through the writer the parts will use, as openFiles picks it
+    int nShards = (!rawCapture && (useWriterProcess || numShards > 1)) ? assignShards(numShards) : 0;
+    if (rawCapture)
+    {
+        if (rawWriter == nullptr)
+            rawWriter = new ArfRawCapture();
+        assignShards(1);
+        ArfPartDescription part = describeShard(0, 1, scratchPath);
+        part.recordingNumber = 0;
+        tested = diskCheck.run(*rawWriter, part, savingNum, preflightMB);
+    }
+    else if (nShards > 0 && startWriters(nShards))
+    {
+        Array<ArfPartDescription> parts;
+        for (int k = 0; k < nShards; k++)
+        {
+            parts.add(describeShard(k, nShards, scratchPath));
+            parts.getReference(k).recordingNumber = 0;
+            parts.getReference(k).preallocateBytes = 0;
+        }
+        tested = diskCheck.run(remoteWriters, parts, channelShard, savingNum, preflightMB);
+    }
+    else
+    {
+        //a scratch part with the settings of the real ones
+        ArfFile scratch;
+        scratch.initFile(0, scratchPath);
+        scratch.setSchema(&schema);
+        scratch.setOverview(getOverviewColumns());
+        scratch.setChunkStats(chunkStats);
+        scratch.setChecksums(checksums);
+        scratch.setPackedSpikes(packedSpikes);
+        scratch.setProfile(profile);
+        scratch.setDirectIO(directIO);
+        scratch.setStaging(staging, stagingRate);
+        scratch.setPagedLayout(pagedLayout, 0);
+        scratch.setCodec(codec);
+        tested = diskCheck.run(scratch, mainInfo, savingNum, preflightMB);
+    }
+    if (!tested)
+    {
+        std::cerr << "The disk test could not write to " << folder.getFullPathName() << std::endl;
+        return;
     }
 
+    double required = ArfDiskCheck::getRequiredRate(*mainInfo, schema);
+    int64 freeBytes = folder.getBytesFreeOnVolume();
+    double headroom = diskCheck.getWriteRate() / required;
+    std::cout << "Disk test of " << folder.getFullPathName() << ": " << String(diskCheck.getWriteRate() / 1048576.0, 1)
+        << " MB/s, the recording needs up to " << String(required / 1048576.0, 1) << " MB/s" << std::endl;
+    if (headroom < ARF_DISK_HEADROOM)
+        std::cerr << "Warning: the disk is only " << String(headroom, 1) << " times as fast as the recording needs,"
+            << " data may be lost" << std::endl;
+    if (freeBytes < required * ARF_DISK_MIN_FREE_SECONDS)
+        std::cerr << "Warning: " << folder.getFullPathName() << " only has room for " << String(freeBytes / required / 60.0, 0)
+            << " minutes of recording" << std::endl;
+}
+
+void ArfRecording::addDiskCheck(const File& folder)
+{
+    if (preflightMB <= 0 || diskCheck.getFolder() != folder || diskCheck.getWriteRate() <= 0)
+    {
+        mainInfo->diskRate = 0;
+        mainInfo->requiredRate = 0;
+        mainInfo->diskFree = 0;
+        return;
+    }
+    mainInfo->diskRate = (float)(diskCheck.getWriteRate() / 1048576.0);
+    mainInfo->requiredRate = (float)(ArfDiskCheck::getRequiredRate(*mainInfo, schema) / 1048576.0);
+    mainInfo->diskFree = folder.getBytesFreeOnVolume();
+}
+
+bool ArfRecording::placePartFile(const File& target)
+{
+    if (partTemplateKey != getTemplateKey() && !buildPartTemplate())
+        return false;
+    if (partPreparer.take(target))
+        return true;
+    return target.replaceWithData(partTemplate.getData(), partTemplate.getSize());
+}
+
+void ArfRecording::openFiles(File rootFolder, int experimentNumber, int recordingNumber)
+{
+    this->rootFolder = rootFolder;
+    this->experimentNumber = experimentNumber;
+    this->recordingNumber = recordingNumber;
+    //the profile is kept for all the parts of the recording
+    applyProfile();
+    openPart();
+}
+
+void ArfRecording::openPart()
+{
+    if (savesInParts()) {
+        std::cout << "Opening part" << partNo << std::endl;
+    }
+    String basepath = getBasePath(partNo);
+
+
+    //Let's just put the first processor (usually the source node) on the KWIK for now
+    infoArray[0]->name = String("Open Ephys Recording #") + String(recordingNumber);
+
+	infoArray[0]->start_time = getTimestamp(0);
+
+    infoArray[0]->start_sample = 0;
+
+    updateChannelInfo();
+    //the test itself takes too long for here, see startAcquisition
+    if (preflightMB > 0 && partNo == 0 && diskCheck.getFolder() != rootFolder)
+        std::cout << "The disk test of " << rootFolder.getFullPathName() << " runs when acquisition starts again" << std::endl;
+    addDiskCheck(rootFolder);
+    if (decimators.size() != getNumRecordedChannels())
+    {
+        decimators.clear();
+        for (int i = 0; i < getNumRecordedChannels(); i++)
+            decimators.add((decimation[i] > 1) ? new ArfDecimator(decimation[i]) : nullptr);
+    }
+    for (int i = 0; i < getNumRecordedChannels(); i++)
+	{
+		channelTimestampArray.add(new Array<int64>);
+		channelTimestampArray.getLast()->ensureStorageAllocated(CHANNEL_TIMESTAMP_PREALLOC_SIZE);
+		channelLeftOverSamples.add(0);
+	}
+    while (partBuffer.size() < getNumRecordedChannels())
+    {        
+        partBuffer.add(new Array<int16, CriticalSection>);
+    }
+    for (int i = 0; i < partBuffer.size(); i++)
+    {
+        partBuffer[i]->ensureStorageAllocated(3 * savingNum);
+    }
+    buildRateGroups();
     hasAcquired = true;
+
+    //The tap stays open across recordings, so that consumers can stay attached
+    if (tapName.isEmpty())
+        liveTap = nullptr;
+    else if (liveTap == nullptr || liveTap->getName() != tapName)
+    {
+        liveTap = new ArfLiveTap();
+        if (!liveTap->open(tapName, tapSize))
+            liveTap = nullptr;
+    }
+    if (liveTap != nullptr)
+        liveTap->openPart(recordingNumber, partNo, mainInfo->sample_rate, sampleRates, bitVolts, procMap);
+
+    //Raw capture leaves all the HDF5 work for after the session
+    if (rawCapture)
+    {
+        if (rawWriter == nullptr)
+            rawWriter = new ArfRawCapture();
+        assignShards(1);
+        if (rawWriter->openPart(describeShard(0, 1, basepath)))
+            return;
+        std::cerr << "Could not start the raw capture, writing ARF files instead" << std::endl;
+    }
+
+    //HDF5 can only be used from one thread, so every shard needs a writer process of its own
+    int nShards = (useWriterProcess || numShards > 1) ? assignShards(numShards) : 0;
+    if (nShards > 0 && startWriters(nShards))
+    {
+        for (int i = 0; i < nShards; i++)
+        {
+            remoteWriters[i]->openPart(describeShard(i, nShards, basepath));
+        }
+        if (nShards > 1 && !writeShardIndex(nShards, basepath))
+            std::cerr << "Could not write the shard index for " << basepath << std::endl;
+        activeShards = nShards;
+        return;
+    }
+
+    mainFile = new ArfFile();
+    mainFile->initFile(0, basepath);
+    mainFile->setSchema(&schema);
+    mainFile->setOverview(getOverviewColumns());
+    mainFile->setChunkStats(chunkStats);
+    mainFile->setChecksums(checksums);
+    mainFile->setPackedSpikes(packedSpikes);
+    mainFile->setProfile(profile);
+    mainFile->setDirectIO(directIO);
+    mainFile->setStaging(staging, stagingRate);
+    mainFile->setPagedLayout(pagedLayout, getPartBytes(-1));
+    mainFile->setCodec(codec);
+
+    //A new file is made from the template, so only the names and timestamps are left to write.
+    //If the file is already there (e.g. a new recording in the same experiment) we add to it as before.
+    File partFile(mainFile->getFileName());
+    bool fromTemplate = !partFile.exists() && placePartFile(partFile);
+
+    mainFile->open(getNumRecordedChannels());
+
+    if (!fromTemplate || !mainFile->resumeRecording(recordingNumber, getNumRecordedChannels(), mainInfo))
+        mainFile->startNewRecording(recordingNumber,getNumRecordedChannels(), mainInfo, recordedChanToKWDChan, procMap);
+
+    //Get the next part ready while this one is being written
+    File nextPartFile(getBasePath(partNo + 1) + ".arf");
+    if (savesInParts() && partTemplate.getSize() > 0 && !nextPartFile.exists())
+        partPreparer.prepare(nextPartFile, partTemplate);
 }
 
 void ArfRecording::closeFiles()
 {    
     //TODO There are some unsaved samples in partBuf when we stop recording. However, only savingNum of them at most.
     
-    mainFile->stopRecording();
-    mainFile->close();
+    if (liveTap != nullptr)
+        liveTap->closePart();
+    if (mainFile != nullptr)
+    {
+        mainFile->stopRecording();
+        mainFile->close();
+        mainFile = nullptr;
+    }
+    //Without parts this is never a rollover, and what is left of the last blocks for the writer processes goes in now
+    if (!savesInParts() && activeShards > 0)
+    {
+        const ScopedLock al(partBuffer.getLock());
+        for (int i = 0; i < rateGroups.size(); i++)
+        {
+            ArfRateGroup* g = rateGroups[i];
+            int n = 0;
+            for (int j = 0; j < g->channels.size(); j++)
+                n = jmax(n, partBuffer[g->channels[j]]->size());
+            bool reserved = n > 0 && reserveBlock(*g, n);
+            for (int j = 0; j < g->channels.size(); j++)
+            {
+                int channel = g->channels[j];
+                if (reserved && partBuffer[channel]->size() > 0)
+                    writeChannelData(partBuffer[channel]->getRawDataPointer(), partBuffer[channel]->size(), channel);
+                partBuffer[channel]->clearQuick();
+            }
+        }
+    }
+    //dropped samples that could not be marked yet belong to this part
+    for (int i = 0; i < rateGroups.size() && activeShards > 0; i++)
+    {
+        if (rateGroups[i]->droppedSamples > 0)
+            reserveBlock(*rateGroups[i], 0);
+    }
+    for (int i = 0; i < activeShards; i++)
+    {
+        remoteWriters[i]->closePart();
+    }
+    activeShards = 0;
+    if (rawWriter != nullptr)
+        rawWriter->closePart();
     bitVolts.clear();
     sampleRates.clear();
+    procMap.clear();
+    decimators.clear();
 
-	recordedChanToKWDChan.clear();
-	channelTimestampArray.clear();
-	channelLeftOverSamples.clear();
-	scaledBuffer.malloc(MAX_BUFFER_SIZE);
-	intBuffer.malloc(MAX_BUFFER_SIZE);
-	bufferSize = MAX_BUFFER_SIZE;
+    //Keep the prepared part only if it is the one about to be opened, i.e. when rolling over
+    if (partPreparer.getTarget() != File(getBasePath(partNo) + ".arf"))
+        partPreparer.discard();
+
+    recordedChanToKWDChan.clear();
+    channelTimestampArray.clear();
+    channelLeftOverSamples.clear();
+    scaledBuffer.malloc(profile.bufferSize);
+    intBuffer.malloc(profile.bufferSize);
+    bufferSize = profile.bufferSize;
 }
 
 void ArfRecording::writeData(int writeChannel, int realChannel, const float* buffer, int size)
@@ -204,9 +530,18 @@ void ArfRecording::writeData(int writeChannel, int realChannel, const float* buf
 	double multFactor = 1 / (float(0x7fff) * getChannel(realChannel)->bitVolts);
 	int index = processorMap[getChannel(realChannel)->recordIndex];
 	FloatVectorOperations::copyWithMultiply(scaledBuffer.getData(), buffer, multFactor, size);
+    int64 timestamp = getTimestamp(realChannel);
+    if (decimators[writeChannel] != nullptr)
+    {
+        timestamp += decimators[writeChannel]->getOutputOffset();
+        size = decimators[writeChannel]->process(scaledBuffer.getData(), size);
+    }
 	AudioDataConverters::convertFloatToInt16LE(scaledBuffer.getData(), intBuffer.getData(), size);
+    if (liveTap != nullptr && size > 0)
+        liveTap->writeData(writeChannel, intBuffer.getData(), size, timestamp);
     
-    if (cntPerPart > 0) { //saving in parts; based on intermediate buffer
+    //Writer processes get whole blocks too, so that a full buffer drops a block of all the channels
+    if (savesInParts() || activeShards > 0) { //saving in parts; based on intermediate buffer
         int16* buf = intBuffer.getData();
         //simply appending to Array - best option?
         for (int i=0; i<size; i++) {
@@ -214,41 +549,190 @@ void ArfRecording::writeData(int writeChannel, int realChannel, const float* buf
         }
 
         const ScopedLock al(partBuffer.getLock());
-        bool ifSave = true;
-        for (int i=0; i<getNumRecordedChannels();i++)
+        int group = channelGroup[writeChannel];
+        while (isGroupReady(group) && flushGroup(group))
+            ;
+    }
+    else if (size > 0) { //saving to one file
+        writeChannelData(intBuffer.getData(), size, writeChannel);
+    }
+
+}
+
+bool ArfRecording::isGroupReady(int group)
+{
+    const ArfRateGroup* g = rateGroups[group];
+    for (int i = 0; i < g->channels.size(); i++)
+    {
+        if (partBuffer[g->channels[i]]->size() < g->savingNum)
+            return false;
+    }
+    return true;
+}
+
+bool ArfRecording::flushGroup(int group)
+{
+    //The block is split where the part ends, so that every part ends on a chunk boundary.
+    //A group that has reached the end keeps the rest buffered until all the others have too.
+    int blockSize = rateGroups[group]->savingNum;
+    int written = 0;
+    while (written < blockSize)
+    {
+        //rollOver rebuilds the groups
+        ArfRateGroup* g = rateGroups[group];
+        int64 groupEnd = getGroupEnd(*g);
+        if (g->partSamples >= groupEnd)
         {
-            if (partBuffer[i]->size() < savingNum)
-                ifSave = false;
+            if (!partEndReached())
+                break;
+            rollOver();
+            continue;
         }
-        if (ifSave) 
+        int n = (int)jmin((int64)(blockSize - written), groupEnd - g->partSamples);
+        //a block the writer processes have no room for is dropped for all the channels, so they stay the same length
+        bool reserved = reserveBlock(*g, n);
+        if (!reserved)
         {
-            if (partCnt >= cntPerPart) {
-                //This lock is also in writeEvent, writeSpike.
-                //Should prevent from trying to write one of those when we are opening the next part.
-                ScopedLock sl(partLock);
-                partNo++;
-                this->closeFiles();
-                this->openFiles(rootFolder, experimentNumber, recordingNumber);
-                partCnt = 0;
-            }
-            partCnt++;
-        
-            for (int i=0; i<getNumRecordedChannels();i++)
-            {
-                mainFile->writeChannel(partBuffer[i]->getRawDataPointer(), savingNum, i);
-                partBuffer[i]->removeRange(0, savingNum);            
-            }                    
+            if (g->droppedSamples == 0)
+                g->dropStart = g->partSamples;
+            g->droppedSamples += n;
         }
+        for (int i = 0; i < g->channels.size() && reserved; i++)
+        {
+            int channel = g->channels[i];
+            writeChannelData(partBuffer[channel]->getRawDataPointer() + written, n, channel);
+        }
+        written += n;
+        g->partSamples += n;
     }
-    else { //saving to one file
-        mainFile->writeChannel(intBuffer.getData(), size, writeChannel);
+    const ArfRateGroup* g = rateGroups[group];
+    for (int i = 0; i < g->channels.size(); i++)
+    {
+        partBuffer[g->channels[i]]->removeRange(0, written);
     }
+    return written == blockSize;
+}
 
+bool ArfRecording::savesInParts() const
+{
+    return cntPerPart > 0 || partSeconds > 0 || partMegabytes > 0 || partMessage.isNotEmpty();
 }
 
-void ArfRecording::endChannelBlock(bool lastBlock)
+bool ArfRecording::reserveBlock(ArfRateGroup& group, int nSamples)
 {
+    if (activeShards == 0)
+        return true;
+    String gap;
+    if (group.droppedSamples > 0)
+        gap = "ARF dropped " + String(group.droppedSamples) + " samples of the " + String(group.sampleRate) + " Hz channels from sample " + String(group.dropStart) + " of the part";
+    int gapBytes = gap.isEmpty() ? 0 : (int)gap.getNumBytesAsUTF8() + 1;
 
+    Array<int> shardChannels;
+    shardChannels.insertMultiple(0, 0, activeShards);
+    for (int i = 0; i < group.channels.size(); i++)
+        shardChannels.getReference(channelShard[group.channels[i]])++;
+    bool room = true;
+    for (int k = 0; k < activeShards && room; k++)
+    {
+        //events go to the first shard
+        int eventBytes = (k == 0) ? gapBytes : 0;
+        if (shardChannels[k] > 0 || eventBytes > 0)
+            room = remoteWriters[k]->hasRoom(shardChannels[k], nSamples, eventBytes);
+    }
+    if (!room)
+        return false;
+
+    if (gapBytes > 0)
+    {
+        int64 timestamp = mainInfo->start_time + (int64)(group.dropStart * mainInfo->sample_rate / group.sampleRate);
+        writeEventData(1, 0, 0, (void*)gap.toRawUTF8(), gapBytes, timestamp);
+        group.droppedSamples = 0;
+    }
+    return true;
+}
+
+int64 ArfRecording::getPartLength()
+{
+    //with only a part ending message, a part goes on until the message
+    int64 length = (cntPerPart > 0) ? (int64)cntPerPart * savingNum : std::numeric_limits<int64>::max();
+    if (partSeconds > 0 || partMegabytes > 0)
+    {
+        length = std::numeric_limits<int64>::max();
+        if (partSeconds > 0)
+            length = jmin(length, (int64)(partSeconds * mainInfo->sample_rate));
+        if (partMegabytes > 0)
+        {
+            //bytes of all channels together per sample at the main rate
+            double bytesPerSample = 0;
+            for (int i = 0; i < rateGroups.size(); i++)
+                bytesPerSample += rateGroups[i]->channels.size() * sizeof(int16) * rateGroups[i]->sampleRate / mainInfo->sample_rate;
+            length = jmin(length, (int64)(((int64)partMegabytes << 20) / jmax(1.0, bytesPerSample)));
+        }
+    }
+    return length;
+}
+
+int64 ArfRecording::getPartBytes(int shard)
+{
+    int64 length = getPartLength();
+    if (!pagedLayout || length <= 0 || length == std::numeric_limits<int64>::max())
+        return 0;
+    double bytes = 0;
+    for (int i = 0; i < getNumRecordedChannels(); i++)
+    {
+        if (shard < 0 || channelShard[i] == shard)
+            bytes += (double)length * sizeof(int16) * sampleRates[i] / mainInfo->sample_rate;
+    }
+    return jmin((int64)bytes, (int64)MAX_PREALLOCATION << 20);
+}
+
+int64 ArfRecording::getGroupEnd(const ArfRateGroup& group)
+{
+    double scale = group.sampleRate / mainInfo->sample_rate;
+    int64 length = getPartLength();
+    int64 end = std::numeric_limits<int64>::max();
+    if (length != end)
+        end = jmax((int64)group.chunkSize, (int64)(length * scale) / group.chunkSize * group.chunkSize);
+    if (messageCut >= 0)
+    {
+        int64 cut = jmax((int64)1, (int64)std::ceil(messageCut * scale));
+        end = jmin(end, (cut + group.chunkSize - 1) / group.chunkSize * group.chunkSize);
+    }
+    return end;
+}
+
+bool ArfRecording::partEndReached()
+{
+    for (int i = 0; i < rateGroups.size(); i++)
+    {
+        if (rateGroups[i]->partSamples < getGroupEnd(*rateGroups[i]))
+            return false;
+    }
+    return true;
+}
+
+void ArfRecording::rollOver()
+{
+    //This lock is also in writeEvent, writeSpike.
+    //Should prevent from trying to write one of those when we are opening the next part.
+    ScopedLock sl(partLock);
+    partNo++;
+    //the decimation filters go on with the samples they hold
+    OwnedArray<ArfDecimator> filters;
+    filters.swapWith(decimators);
+    this->closeFiles();
+    decimators.swapWith(filters);
+    openPart();
+    messageCut = -1;
+}
+
+void ArfRecording::endChannelBlock(bool lastBlock)
+{
+    //Event rows wait for a batch only within a block, so that rare events are in the file as soon
+    //as the samples around them
+    ScopedLock sl(partLock);
+    if (mainFile != nullptr)
+        mainFile->writePendingEvents();
 }
 
 void ArfRecording::writeEvent(int eventType, const MidiMessage& event, int64 timestamp)
@@ -261,7 +745,7 @@ void ArfRecording::writeEvent(int eventType, const MidiMessage& event, int64 tim
     const uint8* dataptr = event.getRawData();
     if (eventType == GenericProcessor::TTL)
     {
-        mainFile->writeEvent(0,*(dataptr+2),*(dataptr+1),(void*)(dataptr+3),timestamp);
+        writeEventData(0,*(dataptr+2),*(dataptr+1),(void*)(dataptr+3),1,timestamp);
     }
         
     else if (eventType == GenericProcessor::MESSAGE)
@@ -275,9 +759,25 @@ void ArfRecording::writeEvent(int eventType, const MidiMessage& event, int64 tim
         }
         else
         {
-            mainFile->writeEvent(1,*(dataptr+2),*(dataptr+1),(void*)(dataptr+6),timestamp);
+            writeEventData(1,*(dataptr+2),*(dataptr+1),(void*)(dataptr+6),event.getRawDataSize()-6,timestamp);
+            //The samples up to the message are the ones received so far, flushed or still in partBuffer
+            if (partMessage.isNotEmpty() && msg.startsWith(partMessage) && rateGroups.size() > 0)
+            {
+                const ArfRateGroup* g = rateGroups[channelGroup[0]];
+                int64 received = g->partSamples + partBuffer[0]->size();
+                int64 cut = jmax((int64)1, (int64)(received * mainInfo->sample_rate / g->sampleRate));
+                messageCut = (messageCut < 0) ? cut : jmin(messageCut, cut);
+            }
         }
     }
+
+    //The event channel picks the binary event type; messages without a type are not recorded
+    else if (eventType == GenericProcessor::BINARY_MSG)
+    {
+        int type = FIRST_BINARY_EVENT + *(dataptr+3);
+        if (type < schema.getNumEventTypes() && event.getRawDataSize() > 6)
+            writeEventData(type,*(dataptr+2),*(dataptr+1),(void*)(dataptr+6),event.getRawDataSize()-6,timestamp);
+    }
 }
 
 void ArfRecording::processSpecialEvent(String msg)
@@ -287,7 +787,12 @@ void ArfRecording::processSpecialEvent(String msg)
     std::cout << words[1] << std::endl;
     if (words[1].compare("SetAttr")==0)
     {
-        mainFile->setAttributeStr(words[3], "/rec_"+String(recordingNumber), words[2]);
+        if (mainFile != nullptr)
+            mainFile->setAttributeStr(words[3], "/rec_"+String(recordingNumber), words[2]);
+        for (int i = 0; i < activeShards; i++)
+            remoteWriters[i]->setAttributeStr(words[3], "/rec_"+String(recordingNumber), words[2]);
+        if (rawWriter != nullptr && rawWriter->isOpen())
+            rawWriter->setAttributeStr(words[3], "/rec_"+String(recordingNumber), words[2]);
     }
     else if(words[1].compare("TS")==0)
     {
@@ -300,7 +805,7 @@ void ArfRecording::processSpecialEvent(String msg)
 
 void ArfRecording::addSpikeElectrode(int index, const SpikeRecordInfo* elec)
 {
-    spikeInfoArray.add(elec->numChannels);
+    schema.addChannelGroup(elec->numChannels);
 }
 void ArfRecording::writeSpike(int electrodeIndex, const SpikeObject& spike, int64 /*timestamp*/)
 {
@@ -308,16 +813,391 @@ void ArfRecording::writeSpike(int electrodeIndex, const SpikeObject& spike, int6
     // What if multiple parts? Maybe you need to subtract how much samples have passed
     ScopedLock sl(partLock);
     float time = (float)timestamp / spike.samplingFrequencyHz;
-    mainFile->writeSpike(electrodeIndex,spike.nSamples,spike.data,time);
+    if (liveTap != nullptr)
+        liveTap->writeSpike(electrodeIndex,spike.nSamples,spike.nSamples*spike.nChannels,spike.data,time,timestamp);
+    if (mainFile != nullptr)
+        mainFile->writeSpike(electrodeIndex,spike.nSamples,spike.data,time);
+    else if (activeShards > 0)
+        remoteWriters[0]->writeSpike(electrodeIndex,spike.nSamples,spike.nSamples*spike.nChannels,spike.data,time);
+    else if (rawWriter != nullptr && rawWriter->isOpen())
+        rawWriter->writeSpike(electrodeIndex,spike.nSamples,spike.nSamples*spike.nChannels,spike.data,time);
 }
 
 void ArfRecording::startAcquisition()
 {
-    
+    //The disk test runs once per acquisition, in the folder of the last recording. In the first
+    //acquisition the folder isn't known yet, and recording starts untested.
+    diskCheck.reset();
+    if (preflightMB > 0 && rootFolder.isDirectory() && infoArray.size() > 0 && getNumRecordedChannels() > 0)
+    {
+        applyProfile();
+        updateChannelInfo();
+        checkDisk(rootFolder);
+    }
+
+    //The capture thread and its buffers are set up before recording starts
+    if (rawCapture)
+    {
+        if (rawWriter == nullptr)
+            rawWriter = new ArfRawCapture();
+        return;
+    }
+
+    //The writer processes do not use templates, but starting them takes a moment as well
+    if (useWriterProcess || numShards > 1)
+    {
+        startWriters(jmax(1, numShards));
+        return;
+    }
+
+    //Build the part template now, so that pressing record doesn't have to create
+    //the whole recording skeleton. openFiles rebuilds it if the channels change until then.
+    if (infoArray.size() == 0 || getNumRecordedChannels() == 0)
+        return;
+    applyProfile();
+    updateChannelInfo();
+    if (partTemplateKey != getTemplateKey())
+        buildPartTemplate();
+}
+
+bool ArfRecording::startWriters(int count)
+{
+    while (remoteWriters.size() < count)
+    {
+        ScopedPointer<ArfRemoteWriter> writer = new ArfRemoteWriter();
+        if (!writer->start(writerExecutable, writerBufferSize))
+        {
+            std::cerr << "Could not start the ARF writer processes, writing from the GUI instead" << std::endl;
+            remoteWriters.clear();
+            return false;
+        }
+        remoteWriters.add(writer.release());
+    }
+    return true;
+}
+
+//Splits the recorded channels over COUNT files, in equal consecutive blocks or keeping
+//the channels of every processor together. Returns how many shards there are.
+int ArfRecording::assignShards(int count)
+{
+    int nChannels = getNumRecordedChannels();
+    int nShards = jlimit(1, jmax(1, nChannels), count);
+    Array<int> shardSize;
+    shardSize.insertMultiple(0, 0, nShards);
+
+    channelShard.clearQuick();
+    shardChannel.clearQuick();
+    if (shardByProcessor)
+    {
+        //each processor goes to the shard with the fewest channels so far
+        Array<int> nodes;
+        Array<int> nodeShard;
+        for (int i = 0; i < nChannels; i++)
+        {
+            if (nodes.contains(procMap[i]))
+                continue;
+            int nodeChannels = 0;
+            for (int j = i; j < nChannels; j++)
+            {
+                if (procMap[j] == procMap[i])
+                    nodeChannels++;
+            }
+            int best = 0;
+            for (int k = 1; k < nShards; k++)
+            {
+                if (shardSize[k] < shardSize[best])
+                    best = k;
+            }
+            nodes.add(procMap[i]);
+            nodeShard.add(best);
+            shardSize.set(best, shardSize[best] + nodeChannels);
+        }
+        for (int i = 0; i < nChannels; i++)
+        {
+            channelShard.add(nodeShard[nodes.indexOf(procMap[i])]);
+        }
+        //there may be fewer processors than shards
+        while (nShards > 1 && shardSize[nShards - 1] == 0)
+            nShards--;
+    }
+    else
+    {
+        for (int i = 0; i < nChannels; i++)
+        {
+            channelShard.add(i * nShards / nChannels);
+        }
+    }
+
+    Array<int> nextChannel;
+    nextChannel.insertMultiple(0, 0, nShards);
+    for (int i = 0; i < nChannels; i++)
+    {
+        int shard = channelShard[i];
+        shardChannel.add(nextChannel[shard]);
+        nextChannel.set(shard, nextChannel[shard] + 1);
+    }
+    return nShards;
+}
+
+//The channels of one shard file. Events and spikes all go to the first shard.
+ArfPartDescription ArfRecording::describeShard(int shard, int nShards, String basepath)
+{
+    ArfPartDescription part;
+    part.basePath = (nShards > 1) ? basepath + "_shard" + String(shard) : basepath;
+    part.recordingNumber = recordingNumber;
+    part.info = *mainInfo;
+    part.info.bitVolts.clear();
+    part.info.channelSampleRates.clear();
+    for (int i = 0; i < getNumRecordedChannels(); i++)
+    {
+        if (channelShard[i] != shard)
+            continue;
+        part.info.bitVolts.add(bitVolts[i]);
+        part.info.channelSampleRates.add(sampleRates[i]);
+        part.recordedChanToKWDChan.add(recordedChanToKWDChan[i]);
+        part.procMap.add(procMap[i]);
+    }
+    part.nChannels = part.procMap.size();
+    part.overviewColumns = getOverviewColumns();
+    part.chunkStats = chunkStats;
+    part.checksums = checksums;
+    part.packedSpikes = packedSpikes;
+    part.profile = profile;
+    part.directIO = directIO;
+    part.staging = staging;
+    part.stagingRate = stagingRate;
+    part.pagedLayout = pagedLayout;
+    part.preallocateBytes = getPartBytes(shard);
+    part.codec = codec;
+    if (shard == 0)
+        part.setSchema(schema);
+    return part;
+}
+
+int ArfRecording::getOverviewColumns() const
+{
+    if (!writeOverview)
+        return 0;
+    return overviewRms ? 3 : 2;
+}
+
+//Adds the channel to shard map of this recording to <basepath>_shards.xml
+bool ArfRecording::writeShardIndex(int nShards, String basepath)
+{
+    File indexFile(basepath + "_shards.xml");
+    ScopedPointer<XmlElement> index;
+    if (indexFile.existsAsFile())
+        index = XmlDocument::parse(indexFile);
+    if (index == nullptr || !index->hasTagName("ARF_SHARDS"))
+        index = new XmlElement("ARF_SHARDS");
+    index->setAttribute("version", 1);
+
+    forEachXmlChildElementWithTagName(*index, old, "RECORDING")
+    {
+        if (old->getIntAttribute("number") == recordingNumber)
+        {
+            index->removeChildElement(old, true);
+            break;
+        }
+    }
+
+    XmlElement* rec = index->createNewChildElement("RECORDING");
+    rec->setAttribute("number", recordingNumber);
+    rec->setAttribute("channels", getNumRecordedChannels());
+    for (int k = 0; k < nShards; k++)
+    {
+        StringArray channels;
+        for (int i = 0; i < getNumRecordedChannels(); i++)
+        {
+            if (channelShard[i] == k)
+                channels.add(String(i));
+        }
+        XmlElement* shard = rec->createNewChildElement("SHARD");
+        shard->setAttribute("index", k);
+        shard->setAttribute("file", File(basepath + "_shard" + String(k) + ".arf").getFileName());
+        shard->setAttribute("events", (k == 0) ? 1 : 0);
+        //recorded channel numbers, in the order of the channel datasets of the shard file
+        shard->setAttribute("channels", channels.joinIntoString(","));
+    }
+    return index->writeToFile(indexFile, String());
+}
+
+void ArfRecording::writeChannelData(int16* data, int nSamples, int channel)
+{
+    if (mainFile != nullptr)
+        mainFile->writeChannel(data, nSamples, channel);
+    else if (activeShards > 0)
+        remoteWriters[channelShard[channel]]->writeChannel(data, nSamples, shardChannel[channel]);
+    else if (rawWriter != nullptr && rawWriter->isOpen())
+        rawWriter->writeChannel(data, nSamples, channel);
+}
+
+void ArfRecording::writeEventData(int type, uint8 id, uint8 processor, void* data, int dataSize, int64 timestamp)
+{
+    if (liveTap != nullptr)
+        liveTap->writeEvent(type, id, processor, data, dataSize, timestamp);
+    if (mainFile != nullptr)
+        mainFile->writeEvent(type, id, processor, data, dataSize, timestamp);
+    else if (activeShards > 0)
+        remoteWriters[0]->writeEvent(type, id, processor, data, dataSize, timestamp);
+    else if (rawWriter != nullptr && rawWriter->isOpen())
+        rawWriter->writeEvent(type, id, processor, data, dataSize, timestamp);
+}
+
+void ArfRecording::setParameter(EngineParameter& parameter)
+{
+    //running writers and the tap were started with these settings, the others don't concern them
+    String writerSettings = getWriterSettings();
+    String oldTapName = tapName;
+    int oldTapSize = tapSize;
+
+    boolParameter(0, useWriterProcess);
+    intParameter(1, writerBufferSize);
+    strParameter(2, writerExecutable);
+    intParameter(3, numShards);
+    boolParameter(4, shardByProcessor);
+    boolParameter(5, rawCapture);
+    intParameter(6, partSeconds);
+    intParameter(7, partMegabytes);
+    strParameter(8, partMessage);
+    boolParameter(9, writeOverview);
+    boolParameter(10, overviewRms);
+    boolParameter(11, chunkStats);
+    boolParameter(12, packedSpikes);
+    strParameter(13, profileName);
+    boolParameter(14, directIO);
+    boolParameter(15, staging);
+    intParameter(16, stagingRate);
+    boolParameter(17, pagedLayout);
+    strParameter(18, tapName);
+    intParameter(19, tapSize);
+    strParameter(20, decimationSpec);
+    boolParameter(21, codec);
+    boolParameter(22, checksums);
+    intParameter(23, preflightMB);
+    strParameter(24, eventSchemaSpec);
+    if (parameter.id == 24)
+    {
+        schema.removeEventTypes(FIRST_BINARY_EVENT);
+        schema.addEventSchemas(eventSchemaSpec);
+    }
+
+    if (getWriterSettings() != writerSettings)
+        remoteWriters.clear();
+    if (tapName != oldTapName || tapSize != oldTapSize)
+        liveTap = nullptr;
+}
+
+String ArfRecording::getWriterSettings() const
+{
+    return String((int)useWriterProcess) + ";" + String(writerBufferSize) + ";" + writerExecutable + ";" + String(numShards) + ";" + String((int)shardByProcessor);
 }
 
 RecordEngineManager* ArfRecording::getEngineManager()
 {
     RecordEngineManager* man = new RecordEngineManager("Arf","Arf",&(engineFactory<ArfRecording>));
+    EngineParameter* param;
+    param = new EngineParameter(EngineParameter::BOOL, 0, "Write in separate process", false);
+    man->addParameter(param);
+    param = new EngineParameter(EngineParameter::INT, 1, "Writer buffer (MB)", 256, 16, 4096);
+    man->addParameter(param);
+    param = new EngineParameter(EngineParameter::STR, 2, "Writer executable", "arf-writer");
+    man->addParameter(param);
+    param = new EngineParameter(EngineParameter::INT, 3, "Writer shards", 1, 1, 64);
+    man->addParameter(param);
+    param = new EngineParameter(EngineParameter::BOOL, 4, "Keep processors in one shard", false);
+    man->addParameter(param);
+    param = new EngineParameter(EngineParameter::BOOL, 5, "Raw capture (convert later)", false);
+    man->addParameter(param);
+    param = new EngineParameter(EngineParameter::INT, 6, "Part length (s), 0 = default", 0, 0, 86400);
+    man->addParameter(param);
+    param = new EngineParameter(EngineParameter::INT, 7, "Part size (MB), 0 = default", 0, 0, 1048576);
+    man->addParameter(param);
+    param = new EngineParameter(EngineParameter::STR, 8, "New part after message", "");
+    man->addParameter(param);
+    param = new EngineParameter(EngineParameter::BOOL, 9, "Min/max overview", false);
+    man->addParameter(param);
+    param = new EngineParameter(EngineParameter::BOOL, 10, "Overview with RMS", false);
+    man->addParameter(param);
+    param = new EngineParameter(EngineParameter::BOOL, 11, "Chunk statistics", false);
+    man->addParameter(param);
+    param = new EngineParameter(EngineParameter::BOOL, 12, "Packed spike table", false);
+    man->addParameter(param);
+    param = new EngineParameter(EngineParameter::STR, 13, "Profile (" + ArfProfile::getPresetNames().joinIntoString(", ") + " or a file)", "default");
+    man->addParameter(param);
+    param = new EngineParameter(EngineParameter::BOOL, 14, "Direct I/O (Linux)", false);
+    man->addParameter(param);
+    param = new EngineParameter(EngineParameter::BOOL, 15, "Build parts in memory (Linux)", false);
+    man->addParameter(param);
+    param = new EngineParameter(EngineParameter::INT, 16, "Disk rate of parts in memory (MB/s), 0 = any", 0, 0, 100000);
+    man->addParameter(param);
+    param = new EngineParameter(EngineParameter::BOOL, 17, "Paged layout for many channels (HDF5 1.10)", false);
+    man->addParameter(param);
+    param = new EngineParameter(EngineParameter::STR, 18, "Live tap (shared memory name), empty = off", "");
+    man->addParameter(param);
+    param = new EngineParameter(EngineParameter::INT, 19, "Live tap buffer (MB)", 64, 1, 65536);
+    man->addParameter(param);
+    param = new EngineParameter(EngineParameter::STR, 20, "Decimate channels (e.g. 0-31:10, 40:4)", "");
+    man->addParameter(param);
+    param = new EngineParameter(EngineParameter::BOOL, 21, "Lossless sample codec", false);
+    man->addParameter(param);
+    param = new EngineParameter(EngineParameter::BOOL, 22, "Chunk checksums (CRC32C)", false);
+    man->addParameter(param);
+    param = new EngineParameter(EngineParameter::INT, 23, "Disk test before recording (MB), 0 = off", 0, 0, 4096);
+    man->addParameter(param);
+    param = new EngineParameter(EngineParameter::STR, 24, "Binary event types (e.g. Position: x F32, y F32; Lick: side U8)", "");
+    man->addParameter(param);
     return man;
 }
+
+//ArfPartPreparer
+
+ArfPartPreparer::ArfPartPreparer() : Thread("Arf part preparer"), written(false)
+{
+}
+
+ArfPartPreparer::~ArfPartPreparer()
+{
+    discard();
+}
+
+void ArfPartPreparer::prepare(const File& target, const MemoryBlock& image)
+{
+    discard();
+    this->target = target;
+    this->tempFile = File(target.getFullPathName() + ".tmp");
+    this->image = image;
+    startThread(3);
+}
+
+void ArfPartPreparer::run()
+{
+    written = tempFile.replaceWithData(image.getData(), image.getSize());
+}
+
+bool ArfPartPreparer::take(const File& target)
+{
+    waitForThreadToExit(-1);
+    if (written && this->target == target && !target.exists() && tempFile.moveFileTo(target))
+    {
+        this->target = File();
+        written = false;
+        return true;
+    }
+    discard();
+    return false;
+}
+
+void ArfPartPreparer::discard()
+{
+    waitForThreadToExit(-1);
+    if (target != File())
+        tempFile.deleteFile();
+    target = File();
+    written = false;
+}
+
+File ArfPartPreparer::getTarget() const
+{
+    return target;
+}
@@ -26,8 +26,55 @@
 
 #include <RecordingLib.h>
 #include "ArfFileFormat.h"
+#include "ArfRemoteWriter.h"
+#include "ArfRawCapture.h"
+#include "ArfLiveTap.h"
+#include "ArfDecimator.h"
+#include "ArfDiskCheck.h"
 
-#define SAVING_NUM 20000
+//Writes the skeleton of the next part to disk in the background, so that opening the
+//part is only a rename. Only plain file I/O happens here, never any HDF5 calls.
+class ArfPartPreparer : public Thread
+{
+public:
+    ArfPartPreparer();
+    ~ArfPartPreparer();
+
+    void prepare(const File& target, const MemoryBlock& image);
+    //Waits for the pending write. Returns true if TARGET was prepared and is now in place
+    bool take(const File& target);
+    void discard();
+    File getTarget() const;
+
+    void run() override;
+
+private:
+    File target;
+    File tempFile;
+    MemoryBlock image;
+    bool written;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ArfPartPreparer);
+};
+
+//Recorded channels that run at the same sample rate. Each group is written on its own,
+//in blocks of savingNum samples (see ArfProfile) scaled to its rate, so slow channels don't hold up fast ones.
+struct ArfRateGroup
+{
+    float sampleRate;
+    //recorded channel numbers
+    Array<int> channels;
+    //samples per channel in a block
+    int savingNum;
+    //chunk size of the channel datasets, see ArfFile::getChannelChunkSize
+    int chunkSize;
+    //samples per channel in the current part
+    int64 partSamples;
+    //Samples per channel the writer processes had no room for, from dropStart of the part on,
+    //that are still to be marked in the Messages table
+    int64 droppedSamples;
+    int64 dropStart;
+};
 
 class ArfRecording : public RecordEngine
 {
@@ -46,6 +93,7 @@ public:
 	void resetChannels() override;
 	void startAcquisition() override;
 	void endChannelBlock(bool lastBlock) override;
+    void setParameter(EngineParameter& parameter) override;
 
     static RecordEngineManager* getEngineManager();
 private:
@@ -54,6 +102,52 @@ private:
     
     void processSpecialEvent(String msg);
 
+    String getBasePath(int part);
+    void updateChannelInfo();
+    //loads the profile and sets the block, buffer and part sizes from it
+    void applyProfile();
+    //opens part partNo of the recording openFiles started, with the profile loaded then
+    void openPart();
+    String getTemplateKey();
+    bool buildPartTemplate();
+    //Runs the disk test in FOLDER through the writer the parts will use, if it hasn't been run there
+    //since acquisition started, and warns if the disk looks too slow or too full. It takes a while,
+    //so only before recording starts
+    void checkDisk(const File& folder);
+    //adds the result of the disk test of FOLDER to mainInfo, nothing if it wasn't tested
+    void addDiskCheck(const File& folder);
+    //puts a copy of the part template at TARGET, if possible without waiting for the disk
+    bool placePartFile(const File& target);
+
+    //Everything that goes into the current part, to mainFile, the writer processes or the raw capture
+    bool startWriters(int count);
+    //the settings the writer processes depend on, to tell when they have to be started again
+    String getWriterSettings() const;
+    int assignShards(int count);
+    ArfPartDescription describeShard(int shard, int nShards, String basepath);
+    bool writeShardIndex(int nShards, String basepath);
+    void writeChannelData(int16* data, int nSamples, int channel);
+    void writeEventData(int type, uint8 id, uint8 processor, void* data, int dataSize, int64 timestamp);
+
+    void buildRateGroups();
+    bool isGroupReady(int group);
+    //Writes a block of GROUP and returns true, or false if it has to wait for the other groups to end the part
+    bool flushGroup(int group);
+    //True if the writer processes have room for NSAMPLES of every channel of GROUP, and then
+    //first marks the samples of the group that were dropped before
+    bool reserveBlock(ArfRateGroup& group, int nSamples);
+    //true if any of the limits above ends parts, otherwise the recording goes to a single file
+    bool savesInParts() const;
+    //part length in samples at the main sample rate
+    int64 getPartLength();
+    //bytes of samples in a part of the channels of SHARD, -1 for all, to reserve on disk with the
+    //paged layout; 0 if it doesn't apply
+    int64 getPartBytes(int shard);
+    //samples per channel of GROUP after which the current part is closed, always on a chunk boundary
+    int64 getGroupEnd(const ArfRateGroup& group);
+    bool partEndReached();
+    void rollOver();
+
     Array<int> processorMap;
 	Array<int> channelsPerProcessor;
 	Array<int> recordedChanToKWDChan;
@@ -72,18 +166,21 @@ private:
 	HeapBlock<int16> intBuffer;
 	int bufferSize;    
     
-    Array<int> spikeInfoArray;
+    //event and spike datatypes, shared by all the files this engine writes
+    ArfSchemaRegistry schema;
     
     ScopedPointer<ArfFile> mainFile;
     ScopedPointer<ArfRecordingInfo> mainInfo;
 
     int savingNum;
     
-    //To ensure always at least 3*SAVING_NUM is allocated in all of the arrays
-    OwnedArray<Array<int16, CriticalSection, 3*SAVING_NUM>, CriticalSection> partBuffer;
+    //Room for 3*savingNum samples is allocated in all of the arrays when the files are opened
+    OwnedArray<Array<int16, CriticalSection>, CriticalSection> partBuffer;
     int partNo;
-    int partCnt;
     int cntPerPart;
+    OwnedArray<ArfRateGroup> rateGroups;
+    //the rate group of every recorded channel
+    Array<int> channelGroup;
     CriticalSection partLock;
     
     File rootFolder;
@@ -92,6 +189,80 @@ private:
 
     bool hasAcquired;
 
+    //In-memory image of a new part, with the whole recording skeleton already created
+    MemoryBlock partTemplate;
+    String partTemplateKey;
+    ArfPartPreparer partPreparer;
+
+    //Settings for doing the HDF5 work in arf-writer processes
+    bool useWriterProcess;
+    int writerBufferSize;
+    String writerExecutable;
+    int numShards;
+    bool shardByProcessor;
+    OwnedArray<ArfRemoteWriter> remoteWriters;
+    //how many of them have a part open
+    int activeShards;
+    //the shard of every recorded channel, and its channel number in the shard file
+    Array<int> channelShard;
+    Array<int> shardChannel;
+
+    //Rollover policy. Parts end after partSeconds of recording or partMegabytes of samples,
+    //whichever comes first, or after the profile's blocksPerPart blocks if neither is set
+    int partSeconds;
+    int partMegabytes;
+    //a message starting with this ends the part at the next chunk boundary
+    String partMessage;
+    //where the current part ends because of partMessage, in samples at the main rate, -1 if no such message came
+    int64 messageCut;
+
+    //Min/max (and RMS) overview of every channel, see ArfOverview
+    bool writeOverview;
+    bool overviewRms;
+    int getOverviewColumns() const;
+    //Statistics of every chunk of every channel, see ArfFile::setChunkStats
+    bool chunkStats;
+    //CRC32C of every chunk of every channel, see ArfFile::setChecksums
+    bool checksums;
+    //One spike table per electrode size, see ArfFile::setPackedSpikes
+    bool packedSpikes;
+
+    //Preset name or profile file, and the profile of the files that are open
+    String profileName;
+    ArfProfile profile;
+    //Raw data written past the page cache, see ArfDirectDriver
+    bool directIO;
+    //Parts built in memory and written out in the background at up to stagingRate MB/s
+    bool staging;
+    int stagingRate;
+    //Latest file format with paged file space, and the disk space of a part reserved when it is
+    //opened, see ArfFileBase::setPagedLayout
+    bool pagedLayout;
+    //Samples stored with ArfCodec, see ArfFileBase::setCodec
+    bool codec;
+    //MB written by the disk test before recording, 0 for none
+    int preflightMB;
+    ArfDiskCheck diskCheck;
+
+    //Raw capture instead of ARF files, see Tools/arf-convert
+    bool rawCapture;
+    ScopedPointer<ArfRawCapture> rawWriter;
+
+    //Event types of the binary messages, see ArfSchemaRegistry::addEventSchemas. They follow TTL and
+    //Messages in the schema, in the order they are given.
+    String eventSchemaSpec;
+
+    //Recorded channels kept at a lower rate, e.g. "0-31:10", and the filter of every recorded
+    //channel (nullptr if it is kept at its rate). The filters carry on from one part to the next.
+    String decimationSpec;
+    Array<int> decimation;
+    OwnedArray<ArfDecimator> decimators;
+
+    //Everything written also goes to the shared memory tapName while it is set, see ArfLiveTap
+    String tapName;
+    int tapSize;
+    ScopedPointer<ArfLiveTap> liveTap;
+
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ArfRecording);
 };
 
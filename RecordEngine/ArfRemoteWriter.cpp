@@ -0,0 +1,248 @@
+/*
+ ------------------------------------------------------------------
+
+ Michal Badura, 2016
+ based on code by Florian Franzen, 2014
+
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "ArfRemoteWriter.h"
+#include <unistd.h>
+
+//how long to wait for room for an open, close or quit record, in ms
+#define CONTROL_RECORD_TIMEOUT 5000
+//how long to wait for the writer to empty the ring when stopping, in ms
+#define STOP_TIMEOUT 10000
+
+ArfRemoteWriter::ArfRemoteWriter() : lastCheck(0), reportedDropped(0), reportedErrors(0), restarts(0)
+{
+}
+
+ArfRemoteWriter::~ArfRemoteWriter()
+{
+    stop();
+}
+
+bool ArfRemoteWriter::start(String executable, int ringMegabytes)
+{
+    this->executable = executable;
+    String name = String("/arf-writer-") + String(getpid()) + "-" + String::toHexString((pointer_sized_int)this);
+    if (!ring.create(name, (size_t)ringMegabytes << 20))
+        return false;
+    if (!launch())
+    {
+        ring.close();
+        return false;
+    }
+    return true;
+}
+
+bool ArfRemoteWriter::launch()
+{
+    StringArray args;
+    args.add(executable);
+    args.add(ring.getName());
+
+    process = new ChildProcess();
+    //the writer reports through the ring, so its output is not needed
+    if (!process->start(args, 0))
+    {
+        std::cerr << "Could not start the ARF writer " << executable << std::endl;
+        process = nullptr;
+        return false;
+    }
+    return true;
+}
+
+void ArfRemoteWriter::stop()
+{
+    if (!ring.isOpen())
+        return;
+    const ScopedLock sl(pushLock);
+    if (process != nullptr && process->isRunning())
+    {
+        //The writer keeps its own mapping, so if it takes longer it still finishes after the name is gone
+        if (pushControl(ArfRecord::RecordQuit, nullptr, 0) && !process->waitForProcessToFinish(STOP_TIMEOUT))
+            std::cerr << "The ARF writer is still emptying its buffer" << std::endl;
+    }
+    reportProgress();
+    process = nullptr;
+    ring.close();
+}
+
+bool ArfRemoteWriter::pushControl(ArfRecord::RecordType type, const void* data, uint32 size)
+{
+    uint32 start = Time::getMillisecondCounter();
+    ArfRingHeader* header = ring.getHeader();
+    uint64 dropped = header->dropped.load();
+    while (!ring.push(type, data, size))
+    {
+        //a full ring counts as a drop, but this record is not dropped, only delayed
+        header->dropped.store(dropped);
+        if (Time::getMillisecondCounter() - start > CONTROL_RECORD_TIMEOUT)
+        {
+            std::cerr << "The ARF writer is not keeping up, a file command was lost" << std::endl;
+            return false;
+        }
+        checkWriter();
+        Thread::sleep(1);
+    }
+    return true;
+}
+
+void ArfRemoteWriter::openPart(const ArfPartDescription& part)
+{
+    MemoryOutputStream out;
+    part.writeTo(out);
+
+    const ScopedLock sl(pushLock);
+    checkWriter(true);
+    pushControl(ArfRecord::RecordOpen, out.getData(), (uint32)out.getDataSize());
+}
+
+void ArfRemoteWriter::closePart()
+{
+    const ScopedLock sl(pushLock);
+    pushControl(ArfRecord::RecordClose, nullptr, 0);
+    checkWriter(true);
+}
+
+void ArfRemoteWriter::writeChannel(const int16* data, int nSamples, int channel)
+{
+    const ScopedLock sl(pushLock);
+    uint32 dataSize = nSamples * sizeof(int16);
+    char* dst = ring.beginRecord(ArfRecord::RecordData, sizeof(ArfRecord::DataRecord) + dataSize);
+    if (dst != nullptr)
+    {
+        ArfRecord::DataRecord* rec = (ArfRecord::DataRecord*)dst;
+        rec->channel = channel;
+        rec->nSamples = nSamples;
+        memcpy(dst + sizeof(ArfRecord::DataRecord), data, dataSize);
+        ring.commitRecord();
+    }
+    checkWriter();
+}
+
+void ArfRemoteWriter::writeEvent(int type, uint8 id, uint8 processor, const void* data, int dataSize, int64 timestamp)
+{
+    const ScopedLock sl(pushLock);
+    dataSize = jlimit(0, ARF_MAX_EVENT_DATA, dataSize);
+    char* dst = ring.beginRecord(ArfRecord::RecordEvent, sizeof(ArfRecord::EventRecord) + dataSize);
+    if (dst != nullptr)
+    {
+        ArfRecord::EventRecord* rec = (ArfRecord::EventRecord*)dst;
+        rec->type = type;
+        rec->eventID = id;
+        rec->nodeID = processor;
+        rec->dataSize = (uint16)dataSize;
+        rec->timestamp = timestamp;
+        memcpy(dst + sizeof(ArfRecord::EventRecord), data, dataSize);
+        ring.commitRecord();
+    }
+}
+
+void ArfRemoteWriter::writeSpike(int groupIndex, int nSamples, int nValues, const uint16* data, float time)
+{
+    const ScopedLock sl(pushLock);
+    uint32 dataSize = nValues * sizeof(uint16);
+    char* dst = ring.beginRecord(ArfRecord::RecordSpike, sizeof(ArfRecord::SpikeRecord) + dataSize);
+    if (dst != nullptr)
+    {
+        ArfRecord::SpikeRecord* rec = (ArfRecord::SpikeRecord*)dst;
+        rec->electrode = groupIndex;
+        rec->nSamples = nSamples;
+        rec->nValues = nValues;
+        rec->time = time;
+        memcpy(dst + sizeof(ArfRecord::SpikeRecord), data, dataSize);
+        ring.commitRecord();
+    }
+}
+
+void ArfRemoteWriter::setAttributeStr(String value, String path, String name)
+{
+    MemoryOutputStream out;
+    out.writeString(value);
+    out.writeString(path);
+    out.writeString(name);
+
+    const ScopedLock sl(pushLock);
+    ring.push(ArfRecord::RecordAttribute, out.getData(), (uint32)out.getDataSize());
+}
+
+bool ArfRemoteWriter::hasRoom(int nChannels, int nSamples, int eventBytes)
+{
+    const ScopedLock sl(pushLock);
+    uint64 channelSpace = ArfRecord::space(sizeof(ArfRecord::DataRecord) + nSamples * sizeof(int16));
+    uint64 eventSpace = (eventBytes > 0) ? ArfRecord::space(sizeof(ArfRecord::EventRecord) + eventBytes) : 0;
+    if (ring.hasRoom(nChannels * channelSpace + eventSpace, jmax(channelSpace, eventSpace)))
+        return true;
+    ring.getHeader()->dropped.fetch_add(1, std::memory_order_relaxed);
+    checkWriter();
+    return false;
+}
+
+void ArfRemoteWriter::checkWriter(bool force)
+{
+    uint32 now = Time::getMillisecondCounter();
+    if (!ring.isOpen() || (!force && now - lastCheck < ARF_WRITER_CHECK_INTERVAL))
+        return;
+    lastCheck = now;
+    reportProgress();
+
+    if (process != nullptr && process->isRunning())
+        return;
+    //Whatever the writer had not flushed is still in the ring, a new one picks up from there
+    if (restarts >= ARF_WRITER_MAX_RESTARTS)
+    {
+        if (restarts++ == ARF_WRITER_MAX_RESTARTS)
+            std::cerr << "The ARF writer keeps exiting, not restarting it again" << std::endl;
+        return;
+    }
+    restarts++;
+    std::cerr << "The ARF writer has exited, restarting it" << std::endl;
+    launch();
+}
+
+double ArfRemoteWriter::getBacklog() const
+{
+    if (!ring.isOpen())
+        return 0;
+    //the writer moves tail once what it has applied is flushed
+    ArfRingHeader* header = ring.getHeader();
+    return (double)(header->head.load() - header->tail.load()) / (double)header->capacity;
+}
+
+void ArfRemoteWriter::reportProgress()
+{
+    ArfRingHeader* header = ring.getHeader();
+    uint64 dropped = header->dropped.load();
+    if (dropped != reportedDropped)
+    {
+        std::cerr << "ARF writer buffer full, " << (int64)(dropped - reportedDropped) << " blocks were not recorded" << std::endl;
+        reportedDropped = dropped;
+    }
+    uint32 errors = header->errors.load();
+    if (errors != reportedErrors)
+    {
+        char msg[ARF_RING_ERROR_SIZE];
+        memcpy(msg, header->lastError, ARF_RING_ERROR_SIZE);
+        msg[ARF_RING_ERROR_SIZE - 1] = 0;
+        std::cerr << "ARF writer: " << msg << std::endl;
+        reportedErrors = errors;
+    }
+}
@@ -0,0 +1,82 @@
+/*
+ ------------------------------------------------------------------
+
+ Michal Badura, 2016
+ based on code by Florian Franzen, 2014
+
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef ARFREMOTEWRITER_H_INCLUDED
+#define ARFREMOTEWRITER_H_INCLUDED
+
+#include "ArfShmRing.h"
+
+//how often to look at the writer process, in ms
+#define ARF_WRITER_CHECK_INTERVAL 500
+#define ARF_WRITER_MAX_RESTARTS 5
+
+//Hands everything to be written to an arf-writer process (see Tools/arf-writer) through
+//an ArfShmRing, so that the recording thread never has to wait on HDF5. Same calls as ArfFile.
+class ArfRemoteWriter
+{
+public:
+    ArfRemoteWriter();
+    ~ArfRemoteWriter();
+
+    //creates the ring and launches EXECUTABLE on it
+    bool start(String executable, int ringMegabytes);
+    //lets the writer finish what is in the ring and waits for it a while
+    void stop();
+
+    void openPart(const ArfPartDescription& part);
+    void closePart();
+    void writeChannel(const int16* data, int nSamples, int channel);
+    void writeEvent(int type, uint8 id, uint8 processor, const void* data, int dataSize, int64 timestamp);
+    void writeSpike(int groupIndex, int nSamples, int nValues, const uint16* data, float time);
+    void setAttributeStr(String value, String path, String name);
+    //True if blocks of NSAMPLES for NCHANNELS channels, and an event with EVENTBYTES of data, fit
+    //in the ring, so that a block can be written for all the channels or for none. If they don't,
+    //it counts as a drop. Only the recording thread pushes data, so the room is still there after.
+    bool hasRoom(int nChannels, int nSamples, int eventBytes);
+
+    //Restarts the writer if it has exited and reports dropped records and errors.
+    //Cheap unless FORCE or ARF_WRITER_CHECK_INTERVAL has passed.
+    void checkWriter(bool force = false);
+    //how full the ring is, from 0 (the writer has everything on disk) to 1
+    double getBacklog() const;
+
+private:
+    bool launch();
+    void reportProgress();
+    //for records that must not be lost, waits for room in the ring instead of dropping
+    bool pushControl(ArfRecord::RecordType type, const void* data, uint32 size);
+
+    ArfShmRing ring;
+    ScopedPointer<ChildProcess> process;
+    String executable;
+    CriticalSection pushLock;
+
+    uint32 lastCheck;
+    uint64 reportedDropped;
+    uint32 reportedErrors;
+    int restarts;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ArfRemoteWriter);
+};
+
+#endif  // ARFREMOTEWRITER_H_INCLUDED
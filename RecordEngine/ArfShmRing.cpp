@@ -0,0 +1,237 @@
+/*
+ ------------------------------------------------------------------
+
+ Michal Badura, 2016
+ based on code by Florian Franzen, 2014
+
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "ArfShmRing.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <new>
+
+ArfShmRing::ArfShmRing() : header(nullptr), data(nullptr), mappedSize(0), created(false), pendingHead(0)
+{
+}
+
+ArfShmRing::~ArfShmRing()
+{
+    close();
+}
+
+bool ArfShmRing::map(int fd, size_t size, bool populate)
+{
+    //Pre-faulting the pages keeps page faults out of the recording thread
+    void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | (populate ? MAP_POPULATE : 0), fd, 0);
+    ::close(fd);
+    if (ptr == MAP_FAILED)
+        return false;
+    header = (ArfRingHeader*)ptr;
+    data = (char*)ptr + sizeof(ArfRingHeader);
+    mappedSize = size;
+    return true;
+}
+
+bool ArfShmRing::create(String name, size_t capacity)
+{
+    close();
+    capacity = (capacity + 7) & ~(size_t)7;
+    int fd = shm_open(name.toUTF8(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0)
+    {
+        std::cerr << "Could not create shared memory " << name << std::endl;
+        return false;
+    }
+    size_t size = sizeof(ArfRingHeader) + capacity;
+    if (ftruncate(fd, size) != 0 || !map(fd, size, true))
+    {
+        std::cerr << "Could not map " << (int)(size >> 20) << " MB of shared memory" << std::endl;
+        shm_unlink(name.toUTF8());
+        return false;
+    }
+    this->name = name;
+    created = true;
+
+    new (header) ArfRingHeader();
+    header->capacity = capacity;
+    header->producerPid = getpid();
+    header->head = 0;
+    header->tail = 0;
+    header->dropped = 0;
+    header->writerPid = 0;
+    header->writerState = WriterStopped;
+    header->heartbeat = 0;
+    header->samplesWritten = 0;
+    header->errors = 0;
+    header->lastError[0] = 0;
+    header->sessionSize = 0;
+    header->sessionPositions = 0;
+    header->sessionCursor = 0;
+    header->version = ARF_RING_VERSION;
+    std::atomic_thread_fence(std::memory_order_release);
+    header->magic = ARF_RING_MAGIC;
+    pendingHead = 0;
+    return true;
+}
+
+bool ArfShmRing::attach(String name)
+{
+    close();
+    int fd = shm_open(name.toUTF8(), O_RDWR, 0600);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(ArfRingHeader))
+    {
+        ::close(fd);
+        return false;
+    }
+    if (!map(fd, st.st_size, false))
+        return false;
+    if (header->magic != ARF_RING_MAGIC || header->version != ARF_RING_VERSION
+        || sizeof(ArfRingHeader) + header->capacity > mappedSize)
+    {
+        std::cerr << name << " is not an ARF writer ring of this version" << std::endl;
+        close();
+        return false;
+    }
+    this->name = name;
+    created = false;
+    return true;
+}
+
+void ArfShmRing::close()
+{
+    if (header != nullptr)
+        munmap(header, mappedSize);
+    if (created)
+        unlink();
+    header = nullptr;
+    data = nullptr;
+    mappedSize = 0;
+    created = false;
+}
+
+void ArfShmRing::unlink()
+{
+    if (name.isNotEmpty())
+        shm_unlink(name.toUTF8());
+}
+
+bool ArfShmRing::isOpen() const
+{
+    return header != nullptr;
+}
+
+String ArfShmRing::getName() const
+{
+    return name;
+}
+
+ArfRingHeader* ArfShmRing::getHeader() const
+{
+    return header;
+}
+
+char* ArfShmRing::beginRecord(ArfRecord::RecordType type, uint32 size)
+{
+    const uint64 capacity = header->capacity;
+    uint64 head = header->head.load(std::memory_order_relaxed);
+    uint64 tail = header->tail.load(std::memory_order_acquire);
+    uint64 space = ArfRecord::space(size);
+    uint64 offset = head % capacity;
+    uint64 contiguous = capacity - offset;
+
+    //A record never wraps around, the rest of the ring is skipped with a pad record instead
+    uint64 needed = space + ((contiguous < space) ? contiguous : 0);
+    if (space > capacity || needed > capacity - (head - tail))
+    {
+        header->dropped.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    if (contiguous < space)
+    {
+        ArfRecord::RecordHeader* pad = (ArfRecord::RecordHeader*)(data + offset);
+        pad->type = ArfRecord::RecordPad;
+        pad->size = (uint32)(contiguous - sizeof(ArfRecord::RecordHeader));
+        head += contiguous;
+        offset = 0;
+    }
+    ArfRecord::RecordHeader* rec = (ArfRecord::RecordHeader*)(data + offset);
+    rec->type = type;
+    rec->size = size;
+    pendingHead = head + space;
+    return data + offset + sizeof(ArfRecord::RecordHeader);
+}
+
+void ArfShmRing::commitRecord()
+{
+    header->head.store(pendingHead, std::memory_order_release);
+}
+
+bool ArfShmRing::push(ArfRecord::RecordType type, const void* src, uint32 size)
+{
+    char* dst = beginRecord(type, size);
+    if (dst == nullptr)
+        return false;
+    if (size > 0)
+        memcpy(dst, src, size);
+    commitRecord();
+    return true;
+}
+
+bool ArfShmRing::hasRoom(uint64 total, uint64 largest) const
+{
+    uint64 used = header->head.load(std::memory_order_relaxed) - header->tail.load(std::memory_order_acquire);
+    //the end of the ring is skipped at most once, and never more than one record needs
+    return total + largest <= header->capacity - used;
+}
+
+bool ArfShmRing::read(uint64& cursor, ArfRecord::RecordType& type, const char*& recData, uint32& size) const
+{
+    const uint64 capacity = header->capacity;
+    uint64 head = header->head.load(std::memory_order_acquire);
+    while (cursor != head)
+    {
+        const ArfRecord::RecordHeader* rec = (const ArfRecord::RecordHeader*)(data + cursor % capacity);
+        if (rec->type == ArfRecord::RecordPad)
+        {
+            cursor += sizeof(ArfRecord::RecordHeader) + rec->size;
+            continue;
+        }
+        type = (ArfRecord::RecordType)rec->type;
+        size = rec->size;
+        recData = (const char*)rec + sizeof(ArfRecord::RecordHeader);
+        cursor += ArfRecord::space(size);
+        return true;
+    }
+    return false;
+}
+
+void ArfShmRing::release(uint64 cursor)
+{
+    header->tail.store(cursor, std::memory_order_release);
+}
+
+bool ArfShmRing::hasData(uint64 cursor) const
+{
+    return header->head.load(std::memory_order_acquire) != cursor;
+}
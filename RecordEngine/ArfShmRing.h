@@ -0,0 +1,115 @@
+/*
+ ------------------------------------------------------------------
+
+ Michal Badura, 2016
+ based on code by Florian Franzen, 2014
+
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef ARFSHMRING_H_INCLUDED
+#define ARFSHMRING_H_INCLUDED
+
+#include "ArfRecordStream.h"
+#include <atomic>
+
+#define ARF_RING_MAGIC 0x52465241 //"ARFR"
+#define ARF_RING_VERSION 2
+#define ARF_RING_ERROR_SIZE 256
+//room for the description and write positions of the part the writer has open
+#define ARF_RING_SESSION_SIZE (1 << 20)
+
+//Layout of the start of the shared memory. The recording engine appends records at head,
+//the writer process applies them and moves tail once they are safely on disk.
+struct ArfRingHeader
+{
+    uint32 magic;
+    uint32 version;
+    uint64 capacity;
+    int32 producerPid;
+
+    std::atomic<uint64> head;
+    std::atomic<uint64> tail;
+    //records the producer had to throw away because the ring was full
+    std::atomic<uint64> dropped;
+
+    //Progress, reported by the writer
+    std::atomic<int32> writerPid;
+    std::atomic<int32> writerState;
+    std::atomic<int64> heartbeat;
+    std::atomic<uint64> samplesWritten;
+    std::atomic<uint32> errors;
+    char lastError[ARF_RING_ERROR_SIZE];
+
+    //The part the writer has open, so that a restarted writer can continue in it.
+    //Only the writer touches these; sessionSize is 0 when no part is open.
+    //The sessionPositions int64 write positions (ArfFile::getWritePositions) follow the description.
+    std::atomic<uint32> sessionSize;
+    uint32 sessionPositions;
+    uint64 sessionCursor;
+    char session[ARF_RING_SESSION_SIZE];
+};
+
+//Single producer, single consumer ring of variable sized records in POSIX shared memory
+class ArfShmRing
+{
+public:
+    enum WriterState { WriterStopped, WriterRunning, WriterFailed };
+
+    ArfShmRing();
+    ~ArfShmRing();
+
+    //Producer side: makes a new segment with CAPACITY bytes for records
+    bool create(String name, size_t capacity);
+    //Writer side: maps the segment the producer made
+    bool attach(String name);
+    //unmaps, and removes the name if this side created it
+    void close();
+    void unlink();
+    bool isOpen() const;
+    String getName() const;
+    ArfRingHeader* getHeader() const;
+
+    //Producer side. Returns where SIZE bytes of the record go, or nullptr if the ring is full.
+    //The record is visible to the writer only after commitRecord.
+    char* beginRecord(ArfRecord::RecordType type, uint32 size);
+    void commitRecord();
+    bool push(ArfRecord::RecordType type, const void* data, uint32 size);
+    //Producer side. True if records taking TOTAL bytes (see ArfRecord::space), none more than
+    //LARGEST, can all be pushed. The writer only frees room, so they still fit when they are.
+    bool hasRoom(uint64 total, uint64 largest) const;
+
+    //Writer side. Reads the record at CURSOR and moves CURSOR past it; false if there is none yet
+    bool read(uint64& cursor, ArfRecord::RecordType& type, const char*& data, uint32& size) const;
+    //Lets the producer reuse everything before CURSOR
+    void release(uint64 cursor);
+    bool hasData(uint64 cursor) const;
+
+private:
+    bool map(int fd, size_t size, bool populate);
+
+    String name;
+    ArfRingHeader* header;
+    char* data;
+    size_t mappedSize;
+    bool created;
+    uint64 pendingHead;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ArfShmRing);
+};
+
+#endif  // ARFSHMRING_H_INCLUDED
@@ -0,0 +1,137 @@
+/*
+ ------------------------------------------------------------------
+
+ Michal Badura, 2016
+ based on code by Florian Franzen, 2014
+
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef ARFTAPFORMAT_H_INCLUDED
+#define ARFTAPFORMAT_H_INCLUDED
+
+//Layout of the live tap shared memory (see ArfLiveTap). Plain C++11 without JUCE, so that
+//consumers (Tools/arf-tap/ArfTapReader.h) only need this file.
+
+#include <stdint.h>
+#include <atomic>
+
+#define ARF_TAP_MAGIC 0x50415441 //"ATAP"
+#define ARF_TAP_VERSION 1
+//channels the channel table has room for
+#define ARF_TAP_MAX_CHANNELS 4096
+//records start on multiples of this
+#define ARF_TAP_ALIGN 16
+
+struct ArfTapChannel
+{
+    float sampleRate;
+    float bitVolts;
+    int32_t processor;
+};
+
+//The start of the shared memory, the records follow. There is one producer, which never waits:
+//it overwrites the oldest records, and consumers notice from oldest and the sequence numbers.
+struct ArfTapHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t capacity;
+    int32_t producerPid;
+
+    //bytes written since the tap was created; a record is complete once head is past it
+    std::atomic<uint64_t> head;
+    //start of the oldest record that has not been overwritten. It moves before the producer
+    //overwrites anything, so a record read from position p is intact if oldest <= p afterwards
+    std::atomic<uint64_t> oldest;
+    //records the producer could not publish at all, i.e. larger than half the ring
+    std::atomic<uint64_t> dropped;
+
+    //The channels of the part being recorded. infoVersion is odd while they are being changed
+    std::atomic<uint32_t> infoVersion;
+    int32_t recordingNumber;
+    int32_t partNumber;
+    int32_t nChannels;
+    float mainSampleRate;
+    ArfTapChannel channels[ARF_TAP_MAX_CHANNELS];
+};
+
+enum ArfTapRecordType
+{
+    //fills the end of the ring when a record doesn't fit there
+    TapPad,
+    //a part was opened or closed; the data is an ArfTapPart
+    TapOpen,
+    TapClose,
+    //a converted block of one channel: ArfTapData, then nSamples int16 samples
+    TapData,
+    //ArfTapEvent, then dataSize bytes (the TTL byte, the message text or the binary payload)
+    TapEvent,
+    //ArfTapSpike, then nValues uint16 values
+    TapSpike
+};
+
+struct ArfTapRecordHeader
+{
+    uint32_t type;
+    //bytes of data after the header
+    uint32_t size;
+    //numbers every record but the pads, without gaps
+    uint64_t sequence;
+};
+
+struct ArfTapPart
+{
+    int32_t recordingNumber;
+    int32_t partNumber;
+};
+
+struct ArfTapData
+{
+    //recorded channel, as in the channel table
+    int32_t channel;
+    int32_t nSamples;
+    //of the first sample
+    int64_t timestamp;
+};
+
+struct ArfTapEvent
+{
+    //0 for TTL, 1 for messages, then the binary event types, as in the ARF files
+    int32_t type;
+    uint8_t eventID;
+    uint8_t nodeID;
+    uint16_t dataSize;
+    int64_t timestamp;
+};
+
+struct ArfTapSpike
+{
+    int32_t electrode;
+    int32_t nSamples;
+    int32_t nValues;
+    float time;
+    int64_t timestamp;
+};
+
+//bytes taken by a record with SIZE bytes of data, header included
+inline uint64_t arfTapSpace(uint32_t size)
+{
+    return (sizeof(ArfTapRecordHeader) + (uint64_t)size + ARF_TAP_ALIGN - 1) & ~(uint64_t)(ARF_TAP_ALIGN - 1);
+}
+
+#endif  // ARFTAPFORMAT_H_INCLUDED
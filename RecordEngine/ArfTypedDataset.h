@@ -0,0 +1,120 @@
+/*
+ ------------------------------------------------------------------
+
+ Michal Badura, 2016
+ based on code by Florian Franzen, 2014
+
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+#ifndef ARFTYPEDDATASET_H_INCLUDED
+#define ARFTYPEDDATASET_H_INCLUDED
+
+#include "ArfFileFormat.h"
+
+//Typed access to an ArfRecordingData. The element type and rank are template parameters, so the
+//HDF5 memory type is picked when the writer is compiled, and every write goes straight to
+//ArfRecordingData::appendBlock or appendToRow, which keep their dataspaces from one write to the next.
+
+//The HDF5 native type of T, one specialization per element type the files use
+template <typename T> struct ArfNativeType;
+
+#define ARF_NATIVE_TYPE(T, TYPE) \
+    template <> struct ArfNativeType<T> \
+    { \
+        static const ArfFileBase::DataTypes type = ArfFileBase::TYPE; \
+        static const H5::DataType& get(); \
+    }
+
+ARF_NATIVE_TYPE(int8, I8);
+ARF_NATIVE_TYPE(uint8, U8);
+ARF_NATIVE_TYPE(int16, I16);
+ARF_NATIVE_TYPE(uint16, U16);
+ARF_NATIVE_TYPE(int32, I32);
+ARF_NATIVE_TYPE(uint32, U32);
+ARF_NATIVE_TYPE(int64, I64);
+ARF_NATIVE_TYPE(uint64, U64);
+ARF_NATIVE_TYPE(float, F32);
+
+#undef ARF_NATIVE_TYPE
+
+//SIZE consecutive elements, e.g. a block of samples or the rows of an Array
+template <typename T>
+struct ArfSpan
+{
+    ArfSpan(T* data, int size) : data(data), size(size) {}
+    //a span of T is also one of const T
+    template <typename U>
+    ArfSpan(const ArfSpan<U>& other) : data(other.data), size(other.size) {}
+
+    T* data;
+    int size;
+};
+
+template <typename T>
+ArfSpan<T> arfSpan(T* data, int size)
+{
+    return ArfSpan<T>(data, size);
+}
+
+template <typename T>
+ArfSpan<T> arfSpan(Array<T>& array)
+{
+    return ArfSpan<T>(array.getRawDataPointer(), array.size());
+}
+
+//A view of a dataset of RANK (1 or 2) dimensions with elements of type T. It doesn't own the
+//dataset and costs nothing to create, so it can be made for every write.
+template <typename T, int Rank>
+class TypedDataset
+{
+public:
+    explicit TypedDataset(ArfRecordingData* data) : data(data)
+    {
+        static_assert(Rank == 1 || Rank == 2, "TypedDataset only handles 1-D and 2-D datasets");
+        jassert(data != nullptr && data->getRank() == Rank);
+    }
+
+    //Appends VALUES at the write position. For 2-D datasets they are whole rows of NCOLUMNS
+    //values, and NCOLUMNS must be given
+    int append(ArfSpan<const T> values, int nColumns = 1)
+    {
+        jassert(Rank == 2 || nColumns == 1);
+        return data->appendBlock(values.size / nColumns, nColumns, ArfNativeType<T>::get(), values.data);
+    }
+
+    //Appends VALUES along row ROW of a 2-D dataset, which has its own write position (see
+    //ArfRecordingData::appendToRow)
+    int appendToRow(int row, ArfSpan<const T> values)
+    {
+        static_assert(Rank == 2, "only 2-D datasets have rows");
+        return data->appendToRow(row, values.size, ArfNativeType<T>::get(), values.data);
+    }
+
+    //Reads VALUES.size elements of a 1-D dataset, from XSTART on
+    int read(int64 xStart, ArfSpan<T> values)
+    {
+        static_assert(Rank == 1, "only 1-D datasets are read");
+        return data->readCompoundData(xStart, values.size, ArfNativeType<T>::get(), values.data);
+    }
+
+    ArfRecordingData* getDataSet() const { return data; }
+
+private:
+    ArfRecordingData* data;
+};
+
+#endif  // ARFTYPEDDATASET_H_INCLUDED
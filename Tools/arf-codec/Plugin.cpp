@@ -0,0 +1,37 @@
+/*
+ ------------------------------------------------------------------
+
+ Michal Badura, 2016
+ based on code by Florian Franzen, 2014
+
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+//The codec of the "Lossless sample codec" option as an HDF5 filter plugin, so that any program
+//using HDF5 (h5py, MATLAB, HDFView, ...) can read the coded datasets once it finds the plugin.
+
+#include "../../RecordEngine/ArfCodec.h"
+#include <H5PLextern.h>
+
+H5PL_type_t H5PLget_plugin_type(void)
+{
+    return H5PL_TYPE_FILTER;
+}
+
+const void* H5PLget_plugin_info(void)
+{
+    return ArfCodec::getFilterClass();
+}
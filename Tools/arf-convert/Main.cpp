@@ -0,0 +1,198 @@
+/*
+ ------------------------------------------------------------------
+
+ Michal Badura, 2016
+ based on code by Florian Franzen, 2014
+
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+//arf-convert: makes the ARF files of a session recorded with "Raw capture (convert later)".
+//Every <base>_rec<N>.evt log and the .dat file next to it become recording N of <base>.arf,
+//written by the same ArfFile code the engine uses. See RecordEngine/ArfRawCapture.h
+
+#include "../common/ArfRecordPlayer.h"
+
+//Reads the records of a raw capture file one by one
+class RawFileReader
+{
+public:
+    RawFileReader() : truncated(false) {}
+
+    bool open(const File& file)
+    {
+        in = file.createInputStream();
+        return in != nullptr && !in->failedToOpen();
+    }
+
+    //Skips pad records. False at the end of the file, or at a record cut short by a crash.
+    bool next(ArfRecord::RecordType& type, const char*& data, uint32& size)
+    {
+        ArfRecord::RecordHeader rec;
+        while (true)
+        {
+            int n = in->read(&rec, sizeof(rec));
+            if (n != sizeof(rec))
+            {
+                truncated = (n > 0);
+                return false;
+            }
+            uint64 space = ArfRecord::space(rec.size) - sizeof(rec);
+            if (rec.type == ArfRecord::RecordPad)
+            {
+                in->setPosition(in->getPosition() + space);
+                continue;
+            }
+            if (space > buffer.getSize())
+                buffer.setSize((size_t)space);
+            if (in->read(buffer.getData(), (int)space) != (int)space)
+            {
+                truncated = true;
+                return false;
+            }
+            type = (ArfRecord::RecordType)rec.type;
+            data = (const char*)buffer.getData();
+            size = rec.size;
+            return true;
+        }
+    }
+
+    bool isTruncated() const
+    {
+        return truncated;
+    }
+
+private:
+    ScopedPointer<FileInputStream> in;
+    MemoryBlock buffer;
+    bool truncated;
+};
+
+//Converts one capture into OUTDIR, or next to it if OUTDIR is not set
+static bool convert(const File& logFile, const File& outDir)
+{
+    File dataFile = logFile.withFileExtension("dat");
+    RawFileReader log, samples;
+    ArfRecord::RecordType type;
+    const char* data;
+    uint32 size;
+
+    if (!log.open(logFile) || !log.next(type, data, size) || type != ArfRecord::RecordOpen)
+    {
+        std::cerr << logFile.getFullPathName() << " is not a raw capture log" << std::endl;
+        return false;
+    }
+    MemoryBlock description(data, size);
+    if (!samples.open(dataFile) || !samples.next(type, data, size) || type != ArfRecord::RecordOpen
+        || MemoryBlock(data, size) != description)
+    {
+        std::cerr << dataFile.getFullPathName() << " is missing or belongs to another capture" << std::endl;
+        return false;
+    }
+
+    ArfPartDescription part;
+    MemoryInputStream in(description, false);
+    if (!part.readFrom(in))
+    {
+        std::cerr << "Invalid part description in " << logFile.getFullPathName() << std::endl;
+        return false;
+    }
+    //the capture may have been moved since it was recorded
+    File dir = (outDir == File()) ? logFile.getParentDirectory() : outDir;
+    String basePath = dir.getChildFile(File(part.basePath).getFileName()).getFullPathName();
+
+    ArfRecordPlayer player;
+    if (!player.openPart((const char*)description.getData(), (uint32)description.getSize(), nullptr, basePath))
+    {
+        std::cerr << player.getLastError() << std::endl;
+        return false;
+    }
+
+    int errors = 0;
+    while (samples.next(type, data, size))
+    {
+        if (!player.apply(type, data, size) && errors++ == 0)
+            std::cerr << player.getLastError() << std::endl;
+    }
+    bool closed = false;
+    while (!closed && log.next(type, data, size))
+    {
+        if (type == ArfRecord::RecordClose)
+            closed = true;
+        else if (!player.apply(type, data, size) && errors++ == 0)
+            std::cerr << player.getLastError() << std::endl;
+    }
+    player.closePart();
+
+    std::cout << logFile.getFileName() << " -> " << File(basePath + ".arf").getFileName() << " rec_" << part.recordingNumber
+        << ": " << (int64)player.getSamplesWritten() << " samples" << std::endl;
+    if (samples.isTruncated() || log.isTruncated() || !closed)
+        std::cerr << "  the capture was not closed properly, everything up to where it ends was converted" << std::endl;
+    if (errors > 0)
+        std::cerr << "  " << errors << " records did not fit the recording and were skipped" << std::endl;
+    return errors == 0;
+}
+
+struct FileSorter
+{
+    static int compareElements(const File& a, const File& b)
+    {
+        return a.getFileName().compareNatural(b.getFileName());
+    }
+};
+
+int main(int argc, char* argv[])
+{
+    File outDir;
+    Array<File> logs;
+    for (int i = 1; i < argc; i++)
+    {
+        String arg(argv[i]);
+        if (arg == "-o" && i + 1 < argc)
+        {
+            outDir = File::getCurrentWorkingDirectory().getChildFile(argv[++i]);
+            outDir.createDirectory();
+        }
+        else
+        {
+            File f = File::getCurrentWorkingDirectory().getChildFile(arg);
+            //a whole session folder, in recording order
+            if (f.isDirectory())
+            {
+                Array<File> found;
+                f.findChildFiles(found, File::findFiles, false, "*.evt");
+                FileSorter sorter;
+                found.sort(sorter);
+                logs.addArray(found);
+            }
+            else
+                logs.add(f);
+        }
+    }
+    if (logs.size() == 0)
+    {
+        std::cerr << "usage: arf-convert [-o <output directory>] <capture>.evt|<session directory> ..." << std::endl;
+        return 2;
+    }
+
+    int failed = 0;
+    for (int i = 0; i < logs.size(); i++)
+    {
+        if (!convert(logs[i], outDir))
+            failed++;
+    }
+    return (failed > 0) ? 1 : 0;
+}
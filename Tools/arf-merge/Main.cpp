@@ -0,0 +1,873 @@
+/*
+ ------------------------------------------------------------------
+
+ Michal Badura, 2016
+ based on code by Florian Franzen, 2014
+
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+//arf-merge: joins the parts of a session (experimentN_prtK.arf) into one experimentN.arf, with the
+//channel datasets rechunked and compressed for reading instead of writing.
+//Compression runs on all cores; HDF5 itself is only ever called from the main thread.
+
+#include "../../RecordEngine/ArfFileFormat.h"
+#include "../../RecordEngine/ArfOverview.h"
+#include "../../RecordEngine/ArfChecksum.h"
+#include "../../RecordEngine/ArfCodec.h"
+#include <H5Cpp.h>
+#include <zlib.h>
+#include <limits>
+
+//samples per chunk of the merged channel datasets, about 2 s at 30 kHz
+#define DEFAULT_CHUNK_SAMPLES 65536
+#define DEFAULT_COMPRESSION 4
+//memory for chunks waiting to be compressed or written, in MB
+#define DEFAULT_MEMORY 256
+//rows copied at a time from the event and spike datasets
+#define COPY_ROWS 4096
+
+//An ARF file opened by name, for reading the parts and writing the merged file
+class MergeFile : public ArfFileBase
+{
+public:
+    MergeFile(String fileName) : fileName(fileName)
+    {
+        readyToOpen = true;
+    }
+
+    String getFileName() override
+    {
+        return fileName;
+    }
+
+    int addGroup(String path)
+    {
+        return createGroup(path);
+    }
+
+    ArfRecordingData* createChannel(String path, int chunkSamples)
+    {
+        return createDataSet(I16, 0, chunkSamples, path);
+    }
+
+    ArfRecordingData* createOverview(String path, int columns)
+    {
+        return createDataSet(I16, 0, columns, COPY_ROWS, path);
+    }
+
+    ArfRecordingData* createChecksums(String path, int chunkSamples)
+    {
+        ArfRecordingData* dSet = createDataSet(U32, 0, ARF_CHECKSUM_CHUNK_SIZE, path);
+        if (dSet != nullptr && setAttribute(I32, &chunkSamples, path, "chunk_size"))
+        {
+            delete dSet;
+            return nullptr;
+        }
+        return dSet;
+    }
+
+    ArfRecordingData* createIndex(String path, int columns)
+    {
+        if (columns > 1)
+            return createDataSet(I32, 0, columns, COPY_ROWS, path);
+        return createDataSet(I32, 0, COPY_ROWS, path);
+    }
+
+    ArfRecordingData* createTable(H5::DataType type, String path, int64 nRows)
+    {
+        //the dimensions are int, a larger table can only be unlimited
+        int maxDims[1] = { (nRows > std::numeric_limits<int>::max()) ? 0 : (int)nRows };
+        int chunkDims[1] = { (int)jlimit((int64)1, (int64)COPY_ROWS, nRows) };
+        return createCompoundDataSet(type, path, 1, maxDims, chunkDims);
+    }
+
+protected:
+    //the root attributes are copied from the first part
+    int createFileStructure() override
+    {
+        return 0;
+    }
+
+private:
+    String fileName;
+};
+
+//One chunk of a merged channel dataset, on its way from the parts to the file
+struct ChunkJob
+{
+    int dataset;
+    int chunkIndex;
+    int nSamples;
+    HeapBlock<int16> samples;
+    //the chunk as it is stored: shuffled and deflated, coded, or just the samples
+    MemoryBlock stored;
+};
+
+class ChunkQueue
+{
+public:
+    void addPending(ChunkJob* job)
+    {
+        const ScopedLock sl(lock);
+        pending.add(job);
+        pendingEvent.signal();
+    }
+
+    ChunkJob* takePending(Thread* thread)
+    {
+        while (!thread->threadShouldExit())
+        {
+            {
+                const ScopedLock sl(lock);
+                if (pending.size() > 0)
+                    return pending.removeAndReturn(0);
+            }
+            pendingEvent.wait(100);
+        }
+        return nullptr;
+    }
+
+    void addDone(ChunkJob* job)
+    {
+        const ScopedLock sl(lock);
+        done.add(job);
+        doneEvent.signal();
+    }
+
+    ChunkJob* takeDone(bool wait)
+    {
+        while (true)
+        {
+            {
+                const ScopedLock sl(lock);
+                if (done.size() > 0)
+                    return done.removeAndReturn(0);
+            }
+            if (!wait)
+                return nullptr;
+            doneEvent.wait(100);
+        }
+    }
+
+private:
+    CriticalSection lock;
+    Array<ChunkJob*> pending;
+    Array<ChunkJob*> done;
+    WaitableEvent pendingEvent;
+    WaitableEvent doneEvent;
+};
+
+//Does what the filters of the merged datasets (shuffle and deflate, or ArfCodec) would do, but in parallel
+class ChunkCompressor : public Thread
+{
+public:
+    ChunkCompressor(ChunkQueue& queue, int level, bool codec) : Thread("arf-merge compressor"), queue(queue), level(level), codec(codec)
+    {
+    }
+
+    void run() override
+    {
+        ChunkJob* job;
+        while ((job = queue.takePending(this)) != nullptr)
+        {
+            compress(job);
+            queue.addDone(job);
+        }
+    }
+
+private:
+    void compress(ChunkJob* job)
+    {
+        size_t nBytes = job->nSamples * sizeof(int16);
+        if (codec)
+        {
+            job->stored.setSize(ArfCodec::getMaxEncodedSize(job->nSamples));
+            size_t size = ArfCodec::encode(job->samples.getData(), job->nSamples, (uint8*)job->stored.getData());
+            job->stored.setSize(size);
+            return;
+        }
+        if (level == 0)
+        {
+            job->stored.replaceWith(job->samples.getData(), nBytes);
+            return;
+        }
+        //all the low bytes first, then all the high bytes, as H5Z_FILTER_SHUFFLE does
+        shuffled.malloc(nBytes);
+        const uint8* src = (const uint8*)job->samples.getData();
+        for (int i = 0; i < job->nSamples; i++)
+        {
+            shuffled[i] = src[2 * i];
+            shuffled[job->nSamples + i] = src[2 * i + 1];
+        }
+        uLongf size = compressBound(nBytes);
+        job->stored.setSize(size);
+        if (compress2((Bytef*)job->stored.getData(), &size, (const Bytef*)shuffled.getData(), nBytes, level) != Z_OK)
+        {
+            std::cerr << "Could not compress chunk " << job->chunkIndex << std::endl;
+            size = 0;
+        }
+        job->stored.setSize(size);
+    }
+
+    ChunkQueue& queue;
+    int level;
+    bool codec;
+    HeapBlock<uint8> shuffled;
+};
+
+class PartMerger
+{
+public:
+    PartMerger(int chunkSamples, int level, bool codec, int nThreads, int memoryMB)
+        : chunkSamples(chunkSamples), level(level), codec(codec), inFlight(0), failed(false), overviewColumns(0), chunkStats(false), checksums(false)
+    {
+        maxInFlight = jmax(2 * nThreads, (int)(((int64)memoryMB << 20) / (chunkSamples * sizeof(int16) * 2)));
+        for (int i = 0; i < nThreads; i++)
+        {
+            compressors.add(new ChunkCompressor(queue, level, codec));
+            compressors.getLast()->startThread();
+        }
+    }
+
+    ~PartMerger()
+    {
+        for (int i = 0; i < compressors.size(); i++)
+            compressors[i]->stopThread(-1);
+    }
+
+    bool merge(const Array<File>& partFiles, const File& output);
+
+private:
+    bool mergeRecording(String rec);
+    bool mergeChannel(String path);
+    bool mergeTable(String path);
+    //writes the overview levels of the merged channel at PATH and keeps its chunk statistics
+    bool writeOverview(String path, ArfOverview& overview, MergeFile* source);
+    bool writeChunkStats(String rec);
+    //writes the checksums of the chunks of the merged channel at PATH
+    bool writeChecksums(String path, ArfChecksum& checksum);
+    //writes the _order and _index datasets of the packed spike table at PATH
+    bool writeSpikeIndex(String path, const Array<int>& electrodes, MergeFile* source);
+    //every part that has a dataset at PATH, with the dataset
+    void findDataSets(String path, Array<MergeFile*>& files, OwnedArray<ArfRecordingData>& sets);
+    void submit(ChunkJob* job);
+    //writes the chunks that are ready; with WAIT at least one
+    void writeDone(bool wait);
+    bool verify(const File& output);
+
+    int chunkSamples;
+    int level;
+    bool codec;
+    int maxInFlight;
+    int inFlight;
+    bool failed;
+    //columns of the overview of the recording being merged, 0 if the parts have none
+    int overviewColumns;
+    //whether the parts have chunk statistics, and the rows of the merged channels
+    bool chunkStats;
+    Array<ArfChunkStats> chunkStatsRows;
+    //whether the parts have chunk checksums, which are taken again for the merged chunks
+    bool checksums;
+    //packed spike tables of the recording, whose electrode index is built again
+    StringArray packedTables;
+    ChunkQueue queue;
+    OwnedArray<ChunkCompressor> compressors;
+
+    OwnedArray<MergeFile> parts;
+    ScopedPointer<MergeFile> out;
+    //channel datasets of the recording being merged, until all their chunks are written
+    OwnedArray<ArfRecordingData> outSets;
+    StringArray expectedPaths;
+    Array<int64> expectedSizes;
+};
+
+bool PartMerger::merge(const Array<File>& partFiles, const File& output)
+{
+    if (output.exists())
+    {
+        std::cerr << output.getFullPathName() << " already exists" << std::endl;
+        return false;
+    }
+    for (int i = 0; i < partFiles.size(); i++)
+    {
+        MergeFile* part = parts.add(new MergeFile(partFiles[i].getFullPathName()));
+        if (part->openReadOnly())
+        {
+            std::cerr << "Could not open " << partFiles[i].getFullPathName() << std::endl;
+            return false;
+        }
+    }
+
+    out = new MergeFile(output.getFullPathName());
+    if (out->open())
+    {
+        std::cerr << "Could not create " << output.getFullPathName() << std::endl;
+        return false;
+    }
+    out->setCompression(level);
+    out->setCodec(codec);
+    out->copyAttributes(*parts[0], "/", "/");
+
+    //every recording, in the order the parts have them
+    StringArray recordings;
+    for (int i = 0; i < parts.size(); i++)
+    {
+        StringArray names = parts[i]->getChildNames("/");
+        for (int j = 0; j < names.size(); j++)
+        {
+            if (names[j].startsWith("rec_") && !recordings.contains(names[j]))
+                recordings.add(names[j]);
+        }
+    }
+    for (int i = 0; i < recordings.size() && !failed; i++)
+    {
+        if (!mergeRecording("/" + recordings[i]))
+            failed = true;
+    }
+    out->close();
+    parts.clear();
+
+    return !failed && verify(output);
+}
+
+void PartMerger::findDataSets(String path, Array<MergeFile*>& files, OwnedArray<ArfRecordingData>& sets)
+{
+    String group = path.upToLastOccurrenceOf("/", false, false);
+    for (int i = 0; i < parts.size(); i++)
+    {
+        if (!parts[i]->getChildNames(group).contains(path.fromLastOccurrenceOf("/", false, false)))
+            continue;
+        ArfRecordingData* set = parts[i]->getDataSet(path);
+        if (set == nullptr)
+            continue;
+        files.add(parts[i]);
+        sets.add(set);
+    }
+}
+
+bool PartMerger::mergeRecording(String rec)
+{
+    StringArray children;
+    MergeFile* first = nullptr;
+    for (int i = 0; i < parts.size(); i++)
+    {
+        StringArray names = parts[i]->getChildNames(rec);
+        if (names.size() == 0)
+            continue;
+        if (first == nullptr)
+            first = parts[i];
+        for (int j = 0; j < names.size(); j++)
+        {
+            if (!children.contains(names[j]))
+                children.add(names[j]);
+        }
+    }
+    if (out->addGroup(rec) || out->copyAttributes(*first, rec, rec))
+        return false;
+    //the named types come first, the tables are created with them
+    for (int i = 0; i < parts.size(); i++)
+    {
+        if (out->copyNamedTypes(*parts[i], rec))
+            return false;
+    }
+    children.removeString(ARF_TYPES_GROUP);
+
+    //The overview is not copied, its blocks would restart at every part. It is built again
+    //over the merged channels instead.
+    overviewColumns = 0;
+    String overviewGroup = rec + "/" + ARF_OVERVIEW_GROUP;
+    for (int i = 0; i < parts.size() && overviewColumns == 0 && children.contains(ARF_OVERVIEW_GROUP); i++)
+    {
+        if (!parts[i]->getChildNames(rec).contains(ARF_OVERVIEW_GROUP))
+            continue;
+        StringArray names = parts[i]->getChildNames(overviewGroup);
+        if (names.size() == 0)
+            continue;
+        ScopedPointer<ArfRecordingData> level = parts[i]->getDataSet(overviewGroup + "/" + names[0]);
+        if (level == nullptr)
+            continue;
+        overviewColumns = level->getWidth();
+        if (out->addGroup(overviewGroup) || out->copyAttributes(*parts[i], overviewGroup, overviewGroup))
+            return false;
+    }
+    children.removeString(ARF_OVERVIEW_GROUP);
+    //so are the chunk statistics, for the chunks of the merged file
+    chunkStats = children.contains(ARF_CHUNK_STATS);
+    children.removeString(ARF_CHUNK_STATS);
+    chunkStatsRows.clearQuick();
+    //and the checksums
+    checksums = children.contains(ARF_CHECKSUM_GROUP);
+    children.removeString(ARF_CHECKSUM_GROUP);
+    String checksumGroup = rec + "/" + ARF_CHECKSUM_GROUP;
+    for (int i = 0; i < parts.size() && checksums; i++)
+    {
+        if (!parts[i]->getChildNames(rec).contains(ARF_CHECKSUM_GROUP))
+            continue;
+        if (out->addGroup(checksumGroup) || out->copyAttributes(*parts[i], checksumGroup, checksumGroup))
+            return false;
+        break;
+    }
+    //and the electrode index of the packed spike tables, for the rows of the merged table
+    packedTables.clear();
+    for (int i = 0; i < children.size(); i++)
+    {
+        if (children.contains(children[i] + "_order") && children.contains(children[i] + "_index"))
+            packedTables.add(rec + "/" + children[i]);
+    }
+    for (int i = 0; i < packedTables.size(); i++)
+    {
+        String name = packedTables[i].fromLastOccurrenceOf("/", false, false);
+        children.removeString(name + "_order");
+        children.removeString(name + "_index");
+    }
+
+    int nChannels = 0;
+    for (int i = 0; i < children.size() && !failed; i++)
+    {
+        Array<MergeFile*> files;
+        OwnedArray<ArfRecordingData> sets;
+        String path = rec + "/" + children[i];
+        findDataSets(path, files, sets);
+        if (sets.size() == 0)
+            continue;
+
+        //the int16 channel datasets are rechunked, everything else is copied row by row
+        H5::DataType type = sets[0]->getType();
+        if (type.getClass() == H5T_INTEGER && type.getSize() == sizeof(int16))
+        {
+            if (!mergeChannel(path))
+                return false;
+            nChannels++;
+        }
+        else if (!mergeTable(path))
+            return false;
+    }
+
+    while (inFlight > 0)
+        writeDone(true);
+    outSets.clear();
+    if (chunkStats && !writeChunkStats(rec))
+        return false;
+    std::cout << rec.substring(1) << ": " << nChannels << " channels from " << parts.size() << " parts" << std::endl;
+    return !failed;
+}
+
+bool PartMerger::mergeChannel(String path)
+{
+    Array<MergeFile*> files;
+    OwnedArray<ArfRecordingData> sets;
+    findDataSets(path, files, sets);
+
+    int64 total = 0;
+    for (int i = 0; i < sets.size(); i++)
+        total += sets[i]->getSize();
+
+    ArfRecordingData* dest = out->createChannel(path, chunkSamples);
+    if (dest == nullptr || dest->setPosition(total) || out->copyAttributes(*files[0], path, path))
+    {
+        std::cerr << "Could not create " << path << std::endl;
+        return false;
+    }
+    int dataset = outSets.size();
+    outSets.add(dest);
+    expectedPaths.add(path);
+    expectedSizes.add(total);
+
+    ScopedPointer<ArfOverview> overview;
+    if (overviewColumns > 0 || chunkStats)
+    {
+        int channel = path.fromLastOccurrenceOf("/channel", false, false).getIntValue();
+        overview = new ArfOverview(overviewColumns, chunkStats ? chunkSamples : 0, channel);
+    }
+    ScopedPointer<ArfChecksum> checksum;
+    if (checksums)
+        checksum = new ArfChecksum(chunkSamples);
+
+    //Chunks are cut from the samples of all parts in a row, so they can span two parts
+    ScopedPointer<ChunkJob> job;
+    int chunkIndex = 0;
+    int filled = 0;
+    for (int i = 0; i < sets.size(); i++)
+    {
+        int64 pos = 0;
+        int64 size = sets[i]->getSize();
+        while (pos < size)
+        {
+            if (job == nullptr)
+            {
+                job = new ChunkJob();
+                job->dataset = dataset;
+                job->chunkIndex = chunkIndex++;
+                job->nSamples = chunkSamples;
+                //the end of the last chunk stays zero
+                job->samples.calloc(chunkSamples);
+                filled = 0;
+            }
+            int n = (int)jmin(size - pos, (int64)(chunkSamples - filled));
+            if (sets[i]->readDataBlock(pos, n, ArfFileBase::I16, job->samples + filled))
+            {
+                std::cerr << "Could not read " << path << " from " << files[i]->getFileName() << std::endl;
+                return false;
+            }
+            if (overview != nullptr)
+                overview->addSamples(job->samples + filled, n);
+            if (checksum != nullptr)
+                checksum->addSamples(job->samples + filled, n);
+            pos += n;
+            filled += n;
+            if (filled == chunkSamples)
+                submit(job.release());
+        }
+    }
+    if (job != nullptr)
+        submit(job.release());
+    if (checksum != nullptr && !writeChecksums(path, *checksum))
+        return false;
+    return overview == nullptr || writeOverview(path, *overview, files[0]);
+}
+
+bool PartMerger::writeChecksums(String path, ArfChecksum& checksum)
+{
+    checksum.finish();
+    String checksumPath = path.upToLastOccurrenceOf("/", false, false) + "/" + ARF_CHECKSUM_GROUP + "/" + path.fromLastOccurrenceOf("/", false, false);
+    ScopedPointer<ArfRecordingData> dest = out->createChecksums(checksumPath, chunkSamples);
+    if (dest == nullptr)
+    {
+        std::cerr << "Could not create " << checksumPath << std::endl;
+        return false;
+    }
+    int n = checksum.getNumChecksums();
+    if (n > 0 && dest->writeDataBlock(n, ArfFileBase::U32, checksum.getChecksums()))
+        return false;
+    expectedPaths.add(checksumPath);
+    expectedSizes.add(n);
+    return true;
+}
+
+bool PartMerger::writeOverview(String path, ArfOverview& overview, MergeFile* source)
+{
+    overview.finish();
+    chunkStatsRows.addArray(overview.getChunkStats(), overview.getNumChunkStats());
+    overview.clearChunkStats();
+    if (overviewColumns == 0)
+        return true;
+
+    String group = path.upToLastOccurrenceOf("/", false, false) + "/" + ARF_OVERVIEW_GROUP;
+    String name = path.fromLastOccurrenceOf("/", false, false);
+    StringArray sourceLevels = source->getChildNames(group);
+    for (int j = 0; j < ARF_OVERVIEW_LEVELS; j++)
+    {
+        String levelName = name + "_" + String(ArfOverview::getDecimation(j));
+        String levelPath = group + "/" + levelName;
+        ScopedPointer<ArfRecordingData> dest = out->createOverview(levelPath, overview.getNumColumns());
+        if (dest == nullptr
+            || (sourceLevels.contains(levelName) && out->copyAttributes(*source, levelPath, levelPath)))
+        {
+            std::cerr << "Could not create " << levelPath << std::endl;
+            return false;
+        }
+        int nRows = overview.getNumRows(j);
+        if (nRows > 0 && dest->writeDataBlock(nRows, overview.getNumColumns(), ArfFileBase::I16, overview.getRows(j)))
+            return false;
+        expectedPaths.add(levelPath);
+        expectedSizes.add(nRows);
+        overview.clearRows(j);
+    }
+    return true;
+}
+
+bool PartMerger::writeChunkStats(String rec)
+{
+    String path = rec + "/" + ARF_CHUNK_STATS;
+    int nRows = chunkStatsRows.size();
+    ScopedPointer<ArfRecordingData> dest = out->createTable(out->findNamedType(ArfFile::getChunkStatsType(), rec), path, nRows);
+    if (dest == nullptr)
+    {
+        std::cerr << "Could not create " << path << std::endl;
+        return false;
+    }
+    if (nRows > 0)
+        dest->writeCompoundData(nRows, 0, ArfFile::getChunkStatsType(), chunkStatsRows.getRawDataPointer());
+    expectedPaths.add(path);
+    expectedSizes.add(nRows);
+    chunkStatsRows.clearQuick();
+    return true;
+}
+
+bool PartMerger::mergeTable(String path)
+{
+    Array<MergeFile*> files;
+    OwnedArray<ArfRecordingData> sets;
+    findDataSets(path, files, sets);
+
+    int64 total = 0;
+    for (int i = 0; i < sets.size(); i++)
+        total += sets[i]->getSize();
+
+    H5::DataType type = sets[0]->getType();
+    ScopedPointer<ArfRecordingData> dest = out->createTable(out->findNamedType(type, path.upToLastOccurrenceOf("/", false, false)), path, total);
+    if (dest == nullptr || out->copyAttributes(*files[0], path, path))
+    {
+        std::cerr << "Could not create " << path << std::endl;
+        return false;
+    }
+
+    //Event and spike times are on the acquisition clock in every part, so they carry over as
+    //they are. They should only ever grow from one part to the next.
+    int startOffset = -1;
+    //Message rows point into the text table of their part, which is appended after those of the parts before
+    int textOffset = -1;
+    if (type.getClass() == H5T_COMPOUND)
+    {
+        int index = H5Tget_member_index(type.getId(), "start");
+        if (index >= 0)
+            startOffset = (int)H5Tget_member_offset(type.getId(), index);
+        index = H5Tget_member_index(type.getId(), "text_offset");
+        if (index >= 0)
+            textOffset = (int)H5Tget_member_offset(type.getId(), index);
+    }
+    int64 textStart = 0;
+    int electrodeOffset = -1;
+    Array<int> electrodes;
+    if (type.getClass() == H5T_COMPOUND && packedTables.contains(path))
+    {
+        int index = H5Tget_member_index(type.getId(), "electrode");
+        if (index >= 0)
+            electrodeOffset = (int)H5Tget_member_offset(type.getId(), index);
+    }
+    float lastStart = 0;
+    int backwards = 0;
+
+    size_t rowSize = type.getSize();
+    HeapBlock<char> rows;
+    rows.malloc(rowSize * COPY_ROWS);
+    for (int i = 0; i < sets.size(); i++)
+    {
+        int64 size = sets[i]->getSize();
+        if (textOffset >= 0 && i > 0)
+        {
+            ScopedPointer<ArfRecordingData> text = files[i - 1]->getDataSet(path.upToLastOccurrenceOf("/", true, false) + MESSAGE_TEXT);
+            textStart += (text != nullptr) ? text->getSize() : 0;
+        }
+        for (int64 pos = 0; pos < size; pos += COPY_ROWS)
+        {
+            int n = (int)jmin((int64)COPY_ROWS, size - pos);
+            if (sets[i]->readCompoundData(pos, n, type, rows))
+            {
+                std::cerr << "Could not read " << path << " from " << files[i]->getFileName() << std::endl;
+                return false;
+            }
+            if (startOffset >= 0 && pos == 0)
+            {
+                float start;
+                memcpy(&start, rows + startOffset, sizeof(float));
+                if (i > 0 && start < lastStart)
+                    backwards++;
+            }
+            if (startOffset >= 0)
+                memcpy(&lastStart, rows + (n - 1) * rowSize + startOffset, sizeof(float));
+            for (int j = 0; j < n && electrodeOffset >= 0; j++)
+            {
+                int32 electrode;
+                memcpy(&electrode, rows + j * rowSize + electrodeOffset, sizeof(int32));
+                electrodes.add(electrode);
+            }
+            for (int j = 0; j < n && textOffset >= 0 && textStart > 0; j++)
+            {
+                int64 offset;
+                memcpy(&offset, rows + j * rowSize + textOffset, sizeof(int64));
+                if (offset >= 0)
+                    offset += textStart;
+                memcpy(rows + j * rowSize + textOffset, &offset, sizeof(int64));
+            }
+            dest->writeCompoundData(n, 0, type, rows);
+        }
+    }
+    if (backwards > 0)
+        std::cerr << path << ": times go back at " << backwards << " part boundaries" << std::endl;
+
+    expectedPaths.add(path);
+    expectedSizes.add(total);
+    return electrodeOffset < 0 || writeSpikeIndex(path, electrodes, files[0]);
+}
+
+bool PartMerger::writeSpikeIndex(String path, const Array<int>& electrodes, MergeFile* source)
+{
+    Array<int> order, index;
+    ArfFile::buildSpikeIndex(electrodes, order, index);
+    ScopedPointer<ArfRecordingData> orderSet = out->createIndex(path + "_order", 1);
+    ScopedPointer<ArfRecordingData> indexSet = out->createIndex(path + "_index", 3);
+    if (orderSet == nullptr || indexSet == nullptr || out->copyAttributes(*source, path + "_index", path + "_index"))
+    {
+        std::cerr << "Could not create the electrode index of " << path << std::endl;
+        return false;
+    }
+    if ((order.size() > 0 && orderSet->writeDataBlock(order.size(), ArfFileBase::I32, order.getRawDataPointer()))
+        || (index.size() > 0 && indexSet->writeDataBlock(index.size() / 3, 3, ArfFileBase::I32, index.getRawDataPointer())))
+        return false;
+    expectedPaths.add(path + "_order");
+    expectedSizes.add(order.size());
+    expectedPaths.add(path + "_index");
+    expectedSizes.add(index.size() / 3);
+    return true;
+}
+
+void PartMerger::submit(ChunkJob* job)
+{
+    while (inFlight >= maxInFlight)
+        writeDone(true);
+    inFlight++;
+    queue.addPending(job);
+    writeDone(false);
+}
+
+void PartMerger::writeDone(bool wait)
+{
+    ScopedPointer<ChunkJob> job;
+    while ((job = queue.takeDone(wait)) != nullptr)
+    {
+        inFlight--;
+        if (job->stored.getSize() == 0
+            || outSets[job->dataset]->writeRawChunk(job->chunkIndex, job->stored.getData(), job->stored.getSize()))
+            failed = true;
+        wait = false;
+    }
+}
+
+//Reads the merged file back and checks that every dataset has all the rows of the parts
+bool PartMerger::verify(const File& output)
+{
+    MergeFile check(output.getFullPathName());
+    if (check.openReadOnly())
+        return false;
+    int bad = 0;
+    int64 samples = 0;
+    for (int i = 0; i < expectedPaths.size(); i++)
+    {
+        ScopedPointer<ArfRecordingData> set = check.getDataSet(expectedPaths[i]);
+        int64 size = (set != nullptr) ? set->getSize() : -1;
+        if (size != expectedSizes[i])
+        {
+            std::cerr << expectedPaths[i] << ": " << size << " rows instead of " << expectedSizes[i] << std::endl;
+            bad++;
+        }
+        else if (expectedPaths[i].contains("/channel") && !expectedPaths[i].contains("/" ARF_OVERVIEW_GROUP "/")
+            && !expectedPaths[i].contains("/" ARF_CHECKSUM_GROUP "/"))
+            samples += size;
+    }
+    std::cout << output.getFileName() << ": " << expectedPaths.size() - bad << " of " << expectedPaths.size()
+        << " datasets complete, " << samples << " samples" << std::endl;
+    return bad == 0;
+}
+
+//experiment1_prt12.arf and experiment1_prt12_shard3.arf go to experiment1.arf and experiment1_shard3.arf
+static String getMergedName(const File& part)
+{
+    String name = part.getFileNameWithoutExtension();
+    int prt = name.lastIndexOf("_prt");
+    if (prt < 0)
+        return name;
+    int end = prt + 4;
+    while (end < name.length() && CharacterFunctions::isDigit(name[end]))
+        end++;
+    return name.substring(0, prt) + name.substring(end);
+}
+
+struct FileSorter
+{
+    static int compareElements(const File& a, const File& b)
+    {
+        return a.getFileName().compareNatural(b.getFileName());
+    }
+};
+
+int main(int argc, char* argv[])
+{
+    File output;
+    int chunkSamples = DEFAULT_CHUNK_SAMPLES;
+    int level = DEFAULT_COMPRESSION;
+    bool codec = false;
+    int nThreads = SystemStats::getNumCpus();
+    int memoryMB = DEFAULT_MEMORY;
+    Array<File> inputs;
+    for (int i = 1; i < argc; i++)
+    {
+        String arg(argv[i]);
+        if (arg.startsWith("-") && i + 1 < argc)
+        {
+            String value(argv[++i]);
+            if (arg == "-o")
+                output = File::getCurrentWorkingDirectory().getChildFile(value);
+            else if (arg == "-c")
+                chunkSamples = jlimit(256, 1 << 24, value.getIntValue());
+            else if (arg == "-z" && value == "codec")
+                codec = true;
+            else if (arg == "-z")
+                level = jlimit(0, 9, value.getIntValue());
+            else if (arg == "-j")
+                nThreads = jmax(1, value.getIntValue());
+            else if (arg == "-m")
+                memoryMB = jmax(1, value.getIntValue());
+            continue;
+        }
+        File f = File::getCurrentWorkingDirectory().getChildFile(arg);
+        if (f.isDirectory())
+            f.findChildFiles(inputs, File::findFiles, false, "*_prt*.arf");
+        else
+            inputs.add(f);
+    }
+    if (inputs.size() == 0)
+    {
+        std::cerr << "usage: arf-merge [-o <merged file>] [-c <samples per chunk>] [-z <deflate level, 0-9, or codec>]" << std::endl
+            << "                 [-j <threads>] [-m <buffer MB>] <part files or session folder>" << std::endl;
+        return 2;
+    }
+
+    //one merged file for every experiment (and shard) among the inputs
+    FileSorter sorter;
+    inputs.sort(sorter);
+    StringArray names;
+    for (int i = 0; i < inputs.size(); i++)
+    {
+        if (!names.contains(getMergedName(inputs[i])))
+            names.add(getMergedName(inputs[i]));
+    }
+    if (output != File() && names.size() > 1)
+    {
+        std::cerr << "The inputs are from " << names.size() << " experiments, -o can only be used for one" << std::endl;
+        return 2;
+    }
+
+    int failed = 0;
+    for (int i = 0; i < names.size(); i++)
+    {
+        Array<File> parts;
+        for (int j = 0; j < inputs.size(); j++)
+        {
+            if (getMergedName(inputs[j]) == names[i])
+                parts.add(inputs[j]);
+        }
+        File target = (output != File()) ? output : parts[0].getSiblingFile(names[i] + ".arf");
+        PartMerger merger(chunkSamples, level, codec, nThreads, memoryMB);
+        if (!merger.merge(parts, target))
+        {
+            std::cerr << "Merging into " << target.getFullPathName() << " failed" << std::endl;
+            failed++;
+        }
+    }
+    return (failed > 0) ? 1 : 0;
+}
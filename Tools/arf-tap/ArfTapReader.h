@@ -0,0 +1,256 @@
+/*
+ ------------------------------------------------------------------
+
+ Michal Badura, 2016
+ based on code by Florian Franzen, 2014
+
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef ARFTAPREADER_H_INCLUDED
+#define ARFTAPREADER_H_INCLUDED
+
+//Consumer side of the live tap of the Arf engine ("Live tap" option, see RecordEngine/ArfLiveTap.h).
+//Header only and without JUCE or HDF5: include it and link with -lrt.
+//
+//    ArfTapReader tap;
+//    tap.attach("/arf-tap");
+//    ArfTapRecord rec;
+//    while (tap.next(rec))
+//        if (rec.type == TapData && tap.isValid(rec)) ...
+//
+//Records are read in place from the ring. The producer never waits for readers, so a record can
+//be overwritten while it is being looked at: use it, or copy it, and check isValid afterwards.
+//Records lost that way, or while a reader wasn't reading, show up in getLost().
+
+#include "../../RecordEngine/ArfTapFormat.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <string.h>
+#include <string>
+
+struct ArfTapRecord
+{
+    ArfTapRecordType type;
+    uint32_t size;
+    uint64_t sequence;
+    //position in the ring, for isValid
+    uint64_t position;
+    //SIZE bytes of data, in the shared memory
+    const char* data;
+
+    const ArfTapData* dataHeader() const { return (const ArfTapData*)data; }
+    const int16_t* samples() const { return (const int16_t*)(data + sizeof(ArfTapData)); }
+    const ArfTapEvent* event() const { return (const ArfTapEvent*)data; }
+    const char* eventData() const { return data + sizeof(ArfTapEvent); }
+    const ArfTapSpike* spike() const { return (const ArfTapSpike*)data; }
+    const uint16_t* spikeValues() const { return (const uint16_t*)(data + sizeof(ArfTapSpike)); }
+    const ArfTapPart* part() const { return (const ArfTapPart*)data; }
+};
+
+//A copy of the channel table of the part being recorded
+struct ArfTapInfo
+{
+    int recordingNumber;
+    int partNumber;
+    int nChannels;
+    float mainSampleRate;
+    ArfTapChannel channels[ARF_TAP_MAX_CHANNELS];
+};
+
+class ArfTapReader
+{
+public:
+    ArfTapReader() : header(nullptr), ring(nullptr), mappedSize(0), inode(0), cursor(0), expected(0),
+        synced(false), lost(0)
+    {
+    }
+
+    ~ArfTapReader()
+    {
+        detach();
+    }
+
+    //Maps the tap NAME read-only. Reading starts with the next record written, or with the
+    //oldest one still in the ring if FROMOLDEST
+    bool attach(const std::string& name, bool fromOldest = false)
+    {
+        detach();
+        int fd = shm_open(name.c_str(), O_RDONLY, 0);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(ArfTapHeader))
+        {
+            ::close(fd);
+            return false;
+        }
+        void* ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (ptr == MAP_FAILED)
+            return false;
+        header = (const ArfTapHeader*)ptr;
+        mappedSize = st.st_size;
+        if (header->magic != ARF_TAP_MAGIC || header->version != ARF_TAP_VERSION
+            || sizeof(ArfTapHeader) + header->capacity > mappedSize)
+        {
+            detach();
+            return false;
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        ring = (const char*)ptr + sizeof(ArfTapHeader);
+        this->name = name;
+        inode = st.st_ino;
+        cursor = fromOldest ? header->oldest.load(std::memory_order_acquire) : header->head.load(std::memory_order_acquire);
+        synced = false;
+        lost = 0;
+        return true;
+    }
+
+    void detach()
+    {
+        if (header != nullptr)
+            munmap((void*)header, mappedSize);
+        header = nullptr;
+        ring = nullptr;
+        mappedSize = 0;
+    }
+
+    bool isAttached() const
+    {
+        return header != nullptr;
+    }
+
+    //True if the recording that made the tap is gone, or has made a new one under the same name
+    //(it does when its settings change). Attach again to follow it.
+    bool isReplaced() const
+    {
+        if (header == nullptr)
+            return true;
+        if (kill(header->producerPid, 0) != 0 && errno == ESRCH)
+            return true;
+        int fd = shm_open(name.c_str(), O_RDONLY, 0);
+        if (fd < 0)
+            return true;
+        struct stat st;
+        bool replaced = fstat(fd, &st) != 0 || st.st_ino != inode;
+        ::close(fd);
+        return replaced;
+    }
+
+    //The next record, false if there is none yet. Pads are skipped
+    bool next(ArfTapRecord& rec)
+    {
+        if (header == nullptr)
+            return false;
+        const uint64_t capacity = header->capacity;
+        while (true)
+        {
+            uint64_t head = header->head.load(std::memory_order_acquire);
+            if (cursor >= head)
+                return false;
+            uint64_t oldest = header->oldest.load(std::memory_order_acquire);
+            if (cursor < oldest)
+                cursor = oldest;
+            const ArfTapRecordHeader* h = (const ArfTapRecordHeader*)(ring + cursor % capacity);
+            uint32_t type = h->type;
+            uint32_t size = h->size;
+            uint64_t sequence = h->sequence;
+            //the header may have been overwritten while it was read
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (header->oldest.load(std::memory_order_relaxed) > cursor)
+                continue;
+            rec.position = cursor;
+            cursor += arfTapSpace(size);
+            if (type == TapPad)
+                continue;
+            if (synced && sequence > expected)
+                lost += sequence - expected;
+            expected = sequence + 1;
+            synced = true;
+            rec.type = (ArfTapRecordType)type;
+            rec.size = size;
+            rec.sequence = sequence;
+            rec.data = (const char*)h + sizeof(ArfTapRecordHeader);
+            return true;
+        }
+    }
+
+    //True if REC was not overwritten before this call, i.e. what was read from it is what the recording wrote
+    bool isValid(const ArfTapRecord& rec) const
+    {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return header != nullptr && header->oldest.load(std::memory_order_relaxed) <= rec.position;
+    }
+
+    //Records that were overwritten before they were read, since attach
+    uint64_t getLost() const
+    {
+        return lost;
+    }
+
+    //Records the recording couldn't publish at all, because they were larger than half the ring
+    uint64_t getDropped() const
+    {
+        return header != nullptr ? header->dropped.load(std::memory_order_relaxed) : 0;
+    }
+
+    //Copies the channel table; false if there is no tap, or it kept changing while being read
+    bool getInfo(ArfTapInfo& info) const
+    {
+        if (header == nullptr)
+            return false;
+        for (int attempt = 0; attempt < 1000; attempt++)
+        {
+            uint32_t version = header->infoVersion.load(std::memory_order_acquire);
+            if (version & 1)
+                continue;
+            info.recordingNumber = header->recordingNumber;
+            info.partNumber = header->partNumber;
+            info.nChannels = header->nChannels;
+            info.mainSampleRate = header->mainSampleRate;
+            if (info.nChannels < 0 || info.nChannels > ARF_TAP_MAX_CHANNELS)
+                continue;
+            memcpy(info.channels, header->channels, info.nChannels * sizeof(ArfTapChannel));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (header->infoVersion.load(std::memory_order_relaxed) == version)
+                return true;
+        }
+        return false;
+    }
+
+private:
+    std::string name;
+    const ArfTapHeader* header;
+    const char* ring;
+    size_t mappedSize;
+    ino_t inode;
+    uint64_t cursor;
+    //sequence number of the record after the last one read
+    uint64_t expected;
+    bool synced;
+    uint64_t lost;
+
+    ArfTapReader(const ArfTapReader&);
+    ArfTapReader& operator=(const ArfTapReader&);
+};
+
+#endif  // ARFTAPREADER_H_INCLUDED
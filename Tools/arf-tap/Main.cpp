@@ -0,0 +1,143 @@
+/*
+ ------------------------------------------------------------------
+
+ Michal Badura, 2016
+ based on code by Florian Franzen, 2014
+
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+//arf-tap: follows the live tap of a recording (the "Live tap" option of the Arf engine) and prints
+//what comes through every second. Mostly an example of ArfTapReader.
+
+#include "ArfTapReader.h"
+#include <iostream>
+#include <vector>
+#include <stdlib.h>
+#include <time.h>
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char* argv[])
+{
+    std::string name;
+    double seconds = 0;
+    bool fromOldest = false;
+    bool printEvents = false;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg(argv[i]);
+        if (arg == "-t" && i + 1 < argc)
+            seconds = atof(argv[++i]);
+        else if (arg == "-o")
+            fromOldest = true;
+        else if (arg == "-e")
+            printEvents = true;
+        else
+            name = arg;
+    }
+    if (name.empty())
+    {
+        std::cerr << "usage: arf-tap [-t <seconds to run>] [-o (start with the oldest records)] [-e (print events)] <tap name>" << std::endl;
+        return 2;
+    }
+
+    ArfTapReader tap;
+    ArfTapInfo* info = new ArfTapInfo();
+    double start = now();
+    double lastReport = start;
+    uint64_t samples = 0, events = 0, spikes = 0, torn = 0;
+    //per channel, where the next block should start; blocks that don't are counted as gaps
+    std::vector<int64_t> nextTimestamp;
+    uint64_t gaps = 0;
+    while (seconds <= 0 || now() - start < seconds)
+    {
+        if (!tap.isAttached() || tap.isReplaced())
+        {
+            if (!tap.attach(name, fromOldest))
+            {
+                usleep(100000);
+                continue;
+            }
+            std::cout << "Attached to " << name << std::endl;
+            nextTimestamp.clear();
+        }
+
+        ArfTapRecord rec;
+        int n = 0;
+        while (n < 4096 && tap.next(rec))
+        {
+            n++;
+            if (rec.type == TapData)
+            {
+                int channel = rec.dataHeader()->channel;
+                int64_t timestamp = rec.dataHeader()->timestamp;
+                int nSamples = rec.dataHeader()->nSamples;
+                if (!tap.isValid(rec))
+                {
+                    torn++;
+                    continue;
+                }
+                if (channel >= (int)nextTimestamp.size())
+                    nextTimestamp.resize(channel + 1, -1);
+                if (nextTimestamp[channel] >= 0 && nextTimestamp[channel] != timestamp)
+                    gaps++;
+                nextTimestamp[channel] = timestamp + nSamples;
+                samples += nSamples;
+            }
+            else if (rec.type == TapEvent)
+            {
+                events++;
+                ArfTapEvent ev = *rec.event();
+                std::string text;
+                if (ev.type == 1)
+                    text.assign(rec.eventData(), strnlen(rec.eventData(), ev.dataSize));
+                if (printEvents && tap.isValid(rec))
+                    std::cout << "event " << ev.timestamp << " type " << ev.type << " id " << (int)ev.eventID
+                        << " node " << (int)ev.nodeID << (ev.type == 1 ? " \"" + text + "\"" : std::string()) << std::endl;
+            }
+            else if (rec.type == TapSpike)
+                spikes++;
+            else if (rec.type == TapOpen || rec.type == TapClose)
+            {
+                ArfTapPart part = *rec.part();
+                std::cout << (rec.type == TapOpen ? "Opened" : "Closed") << " recording " << part.recordingNumber
+                    << " part " << part.partNumber << std::endl;
+                if (rec.type == TapOpen && tap.getInfo(*info))
+                    std::cout << "  " << info->nChannels << " channels, " << info->mainSampleRate << " Hz" << std::endl;
+                nextTimestamp.clear();
+            }
+        }
+        if (n == 0)
+            usleep(1000);
+
+        double t = now();
+        if (t - lastReport >= 1)
+        {
+            std::cout << samples / (t - lastReport) << " samples/s, " << events << " events, " << spikes << " spikes, "
+                << tap.getLost() << " records lost, " << torn << " overwritten while read, " << gaps << " gaps" << std::endl;
+            samples = events = spikes = 0;
+            lastReport = t;
+        }
+    }
+    delete info;
+    return 0;
+}
@@ -0,0 +1,508 @@
+/*
+ ------------------------------------------------------------------
+
+ Michal Badura, 2016
+ based on code by Florian Franzen, 2014
+
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+//arf-verify: checks ARF files, e.g. all the parts of a session, against the CRC32C checksums
+//stored with their channels (/rec_N/checksums, see ArfChecksum).
+//HDF5 is only ever called from the main thread, which reads the chunks as they are stored, one
+//after the other. Undoing the filters and the checksums run on all cores, so that the files are
+//read at the speed of the disk.
+
+#include "../../RecordEngine/ArfFileFormat.h"
+#include "../../RecordEngine/ArfChecksum.h"
+#include "../../RecordEngine/ArfCodec.h"
+#include <H5Cpp.h>
+#include <zlib.h>
+
+//memory for chunks waiting to be checked, in MB
+#define DEFAULT_MEMORY 256
+//samples of one job, in bytes
+#define JOB_BYTES (4 << 20)
+
+//An ARF file opened by name, for reading
+class VerifyFile : public ArfFileBase
+{
+public:
+    VerifyFile(String fileName) : fileName(fileName)
+    {
+        readyToOpen = true;
+    }
+
+    String getFileName() override
+    {
+        return fileName;
+    }
+
+protected:
+    int createFileStructure() override
+    {
+        return 0;
+    }
+
+private:
+    String fileName;
+};
+
+//A run of chunks of one channel dataset, on its way from the file to a checker
+struct VerifyJob
+{
+    //of the file being checked, for the report
+    int dataset;
+    int firstChunk;
+    int nChunks;
+    int chunkSize;
+    //samples the checksums cover; the last chunk of a dataset can be short
+    int nSamples;
+    //the filters of the dataset, in the order they were applied. Empty if the samples were read
+    //through HDF5, which has undone them already
+    Array<int> filters;
+    //every chunk as it is stored, and the filters that were skipped for it
+    OwnedArray<MemoryBlock> stored;
+    Array<uint32> filterMasks;
+    HeapBlock<int16> samples;
+    Array<uint32> expected;
+    //chunks whose checksum doesn't match, or that could not be decoded
+    Array<int> bad;
+};
+
+class JobQueue
+{
+public:
+    void addPending(VerifyJob* job)
+    {
+        const ScopedLock sl(lock);
+        pending.add(job);
+        pendingEvent.signal();
+    }
+
+    VerifyJob* takePending(Thread* thread)
+    {
+        while (!thread->threadShouldExit())
+        {
+            {
+                const ScopedLock sl(lock);
+                if (pending.size() > 0)
+                    return pending.removeAndReturn(0);
+            }
+            pendingEvent.wait(100);
+        }
+        return nullptr;
+    }
+
+    void addDone(VerifyJob* job)
+    {
+        const ScopedLock sl(lock);
+        done.add(job);
+        doneEvent.signal();
+    }
+
+    VerifyJob* takeDone(bool wait)
+    {
+        while (true)
+        {
+            {
+                const ScopedLock sl(lock);
+                if (done.size() > 0)
+                    return done.removeAndReturn(0);
+            }
+            if (!wait)
+                return nullptr;
+            doneEvent.wait(100);
+        }
+    }
+
+private:
+    CriticalSection lock;
+    Array<VerifyJob*> pending;
+    Array<VerifyJob*> done;
+    WaitableEvent pendingEvent;
+    WaitableEvent doneEvent;
+};
+
+//Undoes what the filters did to the chunks (shuffle and deflate, ArfCodec, Fletcher32) and checks them
+class ChunkChecker : public Thread
+{
+public:
+    ChunkChecker(JobQueue& queue) : Thread("arf-verify checker"), queue(queue)
+    {
+    }
+
+    void run() override
+    {
+        VerifyJob* job;
+        while ((job = queue.takePending(this)) != nullptr)
+        {
+            check(job);
+            queue.addDone(job);
+        }
+    }
+
+    static bool canDecode(const Array<int>& filters)
+    {
+        for (int i = 0; i < filters.size(); i++)
+        {
+            if (filters[i] != H5Z_FILTER_DEFLATE && filters[i] != H5Z_FILTER_SHUFFLE
+                && filters[i] != H5Z_FILTER_FLETCHER32 && filters[i] != ARF_CODEC_FILTER)
+                return false;
+        }
+        return true;
+    }
+
+private:
+    void check(VerifyJob* job)
+    {
+        for (int k = 0; k < job->nChunks; k++)
+        {
+            int16* samples = job->samples + (size_t)k * job->chunkSize;
+            int n = jmin(job->chunkSize, job->nSamples - k * job->chunkSize);
+            if (job->filters.size() > 0 && !decode(*job->stored[k], job->filterMasks[k], job->filters, samples, job->chunkSize))
+                job->bad.add(job->firstChunk + k);
+            else if (ArfChecksum::crc32c(0, samples, n * sizeof(int16)) != job->expected[k])
+                job->bad.add(job->firstChunk + k);
+        }
+    }
+
+    bool decode(const MemoryBlock& stored, uint32 filterMask, const Array<int>& filters, int16* samples, int chunkSize)
+    {
+        size_t nBytes = (size_t)chunkSize * sizeof(int16);
+        //a chunk that was never written reads as the fill value
+        if (stored.getSize() == 0)
+        {
+            memset(samples, 0, nBytes);
+            return true;
+        }
+        current = stored;
+        for (int i = filters.size() - 1; i >= 0; i--)
+        {
+            if (filterMask & (1u << i))
+                continue;
+            const uint8* src = (const uint8*)current.getData();
+            size_t size = current.getSize();
+            if (filters[i] == H5Z_FILTER_FLETCHER32)
+            {
+                if (size < 4)
+                    return false;
+                current.setSize(size - 4);
+                continue;
+            }
+            if (filters[i] == H5Z_FILTER_DEFLATE)
+            {
+                uLongf outSize = nBytes;
+                next.setSize(nBytes);
+                if (uncompress((Bytef*)next.getData(), &outSize, src, size) != Z_OK)
+                    return false;
+                next.setSize(outSize);
+            }
+            else if (filters[i] == H5Z_FILTER_SHUFFLE)
+            {
+                //back from all the low bytes, then all the high bytes
+                size_t n = size / 2;
+                next.setSize(size);
+                uint8* dst = (uint8*)next.getData();
+                for (size_t j = 0; j < n; j++)
+                {
+                    dst[2 * j] = src[j];
+                    dst[2 * j + 1] = src[n + j];
+                }
+            }
+            else if (filters[i] == ARF_CODEC_FILTER)
+            {
+                if (ArfCodec::getDecodedSamples(src, size) != chunkSize)
+                    return false;
+                next.setSize(nBytes);
+                if (!ArfCodec::decode(src, size, (int16_t*)next.getData()))
+                    return false;
+            }
+            else
+                return false;
+            current.swapWith(next);
+        }
+        if (current.getSize() != nBytes)
+            return false;
+        memcpy(samples, current.getData(), nBytes);
+        return true;
+    }
+
+    JobQueue& queue;
+    MemoryBlock current;
+    MemoryBlock next;
+};
+
+class SessionVerifier
+{
+public:
+    SessionVerifier(int nThreads, int memoryMB)
+        : inFlight(0), bytesRead(0), chunksChecked(0), badChunks(0), errors(0)
+    {
+        maxInFlight = jmax(2 * nThreads, (int)(((int64)memoryMB << 20) / JOB_BYTES));
+        for (int i = 0; i < nThreads; i++)
+        {
+            checkers.add(new ChunkChecker(queue));
+            checkers.getLast()->startThread();
+        }
+    }
+
+    ~SessionVerifier()
+    {
+        for (int i = 0; i < checkers.size(); i++)
+            checkers[i]->stopThread(-1);
+    }
+
+    //checks every channel of FILE that has checksums; false if anything is wrong with it
+    bool verify(const File& file);
+
+    int64 getBytesRead() const { return bytesRead; }
+    int64 getChunksChecked() const { return chunksChecked; }
+    int getBadChunks() const { return badChunks; }
+    int getErrors() const { return errors; }
+
+private:
+    //adds the chunks of the channel that have no checksum to UNCHECKED
+    bool verifyChannel(VerifyFile& file, String path, String checksumPath, int64& unchecked);
+    void submit(VerifyJob* job);
+    //reports the jobs that are done; with WAIT at least one
+    void collect(bool wait);
+
+    int maxInFlight;
+    int inFlight;
+    JobQueue queue;
+    OwnedArray<ChunkChecker> checkers;
+
+    //channel datasets of the file being checked, and the sizes of their chunks
+    StringArray paths;
+    Array<int> chunkSizes;
+    int64 bytesRead;
+    int64 chunksChecked;
+    int badChunks;
+    int errors;
+};
+
+bool SessionVerifier::verify(const File& file)
+{
+    VerifyFile arf(file.getFullPathName());
+    if (arf.openReadOnly())
+    {
+        std::cerr << "Could not open " << file.getFullPathName() << std::endl;
+        errors++;
+        return false;
+    }
+    paths.clear();
+    chunkSizes.clearQuick();
+    int64 startBytes = bytesRead;
+    int64 startChunks = chunksChecked;
+    int startBad = badChunks;
+    int startErrors = errors;
+    int64 unchecked = 0;
+    int withoutChecksums = 0;
+
+    StringArray recordings = arf.getChildNames("/");
+    for (int i = 0; i < recordings.size(); i++)
+    {
+        if (!recordings[i].startsWith("rec_"))
+            continue;
+        String rec = "/" + recordings[i];
+        StringArray children = arf.getChildNames(rec);
+        StringArray checked = children.contains(ARF_CHECKSUM_GROUP) ? arf.getChildNames(rec + "/" + ARF_CHECKSUM_GROUP) : StringArray();
+        for (int j = 0; j < children.size(); j++)
+        {
+            if (!children[j].startsWith("channel"))
+                continue;
+            if (!checked.contains(children[j]))
+            {
+                withoutChecksums++;
+                continue;
+            }
+            if (!verifyChannel(arf, rec + "/" + children[j], rec + "/" + ARF_CHECKSUM_GROUP + "/" + children[j], unchecked))
+                errors++;
+        }
+    }
+    while (inFlight > 0)
+        collect(true);
+
+    std::cout << file.getFileName() << ": " << (chunksChecked - startChunks) << " chunks, "
+        << String((bytesRead - startBytes) / 1048576.0, 1) << " MB";
+    if (badChunks > startBad || errors > startErrors)
+        std::cout << ", " << (badChunks - startBad) << " bad chunks, " << (errors - startErrors) << " errors" << std::endl;
+    else
+        std::cout << ", ok" << std::endl;
+    //not an error: e.g. a part that ended before its last chunk was finished, or a recording without checksums
+    if (unchecked > 0)
+        std::cout << "  " << unchecked << " chunks have no checksum" << std::endl;
+    if (withoutChecksums > 0)
+        std::cout << "  " << withoutChecksums << " channels have no checksums" << std::endl;
+    return badChunks == startBad && errors == startErrors;
+}
+
+bool SessionVerifier::verifyChannel(VerifyFile& file, String path, String checksumPath, int64& unchecked)
+{
+    ScopedPointer<ArfRecordingData> data = file.getDataSet(path);
+    ScopedPointer<ArfRecordingData> table = file.getDataSet(checksumPath);
+    if (data == nullptr || table == nullptr || data->getChunkSize() <= 0)
+    {
+        std::cerr << "Could not open " << path << " or its checksums" << std::endl;
+        return false;
+    }
+    int chunkSize = data->getChunkSize();
+    int size = data->getSize();
+    int nChunks = (int)(((int64)size + chunkSize - 1) / chunkSize);
+    Array<uint32> expected;
+    expected.insertMultiple(0, 0, table->getSize());
+    if (expected.size() > 0 && table->readDataBlock(0, expected.size(), ArfFileBase::U32, expected.getRawDataPointer()))
+    {
+        std::cerr << "Could not read " << checksumPath << std::endl;
+        return false;
+    }
+    if (expected.size() > nChunks)
+    {
+        std::cerr << path << ": " << expected.size() << " checksums for " << nChunks << " chunks" << std::endl;
+        return false;
+    }
+    unchecked += nChunks - expected.size();
+
+    //Chunks that are stored as they are, or with filters only HDF5 knows, are read through HDF5
+    //in one go; the others are read as stored and decoded by the checkers
+    Array<int> filters = data->getFilters();
+    if (!ChunkChecker::canDecode(filters))
+        filters.clearQuick();
+    int dataset = paths.size();
+    paths.add(file.getFileName() + ":" + path);
+    chunkSizes.add(chunkSize);
+
+    int chunksPerJob = jmax(1, JOB_BYTES / (chunkSize * (int)sizeof(int16)));
+    for (int first = 0; first < expected.size(); first += chunksPerJob)
+    {
+        ScopedPointer<VerifyJob> job = new VerifyJob();
+        job->dataset = dataset;
+        job->firstChunk = first;
+        job->nChunks = jmin(chunksPerJob, expected.size() - first);
+        job->chunkSize = chunkSize;
+        job->nSamples = jmin(job->nChunks * chunkSize, size - first * chunkSize);
+        job->filters = filters;
+        job->expected.addArray(expected.getRawDataPointer() + first, job->nChunks);
+        job->samples.malloc((size_t)job->nChunks * chunkSize);
+        if (filters.size() == 0)
+        {
+            if (data->readDataBlock(first * chunkSize, job->nSamples, ArfFileBase::I16, job->samples))
+            {
+                std::cerr << "Could not read " << path << std::endl;
+                return false;
+            }
+            bytesRead += (int64)job->nSamples * sizeof(int16);
+        }
+        for (int k = 0; k < job->nChunks && filters.size() > 0; k++)
+        {
+            uint32 filterMask;
+            MemoryBlock* stored = job->stored.add(new MemoryBlock());
+            if (data->readRawChunk(first + k, *stored, filterMask))
+                return false;
+            job->filterMasks.add(filterMask);
+            bytesRead += stored->getSize();
+        }
+        submit(job.release());
+    }
+    return true;
+}
+
+void SessionVerifier::submit(VerifyJob* job)
+{
+    while (inFlight >= maxInFlight)
+        collect(true);
+    inFlight++;
+    queue.addPending(job);
+    collect(false);
+}
+
+void SessionVerifier::collect(bool wait)
+{
+    ScopedPointer<VerifyJob> job;
+    while ((job = queue.takeDone(wait)) != nullptr)
+    {
+        inFlight--;
+        chunksChecked += job->nChunks;
+        badChunks += job->bad.size();
+        int chunkSize = chunkSizes[job->dataset];
+        for (int i = 0; i < job->bad.size(); i++)
+        {
+            int64 start = (int64)job->bad[i] * chunkSize;
+            std::cerr << paths[job->dataset] << ": chunk " << job->bad[i] << " (samples " << start << " to "
+                << start + chunkSize - 1 << ") does not match its checksum" << std::endl;
+        }
+        wait = false;
+    }
+}
+
+struct FileSorter
+{
+    static int compareElements(const File& a, const File& b)
+    {
+        return a.getFileName().compareNatural(b.getFileName());
+    }
+};
+
+int main(int argc, char* argv[])
+{
+    int nThreads = SystemStats::getNumCpus();
+    int memoryMB = DEFAULT_MEMORY;
+    Array<File> inputs;
+    for (int i = 1; i < argc; i++)
+    {
+        String arg(argv[i]);
+        if (arg.startsWith("-") && i + 1 < argc)
+        {
+            String value(argv[++i]);
+            if (arg == "-j")
+                nThreads = jmax(1, value.getIntValue());
+            else if (arg == "-m")
+                memoryMB = jmax(1, value.getIntValue());
+            continue;
+        }
+        File f = File::getCurrentWorkingDirectory().getChildFile(arg);
+        if (f.isDirectory())
+            f.findChildFiles(inputs, File::findFiles, false, "*.arf");
+        else
+            inputs.add(f);
+    }
+    if (inputs.size() == 0)
+    {
+        std::cerr << "usage: arf-verify [-j <threads>] [-m <buffer MB>] <ARF files or session folders>" << std::endl;
+        return 2;
+    }
+    FileSorter sorter;
+    inputs.sort(sorter);
+
+    SessionVerifier verifier(nThreads, memoryMB);
+    int failed = 0;
+    uint32 start = Time::getMillisecondCounter();
+    for (int i = 0; i < inputs.size(); i++)
+    {
+        if (!verifier.verify(inputs[i]))
+            failed++;
+    }
+    double seconds = jmax(1, (int)(Time::getMillisecondCounter() - start)) / 1000.0;
+    double megabytes = verifier.getBytesRead() / 1048576.0;
+    std::cout << inputs.size() << " files, " << verifier.getChunksChecked() << " chunks, " << String(megabytes, 1) << " MB in "
+        << String(seconds, 1) << " s (" << String(megabytes / seconds, 0) << " MB/s)";
+    if (failed > 0)
+        std::cout << ", " << failed << " files failed" << std::endl;
+    else
+        std::cout << ", all ok" << std::endl;
+    return (failed > 0) ? 1 : 0;
+}
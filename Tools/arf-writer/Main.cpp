@@ -0,0 +1,231 @@
+/*
+ ------------------------------------------------------------------
+
+ Michal Badura, 2016
+ based on code by Florian Franzen, 2014
+
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+//arf-writer: does all the HDF5 work for an ArfRecording engine that has "Write in separate process" set.
+//Started by the engine as "arf-writer <shared memory name>", see RecordEngine/ArfRemoteWriter.h
+
+#include "../../RecordEngine/ArfShmRing.h"
+#include "../common/ArfRecordPlayer.h"
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+
+//records applied before looking at the time again
+#define RECORDS_PER_BATCH 256
+
+class RingWriter
+{
+public:
+    RingWriter(ArfShmRing& ring);
+    int run();
+
+private:
+    bool openPart(const char* data, uint32 size, const Array<int64>* positions);
+    void closePart();
+    void apply(ArfRecord::RecordType type, const char* data, uint32 size);
+    //flushes the open part and lets the producer reuse what has been written
+    void commit();
+    //stores the write positions next to the part description, for a restarted writer
+    bool saveSession(uint32 descriptionSize);
+    void fail(String msg);
+    bool producerAlive() const;
+
+    ArfShmRing& ring;
+    ArfRingHeader* header;
+    uint64 cursor;
+    //if the part could not be opened, its records are thrown away until the next one
+    ArfRecordPlayer player;
+    uint32 lastFlush;
+};
+
+RingWriter::RingWriter(ArfShmRing& ring) : ring(ring), header(ring.getHeader()), cursor(0), lastFlush(0)
+{
+}
+
+int RingWriter::run()
+{
+    header->writerPid = getpid();
+    header->writerState = ArfShmRing::WriterRunning;
+
+    //A writer before this one had a part open: continue in it, from where it was last flushed
+    cursor = header->tail.load();
+    uint32 sessionSize = header->sessionSize.load();
+    if (sessionSize > 0)
+    {
+        Array<int64> positions;
+        positions.insertMultiple(0, 0, (int)header->sessionPositions);
+        memcpy(positions.getRawDataPointer(), header->session + sessionSize, positions.size() * sizeof(int64));
+        cursor = header->sessionCursor;
+        openPart(header->session, sessionSize, &positions);
+    }
+
+    lastFlush = Time::getMillisecondCounter();
+    while (true)
+    {
+        header->heartbeat = Time::currentTimeMillis();
+
+        ArfRecord::RecordType type;
+        const char* data;
+        uint32 size;
+        int n = 0;
+        while (n < RECORDS_PER_BATCH && ring.read(cursor, type, data, size))
+        {
+            if (type == ArfRecord::RecordQuit)
+            {
+                closePart();
+                ring.release(cursor);
+                header->writerState = ArfShmRing::WriterStopped;
+                return 0;
+            }
+            apply(type, data, size);
+            n++;
+        }
+
+        if (n == 0)
+        {
+            //Nobody left to write for: save what we have and clean up the ring
+            if (!producerAlive())
+            {
+                closePart();
+                ring.release(cursor);
+                ring.unlink();
+                header->writerState = ArfShmRing::WriterStopped;
+                return 0;
+            }
+            Thread::sleep(1);
+        }
+
+        //how often the file is flushed and the ring space released comes with the part
+        if (Time::getMillisecondCounter() - lastFlush >= (uint32)player.getPart().profile.flushInterval)
+            commit();
+    }
+}
+
+bool RingWriter::openPart(const char* data, uint32 size, const Array<int64>* positions)
+{
+    if (!player.openPart(data, size, positions))
+    {
+        fail(player.getLastError());
+        return false;
+    }
+    if (positions == nullptr)
+    {
+        if (size + player.getPart().nChannels * sizeof(int64) * 2 > ARF_RING_SESSION_SIZE)
+        {
+            fail("Part description too large, a restarted writer would not be able to continue it");
+            ring.release(cursor);
+            return true;
+        }
+        //the skeleton has to be on disk before a restarted writer relies on it
+        memcpy(header->session, data, size);
+        if (saveSession(size))
+            header->sessionSize = size;
+        ring.release(cursor);
+    }
+    return true;
+}
+
+void RingWriter::closePart()
+{
+    player.closePart();
+    header->sessionSize = 0;
+}
+
+void RingWriter::commit()
+{
+    lastFlush = Time::getMillisecondCounter();
+    uint32 sessionSize = header->sessionSize.load();
+    if (player.isOpen() && sessionSize > 0 && !saveSession(sessionSize))
+        return;
+    ring.release(cursor);
+}
+
+bool RingWriter::saveSession(uint32 descriptionSize)
+{
+    Array<int64> positions;
+    if (player.getFile()->flush())
+        return false;
+    player.getFile()->getWritePositions(positions);
+    if (descriptionSize + positions.size() * sizeof(int64) > ARF_RING_SESSION_SIZE)
+        return false;
+    memcpy(header->session + descriptionSize, positions.getRawDataPointer(), positions.size() * sizeof(int64));
+    header->sessionPositions = positions.size();
+    header->sessionCursor = cursor;
+    return true;
+}
+
+void RingWriter::apply(ArfRecord::RecordType type, const char* data, uint32 size)
+{
+    switch (type)
+    {
+    case ArfRecord::RecordOpen:
+        closePart();
+        openPart(data, size, nullptr);
+        break;
+    case ArfRecord::RecordClose:
+        closePart();
+        ring.release(cursor);
+        break;
+    default:
+    {
+        uint64 written = player.getSamplesWritten();
+        if (!player.apply(type, data, size))
+            fail(player.getLastError());
+        header->samplesWritten += player.getSamplesWritten() - written;
+        break;
+    }
+    }
+}
+
+void RingWriter::fail(String msg)
+{
+    std::cerr << msg << std::endl;
+    msg.copyToUTF8(header->lastError, ARF_RING_ERROR_SIZE);
+    header->errors++;
+    header->writerState = ArfShmRing::WriterFailed;
+}
+
+bool RingWriter::producerAlive() const
+{
+    return kill(header->producerPid, 0) == 0 || errno == EPERM;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        std::cerr << "usage: arf-writer <shared memory name>" << std::endl;
+        return 2;
+    }
+    //Ctrl-C in the terminal of the GUI reaches us too; we still want to empty the ring and close the file
+    signal(SIGINT, SIG_IGN);
+
+    ArfShmRing ring;
+    if (!ring.attach(argv[1]))
+    {
+        std::cerr << "Could not open " << argv[1] << std::endl;
+        return 1;
+    }
+    RingWriter writer(ring);
+    return writer.run();
+}
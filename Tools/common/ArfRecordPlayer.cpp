@@ -0,0 +1,165 @@
+/*
+ ------------------------------------------------------------------
+
+ Michal Badura, 2016
+ based on code by Florian Franzen, 2014
+
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+#include "ArfRecordPlayer.h"
+
+ArfRecordPlayer::ArfRecordPlayer() : samplesWritten(0)
+{
+}
+
+ArfRecordPlayer::~ArfRecordPlayer()
+{
+    closePart();
+}
+
+bool ArfRecordPlayer::openPart(const char* data, uint32 size, const Array<int64>* positions, String basePath)
+{
+    closePart();
+    MemoryInputStream in(data, size, false);
+    if (!part.readFrom(in))
+        return fail("Invalid part description");
+    if (basePath.isNotEmpty())
+        part.basePath = basePath;
+
+    schema = new ArfSchemaRegistry();
+    part.applySchema(*schema);
+
+    file = new ArfFile();
+    file->initFile(0, part.basePath);
+    file->setSchema(schema);
+    file->setOverview(part.overviewColumns);
+    file->setChunkStats(part.chunkStats);
+    file->setChecksums(part.checksums);
+    file->setPackedSpikes(part.packedSpikes);
+    file->setProfile(part.profile);
+    file->setDirectIO(part.directIO);
+    file->setStaging(part.staging, part.stagingRate);
+    file->setPagedLayout(part.pagedLayout, part.preallocateBytes);
+    file->setCodec(part.codec);
+    if (file->open(part.nChannels))
+    {
+        file = nullptr;
+        return fail("Could not open " + part.basePath + ".arf");
+    }
+    if (positions == nullptr)
+    {
+        file->startNewRecording(part.recordingNumber, part.nChannels, &part.info, part.recordedChanToKWDChan, part.procMap);
+    }
+    else if (!file->attachRecording(part.recordingNumber, part.nChannels, &part.info, positions))
+    {
+        file->close();
+        file = nullptr;
+        return fail("Could not continue recording in " + part.basePath + ".arf");
+    }
+    return true;
+}
+
+void ArfRecordPlayer::closePart()
+{
+    if (file != nullptr)
+    {
+        file->stopRecording();
+        file->close();
+        file = nullptr;
+    }
+}
+
+bool ArfRecordPlayer::isOpen() const
+{
+    return file != nullptr;
+}
+
+bool ArfRecordPlayer::apply(ArfRecord::RecordType type, const char* data, uint32 size)
+{
+    if (file == nullptr)
+        return true;
+    switch (type)
+    {
+    case ArfRecord::RecordData:
+    {
+        const ArfRecord::DataRecord* rec = (const ArfRecord::DataRecord*)data;
+        if (size < sizeof(ArfRecord::DataRecord) || rec->channel < 0 || rec->channel >= part.nChannels
+            || size < sizeof(ArfRecord::DataRecord) + rec->nSamples * sizeof(int16))
+            return fail("Data for channel " + String(rec->channel) + " does not fit the part");
+        file->writeChannel((int16*)(data + sizeof(ArfRecord::DataRecord)), rec->nSamples, rec->channel);
+        samplesWritten += rec->nSamples;
+        break;
+    }
+    case ArfRecord::RecordEvent:
+    {
+        const ArfRecord::EventRecord* rec = (const ArfRecord::EventRecord*)data;
+        if (size < sizeof(ArfRecord::EventRecord) || rec->type < 0 || rec->type >= schema->getNumEventTypes())
+            return fail("Event of type " + String(rec->type) + " does not match the schema");
+        int dataSize = jmin((int)rec->dataSize, (int)(size - sizeof(ArfRecord::EventRecord)));
+        file->writeEvent(rec->type, rec->eventID, rec->nodeID, data + sizeof(ArfRecord::EventRecord), dataSize, rec->timestamp);
+        break;
+    }
+    case ArfRecord::RecordSpike:
+    {
+        const ArfRecord::SpikeRecord* rec = (const ArfRecord::SpikeRecord*)data;
+        if (size < sizeof(ArfRecord::SpikeRecord) || rec->electrode < 0 || rec->electrode >= schema->getNumChannelGroups()
+            || rec->nValues < rec->nSamples * schema->getChannelGroupSize(rec->electrode)
+            || size < sizeof(ArfRecord::SpikeRecord) + rec->nValues * sizeof(uint16))
+            return fail("Spike for electrode " + String(rec->electrode) + " does not match the schema");
+        file->writeSpike(rec->electrode, rec->nSamples, (const uint16*)(data + sizeof(ArfRecord::SpikeRecord)), rec->time);
+        break;
+    }
+    case ArfRecord::RecordAttribute:
+    {
+        MemoryInputStream in(data, size, false);
+        String value = in.readString();
+        String path = in.readString();
+        String name = in.readString();
+        file->setAttributeStr(value, path, name);
+        break;
+    }
+    default:
+        break;
+    }
+    return true;
+}
+
+ArfFile* ArfRecordPlayer::getFile() const
+{
+    return file;
+}
+
+const ArfPartDescription& ArfRecordPlayer::getPart() const
+{
+    return part;
+}
+
+String ArfRecordPlayer::getLastError() const
+{
+    return lastError;
+}
+
+uint64 ArfRecordPlayer::getSamplesWritten() const
+{
+    return samplesWritten;
+}
+
+bool ArfRecordPlayer::fail(String msg)
+{
+    lastError = msg;
+    return false;
+}
@@ -0,0 +1,62 @@
+/*
+ ------------------------------------------------------------------
+
+ Michal Badura, 2016
+ based on code by Florian Franzen, 2014
+
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+#ifndef ARFRECORDPLAYER_H_INCLUDED
+#define ARFRECORDPLAYER_H_INCLUDED
+
+#include "../../RecordEngine/ArfRecordStream.h"
+
+//Applies ArfRecord records to the part file they describe. Used by arf-writer and arf-convert.
+class ArfRecordPlayer
+{
+public:
+    ArfRecordPlayer();
+    ~ArfRecordPlayer();
+
+    //Creates the part file from the data of a RecordOpen record, at BASEPATH if given.
+    //With POSITIONS, continues the recording already in the file (see ArfFile::attachRecording).
+    bool openPart(const char* data, uint32 size, const Array<int64>* positions = nullptr, String basePath = String());
+    void closePart();
+    bool isOpen() const;
+
+    //Applies a data, event, spike or attribute record; false if it does not fit the part.
+    //Records that come while no part is open are ignored.
+    bool apply(ArfRecord::RecordType type, const char* data, uint32 size);
+
+    ArfFile* getFile() const;
+    const ArfPartDescription& getPart() const;
+    String getLastError() const;
+    uint64 getSamplesWritten() const;
+
+private:
+    bool fail(String msg);
+
+    ScopedPointer<ArfFile> file;
+    ScopedPointer<ArfSchemaRegistry> schema;
+    ArfPartDescription part;
+    String lastError;
+    uint64 samplesWritten;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ArfRecordPlayer);
+};
+
+#endif  // ARFRECORDPLAYER_H_INCLUDED